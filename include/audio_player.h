@@ -0,0 +1,126 @@
+#pragma once
+
+#include <Arduino.h>
+#include "board_config.h"
+#include "sample_clock.h"
+
+// Asynchronous WAV playback
+//
+// A dedicated task owns I2S and streams from SD. playWAVFile() only queues a
+// request and returns; a new request replaces the current clip, and
+// stopPlayback() ends it with a short linear fade so a cancelled voice
+// doesn't click.
+//
+// prefetchWAVFile() opens a clip that will probably be played soon and
+// reads its first AUDIO_PREFETCH_SIZE bytes into a staging buffer while the
+// card is otherwise idle (e.g. during a gesture window). A PLAY for the same
+// path then starts from memory and continues from the already open file;
+// anything else simply closes it. While another clip plays, staging is
+// spread over its chunks, one BUFFER_SIZE read each, so it never holds up
+// the DMA ring.
+//
+// A clip can be given a start time, so boards that were sent the same
+// command start it together: the task fills the DMA ring with silence up
+// to that time (see waitForStart()), or skips what it is late by.
+//
+// Boards that start together still drift apart with their sample clocks.
+// Writes that waited for a DMA buffer measure this board's output rate
+// (sample_clock.h), and with drift_correction every clip is resampled so
+// it plays at SAMPLE_RATE in fleet time (audioSetReferenceSkew()).
+
+// I2S pins for MAX98357A (correct GPIO mapping for XIAO ESP32-C3)
+#define I2S_DOUT 21 // D6 -> DIN (GPIO21, not GPIO6)
+#define I2S_BCLK 20 // D7 -> BCLK (GPIO20, not GPIO7)
+#define I2S_LRC 8   // D8 -> LRC (GPIO8)
+
+// I2S configuration
+#define I2S_NUM I2S_NUM_0
+#define SAMPLE_RATE 44100
+#define BITS_PER_SAMPLE I2S_BITS_PER_SAMPLE_16BIT
+#define CHANNEL_FORMAT I2S_CHANNEL_FMT_RIGHT_LEFT
+#define BUFFER_SIZE 1024
+
+#define AUDIO_TASK_STACK 4096
+#define AUDIO_QUEUE_LENGTH 8
+#define AUDIO_PREFETCH_SIZE 8192 // ~46 ms of 44.1 kHz stereo, covers open + first reads
+#define AUDIO_PATH_LEN 72
+#define AUDIO_CANCEL_FADE_MS 8 // Fade used when a speculative voice is cancelled
+#define AUDIO_WAITED_US 100    // A write this long waited for a DMA buffer (one is ~2.9 ms)
+
+// Why a clip was started, press-to-sound latency is tracked per source
+enum PlaybackSource
+{
+  PLAYBACK_REMOTE,      // ESP-NOW command
+  PLAYBACK_RESOLVED,    // Gesture resolved (window or hold elapsed)
+  PLAYBACK_SPECULATIVE, // Started on the first press edge
+  PLAYBACK_SOURCE_COUNT
+};
+
+struct LatencyStats
+{
+  uint32_t count;
+  uint32_t totalMs;
+  uint32_t maxMs;
+};
+
+struct PrefetchStats
+{
+  uint32_t hits;     // PLAY served from the staging buffer
+  uint32_t misses;   // PLAY that had to open the file itself
+  uint32_t discards; // Staged clip never played
+  uint32_t hiddenUs; // SD open/read time taken off the press-to-sound path
+  uint32_t coldUs;   // Open/first read time paid on misses
+};
+
+struct ScheduleStats
+{
+  uint32_t scheduled; // Clips with a start time
+  uint32_t late;      // Started late, the late part skipped
+  int64_t maxLateUs;
+  int64_t lastSlackUs; // Start time minus when the last one was released to DMA
+};
+
+// Install I2S and start the playback task
+bool setupAudio(const BoardConfig *config);
+
+// Queue a clip. triggerMs is the millis() time of the press (or frame) that
+// caused it; latency is measured from there to the first DMA write.
+// startUs: esp_timer_get_time() at which the first sample should play, 0
+// to play as soon as possible.
+void playWAVFile(const char *filename, uint32_t triggerMs = 0,
+                 uint8_t source = PLAYBACK_RESOLVED, int64_t startUs = 0);
+
+// Fade out and stop whatever is playing
+void stopPlayback(uint16_t fadeMs);
+
+// Stage the start of a clip that will probably be played next
+void prefetchWAVFile(const char *filename);
+
+// Drop the staged clip (the gesture resolved to something else)
+void discardPrefetch();
+
+bool audioIsPlaying();
+
+// Commands waiting for the audio task
+uint8_t audioQueueDepth();
+
+// Called on the audio task whenever a clip starts or ends
+typedef void (*AudioStateFn)(bool playing);
+void audioSetStateHook(AudioStateFn hook);
+
+const LatencyStats *playbackLatency(uint8_t source);
+const char *playbackSourceName(uint8_t source);
+const PrefetchStats *playbackPrefetchStats();
+const ScheduleStats *playbackScheduleStats();
+
+// How much faster fleet time runs than our clock (ClockSync skewPpb), 0
+// when not synced; clips are resampled to play at SAMPLE_RATE against it
+void audioSetReferenceSkew(int32_t skewPpb);
+
+// Output rate against our clock (ppb above SAMPLE_RATE), false until
+// RATE_MIN_SPAN_US of playback in one go
+bool playbackOutputPpb(int32_t *ppb);
+const RateStats *playbackRateStats();
+
+// Resampler step the next chunk gets, 0 without drift_correction
+int32_t playbackCorrectionPpb();
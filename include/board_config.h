@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sound_message.h"
+
+// Board configuration (/config.txt)
+//
+// One "key = value" per line, '#' starts a comment. The whole file is read
+// with a single SD read and parsed into BoardConfig; anything not set keeps
+// the compile-time default below. Example:
+//
+//   board_id = 3                # optional, negotiated over ESP-NOW otherwise
+//   button = 6, remote, Red     # gpio, role, name - replaces the default table
+//   button = 9, sound, Green
+//   green_sound = airhorn.wav   # <name>_sound, after the button is declared
+//   green_speculative = on      # play on press, cancel if it becomes a multi-press
+//   gain = 0.8
+//   multi_press_ms = 350        # upper bound when adaptive_multi_press = on
+//   buffer_profile = low_latency
+//   sleep_budget_ms = 100       # light sleep when idle, 0 = stay awake
+//   wire_version = 1            # send legacy frames while older boards remain
+//   reliable_delivery = on      # targets ack, lost frames are retransmitted
+//   unicast = off               # always broadcast, even to boards with a known MAC
+//   peer_rssi = on              # note each board's signal strength (promiscuous mode)
+//   targets = 12, 27+31, all    # multi-press 2x sends to board 12, 3x to 27 and 31,
+//                               # 4x to every board
+//   sync_lead_ms = 100          # boards sent one sound start it together this long
+//                               # after the send, 0 = each as soon as it can
+//   drift_correction = on       # resample clips to the fleet's sample rate
+//
+// The parser has no Arduino dependency so it can be exercised on the host.
+
+#define CONFIG_FILE_PATH "/config.txt"
+#define CONFIG_MAX_FILE_SIZE 2048
+#define CONFIG_SOUND_NAME_LEN 64
+#define CONFIG_BUTTON_NAME_LEN 12
+#define CONFIG_MAX_TARGETS 8
+
+// Default button table (used unless config.txt declares "button" lines)
+#define BUTTON_RED 6     // GPIO6 (D4)
+#define BUTTON_GREEN 9   // GPIO9 (D9)
+#define BUTTON_BLUE 7    // GPIO7 (D5)
+#define BUTTON_YELLOW 10 // GPIO10 (D10)
+#define MAX_BUTTONS 8
+
+// GPIOs no button may use: SD SPI (2-5, main.cpp), I2S (8, 20, 21,
+// audio_player.h), SPI flash (12-17) and USB serial (18, 19)
+#define CONFIG_RESERVED_GPIOS (0x3CUL | 1UL << 8 | 0x3F000UL | 3UL << 18 | 3UL << 20)
+
+// Button timing defaults
+#define DEBOUNCE_DELAY 50
+#define DUAL_PRESS_WINDOW 100
+#define BUTTON_TIMEOUT 5000
+#define LONG_HOLD_DURATION 1000 // 1 second for long hold
+#define MULTI_PRESS_WINDOW 500  // 500ms window for counting multiple presses
+#define SLEEP_BUDGET 0          // Light sleep off unless configured
+#define SYNC_LEAD_MS 100        // Send to synchronized start (clock_sync.h)
+
+#define WIRE_VERSION 2 // ESP-NOW frame format sent (sound_message.h), both are received
+#define UNICAST 1      // Send to learned peer MACs (peer_table.h)
+#define PEER_RSSI 0    // Promiscuous mode hands the CPU every management frame on the channel
+#define DRIFT_CORRECTION 1 // Resample against the output clock's drift (sample_clock.h)
+
+// Software gain control for MAX98357A with 3W @ 4Ω speakers
+// At 3.3V supply: Theoretical max ~2.7W (limited by supply voltage)
+// Software gain set to 1.0 (100%) to maximize loudness
+// Safe: 3.3V supply limits output well below 3W speaker rating
+#define SOFTWARE_GAIN 1.0
+
+// I2S DMA defaults ("balanced" buffer profile)
+#define DMA_BUF_COUNT 16
+#define DMA_BUF_LEN 128
+
+enum ButtonRole
+{
+  BUTTON_ROLE_SOUND,  // Press plays locally, multi-press sends, hold picks random
+  BUTTON_ROLE_REMOTE, // Press sends a random sound to a random board
+};
+
+struct __attribute__((packed)) ButtonConfig
+{
+  uint8_t pin;
+  uint8_t role; // ButtonRole
+  char name[CONFIG_BUTTON_NAME_LEN];
+  char sound[CONFIG_SOUND_NAME_LEN]; // "" = assigned by catalog index
+  uint8_t speculative;               // Start the local sound on the press edge
+};
+
+struct __attribute__((packed)) BoardConfig
+{
+  uint8_t boardId; // 0 = not set in config
+  float gain;
+  uint16_t debounceMs;
+  uint16_t dualPressMs;
+  uint16_t multiPressMs;
+  uint16_t longHoldMs;
+  uint8_t adaptiveMultiPress; // Learn the multi-press window (press_cadence.h)
+  uint16_t sleepBudgetMs;     // Worst-case wake latency when idle (idle_sleep.h)
+  uint16_t syncLeadMs;        // Scheduled start of sounds sent to several boards, 0 = off
+  uint8_t driftCorrection;    // Resample clips to SAMPLE_RATE in fleet time (sample_clock.h)
+  uint8_t wireVersion;        // Frame format to send
+  uint8_t reliableDelivery;   // Ask targets to ack, retransmit (reliable_link.h)
+  uint8_t unicast;            // Send to learned MACs instead of broadcast (peer_table.h)
+  uint8_t peerRssi;           // Note each peer's RSSI from promiscuous mode
+  BoardMask targets[CONFIG_MAX_TARGETS]; // Multi-press targets in press order (dispatch.h)
+  uint8_t targetCount;                 // 0 = press count - 1 is the board
+  uint8_t dmaBufCount;
+  uint16_t dmaBufLen;
+  uint8_t buttonCount;
+  ButtonConfig buttons[MAX_BUTTONS];
+};
+
+typedef void (*ConfigErrorFn)(int line, const char *message);
+
+void setConfigDefaults(BoardConfig *cfg);
+
+// Parse config text into cfg (which should hold defaults). Bad lines are
+// reported through onError with their 1-based line number and skipped.
+// Returns the number of errors.
+int parseConfig(const char *text, size_t len, BoardConfig *cfg, ConfigErrorFn onError);
+
+// A set of boards as written in targets: "all", or board IDs joined by '+'
+// ("12" or "3+5+7"). False if text is neither.
+bool parseBoardSet(const char *text, BoardMask *mask);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Boot-phase profiler
+//
+// Each phase records its start/end in microseconds since reset, and
+// printBootTrace() prints a single summary line once setup() is done.
+
+enum BootPhase
+{
+  BOOT_SERIAL,
+  BOOT_SD,
+  BOOT_CONFIG,
+  BOOT_DISCOVERY,
+  BOOT_I2S,
+  BOOT_RADIO,
+  BOOT_ESPNOW,
+  BOOT_PHASE_COUNT
+};
+
+void bootPhaseStart(BootPhase phase);
+void bootPhaseEnd(BootPhase phase);
+
+// Duration of a finished phase in microseconds, 0 if it never ran
+uint32_t bootPhaseMicros(BootPhase phase);
+uint32_t bootPhaseEndMicros(BootPhase phase);
+
+const char *bootPhaseName(BootPhase phase);
+
+void printBootTrace();
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Arduino.h>
+#include "board_config.h"
+#include "debounce.h"
+
+// Interrupt-driven, table-driven button input
+//
+// Buttons come from the BoardConfig button table. A CHANGE interrupt on each
+// pin pushes (pin, level, timestamp) into a lock-free single-producer/
+// single-consumer ring. The GPIO ISR is the only producer and the loop task
+// the only consumer, so head/tail need no lock. Edges raised while the loop
+// is busy (e.g. streaming audio) stay queued with their original timestamps.
+//
+// The first edge after a drain also posts LOOP_EVENT_BUTTON, so the event
+// loop wakes up only when there is something to read.
+//
+// Each update drains the ring through the debouncer (debounce.h), which
+// keeps the debounced state of all buttons in one bitmask (bit i =
+// buttons[i]). Drained edges go to the input recorder. Gestures are
+// recognized on top of the accepted changes (see gesture.h).
+
+#define BUTTON_EDGE_QUEUE_SIZE 64 // Must be a power of two
+#define BUTTON_MAX_GPIO 22
+
+struct ButtonEdge
+{
+  uint8_t pin;
+  uint8_t level;        // Raw GPIO level, buttons are active LOW
+  uint32_t timestampUs; // micros() at the interrupt
+};
+
+struct ButtonState
+{
+  uint8_t pin;
+  uint8_t role; // ButtonRole
+  const char *name;
+};
+
+// Debounced state change, timestampMs is the edge time on the millis() clock
+typedef void (*ButtonChangeFn)(uint8_t index, bool pressed, uint32_t timestampMs);
+
+extern ButtonState buttons[MAX_BUTTONS];
+extern uint8_t buttonCount;
+extern Debouncer buttonDebouncer; // Debounced state of every button
+
+void initButtons(const BoardConfig *config);
+
+// Drain queued edges and settle finished bounces, reports every accepted
+// change in edge order per button. The whole pass uses one clock reading
+// (nowMs, nowUs), which is what makes a recording replay exactly.
+void updateAllButtons(ButtonChangeFn onChange, uint32_t nowMs, uint32_t nowUs);
+
+// millis() time at which the next mid-bounce button settles, false if none
+bool buttonSettleDeadline(uint32_t *dueMs);
+
+// Mask of every button with the given ButtonRole
+uint32_t buttonRoleMask(uint8_t role);
+
+// Pop the oldest edge, false if the queue is empty
+bool popButtonEdge(ButtonEdge *edge);
+
+// Edges lost because the queue was full
+uint32_t droppedButtonEdges();
+
+// True if no button is pressed or mid-bounce
+bool buttonsIdle();
+
+// Light sleep support (idle_sleep.h). Arming swaps the edge interrupts for
+// level-triggered GPIO wakeup on every button; disarming restores them.
+void armButtonWakeup();
+void disarmButtonWakeup();
+
+// After a GPIO wakeup: the press that woke the chip happened while the edge
+// interrupt was off, so queue an edge for every button now reading pressed
+// but released in the debouncer, stamped with the wake time. Returns how
+// many edges were queued.
+int queueWakeEdges(uint32_t wakeUs);
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Persisted sound catalog (NVS)
+//
+// The sorted list of WAV files is stored in NVS together with a fingerprint
+// of the SD card. On boot the fingerprint is recomputed from the FAT volume
+// serial and a raw walk of the root directory (names, sizes, timestamps - no
+// files are opened), and the stored catalog is reused when it matches.
+
+#define CATALOG_CACHE_NAMESPACE "catalog"
+#define CATALOG_CACHE_VERSION 1
+
+// FATFS logical drive the SD library mounts the card on
+#define SD_FATFS_DRIVE "0:"
+
+// Fingerprint of the card contents, 0 if the volume could not be read.
+// The same directory walk also picks the firstCount alphabetically smallest
+// WAV names into firstSounds, i.e. catalog indices 0..firstCount-1, so the
+// button sounds are known before the full catalog is available.
+uint32_t computeCatalogFingerprint(String *firstSounds = NULL, int firstCount = 0);
+
+// Restore a catalog stored for this fingerprint. Returns false on a miss.
+// scanMs receives how long the full scan took when the cache was built.
+bool loadCatalogCache(uint32_t fingerprint, String *files, int maxFiles,
+                      int *count, uint32_t *scanMs);
+
+// An empty catalog (no WAVs on the card) is stored too, with a zero count
+void saveCatalogCache(uint32_t fingerprint, const String *files, int count,
+                      uint32_t scanMs);
+
+// Force a rescan on next boot (e.g. a cached file failed to open)
+void invalidateCatalogCache();
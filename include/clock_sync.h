@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include "sound_message.h"
+
+// Fleet clock
+//
+// One board, the time master, keeps the fleet's time; every other board
+// estimates the offset from its own microsecond clock to it, NTP style.
+// A board asks its master for the time (TIME_REQUEST with its clock, t1),
+// the master answers with the fleet time the request arrived (t2) and the
+// answer left (t3), and the answer arrives at t4:
+//
+//   offset = ((t2 - t1) + (t3 - t4)) / 2     delay = (t4 - t1) - (t3 - t2)
+//
+// Radio latency varies (retries, a busy channel, light sleep), and only
+// the part that differs between the two directions skews the offset; it
+// can be at most delay / 2. So of the last CLOCK_SAMPLES samples, the one
+// with the shortest delay is used. Crystals differ by tens of ppm, so the
+// fleet clock's rate is learned too, from samples at least
+// CLOCK_SKEW_SPAN_US apart, and the offset is extrapolated with it.
+//
+// Masters announce themselves (SOUND_PRESENCE_TIME_MASTER), boards that
+// follow the fleet's time say so (SOUND_PRESENCE_TIME_SYNCED). A board
+// keeps its master while it is on, else follows the lowest ID that
+// announces itself. With none, the lowest board that follows the fleet's
+// time takes over at once, so the time carries on from its estimate. Only
+// when no board does, the lowest board that can keep time starts a new
+// one, CLOCK_ELECT_MS after boot (longer than heartbeats take, so it
+// doesn't override a fleet it hasn't heard yet). A master yields to a
+// master with a lower ID.
+//
+// Time is passed in, frames go out through the caller; tools/sync_sim
+// runs this code for a whole fleet.
+
+#define CLOCK_SAMPLES 8
+#define CLOCK_MIN_SAMPLES 4          // Before a first estimate is used
+#define CLOCK_FAST_POLL_MS 500       // Until CLOCK_SAMPLES samples were asked for
+#define CLOCK_POLL_MS 2000
+#define CLOCK_ELECT_MS 10000         // Listen this long after boot, over HEARTBEAT_MAX_MS
+#define CLOCK_MAX_DELAY_US 50000     // Longer round trips aren't samples
+#define CLOCK_SKEW_SPAN_US 16000000 // Between samples the rate is learned from
+#define CLOCK_MAX_SKEW_PPB 200000    // Crystals are within +-100 ppm of each other
+#define CLOCK_MAX_REQUESTS 4         // Waiting for an answer from the loop task
+
+struct ClockSample
+{
+  int64_t localUs;  // Midpoint of the exchange, our clock
+  int64_t offsetUs; // Fleet minus local
+  int32_t delayUs;
+};
+
+struct ClockRequest
+{
+  uint8_t board;
+  uint64_t originUs;   // Its clock when it asked
+  int64_t receivedUs;  // Our clock when it arrived
+};
+
+struct ClockStats
+{
+  uint32_t requests;      // Sent
+  uint32_t answered;
+  uint32_t samples;       // Answers from our master
+  uint32_t rejected;      // Answers with a delay over CLOCK_MAX_DELAY_US
+  uint32_t masterChanges;
+};
+
+struct ClockSync
+{
+  uint8_t self;   // Our ID as of the last clockElect()
+  uint8_t master; // Board we take time from, ourselves when we keep it, 0 = none
+  bool synced;    // clockFleetUs() follows the fleet's time
+  int64_t offsetUs; // Fleet minus local at baseUs
+  int64_t baseUs;
+  int32_t baseDelayUs; // Of the sample offsetUs comes from
+  int32_t skewPpb;  // How much faster the fleet clock runs than ours
+  bool rated;       // skewPpb was measured
+  ClockSample samples[CLOCK_SAMPLES];
+  uint8_t sampleCount;
+  uint8_t nextSample;
+  ClockSample anchor; // Where the current rate estimate was measured from
+  bool anchored;
+  BoardMask masters;  // Boards whose last presence announced a master
+  BoardMask timed;    // Boards whose last presence said they follow the fleet's time
+  int64_t leaderlessUs; // Since when we have no master
+  int64_t nextPollUs;
+  uint8_t polls;      // Requests to the current master
+  ClockRequest requests[CLOCK_MAX_REQUESTS];
+  uint8_t requestCount;
+  ClockStats stats;
+};
+
+void clockInit(ClockSync *sync, int64_t nowUs);
+
+// A presence from board arrived (SOUND_PRESENCE_* flags)
+void clockOnPresence(ClockSync *sync, uint8_t board, uint8_t flags);
+
+// Pick the master (see above). alive: other boards that are on;
+// candidates: the ones among them that can keep time. self 0 (no ID yet)
+// never becomes master. Returns the master, 0 if none yet.
+uint8_t clockElect(ClockSync *sync, uint8_t self, BoardMask alive, BoardMask candidates,
+                   int64_t nowUs);
+
+bool clockIsMaster(const ClockSync *sync, uint8_t self);
+
+// True when a TIME_REQUEST should go to sync->master now
+bool clockPollDue(ClockSync *sync, int64_t nowUs);
+
+// When clockElect()/clockPollDue() next have something to do
+int64_t clockNextDeadlineUs(const ClockSync *sync, int64_t nowUs);
+
+// Board asked for the time (originUs its clock), the request arrived at
+// receivedUs (ours). Queued for clockNextRequest(), dropped when the queue
+// is full or we don't follow the fleet's time.
+void clockOnRequest(ClockSync *sync, uint8_t board, uint64_t originUs, int64_t receivedUs);
+
+// Oldest request to answer, false if none. Answer with
+// clockFleetUs(receivedUs) and the fleet time just before sending.
+bool clockNextRequest(ClockSync *sync, ClockRequest *request);
+
+// Board answered: originUs (t1) and arrivedUs (t4) on our clock,
+// receivedUs (t2) and sentUs (t3) fleet time
+void clockOnResponse(ClockSync *sync, uint8_t board, uint64_t originUs, uint64_t receivedUs,
+                     uint64_t sentUs, int64_t arrivedUs);
+
+// Fleet time at our clock's localUs, and back. Only meaningful when synced.
+int64_t clockFleetUs(const ClockSync *sync, int64_t localUs);
+int64_t clockLocalUs(const ClockSync *sync, int64_t fleetUs);
+
+// Fleet time from the low 32 bits of one within 35 minutes of nowUs (ours)
+int64_t clockExpandUs(const ClockSync *sync, uint32_t fleetLow, int64_t nowUs);
+
+// Bound on how far clockFleetUs() is from the master's clock: half the
+// best sample's delay, plus 10 ppm of drift since (100 ppm until the rate
+// is known). 0 for the master, -1 when not synced.
+int32_t clockErrorUs(const ClockSync *sync, int64_t nowUs);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+// Edge-timestamp debouncer
+//
+// Leading-edge debounce on raw (button, level, timestamp) edges: a change is
+// accepted at once unless the button already changed state within the
+// debounce time. A bounce that ends on the other level is accepted once it
+// has been stable for the debounce time (debounceSettle()). All time is
+// passed in, so the same code runs on the device and in the host replayer.
+
+#define DEBOUNCE_MAX_BUTTONS 8
+
+struct DebounceButton
+{
+  bool currentState;     // Debounced state (true = pressed)
+  bool lastState;        // Last raw state seen
+  uint32_t lastEdgeUs;   // Timestamp of the last raw edge
+  uint32_t lastChangeUs; // Timestamp of the last accepted state change
+};
+
+struct Debouncer
+{
+  DebounceButton buttons[DEBOUNCE_MAX_BUTTONS];
+  uint8_t buttonCount;
+  uint32_t debounceUs;
+  uint32_t pressedMask;   // Debounced state of every button
+  uint32_t unsettledMask; // Buttons whose raw level differs from the debounced one
+};
+
+// Accepted change, timestampUs is the edge that caused it
+typedef void (*DebounceChangeFn)(uint8_t index, bool pressed, uint32_t timestampUs);
+
+void debounceInit(Debouncer *debouncer, uint8_t buttonCount, uint32_t debounceUs);
+
+// Initial level, e.g. a button already held at boot (not reported)
+void debounceSetInitial(Debouncer *debouncer, uint8_t index, bool pressed);
+
+void debounceEdge(Debouncer *debouncer, uint8_t index, bool pressed, uint32_t timestampUs,
+                  DebounceChangeFn onChange);
+
+// Accept bounces that have been stable for the debounce time at nowUs.
+// Edges stamped after nowUs (the ISR ran after the clock was read) count
+// as not yet stable.
+void debounceSettle(Debouncer *debouncer, uint32_t nowUs, DebounceChangeFn onChange);
+
+// Microseconds from nowUs until the next mid-bounce button settles (0 if
+// overdue), false if none is pending
+bool debounceNextSettle(const Debouncer *debouncer, uint32_t nowUs, uint32_t *remainingUs);
+
+// Edge time on the millis() clock, given one (millis, micros) reading.
+// Edges may have been queued for a while, or stamped just after the
+// reading, which is then taken as their time.
+inline uint32_t debounceEdgeMillis(uint32_t timestampUs, uint32_t nowMs, uint32_t nowUs)
+{
+  if ((int32_t)(nowUs - timestampUs) < 0)
+    return nowMs;
+  return nowMs - (nowUs - timestampUs) / 1000;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include "frame_dedupe.h"
+#include "gesture.h"
+#include "sound_message.h"
+
+// Gesture and frame dispatch
+//
+// Decides what a gesture or a received frame does, as a short list of
+// actions, without touching audio, the radio or the SD card. The firmware
+// executes the actions (resolving sound names, picking random sounds and
+// boards); the host replayer just prints them. Both run this same code.
+
+#define DISPATCH_MAX_ACTIONS (SOUND_FRAME_MAX_COMMANDS + 1) // A frame's commands and an ack
+#define DISPATCH_MAX_TARGETS 8 // Boards a multi-press can pick from a target list
+
+enum ActionType
+{
+  ACTION_PLAY,             // button's current sound (speculative: on the press edge)
+  ACTION_PREFETCH,         // stage button's current sound
+  ACTION_DISCARD_PREFETCH, // drop the staged sound
+  ACTION_CANCEL,           // fade out button's speculative voice
+  ACTION_PLAY_RANDOM_HOLD, // switch button to a random sound and play it
+  ACTION_PLAY_RANDOM,      // play a random sound
+  ACTION_SEND,             // send button's current sound to targets
+  ACTION_SEND_RANDOM,      // send a random sound to a random board
+  ACTION_REJECT_TARGET,    // multi-press named an invalid board (or this one, 0 = past the list)
+  ACTION_PLAY_REMOTE,      // received play command for this board
+  ACTION_STOP_REMOTE,      // received stop command for this board
+  ACTION_REJECT_FRAME,     // received frame failed validation
+  ACTION_SEND_ACK,         // acknowledge the received frame to its sender
+  ACTION_ACK,              // a board acknowledged one of our frames
+  ACTION_PRESENCE,         // a board announced itself (heartbeat, peer_table.h)
+  ACTION_TIME_REQUEST,     // a board asked us for the fleet time (clock_sync.h)
+  ACTION_TIME_RESPONSE,    // a board answered our time request
+};
+
+struct Action
+{
+  uint8_t type; // ActionType
+  uint8_t button;
+  uint8_t board;       // SEND/REJECT_TARGET: target (SEND: 0 for several), others: sender
+  BoardMask targets;   // SEND: every board to send to, never this one
+  bool speculative;    // PLAY
+  bool together;       // PLAY: part of a send to a set including this board, starts with it
+  bool scheduled;      // PLAY_REMOTE: start at startUs
+  uint32_t startUs;    // PLAY_REMOTE: fleet time, low 32 bits (sound_message.h)
+  uint32_t triggerMs;  // Press (or hold) time the action answers
+  uint16_t fadeMs;     // STOP_REMOTE
+  uint32_t seq;        // SEND_ACK: frame to ack, ACK: frame acked
+  uint8_t presence;    // PRESENCE: SOUND_PRESENCE_* flags
+  uint16_t firmware;   // PRESENCE: sender's firmware version, 0 if unknown
+  uint8_t queueDepth;  // PRESENCE: sender's queued audio commands
+  uint8_t claim;       // PRESENCE: ID an unassigned sender (board 0) claims
+  uint16_t sleepMs;    // PRESENCE: sender's light sleep budget, 0 if it stays awake
+  uint64_t time[3];    // TIME_REQUEST: origin, TIME_RESPONSE: origin, received, sent
+  int32_t drift;       // TIME_REQUEST: sender's output rate (ppb), SOUND_DRIFT_UNKNOWN if not sent
+  const char *sound;   // PLAY_REMOTE: name from the frame
+  const char *reason;  // REJECT_FRAME
+};
+
+struct Dispatcher
+{
+  uint8_t boardId;
+  uint32_t speculativeButtons; // Buttons configured to play on the press edge
+  uint32_t speculativePending; // Current press already started its sound
+  int8_t speculativeVoice;     // Button whose speculative voice is playing, -1 if none
+  uint32_t prefetchPending;    // Button whose sound is staged
+
+  // Multi-press of n sends to board n-1, or with a target list to the
+  // (n-1)th entry on it (a board, a group or every board), which reaches
+  // any ID in as few presses. A chord of three or more sound buttons plays
+  // everywhere. A set that includes this board also plays here.
+  BoardMask targets[DISPATCH_MAX_TARGETS];
+  uint8_t targetCount;
+
+  // Repeated, retransmitted or relayed frames are dropped before they are
+  // validated. v1 frames have no sequence number, a repeat of one has the
+  // same timestamp.
+  DedupeTable dedupe;
+  uint32_t lastLegacyStamp[SOUND_MESSAGE_MAX_BOARD + 1];
+
+  uint8_t heardFrom; // Sender of the last frame if it passed validation, else 0
+  uint8_t staleFrom; // Sender of the last frame if it was dropped as stale, else 0
+  bool accepted;     // The last frame passed validation and wasn't a copy of an earlier one
+};
+
+void dispatchInit(Dispatcher *dispatcher, uint8_t boardId, uint32_t speculativeButtons);
+
+// Multi-press targets, count 0 for the default (press count - 1)
+void dispatchSetTargets(Dispatcher *dispatcher, const BoardMask *targets, uint8_t count);
+
+// Actions for one gesture, returns how many were written (<= DISPATCH_MAX_ACTIONS)
+int dispatchGesture(Dispatcher *dispatcher, const GestureEvent &gesture, Action *actions);
+
+// Actions for one received frame (v1 or v2, see sound_message.h). frame
+// receives the decoded frame and must outlive the actions (PLAY_REMOTE
+// points into it). Frames from a board still claiming its ID skip
+// duplicate suppression; they only carry its presence.
+int dispatchFrame(Dispatcher *dispatcher, const uint8_t *data, int len, uint32_t nowMs,
+                  SoundFrame *frame, Action *actions);
+
+const char *actionTypeName(uint8_t type);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Cooperative event loop
+//
+// The loop task blocks on a FreeRTOS queue until an event is posted (from a
+// task or an ISR) or the earliest armed timer is due, so it sleeps instead
+// of polling. Timers are callbacks with a millis() deadline, one-shot or
+// periodic. They run on the loop task and may only be started/stopped from
+// it; events are the way in from other contexts.
+//
+// An idle hook (idle_sleep.h) may put the chip to sleep instead of
+// blocking. Lazy timers (housekeeping nothing waits for) don't wake it
+// up, they just run late.
+
+#define LOOP_QUEUE_LENGTH 16
+
+enum LoopEventType
+{
+  LOOP_EVENT_BUTTON,   // Edges queued by the button ISR
+  LOOP_EVENT_SEND_ACK, // Ack frame arg to board source (reliable_link.h)
+  LOOP_EVENT_ACK,      // Board source acked our frame arg
+  LOOP_EVENT_PEER,     // Board source was heard from a new MAC or forgotten (peer_table.h)
+  LOOP_EVENT_AUDIO,    // A clip started (arg 1) or ended (arg 0)
+  LOOP_EVENT_CLAIM,    // A frame changed our ID claim, arg = ClaimResult (id_claim.h)
+  LOOP_EVENT_TIME,     // A board asked for the fleet time (clock_sync.h)
+  LOOP_EVENT_CONSOLE,  // Serial input arrived (serial_console.h)
+};
+
+struct LoopEvent
+{
+  uint8_t type;   // LoopEventType
+  uint8_t source; // Board ID for radio events
+  uint32_t arg;
+};
+
+typedef void (*LoopEventFn)(const LoopEvent &event);
+typedef void (*LoopTimerFn)(void *arg);
+
+// Called when the loop has nothing to do for idleMs (UINT32_MAX: no timer
+// armed). Returns how long the loop may block before asking again; 0 after
+// it slept, so whatever woke the chip is handled at once.
+typedef uint32_t (*LoopIdleFn)(uint32_t idleMs);
+
+struct LoopTimer
+{
+  LoopTimerFn fn;
+  void *arg;
+  uint32_t dueMs;
+  uint32_t periodMs; // 0 = one-shot
+  bool armed;
+  bool lazy; // Not worth waking from sleep for
+  LoopTimer *next; // All timers, linked by loopTimerInit()
+};
+
+bool eventLoopInit(LoopEventFn handler);
+
+void eventLoopSetIdleHook(LoopIdleFn hook);
+
+bool eventLoopPost(uint8_t type, uint32_t arg, uint8_t source = 0);
+void eventLoopPostFromISR(uint8_t type, uint32_t arg);
+
+void loopTimerInit(LoopTimer *timer, LoopTimerFn fn, void *arg);
+void loopTimerStartAt(LoopTimer *timer, uint32_t dueMs);
+void loopTimerStartPeriodic(LoopTimer *timer, uint32_t periodMs);
+void loopTimerStop(LoopTimer *timer);
+void loopTimerSetLazy(LoopTimer *timer, bool lazy);
+
+// Earliest armed deadline, false if no timer is armed
+bool loopNextDeadline(uint32_t *dueMs, bool includeLazy = true);
+
+// Block until the next event or timer and dispatch everything that is due
+void eventLoopRunOnce();
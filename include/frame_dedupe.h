@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include "sound_message.h"
+
+// Duplicate frame suppression
+//
+// Every v2 frame carries the sender's boot epoch (a boot counter kept in
+// NVS) and a sequence number that starts over at each boot. Per sender the
+// receiver remembers the newest (epoch, seq) and which of the
+// DEDUPE_WINDOW sequence numbers below it have been seen, so repeats,
+// retransmissions and relayed copies are dropped while frames reordered
+// within the window still get through. A sender that reboots comes back
+// with a higher epoch and starts a fresh window; frames from an older
+// epoch, or too far behind the window, are dropped as stale.
+//
+// The table has an entry for every board ID, so no sender is ever pushed
+// out by others and then let a copy through when it comes back. No Arduino
+// dependency.
+
+#define DEDUPE_WINDOW 32 // Sequence numbers remembered below the newest
+
+enum DedupeResult
+{
+  DEDUPE_NEW,
+  DEDUPE_DUPLICATE,
+  DEDUPE_STALE, // Older epoch, or below the window
+};
+
+struct DedupePeer
+{
+  bool known; // A frame from it was accepted
+  uint32_t epoch;
+  uint32_t newestSeq;
+  uint32_t seenMask; // Bit i = newestSeq - i was accepted
+};
+
+struct DedupeTable
+{
+  DedupePeer peers[SOUND_MESSAGE_MAX_BOARD + 1]; // By sender ID
+  uint32_t duplicates;
+  uint32_t stale;
+};
+
+void dedupeInit(DedupeTable *table);
+
+// Classify a frame without remembering it
+uint8_t dedupeCheck(const DedupeTable *table, uint8_t sender, uint32_t epoch, uint32_t seq);
+
+// Remember a frame that passed validation (dedupeCheck returned DEDUPE_NEW)
+void dedupeAccept(DedupeTable *table, uint8_t sender, uint32_t epoch, uint32_t seq);
+
+// Drop what is known about sender, e.g. when its ID went to another board
+// whose epoch has nothing to do with the old one's
+void dedupeForget(DedupeTable *table, uint8_t sender);
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Gesture recognition
+//
+// One explicit state machine per button plus a chord arbiter. It consumes
+// debounced (button, pressed, timestamp) transitions and emits gesture
+// events. Time is always passed in, so the engine runs unchanged on the host.
+//
+// "Tap" buttons (sound role) recognize:
+//   PRESS      count = number of presses, each within multiPressMs of the
+//              previous one. Emitted multiPressMs after the last press edge,
+//              or at release if that is later (worst case: multiPressMs
+//              after the last press for a release before that).
+//   LONG_HOLD  held for longHoldMs. Emitted exactly longHoldMs after the
+//              press edge; any pending press count is discarded.
+//   CHORD      press edges of two or more tap buttons within dualPressMs of
+//              the first one. Emitted when that window closes (first edge
+//              + dualPressMs). Members' PRESS and LONG_HOLD are held back
+//              while the window is open and discarded when it commits;
+//              members still down stay consumed until released. A press
+//              after the window is an ordinary gesture of its own.
+// Other buttons emit TRIGGER at the press edge.
+//
+// Tap buttons in pressStartMask also emit PRESS_START at every press edge
+// that is not part of a chord, with count = presses so far. The first one
+// lets the caller start (or stage) the local sound immediately; a later one
+// (count 2+) means the gesture is turning into a multi-press. PRESS,
+// LONG_HOLD and CHORD still follow as usual.
+//
+// Deadlines are resolved in gestureTick(); the worst-case latency above is
+// exact when gestureTick() runs at gestureNextDeadline().
+
+#define GESTURE_MAX_BUTTONS 8
+#define GESTURE_QUEUE_SIZE 16 // Must be a power of two
+
+enum GestureType
+{
+  GESTURE_PRESS,
+  GESTURE_LONG_HOLD,
+  GESTURE_CHORD,
+  GESTURE_TRIGGER,
+  GESTURE_PRESS_START,
+};
+
+struct GestureEvent
+{
+  uint8_t type;   // GestureType
+  uint8_t button; // Button index (for CHORD: highest member)
+  uint8_t count;  // PRESS: number of presses
+  uint32_t mask;  // CHORD: member buttons
+  uint32_t timeMs;
+  uint32_t pressMs; // Press edge that started the gesture (first of a multi-press)
+};
+
+enum GestureButtonState
+{
+  GESTURE_IDLE,
+  GESTURE_DOWN,        // Pressed, gesture not decided yet
+  GESTURE_UP_WAIT,     // Released, waiting for another press or the window
+  GESTURE_HELD_LONG,   // Long hold emitted, waiting for release
+  GESTURE_HELD_CHORD,  // Chord member, waiting for release
+};
+
+struct GestureButton
+{
+  uint8_t state; // GestureButtonState
+  uint8_t count;
+  uint32_t pressMs;     // Current press edge
+  uint32_t lastPressMs; // Multi-press window anchor
+  uint32_t firstPressMs; // First press of the current count
+};
+
+struct GestureEngine
+{
+  GestureButton buttons[GESTURE_MAX_BUTTONS];
+  uint8_t buttonCount;
+  uint32_t tapMask; // Buttons with press/long-hold/chord gestures
+  uint32_t pressStartMask; // Tap buttons that also report PRESS_START
+  uint16_t multiPressMs;
+  uint16_t longHoldMs;
+  uint16_t dualPressMs;
+  bool chordOpen;       // Chord window running
+  uint32_t chordMask;   // Buttons pressed inside the window
+  uint32_t chordStartMs;
+  GestureEvent queue[GESTURE_QUEUE_SIZE];
+  uint8_t head;
+  uint8_t tail;
+};
+
+void gestureInit(GestureEngine *engine, uint8_t buttonCount, uint32_t tapMask,
+                 uint16_t multiPressMs, uint16_t longHoldMs, uint16_t dualPressMs);
+
+// Enable PRESS_START events for these tap buttons
+void gestureSetPressStart(GestureEngine *engine, uint32_t pressStartMask);
+
+// Change the multi-press window (e.g. learned from the operator's cadence)
+void gestureSetMultiPressWindow(GestureEngine *engine, uint16_t multiPressMs);
+
+// Debounced transition of one button
+void gestureOnEdge(GestureEngine *engine, uint8_t button, bool pressed, uint32_t nowMs);
+
+// Resolve every deadline that has passed
+void gestureTick(GestureEngine *engine, uint32_t nowMs);
+
+// Earliest time at which gestureTick() has something to resolve, false if
+// every button is idle or waiting for a release
+bool gestureNextDeadline(const GestureEngine *engine, uint32_t *deadlineMs);
+
+// Pop the oldest gesture, false if none
+bool gesturePoll(GestureEngine *engine, GestureEvent *event);
+
+const char *gestureTypeName(uint8_t type);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include "sound_message.h"
+
+// Automatic board IDs
+//
+// A board whose ID isn't set by hand (board_id in config.txt, or an N.txt
+// file) keeps the ID it settled on last time (NVS), or claims one: it
+// sends as SOUND_BOARD_UNASSIGNED, every CLAIM_ANNOUNCE_MS, a PRESENCE
+// naming the lowest ID it hasn't heard from another board. Every board
+// that hears a claim answers with its own presence, so the claimer learns
+// which IDs are taken. A claim nobody contests for CLAIM_SETTLE_MS is
+// taken (and stored); until then the board acts on nothing addressed to
+// it and sends nothing but its claim.
+//
+// Two boards that want the same ID:
+//   - an ID set by hand (SOUND_PRESENCE_FIXED_ID) beats one that isn't
+//   - a board that already holds the ID beats one claiming it
+//   - otherwise the lower MAC keeps it
+// The other one moves to the lowest ID still free and claims again. Both
+// decide from the same facts, so they agree without further messages. Two
+// boards with the same ID set by hand are only reported.
+//
+// A board that was off keeps its ID when it comes back, unless another
+// board took it meanwhile and wins by the rules above.
+//
+// Time and frames are passed in, no Arduino dependency; tools/id_sim runs
+// this code for a whole fleet.
+
+#define CLAIM_ANNOUNCE_MS 250 // Between claim frames
+#define CLAIM_SETTLE_MS 2000  // Claim uncontested this long -> ours
+#define CLAIM_MAC_LEN 6
+
+enum ClaimResult
+{
+  CLAIM_NOTHING,
+  CLAIM_ANSWER,    // Broadcast our presence soon (defends our ID, tells a claimer it's taken)
+  CLAIM_MOVED,     // Lost our ID, claiming another (boardId is 0 until it settles)
+  CLAIM_DUPLICATE, // Another board has our ID set by hand too
+  CLAIM_ANNOUNCE,  // claimPoll: send our claim now
+  CLAIM_SETTLED,   // claimPoll: the claimed ID is ours, store it
+};
+
+struct IdClaim
+{
+  uint8_t mac[CLAIM_MAC_LEN];
+  uint8_t id;         // Ours, or the one being claimed; 0 = every ID is taken
+  bool fixed;         // Set by hand, never moves
+  bool claiming;
+  uint32_t claimStartMs;
+  uint32_t nextAnnounceMs;
+  BoardMask taken;     // IDs heard from other boards
+  BoardMask contested; // Claims lost to another claimer, avoided while others are free
+  uint16_t moves;      // Times an ID had to be given up
+};
+
+// fixedId: from the config or N.txt, storedId: from NVS, 0 = none
+void claimInit(IdClaim *claim, const uint8_t *mac, uint8_t fixedId, uint8_t storedId, uint32_t nowMs);
+
+// The board's ID for frames and commands, 0 while claiming
+uint8_t claimBoardId(const IdClaim *claim);
+
+// SOUND_PRESENCE_* flags and claimed ID for our presence commands
+uint8_t claimPresenceFlags(const IdClaim *claim);
+uint8_t claimPresenceId(const IdClaim *claim);
+
+// A valid frame from board (an assigned one) arrived from mac; fixed when
+// its presence says SOUND_PRESENCE_FIXED_ID, or it sent none (older
+// firmware is numbered by hand). Returns a ClaimResult.
+uint8_t claimOnBoard(IdClaim *claim, uint8_t board, const uint8_t *mac, bool fixed, uint32_t nowMs);
+
+// An unassigned board at mac claims id. Returns a ClaimResult.
+uint8_t claimOnClaim(IdClaim *claim, uint8_t id, const uint8_t *mac, uint32_t nowMs);
+
+// Returns CLAIM_ANNOUNCE or CLAIM_SETTLED when due, else CLAIM_NOTHING
+uint8_t claimPoll(IdClaim *claim, uint32_t nowMs);
+
+// When claimPoll() next has something to do, false when not claiming
+bool claimNextDeadline(const IdClaim *claim, uint32_t *dueMs);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Light sleep while idle
+//
+// When nothing is pending (no input for a while, no audio, no button down)
+// the event loop puts the chip into light sleep instead of blocking. A
+// button press wakes it through GPIO wakeup; the press is queued as an edge
+// stamped with the wake time, so it goes through the normal debounce and
+// gesture path and shows up in the press-to-sound log.
+//
+// The radio can't receive while the chip sleeps, so sleep is cut into
+// slices of (sleep_budget_ms - SLEEP_LISTEN_MS), each followed by at least
+// SLEEP_LISTEN_MS awake. A sleeping board sends its budget in every
+// PRESENCE (sound_message.h), and senders, awake or not, repeat every frame
+// every SLEEP_LISTEN_MS/2 for a full slice of the longest budget among its
+// targets, so one copy always lands in a listen window; receivers drop the
+// extra copies (see dispatch.h). A frame therefore arrives at most its
+// target's sleep_budget_ms late. Until a board has been heard, senders
+// assume it uses their own budget.
+//
+// sleep_budget_ms = 0 (the default) keeps the board awake.
+
+#define SLEEP_LISTEN_MS 20          // Awake after every wakeup, radio listening
+#define SLEEP_ACTIVITY_HOLD_MS 3000 // Stay awake this long after any input
+#define SLEEP_MIN_MS 5              // Not worth sleeping for less
+#define SLEEP_BUSY_POLL_MS 50       // Re-check this often while audio or a button is busy
+
+// ESP32-C3 datasheet supply current, for the estimate in printSleepStats().
+// Nothing on the board measures current; this only weighs the duty cycle.
+#define SLEEP_CURRENT_UA 130    // Light sleep, GPIO and timer wakeup armed
+#define AWAKE_CURRENT_UA 84000 // Awake with the radio receiving
+
+// Install the event loop idle hook. Returns false (and stays awake) if the
+// budget is 0 or too small to leave a sleep slice after the listen window.
+bool idleSleepInit(uint16_t budgetMs);
+
+// Input happened (button, received frame): hold off sleep for a while
+void idleSleepActivity();
+
+// A new frame arrived as the given copy (sound_message.h REPEAT): it came
+// copy * SLEEP_LISTEN_MS/2 later than its first copy was sent
+void idleSleepFrameArrived(uint8_t copy);
+
+// The budget to advertise in PRESENCE, 0 while staying awake
+uint16_t idleSleepBudget();
+
+// How many copies of each outgoing frame to send and how far apart, so a
+// board sleeping with budgetMs hears at least one. 1 if it doesn't sleep.
+uint8_t idleSleepRepeats(uint16_t budgetMs, uint16_t *intervalMs);
+
+void printSleepStats();
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Arduino.h>
+#include "boot_trace.h"
+
+// Concurrent boot initialization
+//
+// Each step runs in its own FreeRTOS task as soon as the steps it depends on
+// have finished, so wall-clock boot approaches the longest dependency chain.
+// A step whose dependency failed is skipped and counts as failed.
+
+#define INIT_DEP(phase) (1UL << (phase))
+#define INIT_TASK_STACK 6144
+
+struct InitStep
+{
+  BootPhase phase;    // Also identifies the step in the boot trace
+  bool (*run)();      // Returns false on failure
+  uint32_t dependsOn; // INIT_DEP() mask of phases that must finish first
+};
+
+// Run all steps and block until every one has finished or been skipped
+void runInitSteps(const InitStep *steps, int count);
+
+bool initStepSucceeded(BootPhase phase);
+
+// Print the chain of steps that bounded the boot time
+void printInitCriticalPath(const InitStep *steps, int count);
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Input recorder
+//
+// Keeps the most recent inputs in a RAM ring so field reports can be
+// reproduced: every button pass (the millis()/micros() reading it ran with
+// and the raw edges it drained), every received ESP-NOW frame and every
+// change of the multi-press window. Records are [type][length][payload],
+// little endian; the oldest are overwritten when the ring is full.
+//
+// "record" on the serial console dumps the ring as hex lines:
+//
+//   === input recording v1 ===
+//   H <RecordingHeader>
+//   R <ring bytes, oldest first, 32 per line>
+//   === end ===
+//
+// tools/replay feeds such a dump through the debouncer, the gesture engine
+// and the dispatcher and prints the resulting actions. The types below are
+// shared with it, so this header has no Arduino dependency.
+
+#define RECORDER_RING_SIZE 8192
+#define RECORDER_MAGIC 0x43455249UL // "IREC"
+#define RECORDER_VERSION 1
+
+enum InputRecordType
+{
+  REC_PASS = 1, // RecPass, followed by the RecEdge records it drained
+  REC_EDGE,     // RecEdge
+  REC_FRAME,    // RecFrame + frame bytes
+  REC_WINDOW,   // RecWindow
+};
+
+struct __attribute__((packed)) RecordingHeader
+{
+  uint32_t magic;
+  uint8_t version;
+  uint8_t boardId;
+  uint8_t buttonCount;
+  uint8_t tapMask;         // Sound role buttons
+  uint8_t speculativeMask; // Buttons that play on the press edge
+  uint16_t debounceMs;
+  uint16_t multiPressMs;   // Window in effect at the oldest record
+  uint16_t longHoldMs;
+  uint16_t dualPressMs;
+  uint32_t dropped;        // Records overwritten since the last clear
+  uint32_t length;         // Ring bytes that follow
+};
+
+struct __attribute__((packed)) RecPass
+{
+  uint32_t nowMs;
+  uint32_t nowUs;
+};
+
+struct __attribute__((packed)) RecEdge
+{
+  uint32_t timestampUs;
+  uint8_t button;
+  uint8_t pressed;
+};
+
+struct __attribute__((packed)) RecFrame
+{
+  uint32_t nowMs;
+};
+
+struct __attribute__((packed)) RecWindow
+{
+  uint16_t oldMs;
+  uint16_t newMs;
+};
+
+// Firmware side (src/input_recorder.cpp)
+
+// Configuration that goes into every dump header
+void recorderBegin(const RecordingHeader *config);
+
+void recordPass(uint32_t nowMs, uint32_t nowUs);
+void recordEdge(uint32_t timestampUs, uint8_t button, bool pressed);
+void recordFrame(uint32_t nowMs, const uint8_t *data, int len);
+void recordWindow(uint16_t oldMs, uint16_t newMs);
+
+void recorderDump();
+void recorderClear();
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdint.h>
+#include "sound_message.h"
+
+// Learned board ID -> MAC address table
+//
+// Every frame that passes validation tells us its sender's MAC. Boards
+// announce themselves with a PRESENCE frame at boot and answer a board
+// they hadn't heard before with one, so peers are usually known before the
+// first command. A frame addressed to one board whose MAC is known and
+// registered with ESP-NOW goes unicast: the radio acks and retries it, and
+// the other boards' radios drop it instead of waking their CPU. Anything
+// else (unknown peers, several targets, announcements) is broadcast as
+// before.
+//
+// A peer whose unicast frames keep failing (moved away, or replaced by a
+// board with another MAC) is forgotten until it is heard from again.
+//
+// Liveness: every board broadcasts a heartbeat (a PRESENCE frame with its
+// firmware version and whether it is playing) unless it broadcast
+// something else recently, at intervals that grow from HEARTBEAT_MIN_MS
+// to HEARTBEAT_MAX_MS after boot. Any valid frame counts as a sign of
+// life. A board not heard from for PEER_ALIVE_MS is taken to be off.
+//
+// Load: a board also broadcasts its presence when it starts or stops
+// playing (at most every PRESENCE_UPDATE_MIN_MS), with how many audio
+// commands are queued. Random targets are then drawn among the boards that
+// are on, idle ones and ones with a strong link (RSSI, no failed unicast)
+// being more likely, so a remote trigger rarely cuts off or queues behind
+// a clip that is still playing.
+//
+// The firmware registers learned MACs with ESP-NOW and marks them
+// routable, and with every heartbeat catches up on any known peer that
+// isn't routable yet; the table itself has no Arduino dependency. ESP-NOW
+// only holds 20 peers, so past PEER_MAX_ROUTABLE the one heard from least
+// recently is unregistered and goes back to broadcast. An entry that is
+// forgotten, evicted or heard from a new MAC keeps the MAC it was
+// registered with until the firmware has deleted it (peerTakeStale), so
+// no registration is left behind to fill ESP-NOW up.
+
+#define PEER_MAC_LEN 6
+#define PEER_MAX_FAILURES 3 // Unicast sends failing in a row before falling back to broadcast
+#define PEER_MAX_ROUTABLE 16 // Below ESP_NOW_MAX_TOTAL_PEER_NUM (20, broadcast included)
+
+#define HEARTBEAT_MIN_MS 1000
+#define HEARTBEAT_MAX_MS 8000
+#define PEER_ALIVE_MS 20000 // Two and a half of the longest heartbeat intervals
+#define PRESENCE_UPDATE_MIN_MS 250 // Between playback state broadcasts
+
+struct PeerEntry
+{
+  bool known;    // mac is valid
+  bool routable; // Registered with ESP-NOW, unicast to it
+  uint8_t mac[PEER_MAC_LEN];
+  bool registered; // registeredMac is registered with ESP-NOW
+  uint8_t registeredMac[PEER_MAC_LEN]; // mac while routable, stale otherwise
+  uint8_t failures; // Unicast sends failed in a row
+  bool heard;       // Any valid frame since boot
+  uint32_t lastHeardMs;
+  int8_t rssi;       // Of the last frame, 0 = unknown
+  uint16_t firmware; // From its heartbeat, 0 = unknown
+  bool busy;         // Playing a sound at its last heartbeat (or just sent one)
+  uint8_t queueDepth; // Audio commands queued at its last heartbeat
+  bool sleepKnown;    // sleepMs is from one of its heartbeats
+  uint16_t sleepMs;   // Its light sleep budget (idle_sleep.h), 0 = stays awake
+  bool driftKnown;    // driftPpb is from one of its time requests
+  int32_t driftPpb;   // Its audio output rate against fleet time (sample_clock.h)
+};
+
+struct PeerStats
+{
+  uint32_t unicast;        // Frames sent unicast
+  uint32_t broadcast;      // Frames sent broadcast
+  uint32_t unicastOk;      // Acked by the target's radio
+  uint32_t unicastFailed;  // Not acked after the radio's retries
+  uint32_t learned;        // New or changed MACs
+  uint32_t forgotten;
+  uint32_t evicted;        // Unregistered to make room for another peer
+  uint32_t unregistered;   // Stale registrations deleted from ESP-NOW
+};
+
+struct PeerTable
+{
+  PeerEntry peers[SOUND_MESSAGE_MAX_BOARD + 1];
+  PeerStats stats;
+  uint32_t startMs;
+};
+
+void peerTableInit(PeerTable *table, uint32_t nowMs);
+
+// A valid frame from board arrived from mac (rssi 0 if not known). Returns
+// true when the board was unknown or its MAC changed; it is then not
+// routable until peerSetRoutable().
+bool peerHeard(PeerTable *table, uint8_t board, const uint8_t *mac, int8_t rssi, uint32_t nowMs);
+
+// board's heartbeat (PRESENCE command) arrived
+void peerPresence(PeerTable *table, uint8_t board, uint8_t flags, uint16_t firmware,
+                  uint8_t queueDepth, uint16_t sleepMs);
+
+// board's time request (clock_sync.h) reported its output drift, or
+// SOUND_DRIFT_UNKNOWN. Only the board keeping the time hears these.
+void peerDrift(PeerTable *table, uint8_t board, int32_t driftPpb);
+
+// A play command was just sent to board: count it as busy until it says
+// otherwise
+void peerMarkBusy(PeerTable *table, uint8_t board);
+
+// Heard from within PEER_ALIVE_MS. A board never heard from counts as
+// alive for PEER_ALIVE_MS after boot, while heartbeats are still coming in.
+bool peerAlive(const PeerTable *table, uint8_t board, uint32_t nowMs);
+
+// Weighted random pick among the boards other than self heard from within
+// PEER_ALIVE_MS (see Load above); random is any 32-bit random number.
+// O(boards), no allocation. Returns 0 when no other board is on.
+uint8_t peerPickTarget(const PeerTable *table, uint8_t self, uint32_t nowMs, uint32_t random);
+
+// Boards other than self heard from within PEER_ALIVE_MS: who answers a
+// frame for every board
+BoardMask peerAliveMask(const PeerTable *table, uint8_t self, uint32_t nowMs);
+
+// Longest light sleep budget among the boards in targetMask (0 = every
+// board alive) other than self, so a frame is repeated long enough for the
+// deepest sleeper to hear it. Boards that haven't told us theirs count as
+// fallbackMs.
+uint16_t peerSleepBudget(const PeerTable *table, BoardMask targetMask, uint8_t self,
+                         uint16_t fallbackMs, uint32_t nowMs);
+
+// mac was registered with ESP-NOW for board. It becomes routable if that
+// is still its MAC; otherwise the registration is stale right away.
+void peerSetRoutable(PeerTable *table, uint8_t board, const uint8_t *mac);
+
+// The routable peer to unregister before registering another, the one
+// heard from least recently; 0 while there is room. Its MAC is forgotten
+// (learned again from its next frame) once this returns it.
+uint8_t peerEvict(PeerTable *table);
+
+// A registration to delete from ESP-NOW: the board (mac filled in) whose
+// entry no longer uses the MAC it was registered with, 0 when there is
+// none left. Counted as deleted once returned. A MAC another routable
+// entry uses (a board that took another ID) is kept.
+uint8_t peerTakeStale(PeerTable *table, uint8_t *mac);
+
+// Where to send a frame addressed to targetMask: true and mac filled in to
+// unicast, false to broadcast. Counts the send.
+bool peerRoute(PeerTable *table, BoardMask targetMask, uint8_t *mac);
+
+// Outcome of a unicast send. Returns the board that was forgotten because
+// of it, 0 otherwise.
+uint8_t peerSendResult(PeerTable *table, const uint8_t *mac, bool ok);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Adaptive multi-press window (NVS)
+//
+// Inter-press intervals of confirmed multi-presses are collected into a
+// histogram per board. The window used by the gesture engine is the
+// CADENCE_PERCENTILE of that histogram plus some headroom, clamped between
+// CADENCE_MIN_WINDOW and the configured multi_press_ms. Presses of the same
+// button that just missed the window (a second single press within
+// multi_press_ms) are counted too, so the window can grow back when it has
+// become too tight.
+
+#define CADENCE_NAMESPACE "cadence"
+#define CADENCE_VERSION 1
+
+#define CADENCE_BUCKET_MS 20
+#define CADENCE_BUCKETS 50     // 0-1000 ms, longer intervals land in the last bucket
+#define CADENCE_MIN_WINDOW 150 // Never tighter than this
+#define CADENCE_MIN_SAMPLES 16 // Keep the configured window until then
+#define CADENCE_PERCENTILE 95
+#define CADENCE_HEADROOM_PCT 25
+#define CADENCE_UPDATE_EVERY 8 // Recompute (and persist) after this many samples
+#define CADENCE_DECAY_TOTAL 1024 // Halve the histogram when it grows past this
+
+// Load the stored histogram. maxWindowMs is the configured multi_press_ms,
+// adaptive = false keeps the window fixed at it.
+void cadenceInit(uint16_t maxWindowMs, bool adaptive);
+
+// Current multi-press window
+uint16_t cadenceWindow();
+
+// Press edge of a tap button (count = presses so far in its gesture).
+// Returns true if the window changed.
+bool cadenceOnPressEdge(uint8_t button, uint8_t count, uint32_t nowMs);
+
+// Forget everything learned, back to the configured window
+void cadenceReset();
+
+void printCadence();
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include "sound_message.h"
+
+// Acknowledged delivery on top of broadcast frames
+//
+// With reliable_delivery = on, commands are sent asking their targets for
+// an ack carrying the frame's sequence number. Frames are kept until every
+// target has acked; the rest are retransmitted (same seq, so receivers
+// drop the copy and just ack again) with exponential backoff plus jitter,
+// and given up after LINK_MAX_ATTEMPTS.
+//
+// The retransmission timeout is learned per target the TCP way (RFC 6298):
+// smoothed RTT plus four times its mean deviation, sampled only from
+// frames acked without a retransmission.
+//
+// Time is passed in and frames go out through a callback, so the same code
+// runs on the device and in tools/link_sim. No Arduino dependency.
+
+#define LINK_MAX_PENDING 4
+#define LINK_MAX_ATTEMPTS 5     // First send included
+#define LINK_INITIAL_RTO_MS 200 // Until a target has been measured
+#define LINK_MIN_RTO_MS 20
+#define LINK_MAX_RTO_MS 2000
+#define LINK_JITTER_DIV 4 // Up to RTO/4 added to every timeout
+
+// targetMask: boards that still haven't acked (bit = board ID)
+typedef void (*LinkSendFn)(const uint8_t *data, int len, BoardMask targetMask);
+
+struct LinkPeer
+{
+  bool measured;
+  int32_t srtt8;   // Smoothed RTT, 1/8 ms
+  int32_t rttvar4; // Mean deviation, 1/4 ms
+  uint32_t rtoMs;
+  uint32_t lastRttMs;
+};
+
+struct LinkDelivery
+{
+  bool active;
+  uint32_t seq;
+  BoardMask waitingMask; // Targets that haven't acked
+  uint8_t attempts;
+  uint32_t firstSentMs;
+  uint32_t dueMs;
+  uint8_t len;
+  uint8_t data[SOUND_FRAME_MAX_LEN];
+};
+
+struct LinkStats
+{
+  uint32_t tracked;       // Deliveries started
+  uint32_t delivered;     // Acked by every target
+  uint32_t failed;        // Given up (or pushed out by newer ones)
+  uint32_t retransmits;
+  uint32_t firstTry;      // Delivered without a retransmission
+};
+
+struct ReliableLink
+{
+  LinkPeer peers[SOUND_MESSAGE_MAX_BOARD + 1];
+  LinkDelivery pending[LINK_MAX_PENDING];
+  LinkStats stats;
+  uint32_t jitterState;
+};
+
+void linkInit(ReliableLink *link, uint32_t seed);
+
+// Start tracking a frame that was just sent. When all slots are busy the
+// oldest delivery is given up.
+void linkTrack(ReliableLink *link, uint32_t seq, BoardMask targetMask,
+               const uint8_t *data, int len, uint32_t nowMs);
+
+// An ack for seq arrived from board
+void linkOnAck(ReliableLink *link, uint8_t board, uint32_t seq, uint32_t nowMs);
+
+// Retransmit or give up whatever is due
+void linkPoll(ReliableLink *link, uint32_t nowMs, LinkSendFn send);
+
+// When linkPoll() next has something to do, false if nothing is pending
+bool linkNextDeadline(const ReliableLink *link, uint32_t *dueMs);
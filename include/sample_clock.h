@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+
+// Output sample clock
+//
+// I2S clocks samples out at the board's crystal divided down to the sample
+// rate, so every board plays a little faster or slower than SAMPLE_RATE:
+// crystals are tens of ppm apart, and the divider rounds. (The C3 has no
+// APLL to fine-tune, so setupI2S() leaves use_apll off.) Boards
+// that started a clip together (clock_sync.h) drift apart by the
+// difference, 20 ppm being over a millisecond a minute.
+//
+// Measurement: the I2S driver hands a DMA buffer back once it has played,
+// so a write that had to wait for one returns just after a buffer
+// boundary. Each such write gives the frames written before the buffer and
+// the time it was taken, never earlier than the boundary. Against the
+// frames at the nominal rate, the earliest of each RATE_WINDOW_US traces
+// the boundaries, and the rate is the slope from the first window of a
+// stretch of playback to the latest, once they are RATE_MIN_SPAN_US apart.
+// A window off the line by more than RATE_GLITCH_US (the ring ran dry and
+// played silence) starts a new stretch. Stretches are averaged by length.
+// The rate is against the board's own clock (esp_timer); with the fleet
+// clock's rate against it (ClockSync skewPpb) it is against fleet time.
+//
+// Compensation: a linear-interpolating resampler stretches the clip by the
+// opposite, so every board plays SAMPLE_RATE frames per second of fleet
+// time. Corrections are tens of ppm: the interpolation point slides by a
+// sample every few seconds.
+//
+// Time is passed in; tools/drift_sim runs this code against simulated DMA
+// boundaries.
+
+#define RATE_WINDOW_US 1000000     // Earliest boundary of each
+#define RATE_MIN_SPAN_US 10000000  // Before a stretch gives a rate
+#define RATE_MAX_WEIGHT_US 600000000 // Past stretches count this long, so warming up comes through
+#define RATE_GLITCH_US 1500        // Off the line by this much: silence was played in between
+#define RATE_MAX_PPB 1000000       // 1000 ppm: anything beyond is a bad measurement
+
+struct RateStats
+{
+  uint32_t stretches; // Long enough to give a rate
+  uint32_t glitches;  // Stretches ended by a jump
+};
+
+struct RateMeter
+{
+  uint32_t sampleRate;
+  // Current stretch: its first window, the last one on the line, and the
+  // one being collected (residual = time minus frames at the nominal rate)
+  bool running;
+  int64_t firstUs;
+  int64_t firstResidualUs;
+  int64_t lastUs;
+  int64_t lastResidualUs;
+  int64_t windowStartUs;
+  int64_t windowUs;
+  int64_t windowResidualUs;
+  bool windowed;
+  int32_t stretchPpb;
+  int64_t stretchSpanUs; // 0 until RATE_MIN_SPAN_US
+  // Earlier stretches combined
+  int32_t ppb;
+  int64_t weightUs;
+  RateStats stats;
+};
+
+void rateMeterInit(RateMeter *meter, uint32_t sampleRate);
+
+// A write waited for a DMA buffer and got it at nowUs, with frames written
+// before it since rateMeterBreak()
+void rateMeterAdd(RateMeter *meter, uint64_t frames, int64_t nowUs);
+
+// Output stopped or restarted: the frame count starts over
+void rateMeterBreak(RateMeter *meter);
+
+// How much faster than the nominal rate the output runs, against our clock,
+// current stretch included. False until a stretch was long enough.
+bool rateMeterPpb(const RateMeter *meter, int32_t *ppb);
+
+#define RESAMPLE_MAX_PPB 1000000 // Step limit, RATE_MAX_PPB plus crystal skew
+
+// Stereo 16-bit linear interpolation with a step of 1 + stepPpb / 1e9
+// input frames per output frame (positive: the clip plays shorter)
+struct Resampler
+{
+  int16_t prev[2];   // Last input frame of the previous call
+  uint64_t position; // Next output frame, 32.32 input frames after prev
+  int32_t stepPpb;
+};
+
+// Start of a clip: silence before it
+void resamplerReset(Resampler *resampler);
+
+// Resample frames input frames into out (room for at least frames + 2).
+// Returns the output frames, which follow on from the previous call.
+int resample(Resampler *resampler, const int16_t *in, int frames, int16_t *out);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Line based serial console
+//
+// Commands are read from Serial without blocking, one per line:
+// "<name> [args]". "help" lists the table passed to consoleBegin().
+// Nothing polls for input: the serial driver calls the input hook when
+// bytes arrive (USB CDC RX event or UART receive callback), and the
+// caller runs consolePoll() in response.
+
+#define CONSOLE_LINE_LEN 64
+
+typedef void (*ConsoleHandler)(const char *args);
+
+struct ConsoleCommand
+{
+  const char *name;
+  const char *help;
+  ConsoleHandler handler;
+};
+
+void consoleBegin(const ConsoleCommand *commands, int count);
+
+// Called on the serial driver's task whenever input arrives
+typedef void (*ConsoleInputFn)();
+void consoleSetInputHook(ConsoleInputFn hook);
+
+// Read pending input, run a command once its line is complete
+void consolePoll();
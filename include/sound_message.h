@@ -0,0 +1,194 @@
+#pragma once
+
+#include <stdint.h>
+
+// ESP-NOW sound commands
+//
+// Sent by broadcast; every board decodes the frame and keeps the commands
+// whose target matches. Pure C++ so the host replayer decodes recorded
+// frames with the same code.
+//
+// Frame v2 (all multi-byte values little endian, varints LEB128: 7 bits per
+// byte, least significant first, high bit set on all but the last byte):
+//
+//   magic 0xB5 | version | sender varint | epoch varint | seq varint
+//   | timestamp varint (ms)
+//   command: type | payload length varint | payload     (repeated)
+//   checksum (8-bit sum of every byte before it)
+//
+//   PLAY      target varint, name length varint, name (no NUL),
+//             [flags varint (SOUND_FLAG_*), [start varint]]
+//   STOP      target varint, fade ms varint, [flags varint]
+//   PRESENCE  flags varint (SOUND_PRESENCE_*), [firmware version varint,
+//             [queued audio commands varint, [claimed ID varint,
+//             [sleep budget ms varint]]]]
+//   ACK       target varint, acknowledged seq varint
+//   PLAY_GROUP targets varint (BoardMask, 0 = every board), then as PLAY
+//   TIME_REQUEST  target varint, origin varint, [drift varint]
+//   TIME_RESPONSE target varint, origin varint, received varint, sent varint
+//   REPEAT    copy number byte (not a varint, so it can be patched in place)
+//
+// start (with SOUND_FLAG_START) is when to start playing, in fleet time
+// (clock_sync.h): the low 32 bits of its microseconds. TIME_REQUEST
+// carries the requester's clock, TIME_RESPONSE echoes it and adds the
+// fleet time the request arrived and the response left (microseconds).
+// drift is how much faster than the nominal rate the requester's audio
+// output runs against fleet time (sample_clock.h), in ppb, zigzag encoded;
+// it is left out until measured.
+//
+// PLAY_GROUP reaches any set of boards with one frame; firmware that
+// predates it skips it like any unknown command.
+//
+// A board without an ID yet sends as SOUND_BOARD_UNASSIGNED, with nothing
+// but a PRESENCE naming the ID it claims (id_claim.h). A board with an ID
+// puts its own there when it goes on to its sleep budget (idle_sleep.h):
+// older decoders reject an ID of 0.
+//
+// epoch counts the sender's boots and seq its frames since boot; receivers
+// drop duplicates by them (frame_dedupe.h). Repeats of a frame (e.g. for
+// boards in light sleep) are sent with the same seq. A frame that will be
+// repeated ends with a REPEAT command numbering the copies from 0, so a
+// receiver can tell how late the first copy it heard was.
+//
+// A decoder skips command types it doesn't know and payload bytes past the
+// fields it knows, so both can be extended without a version bump.
+//
+// Frame v1 is the legacy fixed-size ESPNowMessage (one play command); it is
+// still decoded, and still sent with wire_version = 1, while a fleet is
+// being upgraded.
+
+#define SOUND_MESSAGE_MIN_BOARD 1
+#define SOUND_MESSAGE_MAX_BOARD 63
+#define SOUND_BOARD_UNASSIGNED 0 // v2 sender still claiming an ID
+
+// A set of boards, bit = board ID
+typedef uint64_t BoardMask;
+#define BOARD_BIT(id) ((BoardMask)1 << (id))
+#define BOARD_MASK_ALL (~(BoardMask)0 & ~BOARD_BIT(SOUND_BOARD_UNASSIGNED)) // Every valid ID
+
+#define SOUND_FRAME_MAGIC 0xB5
+#define SOUND_FRAME_VERSION 2
+#define SOUND_FRAME_MAX_LEN 250 // ESP_NOW_MAX_DATA_LEN
+#define SOUND_FRAME_MAX_COMMANDS 8
+#define SOUND_NAME_LEN 64 // Including the NUL
+
+enum SoundCommandType
+{
+  SOUND_CMD_PLAY = 1,
+  SOUND_CMD_STOP,
+  SOUND_CMD_PRESENCE,
+  SOUND_CMD_ACK,
+  SOUND_CMD_PLAY_GROUP,
+  SOUND_CMD_TIME_REQUEST,
+  SOUND_CMD_TIME_RESPONSE,
+  SOUND_CMD_REPEAT,
+};
+
+#define SOUND_PRESENCE_PLAYING 0x01  // Sender is playing a sound
+#define SOUND_PRESENCE_FIXED_ID 0x02 // Sender's ID is set by hand and never moves
+#define SOUND_PRESENCE_TIME_MASTER 0x04 // Sender keeps the fleet's time (clock_sync.h)
+#define SOUND_PRESENCE_TIME_SYNCED 0x08 // Sender follows the fleet's time
+
+#define SOUND_FLAG_ACK 0x01   // Target acks the frame's seq (reliable_link.h)
+#define SOUND_FLAG_START 0x02 // PLAY: a start time follows the flags
+
+#define SOUND_DRIFT_UNKNOWN INT32_MIN // TIME_REQUEST without a drift
+
+// Legacy v1 frame, sent as the raw struct (76 bytes with padding)
+struct ESPNowMessage
+{
+  uint8_t senderBoardId;
+  uint8_t targetBoardId;
+  char soundFile[64];
+  uint32_t timestamp;
+  uint8_t checksum;
+};
+
+struct SoundCommand
+{
+  uint8_t type;   // SoundCommandType
+  uint8_t target; // PLAY, STOP, ACK; PRESENCE: ID an unassigned sender claims
+  BoardMask targets; // Boards the command is for: BOARD_BIT(target), PLAY_GROUP: its set
+  uint8_t flags;  // PLAY, STOP: SOUND_FLAG_*
+  uint32_t start; // PLAY with SOUND_FLAG_START: fleet time, low 32 bits (us)
+  uint16_t fadeMs; // STOP
+  uint16_t firmware; // PRESENCE: sender's firmware version, 0 if not sent
+  uint8_t queueDepth; // PRESENCE: audio commands waiting behind the current clip
+  uint16_t sleepMs;   // PRESENCE: sender's light sleep budget, 0 if it stays awake
+  uint32_t value;  // PRESENCE: flags, ACK: acknowledged seq
+  uint64_t time[3]; // TIME_REQUEST: origin, TIME_RESPONSE: origin, received, sent
+  int32_t drift;    // TIME_REQUEST: sender's output rate (ppb), SOUND_DRIFT_UNKNOWN if not sent
+  char sound[SOUND_NAME_LEN]; // PLAY, PLAY_GROUP
+};
+
+struct SoundFrame
+{
+  uint8_t version; // 1 = legacy ESPNowMessage
+  uint8_t sender;
+  uint32_t epoch; // v2 only
+  uint32_t seq;   // v2 only
+  uint32_t timestamp;
+  uint8_t copy; // v2 with a REPEAT command: which copy this is, otherwise 0
+  uint8_t commandCount;
+  SoundCommand commands[SOUND_FRAME_MAX_COMMANDS];
+};
+
+struct SoundFrameWriter
+{
+  uint8_t *buf;
+  int capacity;
+  int len;
+  uint8_t commandCount;
+  uint8_t sender;
+};
+
+uint8_t calculateChecksum(const ESPNowMessage *msg);
+
+// Copy a received v1 frame into msg. Returns NULL on success, otherwise why
+// the frame was rejected.
+const char *decodeMessage(const uint8_t *data, int len, ESPNowMessage *msg);
+
+// Board ID range and checksum. Returns NULL if valid, otherwise the reason.
+const char *checkMessage(const ESPNowMessage *msg);
+
+// Just the sender, epoch, seq and timestamp of a v1 or v2 frame, so
+// duplicates can be dropped before the rest is looked at. Nothing is
+// validated beyond what reading them needs. Returns NULL on success,
+// otherwise why the frame was rejected.
+const char *decodeFrameHeader(const uint8_t *data, int len, SoundFrame *frame);
+
+// Decode and validate a v1 or v2 frame. Returns NULL on success, otherwise
+// why the frame was rejected. Commands of unknown types are not returned.
+const char *decodeFrame(const uint8_t *data, int len, SoundFrame *frame);
+
+// Build a v2 frame in buf (at most capacity bytes). The add functions
+// return false, leaving the frame as it was, when the command doesn't fit.
+void frameBegin(SoundFrameWriter *writer, uint8_t *buf, int capacity,
+                uint8_t sender, uint32_t epoch, uint32_t seq, uint32_t timestamp);
+// start is only sent with SOUND_FLAG_START in flags
+bool frameAddPlay(SoundFrameWriter *writer, uint8_t target, const char *sound, uint8_t flags = 0,
+                  uint32_t start = 0);
+// targets without bit 0; BOARD_MASK_ALL goes out as 0 (one byte)
+bool frameAddPlayGroup(SoundFrameWriter *writer, BoardMask targets, const char *sound,
+                       uint8_t flags = 0, uint32_t start = 0);
+bool frameAddStop(SoundFrameWriter *writer, uint8_t target, uint16_t fadeMs, uint8_t flags = 0);
+bool frameAddPresence(SoundFrameWriter *writer, uint32_t flags, uint16_t firmware = 0,
+                      uint8_t queueDepth = 0, uint8_t claim = 0, uint16_t sleepMs = 0);
+bool frameAddAck(SoundFrameWriter *writer, uint8_t target, uint32_t seq);
+bool frameAddTimeRequest(SoundFrameWriter *writer, uint8_t target, uint64_t origin,
+                         int32_t drift = SOUND_DRIFT_UNKNOWN);
+bool frameAddTimeResponse(SoundFrameWriter *writer, uint8_t target, uint64_t origin,
+                          uint64_t received, uint64_t sent);
+// Mark the frame as one that will be repeated, as copy 0. Must come last.
+bool frameAddRepeat(SoundFrameWriter *writer);
+
+// Append the checksum, returns the frame length
+int frameFinish(SoundFrameWriter *writer);
+
+// Where the copy number of a finished frame is, -1 if it has no REPEAT
+int frameCopyOffset(const uint8_t *data, int len);
+
+// Renumber a finished frame's copy in place, fixing up the checksum
+void frameSetCopy(uint8_t *data, int len, int offset, uint8_t copy);
+
+const char *soundCommandName(uint8_t type);
@@ -0,0 +1,700 @@
+#include "audio_player.h"
+
+#include <SD.h>
+#include <driver/i2s.h>
+#include <esp_timer.h>
+#include "catalog_cache.h"
+
+enum AudioCommandType
+{
+  AUDIO_PLAY,
+  AUDIO_STOP,
+  AUDIO_PREFETCH,
+  AUDIO_DISCARD,
+};
+
+struct AudioCommand
+{
+  uint8_t type;
+  uint8_t source;
+  uint16_t fadeMs;
+  uint32_t triggerMs;
+  int64_t startUs; // PLAY: esp_timer time the first sample should play, 0 = now
+  char path[AUDIO_PATH_LEN];
+};
+
+static const BoardConfig *audioConfig = NULL;
+static QueueHandle_t audioQueue = NULL;
+static volatile bool playing = false;
+static AudioStateFn stateHook = NULL;
+static LatencyStats latencyStats[PLAYBACK_SOURCE_COUNT];
+static PrefetchStats prefetchStats;
+static ScheduleStats scheduleStats;
+static size_t ringFill = 0; // Bytes written into the DMA buffer being filled
+
+// Output clock (sample_clock.h)
+static RateMeter rateMeter;
+static uint64_t outputBytes = 0; // Written since rateMeterBreak()
+static Resampler resampler;
+static volatile int32_t referenceSkewPpb = 0;
+
+// Staged clip: open file positioned after the staged bytes. While a clip
+// plays it is opened and read one step per chunk (stageMore()).
+static File stagedFile;
+static char stagedPath[AUDIO_PATH_LEN];
+static size_t stagedLength = 0;
+static bool stagedDone = false;   // Staging buffer full or the clip read to its end
+static uint32_t stagedCostUs = 0; // Open + header seek + staging read
+static bool stagingInUse = false; // The playing clip still reads staged bytes
+static uint8_t stagingBuffer[AUDIO_PREFETCH_SIZE];
+
+static uint8_t audioBuffer[BUFFER_SIZE];
+static int16_t processedBuffer[BUFFER_SIZE / 2]; // For 16-bit audio processing
+static int16_t resampledBuffer[BUFFER_SIZE / 2 + 4]; // Two frames more, see resample()
+
+// Audio processing functions
+static int16_t applyVolumeControl(int16_t sample, float volume)
+{
+  // Apply volume scaling with soft limiting to prevent crackling
+  int32_t scaled = (int32_t)(sample * volume);
+
+  // Soft limiting to prevent harsh clipping that causes crackling
+  if (scaled > 28000)
+    scaled = 28000 + (scaled - 28000) / 4;
+  if (scaled < -28000)
+    scaled = -28000 + (scaled + 28000) / 4;
+
+  // Final hard clamp
+  if (scaled > 32767)
+    scaled = 32767;
+  if (scaled < -32768)
+    scaled = -32768;
+
+  return (int16_t)scaled;
+}
+
+static void processAudioBuffer(uint8_t *rawBuffer, int16_t *processedBuffer, size_t bytesRead)
+{
+  // Convert bytes to 16-bit samples and apply volume control
+  size_t sampleCount = bytesRead / 2; // 16-bit = 2 bytes per sample
+
+  for (size_t i = 0; i < sampleCount; i++)
+  {
+    // Convert little-endian bytes to 16-bit sample
+    int16_t sample = (int16_t)(rawBuffer[i * 2] | (rawBuffer[i * 2 + 1] << 8));
+
+    // Apply software gain and limiting
+    processedBuffer[i] = applyVolumeControl(sample, audioConfig->gain);
+  }
+}
+
+// Linear ramp to silence over fadeTotal stereo frames, returns frames left
+static uint32_t applyFade(int16_t *samples, size_t sampleCount, uint32_t fadeLeft, uint32_t fadeTotal)
+{
+  for (size_t i = 0; i + 1 < sampleCount; i += 2)
+  {
+    int32_t gain = fadeLeft > 0 ? fadeLeft - 1 : 0;
+    samples[i] = (int32_t)samples[i] * gain / (int32_t)fadeTotal;
+    samples[i + 1] = (int32_t)samples[i + 1] * gain / (int32_t)fadeTotal;
+    if (fadeLeft > 0)
+      fadeLeft--;
+  }
+  return fadeLeft;
+}
+
+static void recordLatency(const AudioCommand &cmd)
+{
+  if (cmd.triggerMs == 0 || cmd.source >= PLAYBACK_SOURCE_COUNT)
+    return;
+
+  uint32_t latency = millis() - cmd.triggerMs;
+  LatencyStats &stats = latencyStats[cmd.source];
+  stats.count++;
+  stats.totalMs += latency;
+  if (latency > stats.maxMs)
+    stats.maxMs = latency;
+
+  Serial.printf("Press-to-sound: %lu ms (%s, avg %lu ms over %lu)\n", (unsigned long)latency,
+                playbackSourceName(cmd.source), (unsigned long)(stats.totalMs / stats.count),
+                (unsigned long)stats.count);
+}
+
+static bool isWavPath(const char *path)
+{
+  return String(path).endsWith(".wav") || String(path).endsWith(".WAV");
+}
+
+static void dropStaged(bool countDiscard)
+{
+  if (stagedPath[0] == '\0')
+    return;
+  if (stagedFile)
+    stagedFile.close();
+  stagedFile = File();
+  if (countDiscard)
+    prefetchStats.discards++;
+  stagedPath[0] = '\0';
+  stagedLength = 0;
+}
+
+// One step of staging: open the clip, or read up to BUFFER_SIZE more of
+// it. Between two chunks of a playing clip that is about as much SD time
+// as the chunk's own read. False when there is nothing left to do.
+static bool stageMore()
+{
+  if (stagedPath[0] == '\0' || stagedDone || stagingInUse)
+    return false;
+
+  uint32_t start = micros();
+  if (!stagedFile)
+  {
+    stagedFile = SD.open(stagedPath);
+    if (!stagedFile)
+    {
+      dropStaged(false); // The PLAY (if any) reports the failure
+      return false;
+    }
+    if (isWavPath(stagedPath))
+      stagedFile.seek(44);
+  }
+  else
+  {
+    size_t want = min((size_t)BUFFER_SIZE, (size_t)AUDIO_PREFETCH_SIZE - stagedLength);
+    size_t got = stagedFile.read(stagingBuffer + stagedLength, want);
+    stagedLength += got;
+    stagedDone = got < want || stagedLength == AUDIO_PREFETCH_SIZE;
+  }
+  stagedCostUs += micros() - start;
+  return !stagedDone;
+}
+
+// Stage at once when idle; during playback streamFile() calls stageMore()
+// after every chunk, so the DMA ring never waits for the whole 8 KB
+static void stageClip(const char *path)
+{
+  if (strcmp(path, stagedPath) == 0)
+    return; // Already staged
+  dropStaged(true);
+
+  strncpy(stagedPath, path, sizeof(stagedPath) - 1);
+  stagedPath[sizeof(stagedPath) - 1] = '\0';
+  stagedLength = 0;
+  stagedDone = false;
+  stagedCostUs = 0;
+  if (!playing)
+  {
+    while (stageMore())
+      ;
+  }
+}
+
+// Handle commands that don't affect the clip being played
+static bool handleSideCommand(const AudioCommand &cmd)
+{
+  if (cmd.type == AUDIO_PREFETCH)
+  {
+    stageClip(cmd.path);
+    return true;
+  }
+  if (cmd.type == AUDIO_DISCARD)
+  {
+    dropStaged(true);
+    return true;
+  }
+  // Another board may ask for a clip this card doesn't have: ignore it
+  // rather than cut off the current one. Checked here, since this task
+  // owns the SD card.
+  if (cmd.type == AUDIO_PLAY && cmd.source == PLAYBACK_REMOTE && !SD.exists(cmd.path))
+  {
+    Serial.printf("File not found: %s\n", cmd.path);
+    return true;
+  }
+  return false;
+}
+
+// i2s_write() that keeps track of where in its DMA buffer the write
+// position is, which the driver doesn't tell. A write that waited for a
+// buffer times the output clock: the last buffer it took was handed back
+// at a boundary, just before the write returned.
+static esp_err_t writeOutput(const void *data, size_t bytes, size_t *written, TickType_t wait)
+{
+  size_t bufferBytes = (size_t)audioConfig->dmaBufLen * 4;
+  int64_t beforeUs = esp_timer_get_time();
+  esp_err_t result = i2s_write(I2S_NUM, data, bytes, written, wait);
+  int64_t nowUs = esp_timer_get_time();
+
+  uint64_t startBytes = outputBytes;
+  outputBytes += *written;
+  ringFill = (ringFill + *written) % bufferBytes;
+  uint64_t takenAt = outputBytes - (ringFill ? ringFill : bufferBytes);
+  if (*written && takenAt >= startBytes && nowUs - beforeUs >= AUDIO_WAITED_US)
+    rateMeterAdd(&rateMeter, takenAt / 4, nowUs);
+  return result;
+}
+
+// Output stopped or starts over (sample_clock.h)
+static void breakOutput()
+{
+  rateMeterBreak(&rateMeter);
+  outputBytes = 0;
+  resamplerReset(&resampler);
+}
+
+// Resampler step: play SAMPLE_RATE frames per second of fleet time. Before
+// the output was measured, that still takes out our crystal's part.
+static int32_t correctionPpb()
+{
+  int32_t ppb = 0;
+  rateMeterPpb(&rateMeter, &ppb);
+  return referenceSkewPpb - ppb;
+}
+
+static bool writeSilence(size_t bytes)
+{
+  memset(processedBuffer, 0, sizeof(processedBuffer));
+  while (bytes > 0)
+  {
+    size_t written;
+    if (writeOutput(processedBuffer, min(bytes, sizeof(processedBuffer)), &written,
+                    pdMS_TO_TICKS(100)) != ESP_OK ||
+        written == 0)
+      return false;
+    bytes -= written;
+  }
+  return true;
+}
+
+// Microseconds DMA buffers take to play
+static int64_t bufferUs(int64_t buffers)
+{
+  return buffers * audioConfig->dmaBufLen * 1000000LL / SAMPLE_RATE;
+}
+
+// Hold back a scheduled clip until cmd.startUs
+//
+// The legacy driver hands i2s_write() a DMA buffer back as soon as the
+// buffer has played (tx_desc_auto_clear zeroes it), and that buffer plays
+// again after the dmaBufCount - 1 others. So with the ring kept full of
+// silence one buffer at a time, a write that had to wait returns right
+// after a buffer boundary, and the buffer written next starts playing
+// dmaBufCount buffers later. Wake-up latency only delays a return, so the
+// earliest boundary seen (buffers at the sample clock counted from it) is
+// the estimate. Once the start falls within the next buffer, it gets the
+// silence up to the start and the clip follows.
+//
+// Returns the frames the clip starts late (to skip), -1 when a command
+// arrived first (stored in next when it is a PLAY, interrupted set).
+static int32_t waitForStart(const AudioCommand &cmd, AudioCommand *next, bool *interrupted)
+{
+  size_t bufferBytes = (size_t)audioConfig->dmaBufLen * 4;
+  int64_t phaseUs = INT64_MAX; // Earliest boundary, minus bufferUs(boundaries since)
+  int64_t boundaries = 0;
+  int32_t lateFrames = 0;
+
+  scheduleStats.scheduled++;
+  i2s_zero_dma_buffer(I2S_NUM);
+  ringFill = (ringFill + 3) & ~(size_t)3;
+  if (ringFill && !writeSilence(bufferBytes - ringFill))
+    return 0;
+
+  for (;;)
+  {
+    AudioCommand incoming;
+    if (xQueueReceive(audioQueue, &incoming, 0) == pdTRUE && !handleSideCommand(incoming))
+    {
+      if (incoming.type == AUDIO_PLAY)
+      {
+        *next = incoming;
+        *interrupted = true;
+      }
+      return -1;
+    }
+
+    int64_t beforeUs = esp_timer_get_time();
+    if (!writeSilence(bufferBytes))
+      return 0;
+    int64_t nowUs = esp_timer_get_time();
+    if (boundaries == 0 && nowUs - beforeUs < bufferUs(1) / 2)
+      continue; // The ring wasn't full yet
+
+    // From then on every buffer written was freed at a boundary, at the
+    // latest when the write returned
+    int64_t boundaryUs = nowUs - bufferUs(boundaries);
+    if (boundaryUs < phaseUs)
+      phaseUs = boundaryUs;
+    int64_t nextPlaysUs = phaseUs + bufferUs(boundaries + audioConfig->dmaBufCount);
+    boundaries++;
+    if (cmd.startUs >= nextPlaysUs + bufferUs(1))
+      continue;
+
+    int64_t leadUs = cmd.startUs - nextPlaysUs;
+    if (leadUs < 0)
+    {
+      lateFrames = -leadUs * SAMPLE_RATE / 1000000;
+      scheduleStats.late++;
+      if (-leadUs > scheduleStats.maxLateUs)
+        scheduleStats.maxLateUs = -leadUs;
+    }
+    else if (!writeSilence((size_t)(leadUs * SAMPLE_RATE / 1000000) * 4))
+    {
+      return 0;
+    }
+    scheduleStats.lastSlackUs = cmd.startUs - nowUs;
+    return lateFrames;
+  }
+}
+
+// Stream one clip. Returns true if a new PLAY interrupted it (stored in next).
+static bool streamFile(const AudioCommand &cmd, AudioCommand *next)
+{
+  File audioFile;
+  size_t stagedPos = 0;
+  size_t stagedEnd = 0;
+  uint32_t openStartUs = micros();
+
+  if (stagedPath[0] != '\0' && strcmp(cmd.path, stagedPath) == 0 && stagedFile)
+  {
+    // Start from memory, the file is already open past the staged bytes
+    audioFile = stagedFile;
+    stagedFile = File();
+    stagedPath[0] = '\0';
+    stagedEnd = stagedLength;
+    stagingInUse = stagedEnd > 0;
+    prefetchStats.hits++;
+    prefetchStats.hiddenUs += stagedCostUs;
+    Serial.printf("Prefetch hit: %s (hid %lu us of SD open/read, %lu/%lu hits)\n", cmd.path,
+                  (unsigned long)stagedCostUs, (unsigned long)prefetchStats.hits,
+                  (unsigned long)(prefetchStats.hits + prefetchStats.misses));
+  }
+  else
+  {
+    dropStaged(strcmp(cmd.path, stagedPath) != 0); // Not opened yet counts as a miss
+    audioFile = SD.open(cmd.path);
+    if (!audioFile)
+    {
+      Serial.printf("Failed to open: %s\n", cmd.path);
+      invalidateCatalogCache(); // Catalog is stale, rescan on next boot
+      return false;
+    }
+
+    // Skip WAV header (44 bytes for standard WAV)
+    if (isWavPath(cmd.path))
+    {
+      audioFile.seek(44);
+    }
+    prefetchStats.misses++;
+  }
+
+  Serial.printf("Playing: %s (%d bytes)\n", cmd.path, audioFile.size());
+  playing = true;
+  if (stateHook)
+    stateHook(true);
+
+  size_t bytesRead, bytesWritten;
+  bool firstWrite = true;
+  breakOutput();
+  bool interrupted = false;
+  uint32_t fadeTotal = 0;
+  uint32_t fadeLeft = 0;
+
+  if (cmd.startUs)
+  {
+    int32_t lateFrames = waitForStart(cmd, next, &interrupted);
+    if (lateFrames < 0)
+    {
+      // Stopped or replaced before it started
+      audioFile.close();
+      stagingInUse = false;
+      playing = false;
+      if (stateHook)
+        stateHook(false);
+      return interrupted;
+    }
+    // Catch up with the boards that started on time
+    size_t skip = (size_t)lateFrames * 4;
+    size_t fromStage = min(skip, stagedEnd - stagedPos);
+    stagedPos += fromStage;
+    stagingInUse = stagedPos < stagedEnd;
+    if (skip > fromStage)
+      audioFile.seek(audioFile.position() + skip - fromStage);
+  }
+
+  while (stagedPos < stagedEnd || audioFile.available())
+  {
+    // Pick up stop/replace requests between chunks
+    AudioCommand incoming;
+    if (fadeTotal == 0 && xQueueReceive(audioQueue, &incoming, 0) == pdTRUE &&
+        !handleSideCommand(incoming))
+    {
+      if (incoming.type == AUDIO_PLAY)
+      {
+        *next = incoming;
+        interrupted = true;
+        break;
+      }
+      fadeTotal = fadeLeft = max((uint32_t)1, (uint32_t)incoming.fadeMs * SAMPLE_RATE / 1000);
+    }
+
+    uint8_t *chunk = audioBuffer;
+    if (stagedPos < stagedEnd)
+    {
+      chunk = stagingBuffer + stagedPos;
+      bytesRead = min((size_t)BUFFER_SIZE, stagedEnd - stagedPos);
+      stagedPos += bytesRead;
+      // Processed below, before the staging buffer can be reused
+      stagingInUse = stagedPos < stagedEnd;
+    }
+    else
+    {
+      bytesRead = audioFile.read(audioBuffer, BUFFER_SIZE);
+    }
+
+    if (bytesRead > 0)
+    {
+      processAudioBuffer(chunk, processedBuffer, bytesRead);
+      if (fadeTotal > 0)
+      {
+        fadeLeft = applyFade(processedBuffer, bytesRead / 2, fadeLeft, fadeTotal);
+      }
+
+      const int16_t *output = processedBuffer;
+      size_t outputLen = bytesRead;
+      if (audioConfig->driftCorrection)
+      {
+        resampler.stepPpb = correctionPpb();
+        output = resampledBuffer;
+        outputLen = resample(&resampler, processedBuffer, bytesRead / 4, resampledBuffer) * 4;
+      }
+
+      esp_err_t result = writeOutput(output, outputLen, &bytesWritten, pdMS_TO_TICKS(100));
+      if (result != ESP_OK)
+      {
+        Serial.printf("I2S write error: %s\n", esp_err_to_name(result));
+        break;
+      }
+
+      if (firstWrite)
+      {
+        if (stagedEnd == 0)
+          prefetchStats.coldUs += micros() - openStartUs;
+        recordLatency(cmd);
+        firstWrite = false;
+      }
+
+      if (bytesWritten < outputLen)
+      {
+        taskYIELD();
+      }
+      stageMore();
+
+      if (fadeTotal > 0 && fadeLeft == 0)
+      {
+        Serial.printf("Stopped: %s\n", cmd.path);
+        break;
+      }
+    }
+  }
+
+  audioFile.close();
+  stagingInUse = false;
+  breakOutput();
+  if (fadeTotal > 0)
+  {
+    // Don't let the tail of the DMA ring replay un-faded audio
+    i2s_zero_dma_buffer(I2S_NUM);
+  }
+  playing = false;
+  if (stateHook)
+    stateHook(false);
+  if (!interrupted)
+    Serial.println("Playback completed");
+  return interrupted;
+}
+
+static void audioTask(void *param)
+{
+  AudioCommand cmd;
+  bool pending = false;
+
+  for (;;)
+  {
+    if (!pending && xQueueReceive(audioQueue, &cmd, portMAX_DELAY) != pdTRUE)
+      continue;
+
+    if (handleSideCommand(cmd))
+    {
+      pending = false;
+      continue;
+    }
+
+    // A stop with nothing playing is a no-op
+    if (cmd.type != AUDIO_PLAY)
+    {
+      pending = false;
+      continue;
+    }
+
+    AudioCommand next;
+    pending = streamFile(cmd, &next);
+    if (pending)
+      cmd = next;
+  }
+}
+
+static bool setupI2S()
+{
+  // Uninstall any existing I2S driver
+  i2s_driver_uninstall(I2S_NUM);
+
+  i2s_config_t i2s_config = {
+      .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),
+      .sample_rate = SAMPLE_RATE,
+      .bits_per_sample = BITS_PER_SAMPLE,
+      .channel_format = CHANNEL_FORMAT,
+      .communication_format = I2S_COMM_FORMAT_STAND_I2S,
+      .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
+      .dma_buf_count = audioConfig->dmaBufCount,
+      .dma_buf_len = audioConfig->dmaBufLen,
+      .use_apll = false, // No APLL on the C3 (sample_clock.h)
+      .tx_desc_auto_clear = true,
+      .fixed_mclk = 0};
+
+  i2s_pin_config_t pin_config = {
+      .bck_io_num = I2S_BCLK,
+      .ws_io_num = I2S_LRC,
+      .data_out_num = I2S_DOUT,
+      .data_in_num = I2S_PIN_NO_CHANGE};
+
+  esp_err_t err = i2s_driver_install(I2S_NUM, &i2s_config, 0, NULL);
+  if (err != ESP_OK)
+  {
+    Serial.printf("I2S driver install failed: %s\n", esp_err_to_name(err));
+    return false;
+  }
+
+  err = i2s_set_pin(I2S_NUM, &pin_config);
+  if (err != ESP_OK)
+  {
+    Serial.printf("I2S pin config failed: %s\n", esp_err_to_name(err));
+    return false;
+  }
+
+  i2s_zero_dma_buffer(I2S_NUM);
+  Serial.println("I2S initialized successfully");
+  return true;
+}
+
+bool setupAudio(const BoardConfig *config)
+{
+  audioConfig = config;
+  rateMeterInit(&rateMeter, SAMPLE_RATE);
+  if (!setupI2S())
+    return false;
+
+  audioQueue = xQueueCreate(AUDIO_QUEUE_LENGTH, sizeof(AudioCommand));
+  if (!audioQueue ||
+      xTaskCreate(audioTask, "audio", AUDIO_TASK_STACK, NULL, 3, NULL) != pdPASS)
+  {
+    Serial.println("Failed to start audio task");
+    return false;
+  }
+  return true;
+}
+
+void playWAVFile(const char *filename, uint32_t triggerMs, uint8_t source, int64_t startUs)
+{
+  AudioCommand cmd = {};
+  cmd.type = AUDIO_PLAY;
+  cmd.source = source;
+  cmd.triggerMs = triggerMs;
+  cmd.startUs = startUs;
+  strncpy(cmd.path, filename, sizeof(cmd.path) - 1);
+
+  if (!audioQueue || xQueueSend(audioQueue, &cmd, 0) != pdTRUE)
+  {
+    Serial.printf("Audio queue full, dropping %s\n", filename);
+  }
+}
+
+void stopPlayback(uint16_t fadeMs)
+{
+  AudioCommand cmd = {};
+  cmd.type = AUDIO_STOP;
+  cmd.fadeMs = fadeMs;
+  if (audioQueue)
+    xQueueSend(audioQueue, &cmd, 0);
+}
+
+void prefetchWAVFile(const char *filename)
+{
+  AudioCommand cmd = {};
+  cmd.type = AUDIO_PREFETCH;
+  strncpy(cmd.path, filename, sizeof(cmd.path) - 1);
+  if (audioQueue)
+    xQueueSend(audioQueue, &cmd, 0); // Only a hint, fine to drop
+}
+
+void discardPrefetch()
+{
+  AudioCommand cmd = {};
+  cmd.type = AUDIO_DISCARD;
+  if (audioQueue)
+    xQueueSend(audioQueue, &cmd, 0);
+}
+
+bool audioIsPlaying()
+{
+  // A queued command is about to play (or stop) something too
+  return playing || (audioQueue && uxQueueMessagesWaiting(audioQueue) > 0);
+}
+
+uint8_t audioQueueDepth()
+{
+  return audioQueue ? uxQueueMessagesWaiting(audioQueue) : 0;
+}
+
+void audioSetStateHook(AudioStateFn hook)
+{
+  stateHook = hook;
+}
+
+const LatencyStats *playbackLatency(uint8_t source)
+{
+  return &latencyStats[source];
+}
+
+const PrefetchStats *playbackPrefetchStats()
+{
+  return &prefetchStats;
+}
+
+const ScheduleStats *playbackScheduleStats()
+{
+  return &scheduleStats;
+}
+
+void audioSetReferenceSkew(int32_t skewPpb)
+{
+  referenceSkewPpb = skewPpb;
+}
+
+bool playbackOutputPpb(int32_t *ppb)
+{
+  return rateMeterPpb(&rateMeter, ppb);
+}
+
+const RateStats *playbackRateStats()
+{
+  return &rateMeter.stats;
+}
+
+int32_t playbackCorrectionPpb()
+{
+  return audioConfig && audioConfig->driftCorrection ? correctionPpb() : 0;
+}
+
+const char *playbackSourceName(uint8_t source)
+{
+  static const char *names[PLAYBACK_SOURCE_COUNT] = {"remote", "resolved", "speculative"};
+  return source < PLAYBACK_SOURCE_COUNT ? names[source] : "?";
+}
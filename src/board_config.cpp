@@ -0,0 +1,424 @@
+#include "board_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "sound_message.h"
+
+struct BufferProfile
+{
+  const char *name;
+  uint8_t dmaBufCount;
+  uint16_t dmaBufLen;
+};
+
+// Latency vs underrun tolerance while the SD card is busy
+static const BufferProfile bufferProfiles[] = {
+    {"low_latency", 8, 64},
+    {"balanced", DMA_BUF_COUNT, DMA_BUF_LEN},
+    {"robust", 32, 256},
+};
+
+struct TimingSetting
+{
+  const char *key;
+  size_t offset; // uint16_t field in BoardConfig
+  long minValue;
+  long maxValue;
+};
+
+static const TimingSetting timingSettings[] = {
+    {"debounce_ms", offsetof(BoardConfig, debounceMs), 1, 500},
+    {"dual_press_ms", offsetof(BoardConfig, dualPressMs), 10, 1000},
+    {"multi_press_ms", offsetof(BoardConfig, multiPressMs), 50, 2000},
+    {"long_hold_ms", offsetof(BoardConfig, longHoldMs), 200, 10000},
+    {"sleep_budget_ms", offsetof(BoardConfig, sleepBudgetMs), 0, 2000},
+    {"sync_lead_ms", offsetof(BoardConfig, syncLeadMs), 0, 1000},
+};
+
+// On/off keys, each a uint8_t field in BoardConfig
+struct SwitchSetting
+{
+  const char *key;
+  size_t offset;
+};
+
+static const SwitchSetting switchSettings[] = {
+    {"adaptive_multi_press", offsetof(BoardConfig, adaptiveMultiPress)},
+    {"reliable_delivery", offsetof(BoardConfig, reliableDelivery)},
+    {"unicast", offsetof(BoardConfig, unicast)},
+    {"peer_rssi", offsetof(BoardConfig, peerRssi)},
+    {"drift_correction", offsetof(BoardConfig, driftCorrection)},
+};
+
+static const ButtonConfig defaultButtons[] = {
+    {BUTTON_RED, BUTTON_ROLE_REMOTE, "Red", ""},
+    {BUTTON_GREEN, BUTTON_ROLE_SOUND, "Green", ""},
+    {BUTTON_BLUE, BUTTON_ROLE_SOUND, "Blue", ""},
+    {BUTTON_YELLOW, BUTTON_ROLE_SOUND, "Yellow", ""},
+};
+
+void setConfigDefaults(BoardConfig *cfg)
+{
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->gain = SOFTWARE_GAIN;
+  cfg->debounceMs = DEBOUNCE_DELAY;
+  cfg->dualPressMs = DUAL_PRESS_WINDOW;
+  cfg->multiPressMs = MULTI_PRESS_WINDOW;
+  cfg->longHoldMs = LONG_HOLD_DURATION;
+  cfg->adaptiveMultiPress = 1;
+  cfg->sleepBudgetMs = SLEEP_BUDGET;
+  cfg->syncLeadMs = SYNC_LEAD_MS;
+  cfg->driftCorrection = DRIFT_CORRECTION;
+  cfg->wireVersion = WIRE_VERSION;
+  cfg->unicast = UNICAST;
+  cfg->peerRssi = PEER_RSSI;
+  cfg->dmaBufCount = DMA_BUF_COUNT;
+  cfg->dmaBufLen = DMA_BUF_LEN;
+  cfg->buttonCount = sizeof(defaultButtons) / sizeof(defaultButtons[0]);
+  memcpy(cfg->buttons, defaultButtons, sizeof(defaultButtons));
+}
+
+static ButtonConfig *findButton(BoardConfig *cfg, const char *name, size_t nameLen)
+{
+  for (int i = 0; i < cfg->buttonCount; i++)
+  {
+    if (strlen(cfg->buttons[i].name) == nameLen &&
+        strncasecmp(cfg->buttons[i].name, name, nameLen) == 0)
+      return &cfg->buttons[i];
+  }
+  return NULL;
+}
+
+// "button = <gpio>, <sound|remote>, <name>"
+static const char *parseButton(char *value, BoardConfig *cfg, bool *customButtons)
+{
+  // The first button line replaces the whole default table
+  if (!*customButtons)
+  {
+    cfg->buttonCount = 0;
+    *customButtons = true;
+  }
+  if (cfg->buttonCount >= MAX_BUTTONS)
+    return "too many buttons";
+
+  char *fields[3];
+  int fieldCount = 0;
+  for (char *field = strtok(value, ","); field && fieldCount < 3; field = strtok(NULL, ","))
+  {
+    while (*field == ' ' || *field == '\t')
+      field++;
+    char *end = field + strlen(field);
+    while (end > field && (end[-1] == ' ' || end[-1] == '\t'))
+      *--end = '\0';
+    fields[fieldCount++] = field;
+  }
+  if (fieldCount != 3)
+    return "expected button = gpio, role, name";
+
+  char *end;
+  long pin = strtol(fields[0], &end, 10);
+  if (end == fields[0] || *end != '\0' || pin < 0 || pin > 21)
+    return "button gpio must be 0-21";
+  if (CONFIG_RESERVED_GPIOS & (1UL << pin))
+    return "button gpio is used by the SD card, I2S, flash or USB";
+
+  ButtonConfig button = {};
+  button.pin = pin;
+  if (strcmp(fields[1], "sound") == 0)
+    button.role = BUTTON_ROLE_SOUND;
+  else if (strcmp(fields[1], "remote") == 0)
+    button.role = BUTTON_ROLE_REMOTE;
+  else
+    return "button role must be sound or remote";
+
+  if (fields[2][0] == '\0' || strlen(fields[2]) >= CONFIG_BUTTON_NAME_LEN)
+    return "button name empty or too long";
+  if (findButton(cfg, fields[2], strlen(fields[2])))
+    return "duplicate button name";
+  for (int i = 0; i < cfg->buttonCount; i++)
+  {
+    if (cfg->buttons[i].pin == pin)
+      return "duplicate button gpio";
+  }
+  strcpy(button.name, fields[2]);
+
+  cfg->buttons[cfg->buttonCount++] = button;
+  return NULL;
+}
+
+static bool parseLong(const char *value, long minValue, long maxValue, long *out)
+{
+  char *end;
+  long v = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || v < minValue || v > maxValue)
+    return false;
+  *out = v;
+  return true;
+}
+
+#define ON_OFF_ERROR "value must be on or off" // parseConfig() appends the key
+
+// on/off, 1/0 or true/false
+static bool parseBool(const char *value, bool *out)
+{
+  if (strcmp(value, "on") == 0 || strcmp(value, "1") == 0 || strcmp(value, "true") == 0)
+    *out = true;
+  else if (strcmp(value, "off") == 0 || strcmp(value, "0") == 0 || strcmp(value, "false") == 0)
+    *out = false;
+  else
+    return false;
+  return true;
+}
+
+bool parseBoardSet(const char *text, BoardMask *mask)
+{
+  if (strcasecmp(text, "all") == 0)
+  {
+    *mask = BOARD_MASK_ALL;
+    return true;
+  }
+
+  BoardMask set = 0;
+  const char *id = text;
+  while (true)
+  {
+    if (*id < '0' || *id > '9')
+      return false;
+    char *end;
+    long v = strtol(id, &end, 10);
+    if (v < SOUND_MESSAGE_MIN_BOARD || v > SOUND_MESSAGE_MAX_BOARD ||
+        (*end != '\0' && *end != '+'))
+      return false;
+    set |= BOARD_BIT(v);
+    if (*end == '\0')
+      break;
+    id = end + 1;
+  }
+  *mask = set;
+  return true;
+}
+
+// Returns an error message, or NULL if the key/value pair was applied
+static const char *applySetting(const char *key, char *value, BoardConfig *cfg,
+                                bool *customButtons)
+{
+  long v;
+  bool on;
+
+  if (strcmp(key, "board_id") == 0)
+  {
+    if (!parseLong(value, SOUND_MESSAGE_MIN_BOARD, SOUND_MESSAGE_MAX_BOARD, &v))
+      return "board_id must be 1-63";
+    cfg->boardId = v;
+    return NULL;
+  }
+
+  if (strcmp(key, "button") == 0)
+    return parseButton(value, cfg, customButtons);
+
+  // "targets = <set>, <set>, ..."
+  if (strcmp(key, "targets") == 0)
+  {
+    BoardMask targets[CONFIG_MAX_TARGETS];
+    int count = 0;
+    for (char *field = strtok(value, ","); field; field = strtok(NULL, ","))
+    {
+      while (*field == ' ' || *field == '\t')
+        field++;
+      char *end = field + strlen(field);
+      while (end > field && (end[-1] == ' ' || end[-1] == '\t'))
+        *--end = '\0';
+      if (count >= CONFIG_MAX_TARGETS)
+        return "at most 8 targets";
+      if (!parseBoardSet(field, &targets[count]))
+        return "targets must be board IDs 1-63, joined by + or all";
+      count++;
+    }
+    memcpy(cfg->targets, targets, count * sizeof(targets[0]));
+    cfg->targetCount = count;
+    return NULL;
+  }
+
+  // <button name>_sound
+  size_t keyLen = strlen(key);
+  if (keyLen > 6 && strcmp(key + keyLen - 6, "_sound") == 0)
+  {
+    ButtonConfig *button = findButton(cfg, key, keyLen - 6);
+    if (!button)
+      return "no button with that name";
+    if (button->role != BUTTON_ROLE_SOUND)
+      return "button does not play sounds";
+    if (*value == '/')
+      value++;
+    if (strlen(value) >= CONFIG_SOUND_NAME_LEN)
+      return "sound name too long";
+    strcpy(button->sound, value);
+    return NULL;
+  }
+
+  // <button name>_speculative
+  if (keyLen > 12 && strcmp(key + keyLen - 12, "_speculative") == 0)
+  {
+    ButtonConfig *button = findButton(cfg, key, keyLen - 12);
+    if (!button)
+      return "no button with that name";
+    if (button->role != BUTTON_ROLE_SOUND)
+      return "button does not play sounds";
+    if (!parseBool(value, &on))
+      return ON_OFF_ERROR;
+    button->speculative = on;
+    return NULL;
+  }
+
+  if (strcmp(key, "gain") == 0)
+  {
+    char *end;
+    float g = strtof(value, &end);
+    if (end == value || *end != '\0' || g < 0.0f || g > 4.0f)
+      return "gain must be 0.0-4.0";
+    cfg->gain = g;
+    return NULL;
+  }
+
+  for (size_t i = 0; i < sizeof(timingSettings) / sizeof(timingSettings[0]); i++)
+  {
+    const TimingSetting &t = timingSettings[i];
+    if (strcmp(key, t.key) == 0)
+    {
+      if (!parseLong(value, t.minValue, t.maxValue, &v))
+        return "timing value out of range";
+      uint16_t parsed = v;
+      memcpy((uint8_t *)cfg + t.offset, &parsed, sizeof(parsed)); // Field is unaligned
+      return NULL;
+    }
+  }
+
+  for (size_t i = 0; i < sizeof(switchSettings) / sizeof(switchSettings[0]); i++)
+  {
+    if (strcmp(key, switchSettings[i].key) == 0)
+    {
+      if (!parseBool(value, &on))
+        return ON_OFF_ERROR;
+      *((uint8_t *)cfg + switchSettings[i].offset) = on;
+      return NULL;
+    }
+  }
+
+  if (strcmp(key, "wire_version") == 0)
+  {
+    if (!parseLong(value, 1, 2, &v))
+      return "wire_version must be 1 or 2";
+    cfg->wireVersion = v;
+    return NULL;
+  }
+
+  if (strcmp(key, "buffer_profile") == 0)
+  {
+    for (size_t i = 0; i < sizeof(bufferProfiles) / sizeof(bufferProfiles[0]); i++)
+    {
+      if (strcmp(value, bufferProfiles[i].name) == 0)
+      {
+        cfg->dmaBufCount = bufferProfiles[i].dmaBufCount;
+        cfg->dmaBufLen = bufferProfiles[i].dmaBufLen;
+        return NULL;
+      }
+    }
+    return "buffer_profile must be low_latency, balanced or robust";
+  }
+
+  if (strcmp(key, "dma_buf_count") == 0)
+  {
+    if (!parseLong(value, 2, 128, &v))
+      return "dma_buf_count must be 2-128";
+    cfg->dmaBufCount = v;
+    return NULL;
+  }
+
+  if (strcmp(key, "dma_buf_len") == 0)
+  {
+    if (!parseLong(value, 8, 1024, &v))
+      return "dma_buf_len must be 8-1024";
+    cfg->dmaBufLen = v;
+    return NULL;
+  }
+
+  return "unknown key";
+}
+
+static char *trim(char *s)
+{
+  while (*s == ' ' || *s == '\t')
+    s++;
+  char *end = s + strlen(s);
+  while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+    end--;
+  *end = '\0';
+  return s;
+}
+
+int parseConfig(const char *text, size_t len, BoardConfig *cfg, ConfigErrorFn onError)
+{
+  int errors = 0;
+  int lineNumber = 0;
+  bool customButtons = false;
+  size_t pos = 0;
+
+  while (pos < len)
+  {
+    lineNumber++;
+
+    size_t lineEnd = pos;
+    while (lineEnd < len && text[lineEnd] != '\n')
+      lineEnd++;
+
+    char line[128];
+    size_t lineLen = lineEnd - pos;
+    bool tooLong = lineLen >= sizeof(line);
+    if (!tooLong)
+    {
+      memcpy(line, text + pos, lineLen);
+      line[lineLen] = '\0';
+    }
+    pos = lineEnd + 1;
+
+    if (tooLong)
+    {
+      onError(lineNumber, "line too long");
+      errors++;
+      continue;
+    }
+
+    char *hash = strchr(line, '#');
+    if (hash)
+      *hash = '\0';
+
+    char *key = trim(line);
+    if (*key == '\0')
+      continue;
+
+    char *eq = strchr(key, '=');
+    if (!eq)
+    {
+      onError(lineNumber, "expected key = value");
+      errors++;
+      continue;
+    }
+    *eq = '\0';
+    key = trim(key);
+    char *value = trim(eq + 1);
+
+    const char *error = applySetting(key, value, cfg, &customButtons);
+    if (error)
+    {
+      char message[96];
+      snprintf(message, sizeof(message), "%s (%s)", error, key);
+      onError(lineNumber, message);
+      errors++;
+    }
+  }
+
+  return errors;
+}
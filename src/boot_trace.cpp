@@ -0,0 +1,52 @@
+#include "boot_trace.h"
+
+struct BootPhaseTiming
+{
+  uint32_t startUs;
+  uint32_t endUs;
+};
+
+static const char *phaseNames[BOOT_PHASE_COUNT] = {
+    "serial", "sd", "config", "discovery", "i2s", "radio", "espnow"};
+
+static BootPhaseTiming phaseTimings[BOOT_PHASE_COUNT];
+
+void bootPhaseStart(BootPhase phase)
+{
+  phaseTimings[phase].startUs = micros();
+  phaseTimings[phase].endUs = 0;
+}
+
+void bootPhaseEnd(BootPhase phase)
+{
+  phaseTimings[phase].endUs = micros();
+}
+
+uint32_t bootPhaseMicros(BootPhase phase)
+{
+  const BootPhaseTiming &t = phaseTimings[phase];
+  if (t.endUs == 0)
+    return 0;
+  return t.endUs - t.startUs;
+}
+
+uint32_t bootPhaseEndMicros(BootPhase phase)
+{
+  return phaseTimings[phase].endUs;
+}
+
+const char *bootPhaseName(BootPhase phase)
+{
+  return phaseNames[phase];
+}
+
+void printBootTrace()
+{
+  Serial.print("Boot trace:");
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++)
+  {
+    Serial.printf(" %s=%lums", phaseNames[i],
+                  (unsigned long)(bootPhaseMicros((BootPhase)i) / 1000));
+  }
+  Serial.printf(" total=%lums\n", millis());
+}
@@ -0,0 +1,206 @@
+#include "button_input.h"
+
+#include <driver/gpio.h>
+#include "event_loop.h"
+#include "input_recorder.h"
+
+ButtonState buttons[MAX_BUTTONS];
+uint8_t buttonCount = 0;
+Debouncer buttonDebouncer;
+
+static int8_t buttonByPin[BUTTON_MAX_GPIO]; // GPIO -> index in buttons, -1 if none
+static uint32_t roleMasks[2];
+
+static ButtonEdge edgeQueue[BUTTON_EDGE_QUEUE_SIZE];
+static volatile uint32_t edgeHead = 0; // Written by the ISR only
+static volatile uint32_t edgeTail = 0; // Written by the consumer only
+static volatile uint32_t edgeDrops = 0;
+static volatile bool wakePosted = false; // One loop event per drain is enough
+static portMUX_TYPE edgeMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void IRAM_ATTR onButtonEdge(void *arg)
+{
+  uint8_t pin = (uint8_t)(uintptr_t)arg;
+  uint32_t head = edgeHead;
+
+  if (head - edgeTail >= BUTTON_EDGE_QUEUE_SIZE)
+  {
+    edgeDrops++;
+    return;
+  }
+
+  ButtonEdge &edge = edgeQueue[head & (BUTTON_EDGE_QUEUE_SIZE - 1)];
+  edge.pin = pin;
+  edge.level = gpio_get_level((gpio_num_t)pin);
+  edge.timestampUs = micros();
+
+  // Publish only after the slot is written
+  __sync_synchronize();
+  edgeHead = head + 1;
+
+  if (!wakePosted)
+  {
+    wakePosted = true;
+    eventLoopPostFromISR(LOOP_EVENT_BUTTON, 0);
+  }
+}
+
+void initButtons(const BoardConfig *config)
+{
+  buttonCount = config->buttonCount;
+  debounceInit(&buttonDebouncer, buttonCount, config->debounceMs * 1000UL);
+  roleMasks[BUTTON_ROLE_SOUND] = roleMasks[BUTTON_ROLE_REMOTE] = 0;
+  memset(buttonByPin, -1, sizeof(buttonByPin));
+
+  for (int i = 0; i < buttonCount; i++)
+  {
+    const ButtonConfig &cfg = config->buttons[i];
+    ButtonState &btn = buttons[i];
+
+    btn.pin = cfg.pin;
+    btn.role = cfg.role;
+    btn.name = cfg.name;
+    buttonByPin[cfg.pin] = i;
+    roleMasks[cfg.role] |= 1UL << i;
+
+    pinMode(cfg.pin, INPUT_PULLUP);
+    // Start from the current level so a button held at boot isn't a press
+    debounceSetInitial(&buttonDebouncer, i, digitalRead(cfg.pin) == LOW);
+
+    attachInterruptArg(digitalPinToInterrupt(cfg.pin), onButtonEdge,
+                       (void *)(uintptr_t)cfg.pin, CHANGE);
+  }
+
+  Serial.printf("%d buttons initialized (active LOW with pullup, edge interrupts)\n", buttonCount);
+}
+
+uint32_t buttonRoleMask(uint8_t role)
+{
+  return roleMasks[role];
+}
+
+static ButtonChangeFn changeHandler = NULL;
+static uint32_t passMs;
+static uint32_t passUs;
+
+static void onDebouncedChange(uint8_t index, bool pressed, uint32_t timestampUs)
+{
+  changeHandler(index, pressed, debounceEdgeMillis(timestampUs, passMs, passUs));
+}
+
+void updateAllButtons(ButtonChangeFn onChange, uint32_t nowMs, uint32_t nowUs)
+{
+  changeHandler = onChange;
+  passMs = nowMs;
+  passUs = nowUs;
+
+  // Edges arriving from here on post a new wake-up
+  wakePosted = false;
+  __sync_synchronize();
+
+  recordPass(nowMs, nowUs);
+
+  ButtonEdge edge;
+  while (popButtonEdge(&edge))
+  {
+    int8_t index = edge.pin < BUTTON_MAX_GPIO ? buttonByPin[edge.pin] : -1;
+    if (index >= 0)
+    {
+      bool pressed = edge.level == LOW; // Active LOW
+      recordEdge(edge.timestampUs, index, pressed);
+      debounceEdge(&buttonDebouncer, index, pressed, edge.timestampUs, onDebouncedChange);
+    }
+  }
+
+  // A bounce that ended on the other level is taken once it has been stable
+  debounceSettle(&buttonDebouncer, nowUs, onDebouncedChange);
+}
+
+bool buttonSettleDeadline(uint32_t *dueMs)
+{
+  uint32_t remainingUs;
+  if (!debounceNextSettle(&buttonDebouncer, micros(), &remainingUs))
+    return false;
+  *dueMs = millis() + (remainingUs + 999) / 1000;
+  return true;
+}
+
+bool popButtonEdge(ButtonEdge *edge)
+{
+  uint32_t tail = edgeTail;
+  if (tail == edgeHead)
+    return false;
+
+  __sync_synchronize();
+  *edge = edgeQueue[tail & (BUTTON_EDGE_QUEUE_SIZE - 1)];
+  edgeTail = tail + 1;
+  return true;
+}
+
+uint32_t droppedButtonEdges()
+{
+  return edgeDrops;
+}
+
+bool buttonsIdle()
+{
+  return buttonDebouncer.pressedMask == 0 && buttonDebouncer.unsettledMask == 0;
+}
+
+void armButtonWakeup()
+{
+  for (int i = 0; i < buttonCount; i++)
+  {
+    gpio_num_t pin = (gpio_num_t)buttons[i].pin;
+    gpio_intr_disable(pin);
+    gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL);
+  }
+}
+
+void disarmButtonWakeup()
+{
+  for (int i = 0; i < buttonCount; i++)
+  {
+    gpio_num_t pin = (gpio_num_t)buttons[i].pin;
+    gpio_wakeup_disable(pin);
+    gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+    gpio_intr_enable(pin);
+  }
+}
+
+int queueWakeEdges(uint32_t wakeUs)
+{
+  int queued = 0;
+  for (int i = 0; i < buttonCount; i++)
+  {
+    if (gpio_get_level((gpio_num_t)buttons[i].pin) != LOW ||
+        (buttonDebouncer.pressedMask & (1UL << i)))
+      continue;
+
+    // The ISR is live again, so push the way it does, with it held off
+    portENTER_CRITICAL(&edgeMux);
+    uint32_t head = edgeHead;
+    if (head - edgeTail < BUTTON_EDGE_QUEUE_SIZE)
+    {
+      ButtonEdge &edge = edgeQueue[head & (BUTTON_EDGE_QUEUE_SIZE - 1)];
+      edge.pin = buttons[i].pin;
+      edge.level = LOW;
+      edge.timestampUs = wakeUs;
+      __sync_synchronize();
+      edgeHead = head + 1;
+      queued++;
+    }
+    else
+    {
+      edgeDrops++;
+    }
+    portEXIT_CRITICAL(&edgeMux);
+  }
+
+  if (queued && !wakePosted)
+  {
+    wakePosted = true;
+    eventLoopPost(LOOP_EVENT_BUTTON, 0);
+  }
+  return queued;
+}
@@ -0,0 +1,192 @@
+#include "catalog_cache.h"
+
+#include <Preferences.h>
+#include "ff.h"
+
+// FNV-1a, good enough to notice added/removed/renamed/resized files
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= bytes[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+static bool isWavName(const char *name)
+{
+  size_t len = strlen(name);
+  return len > 4 && (strcmp(name + len - 4, ".wav") == 0 || strcmp(name + len - 4, ".WAV") == 0);
+}
+
+// Keep firstSounds sorted, inserting name if it belongs in the first count
+static void insertFirstSound(String *firstSounds, int count, const char *name)
+{
+  int pos = count;
+  while (pos > 0 && (firstSounds[pos - 1].length() == 0 ||
+                     strcmp(name, firstSounds[pos - 1].c_str()) < 0))
+  {
+    pos--;
+  }
+  if (pos >= count)
+    return;
+  for (int i = count - 1; i > pos; i--)
+    firstSounds[i] = firstSounds[i - 1];
+  firstSounds[pos] = name;
+}
+
+uint32_t computeCatalogFingerprint(String *firstSounds, int firstCount)
+{
+  uint32_t hash = 2166136261UL;
+
+  for (int i = 0; i < firstCount; i++)
+    firstSounds[i] = "";
+
+  // Volume serial changes whenever the card is reformatted or swapped
+  DWORD serial = 0;
+  if (f_getlabel(SD_FATFS_DRIVE, NULL, &serial) != FR_OK)
+  {
+    return 0;
+  }
+  hash = fnv1a(hash, &serial, sizeof(serial));
+
+  // Walk the root directory entries without opening any file
+  FF_DIR dir;
+  if (f_opendir(&dir, SD_FATFS_DRIVE "/") != FR_OK)
+  {
+    return 0;
+  }
+
+  FILINFO info;
+  while (f_readdir(&dir, &info) == FR_OK && info.fname[0] != '\0')
+  {
+    hash = fnv1a(hash, info.fname, strlen(info.fname));
+    hash = fnv1a(hash, &info.fsize, sizeof(info.fsize));
+    hash = fnv1a(hash, &info.fdate, sizeof(info.fdate));
+    hash = fnv1a(hash, &info.ftime, sizeof(info.ftime));
+    hash = fnv1a(hash, &info.fattrib, sizeof(info.fattrib));
+
+    if (firstCount > 0 && !(info.fattrib & AM_DIR) && isWavName(info.fname))
+      insertFirstSound(firstSounds, firstCount, info.fname);
+  }
+  f_closedir(&dir);
+
+  // 0 is reserved for "unknown"
+  return hash ? hash : 1;
+}
+
+bool loadCatalogCache(uint32_t fingerprint, String *files, int maxFiles,
+                      int *count, uint32_t *scanMs)
+{
+  if (fingerprint == 0)
+    return false;
+
+  Preferences prefs;
+  if (!prefs.begin(CATALOG_CACHE_NAMESPACE, true))
+    return false;
+
+  if (prefs.getUChar("ver", 0) != CATALOG_CACHE_VERSION ||
+      prefs.getUInt("fp", 0) != fingerprint)
+  {
+    prefs.end();
+    return false;
+  }
+
+  int storedCount = prefs.getUChar("count", 0);
+  if (storedCount == 0)
+  {
+    // A card without WAVs is cached too, so it is not rescanned every boot
+    *scanMs = prefs.getUInt("scanMs", 0);
+    prefs.end();
+    *count = 0;
+    return true;
+  }
+
+  size_t len = prefs.getBytesLength("names");
+  if (storedCount > maxFiles || len == 0)
+  {
+    prefs.end();
+    return false;
+  }
+
+  // Names are stored back to back, NUL separated, already sorted
+  char *names = (char *)malloc(len);
+  if (!names)
+  {
+    prefs.end();
+    return false;
+  }
+  prefs.getBytes("names", names, len);
+  *scanMs = prefs.getUInt("scanMs", 0);
+  prefs.end();
+
+  int restored = 0;
+  size_t pos = 0;
+  while (pos < len && restored < storedCount)
+  {
+    size_t nameLen = strnlen(names + pos, len - pos);
+    if (pos + nameLen >= len)
+      break; // Truncated blob
+    files[restored++] = String(names + pos);
+    pos += nameLen + 1;
+  }
+  free(names);
+
+  if (restored != storedCount)
+    return false;
+
+  *count = restored;
+  return true;
+}
+
+void saveCatalogCache(uint32_t fingerprint, const String *files, int count,
+                      uint32_t scanMs)
+{
+  if (fingerprint == 0)
+    return;
+
+  size_t len = 0;
+  for (int i = 0; i < count; i++)
+    len += files[i].length() + 1;
+
+  char *names = (char *)malloc(len ? len : 1);
+  if (!names)
+    return;
+
+  size_t pos = 0;
+  for (int i = 0; i < count; i++)
+  {
+    memcpy(names + pos, files[i].c_str(), files[i].length() + 1);
+    pos += files[i].length() + 1;
+  }
+
+  Preferences prefs;
+  if (prefs.begin(CATALOG_CACHE_NAMESPACE, false))
+  {
+    // Clear the fingerprint first so a torn write is never trusted
+    prefs.putUInt("fp", 0);
+    // putBytes() refuses an empty blob, an empty catalog has no names key
+    if (len > 0)
+      prefs.putBytes("names", names, len);
+    else
+      prefs.remove("names");
+    prefs.putUChar("count", count);
+    prefs.putUInt("scanMs", scanMs);
+    prefs.putUChar("ver", CATALOG_CACHE_VERSION);
+    prefs.putUInt("fp", fingerprint);
+    prefs.end();
+  }
+  free(names);
+}
+
+void invalidateCatalogCache()
+{
+  Preferences prefs;
+  if (prefs.begin(CATALOG_CACHE_NAMESPACE, false))
+  {
+    prefs.putUInt("fp", 0);
+    prefs.end();
+  }
+}
@@ -0,0 +1,262 @@
+#include "clock_sync.h"
+
+#include <string.h>
+
+#define DRIFT_BOUND_DIV 100000   // 10 ppm: how fast an estimate ages
+#define UNRATED_BOUND_DIV 10000  // 100 ppm before the rate is known
+
+void clockInit(ClockSync *sync, int64_t nowUs)
+{
+  memset(sync, 0, sizeof(*sync));
+  sync->baseUs = nowUs;
+  sync->leaderlessUs = nowUs;
+}
+
+void clockOnPresence(ClockSync *sync, uint8_t board, uint8_t flags)
+{
+  if (board < SOUND_MESSAGE_MIN_BOARD || board > SOUND_MESSAGE_MAX_BOARD)
+    return;
+  if (flags & SOUND_PRESENCE_TIME_MASTER)
+    sync->masters |= BOARD_BIT(board);
+  else
+    sync->masters &= ~BOARD_BIT(board);
+  if (flags & SOUND_PRESENCE_TIME_SYNCED)
+    sync->timed |= BOARD_BIT(board);
+  else
+    sync->timed &= ~BOARD_BIT(board);
+}
+
+static uint8_t lowest(BoardMask set)
+{
+  return __builtin_ctzll(set);
+}
+
+static void follow(ClockSync *sync, uint8_t master, int64_t nowUs)
+{
+  if (master == sync->master)
+    return;
+  sync->stats.masterChanges++;
+  sync->master = master;
+  sync->sampleCount = 0;
+  sync->nextSample = 0;
+  sync->anchored = false;
+  sync->polls = 0;
+  sync->nextPollUs = nowUs;
+  if (master == 0)
+  {
+    sync->leaderlessUs = nowUs;
+    return; // Carry on with the estimate we have
+  }
+  if (master != sync->self)
+    return;
+
+  // Keep the fleet's time going from where our estimate has it, or start
+  // it from our own clock
+  if (sync->synced)
+  {
+    sync->offsetUs = clockFleetUs(sync, nowUs) - nowUs;
+  }
+  else
+  {
+    sync->offsetUs = 0;
+    sync->skewPpb = 0;
+    sync->rated = false;
+  }
+  sync->baseUs = nowUs;
+  sync->baseDelayUs = 0;
+  sync->synced = true;
+}
+
+uint8_t clockElect(ClockSync *sync, uint8_t self, BoardMask alive, BoardMask candidates,
+                   int64_t nowUs)
+{
+  sync->self = self;
+  BoardMask live = sync->masters & alive & ~BOARD_BIT(self);
+  BoardMask below = self ? BOARD_BIT(self) - 1 : 0;
+
+  if (self && sync->master == self)
+  {
+    if (live & below)
+      follow(sync, lowest(live & below), nowUs);
+  }
+  else if (sync->master && (live & BOARD_BIT(sync->master)))
+  {
+    // Keep it
+  }
+  else if (live)
+  {
+    follow(sync, lowest(live), nowUs);
+  }
+  else
+  {
+    follow(sync, 0, nowUs);
+    BoardMask timed = sync->timed & candidates & alive;
+    bool waited = nowUs - sync->leaderlessUs >= (int64_t)CLOCK_ELECT_MS * 1000;
+    bool takeOver = sync->synced ? !(timed & below)
+                                 : !timed && !(candidates & alive & below) && waited;
+    if (self && takeOver)
+      follow(sync, self, nowUs);
+  }
+  return sync->master;
+}
+
+bool clockIsMaster(const ClockSync *sync, uint8_t self)
+{
+  return self && sync->master == self;
+}
+
+static bool following(const ClockSync *sync)
+{
+  return sync->master && sync->master != sync->self;
+}
+
+bool clockPollDue(ClockSync *sync, int64_t nowUs)
+{
+  if (!following(sync) || nowUs < sync->nextPollUs)
+    return false;
+  uint32_t intervalMs = sync->polls < CLOCK_SAMPLES ? CLOCK_FAST_POLL_MS : CLOCK_POLL_MS;
+  sync->nextPollUs = nowUs + (int64_t)intervalMs * 1000;
+  if (sync->polls < 0xFF)
+    sync->polls++;
+  sync->stats.requests++;
+  return true;
+}
+
+int64_t clockNextDeadlineUs(const ClockSync *sync, int64_t nowUs)
+{
+  if (following(sync))
+    return sync->nextPollUs;
+  // Elections are checked now and then (heartbeats come no faster), and
+  // when the wait after boot is over
+  int64_t dueUs = nowUs + (int64_t)CLOCK_POLL_MS * 1000;
+  int64_t electUs = sync->leaderlessUs + (int64_t)CLOCK_ELECT_MS * 1000;
+  if (sync->master == 0 && !sync->synced && electUs > nowUs && electUs < dueUs)
+    dueUs = electUs;
+  return dueUs;
+}
+
+void clockOnRequest(ClockSync *sync, uint8_t board, uint64_t originUs, int64_t receivedUs)
+{
+  if (!sync->synced || sync->requestCount >= CLOCK_MAX_REQUESTS)
+    return;
+  ClockRequest &request = sync->requests[sync->requestCount++];
+  request.board = board;
+  request.originUs = originUs;
+  request.receivedUs = receivedUs;
+}
+
+bool clockNextRequest(ClockSync *sync, ClockRequest *request)
+{
+  if (sync->requestCount == 0)
+    return false;
+  *request = sync->requests[0];
+  sync->requestCount--;
+  memmove(&sync->requests[0], &sync->requests[1], sync->requestCount * sizeof(sync->requests[0]));
+  sync->stats.answered++;
+  return true;
+}
+
+static int64_t driftBound(const ClockSync *sync, int64_t sinceUs)
+{
+  return sinceUs / (sync->rated ? DRIFT_BOUND_DIV : UNRATED_BOUND_DIV);
+}
+
+// Error bound of a sample at nowUs (see clockErrorUs)
+static int64_t sampleError(const ClockSync *sync, const ClockSample &sample, int64_t nowUs)
+{
+  return sample.delayUs / 2 + driftBound(sync, nowUs - sample.localUs);
+}
+
+static void updateEstimate(ClockSync *sync, int64_t nowUs)
+{
+  const ClockSample *best = &sync->samples[0];
+  for (int i = 1; i < sync->sampleCount; i++)
+  {
+    if (sampleError(sync, sync->samples[i], nowUs) < sampleError(sync, *best, nowUs))
+      best = &sync->samples[i];
+  }
+
+  // Rate from two good samples far enough apart, smoothed. Until the span
+  // is reached a better sample makes a better anchor.
+  int64_t spanUs = best->localUs - sync->anchor.localUs;
+  if (!sync->anchored || (spanUs < CLOCK_SKEW_SPAN_US && best->delayUs < sync->anchor.delayUs))
+  {
+    sync->anchor = *best;
+    sync->anchored = true;
+  }
+  else if (spanUs >= CLOCK_SKEW_SPAN_US)
+  {
+    int64_t skew = (best->offsetUs - sync->anchor.offsetUs) * 1000000000LL / spanUs;
+    if (skew > CLOCK_MAX_SKEW_PPB)
+      skew = CLOCK_MAX_SKEW_PPB;
+    if (skew < -CLOCK_MAX_SKEW_PPB)
+      skew = -CLOCK_MAX_SKEW_PPB;
+    sync->skewPpb += (skew - sync->skewPpb) / (sync->rated ? 4 : 1);
+    sync->rated = true;
+    sync->anchor = *best;
+  }
+
+  // A first estimate waits for a few samples to choose from. After a
+  // master change the old one is kept while it is better, until the window
+  // is full of the new master's samples.
+  if (!sync->synced && sync->sampleCount < CLOCK_MIN_SAMPLES)
+    return;
+  if (sync->synced && sync->sampleCount < CLOCK_SAMPLES &&
+      sampleError(sync, *best, nowUs) > clockErrorUs(sync, nowUs))
+    return;
+  sync->offsetUs = best->offsetUs;
+  sync->baseUs = best->localUs;
+  sync->baseDelayUs = best->delayUs;
+  sync->synced = true;
+}
+
+void clockOnResponse(ClockSync *sync, uint8_t board, uint64_t originUs, uint64_t receivedUs,
+                     uint64_t sentUs, int64_t arrivedUs)
+{
+  if (!following(sync) || board != sync->master)
+    return;
+  int64_t t1 = originUs, t2 = receivedUs, t3 = sentUs, t4 = arrivedUs;
+  int64_t delay = (t4 - t1) - (t3 - t2);
+  // An answer to a request long gone is no sample either
+  if (t4 < t1 || t4 - t1 > CLOCK_MAX_DELAY_US || delay > CLOCK_MAX_DELAY_US)
+  {
+    sync->stats.rejected++;
+    return;
+  }
+  sync->stats.samples++;
+
+  ClockSample &sample = sync->samples[sync->nextSample];
+  sample.localUs = t1 + (t4 - t1) / 2;
+  sample.offsetUs = ((t2 - t1) + (t3 - t4)) / 2;
+  sample.delayUs = delay > 0 ? delay : 0;
+  sync->nextSample = (sync->nextSample + 1) % CLOCK_SAMPLES;
+  if (sync->sampleCount < CLOCK_SAMPLES)
+    sync->sampleCount++;
+  updateEstimate(sync, arrivedUs);
+}
+
+int64_t clockFleetUs(const ClockSync *sync, int64_t localUs)
+{
+  return localUs + sync->offsetUs + (localUs - sync->baseUs) * sync->skewPpb / 1000000000LL;
+}
+
+int64_t clockLocalUs(const ClockSync *sync, int64_t fleetUs)
+{
+  int64_t localUs = fleetUs - sync->offsetUs;
+  return localUs - (localUs - sync->baseUs) * sync->skewPpb / 1000000000LL;
+}
+
+int64_t clockExpandUs(const ClockSync *sync, uint32_t fleetLow, int64_t nowUs)
+{
+  int64_t fleetUs = clockFleetUs(sync, nowUs);
+  return fleetUs + (int32_t)(fleetLow - (uint32_t)fleetUs);
+}
+
+int32_t clockErrorUs(const ClockSync *sync, int64_t nowUs)
+{
+  if (!sync->synced)
+    return -1;
+  if (sync->master && sync->master == sync->self)
+    return 0;
+  return sync->baseDelayUs / 2 + driftBound(sync, nowUs - sync->baseUs);
+}
@@ -0,0 +1,88 @@
+#include "debounce.h"
+
+#include <string.h>
+
+void debounceInit(Debouncer *debouncer, uint8_t buttonCount, uint32_t debounceUs)
+{
+  memset(debouncer, 0, sizeof(*debouncer));
+  debouncer->buttonCount = buttonCount;
+  debouncer->debounceUs = debounceUs;
+}
+
+void debounceSetInitial(Debouncer *debouncer, uint8_t index, bool pressed)
+{
+  DebounceButton &btn = debouncer->buttons[index];
+  btn.currentState = btn.lastState = pressed;
+  if (pressed)
+    debouncer->pressedMask |= 1UL << index;
+  else
+    debouncer->pressedMask &= ~(1UL << index);
+}
+
+static void accept(Debouncer *debouncer, uint8_t index, bool pressed, uint32_t timestampUs,
+                   DebounceChangeFn onChange)
+{
+  DebounceButton &btn = debouncer->buttons[index];
+  btn.currentState = pressed;
+  btn.lastChangeUs = timestampUs;
+  if (pressed)
+    debouncer->pressedMask |= 1UL << index;
+  else
+    debouncer->pressedMask &= ~(1UL << index);
+  onChange(index, pressed, timestampUs);
+}
+
+void debounceEdge(Debouncer *debouncer, uint8_t index, bool pressed, uint32_t timestampUs,
+                  DebounceChangeFn onChange)
+{
+  if (index >= debouncer->buttonCount)
+    return;
+
+  DebounceButton &btn = debouncer->buttons[index];
+  btn.lastState = pressed;
+  btn.lastEdgeUs = timestampUs;
+
+  if (pressed != btn.currentState &&
+      timestampUs - btn.lastChangeUs >= debouncer->debounceUs)
+  {
+    accept(debouncer, index, pressed, timestampUs, onChange);
+  }
+
+  if (btn.lastState != btn.currentState)
+    debouncer->unsettledMask |= 1UL << index;
+  else
+    debouncer->unsettledMask &= ~(1UL << index);
+}
+
+void debounceSettle(Debouncer *debouncer, uint32_t nowUs, DebounceChangeFn onChange)
+{
+  // Only buttons that are mid-bounce are visited
+  for (uint32_t pending = debouncer->unsettledMask; pending; pending &= pending - 1)
+  {
+    int index = __builtin_ctz(pending);
+    DebounceButton &btn = debouncer->buttons[index];
+    int32_t stableUs = (int32_t)(nowUs - btn.lastEdgeUs);
+    if (stableUs >= 0 && (uint32_t)stableUs >= debouncer->debounceUs)
+    {
+      debouncer->unsettledMask &= ~(1UL << index);
+      accept(debouncer, index, btn.lastState, btn.lastEdgeUs, onChange);
+    }
+  }
+}
+
+bool debounceNextSettle(const Debouncer *debouncer, uint32_t nowUs, uint32_t *remainingUs)
+{
+  if (!debouncer->unsettledMask)
+    return false;
+
+  int32_t soonest = INT32_MAX;
+  for (uint32_t pending = debouncer->unsettledMask; pending; pending &= pending - 1)
+  {
+    const DebounceButton &btn = debouncer->buttons[__builtin_ctz(pending)];
+    int32_t remaining = (int32_t)(btn.lastEdgeUs + debouncer->debounceUs - nowUs);
+    if (remaining < soonest)
+      soonest = remaining;
+  }
+  *remainingUs = soonest > 0 ? soonest : 0;
+  return true;
+}
@@ -0,0 +1,283 @@
+#include "dispatch.h"
+
+#include <string.h>
+
+void dispatchInit(Dispatcher *dispatcher, uint8_t boardId, uint32_t speculativeButtons)
+{
+  memset(dispatcher, 0, sizeof(*dispatcher));
+  dedupeInit(&dispatcher->dedupe);
+  dispatcher->boardId = boardId;
+  dispatcher->speculativeButtons = speculativeButtons;
+  dispatcher->speculativeVoice = -1;
+}
+
+void dispatchSetTargets(Dispatcher *dispatcher, const BoardMask *targets, uint8_t count)
+{
+  if (count > DISPATCH_MAX_TARGETS)
+    count = DISPATCH_MAX_TARGETS;
+  memcpy(dispatcher->targets, targets, count * sizeof(targets[0]));
+  dispatcher->targetCount = count;
+}
+
+static Action *add(Action *actions, int *count, uint8_t type, uint8_t button, uint32_t triggerMs)
+{
+  Action &action = actions[(*count)++];
+  memset(&action, 0, sizeof(action));
+  action.type = type;
+  action.button = button;
+  action.triggerMs = triggerMs;
+  return &action;
+}
+
+// Fade out a speculative voice (or drop a staged clip) for these buttons
+static void cancelSpeculative(Dispatcher *d, uint32_t members, Action *actions, int *count)
+{
+  if (d->prefetchPending & members)
+  {
+    add(actions, count, ACTION_DISCARD_PREFETCH, __builtin_ctz(d->prefetchPending), 0);
+    d->prefetchPending = 0;
+  }
+  d->speculativePending &= ~members;
+  if (d->speculativeVoice >= 0 && (members & (1UL << d->speculativeVoice)))
+  {
+    add(actions, count, ACTION_CANCEL, d->speculativeVoice, 0);
+    d->speculativeVoice = -1;
+  }
+}
+
+// Send button's sound to a set of boards: played here too if the set
+// includes this board, rejected if this board (or nothing) is all it names.
+// Every board includes this one even while it is still claiming an ID.
+static void sendTo(Dispatcher *d, uint8_t button, BoardMask targets, uint32_t triggerMs,
+                   Action *actions, int *count)
+{
+  BoardMask self = BOARD_BIT(d->boardId);
+  BoardMask others = targets & ~self;
+  if (others == 0)
+  {
+    add(actions, count, ACTION_REJECT_TARGET, button, triggerMs)->board =
+        targets ? d->boardId : 0;
+    return;
+  }
+  if ((targets & self) ||
+      (d->boardId == SOUND_BOARD_UNASSIGNED && targets == BOARD_MASK_ALL))
+    add(actions, count, ACTION_PLAY, button, triggerMs)->together = true;
+  Action *action = add(actions, count, ACTION_SEND, button, triggerMs);
+  action->targets = others;
+  if ((others & (others - 1)) == 0)
+    action->board = __builtin_ctzll(others);
+}
+
+int dispatchGesture(Dispatcher *d, const GestureEvent &gesture, Action *actions)
+{
+  int count = 0;
+  uint8_t button = gesture.button;
+  uint32_t bit = 1UL << button;
+
+  switch (gesture.type)
+  {
+  case GESTURE_PRESS_START:
+    // First press edge: play now on speculative buttons, otherwise stage the
+    // clip while the gesture window runs. A second press cancels either.
+    if (gesture.count > 1)
+    {
+      cancelSpeculative(d, bit, actions, &count);
+    }
+    else if (d->speculativeButtons & bit)
+    {
+      add(actions, &count, ACTION_PLAY, button, gesture.pressMs)->speculative = true;
+      d->speculativePending |= bit;
+      d->speculativeVoice = button;
+    }
+    else
+    {
+      add(actions, &count, ACTION_PREFETCH, button, gesture.pressMs);
+      d->prefetchPending = bit; // The player stages one clip at a time
+    }
+    break;
+
+  case GESTURE_PRESS:
+    if (gesture.count == 1)
+    {
+      d->prefetchPending &= ~bit;
+      // Already playing since the press edge
+      if (d->speculativePending & bit)
+        d->speculativePending &= ~bit;
+      else
+        add(actions, &count, ACTION_PLAY, button, gesture.pressMs);
+    }
+    else
+    {
+      // Multi-press: 2+ presses = send to board (pressCount-1), or to the
+      // (pressCount-1)th listed target. Normally the speculative voice
+      // already faded out at the second press edge.
+      cancelSpeculative(d, bit, actions, &count);
+      uint8_t target = gesture.count - 1;
+      if (d->targetCount)
+      {
+        sendTo(d, button, target <= d->targetCount ? d->targets[target - 1] : 0,
+               gesture.pressMs, actions, &count);
+      }
+      else if (target > SOUND_MESSAGE_MAX_BOARD || target == d->boardId)
+        add(actions, &count, ACTION_REJECT_TARGET, button, gesture.pressMs)->board = target;
+      else
+        sendTo(d, button, BOARD_BIT(target), gesture.pressMs, actions, &count);
+    }
+    break;
+
+  case GESTURE_LONG_HOLD:
+    cancelSpeculative(d, bit, actions, &count);
+    add(actions, &count, ACTION_PLAY_RANDOM_HOLD, button, gesture.timeMs);
+    break;
+
+  case GESTURE_CHORD:
+    cancelSpeculative(d, gesture.mask, actions, &count);
+    // A pair of sound buttons plays a random sound, three or more play the
+    // highest one's sound everywhere
+    if (__builtin_popcount(gesture.mask) == 2)
+      add(actions, &count, ACTION_PLAY_RANDOM, button, gesture.pressMs);
+    else
+      sendTo(d, button, BOARD_MASK_ALL, gesture.pressMs, actions, &count);
+    break;
+
+  case GESTURE_TRIGGER:
+    add(actions, &count, ACTION_SEND_RANDOM, button, gesture.pressMs);
+    break;
+  }
+  return count;
+}
+
+// One ack for the frame if any command addressed to us asks for it
+static void addAck(Dispatcher *d, const SoundFrame *frame, uint32_t nowMs, Action *actions, int *count)
+{
+  for (int i = 0; i < frame->commandCount; i++)
+  {
+    const SoundCommand &cmd = frame->commands[i];
+    if ((cmd.targets & BOARD_BIT(d->boardId)) && (cmd.flags & SOUND_FLAG_ACK) &&
+        (cmd.type == SOUND_CMD_PLAY || cmd.type == SOUND_CMD_PLAY_GROUP ||
+         cmd.type == SOUND_CMD_STOP))
+    {
+      Action *action = add(actions, count, ACTION_SEND_ACK, 0, nowMs);
+      action->board = frame->sender;
+      action->seq = frame->seq;
+      return;
+    }
+  }
+}
+
+int dispatchFrame(Dispatcher *d, const uint8_t *data, int len, uint32_t nowMs,
+                  SoundFrame *frame, Action *actions)
+{
+  int count = 0;
+  bool legacy = false;
+  d->heardFrom = 0;
+  d->staleFrom = 0;
+  d->accepted = false;
+
+  const char *reason = decodeFrameHeader(data, len, frame);
+  if (!reason)
+  {
+    legacy = frame->version == 1;
+    uint8_t verdict = DEDUPE_NEW;
+    if (!legacy && frame->sender != SOUND_BOARD_UNASSIGNED)
+      verdict = dedupeCheck(&d->dedupe, frame->sender, frame->epoch, frame->seq);
+    else if (frame->sender <= SOUND_MESSAGE_MAX_BOARD &&
+             d->lastLegacyStamp[frame->sender] == frame->timestamp)
+      verdict = DEDUPE_DUPLICATE;
+
+    if (verdict != DEDUPE_NEW)
+    {
+      if (verdict == DEDUPE_STALE)
+      {
+        d->dedupe.stale++;
+        d->staleFrom = frame->sender;
+        return 0;
+      }
+      d->dedupe.duplicates++;
+      // A retransmission means our ack was lost: ack again, play nothing
+      if (!legacy && decodeFrame(data, len, frame) == NULL)
+      {
+        d->heardFrom = frame->sender;
+        addAck(d, frame, nowMs, actions, &count);
+      }
+      return count;
+    }
+    reason = decodeFrame(data, len, frame);
+  }
+
+  if (reason)
+  {
+    add(actions, &count, ACTION_REJECT_FRAME, 0, nowMs)->reason = reason;
+    return count;
+  }
+
+  d->heardFrom = frame->sender;
+  d->accepted = true;
+  if (legacy)
+    d->lastLegacyStamp[frame->sender] = frame->timestamp;
+  else if (frame->sender != SOUND_BOARD_UNASSIGNED)
+    dedupeAccept(&d->dedupe, frame->sender, frame->epoch, frame->seq);
+
+  for (int i = 0; i < frame->commandCount; i++)
+  {
+    const SoundCommand &cmd = frame->commands[i];
+    if (cmd.type == SOUND_CMD_PRESENCE)
+    {
+      Action *action = add(actions, &count, ACTION_PRESENCE, 0, nowMs);
+      action->board = frame->sender;
+      action->presence = cmd.value;
+      action->firmware = cmd.firmware;
+      action->queueDepth = cmd.queueDepth;
+      action->claim = frame->sender == SOUND_BOARD_UNASSIGNED ? cmd.target : 0;
+      action->sleepMs = cmd.sleepMs;
+      continue;
+    }
+
+    // Not for us (BOARD_BIT(0) is in no set while we claim an ID): ignore
+    // silently
+    if (!(cmd.targets & BOARD_BIT(d->boardId)))
+      continue;
+
+    if (cmd.type == SOUND_CMD_PLAY || cmd.type == SOUND_CMD_PLAY_GROUP)
+    {
+      Action *action = add(actions, &count, ACTION_PLAY_REMOTE, 0, nowMs);
+      action->board = frame->sender;
+      action->sound = cmd.sound;
+      action->scheduled = cmd.flags & SOUND_FLAG_START;
+      action->startUs = cmd.start;
+    }
+    else if (cmd.type == SOUND_CMD_STOP)
+    {
+      Action *action = add(actions, &count, ACTION_STOP_REMOTE, 0, nowMs);
+      action->board = frame->sender;
+      action->fadeMs = cmd.fadeMs;
+    }
+    else if (cmd.type == SOUND_CMD_ACK)
+    {
+      Action *action = add(actions, &count, ACTION_ACK, 0, nowMs);
+      action->board = frame->sender;
+      action->seq = cmd.value;
+    }
+    else if (cmd.type == SOUND_CMD_TIME_REQUEST || cmd.type == SOUND_CMD_TIME_RESPONSE)
+    {
+      Action *action = add(actions, &count,
+                           cmd.type == SOUND_CMD_TIME_REQUEST ? ACTION_TIME_REQUEST
+                                                              : ACTION_TIME_RESPONSE,
+                           0, nowMs);
+      action->board = frame->sender;
+      memcpy(action->time, cmd.time, sizeof(action->time));
+      action->drift = cmd.drift;
+    }
+  }
+  addAck(d, frame, nowMs, actions, &count);
+  return count;
+}
+
+const char *actionTypeName(uint8_t type)
+{
+  static const char *names[] = {
+      "play", "prefetch", "discard-prefetch", "cancel", "play-random-hold", "play-random",
+      "send", "send-random", "reject-target", "play-remote", "stop-remote", "reject-frame",
+      "send-ack", "ack", "presence", "time-request", "time-response"};
+  return type < sizeof(names) / sizeof(names[0]) ? names[type] : "?";
+}
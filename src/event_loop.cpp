@@ -0,0 +1,142 @@
+#include "event_loop.h"
+
+static QueueHandle_t loopQueue = NULL;
+static LoopEventFn eventHandler = NULL;
+static LoopTimer *timers = NULL;
+static LoopIdleFn idleHook = NULL;
+
+bool eventLoopInit(LoopEventFn handler)
+{
+  eventHandler = handler;
+  loopQueue = xQueueCreate(LOOP_QUEUE_LENGTH, sizeof(LoopEvent));
+  return loopQueue != NULL;
+}
+
+void eventLoopSetIdleHook(LoopIdleFn hook)
+{
+  idleHook = hook;
+}
+
+bool eventLoopPost(uint8_t type, uint32_t arg, uint8_t source)
+{
+  LoopEvent event = {type, source, arg};
+  return loopQueue && xQueueSend(loopQueue, &event, 0) == pdTRUE;
+}
+
+void IRAM_ATTR eventLoopPostFromISR(uint8_t type, uint32_t arg)
+{
+  if (!loopQueue)
+    return;
+  LoopEvent event = {type, 0, arg};
+  BaseType_t woken = pdFALSE;
+  xQueueSendFromISR(loopQueue, &event, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+void loopTimerInit(LoopTimer *timer, LoopTimerFn fn, void *arg)
+{
+  timer->fn = fn;
+  timer->arg = arg;
+  timer->armed = false;
+  timer->lazy = false;
+  timer->periodMs = 0;
+  timer->next = timers;
+  timers = timer;
+}
+
+void loopTimerStartAt(LoopTimer *timer, uint32_t dueMs)
+{
+  timer->dueMs = dueMs;
+  timer->periodMs = 0;
+  timer->armed = true;
+}
+
+void loopTimerStartPeriodic(LoopTimer *timer, uint32_t periodMs)
+{
+  timer->dueMs = millis() + periodMs;
+  timer->periodMs = periodMs;
+  timer->armed = true;
+}
+
+void loopTimerStop(LoopTimer *timer)
+{
+  timer->armed = false;
+}
+
+void loopTimerSetLazy(LoopTimer *timer, bool lazy)
+{
+  timer->lazy = lazy;
+}
+
+bool loopNextDeadline(uint32_t *dueMs, bool includeLazy)
+{
+  bool found = false;
+  for (LoopTimer *t = timers; t; t = t->next)
+  {
+    if (t->armed && (includeLazy || !t->lazy) && (!found || (int32_t)(t->dueMs - *dueMs) < 0))
+    {
+      *dueMs = t->dueMs;
+      found = true;
+    }
+  }
+  return found;
+}
+
+static void runDueTimers()
+{
+  uint32_t now = millis();
+  for (LoopTimer *t = timers; t; t = t->next)
+  {
+    if (!t->armed || (int32_t)(now - t->dueMs) < 0)
+      continue;
+
+    if (t->periodMs)
+    {
+      t->dueMs += t->periodMs;
+      if ((int32_t)(now - t->dueMs) >= 0)
+        t->dueMs = now + t->periodMs; // Fell behind, don't fire a burst
+    }
+    else
+    {
+      t->armed = false;
+    }
+    t->fn(t->arg); // May re-arm itself
+  }
+}
+
+// Milliseconds until the earliest matching timer, UINT32_MAX if none
+static uint32_t msUntilNextTimer(bool includeLazy)
+{
+  uint32_t dueMs;
+  if (!loopNextDeadline(&dueMs, includeLazy))
+    return UINT32_MAX;
+  int32_t remaining = dueMs - millis();
+  return remaining > 0 ? remaining : 0;
+}
+
+void eventLoopRunOnce()
+{
+  uint32_t waitMs = msUntilNextTimer(true);
+
+  if (idleHook && waitMs > 0 && uxQueueMessagesWaiting(loopQueue) == 0)
+  {
+    uint32_t allowedMs = idleHook(msUntilNextTimer(false));
+    if (allowedMs < waitMs)
+      waitMs = allowedMs;
+  }
+
+  // Round up so a deadline is never dispatched early
+  TickType_t wait = waitMs == UINT32_MAX ? portMAX_DELAY
+                                         : (waitMs + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+
+  LoopEvent event;
+  if (xQueueReceive(loopQueue, &event, wait) == pdTRUE)
+  {
+    do
+    {
+      eventHandler(event);
+    } while (xQueueReceive(loopQueue, &event, 0) == pdTRUE);
+  }
+
+  runDueTimers();
+}
@@ -0,0 +1,57 @@
+#include "frame_dedupe.h"
+
+#include <string.h>
+
+void dedupeInit(DedupeTable *table)
+{
+  memset(table, 0, sizeof(*table));
+}
+
+uint8_t dedupeCheck(const DedupeTable *table, uint8_t sender, uint32_t epoch, uint32_t seq)
+{
+  if (sender > SOUND_MESSAGE_MAX_BOARD)
+    return DEDUPE_NEW;
+  const DedupePeer *peer = &table->peers[sender];
+  if (!peer->known || epoch > peer->epoch)
+    return DEDUPE_NEW;
+  if (epoch < peer->epoch)
+    return DEDUPE_STALE;
+
+  if (seq > peer->newestSeq)
+    return DEDUPE_NEW;
+  uint32_t behind = peer->newestSeq - seq;
+  if (behind >= DEDUPE_WINDOW)
+    return DEDUPE_STALE;
+  return (peer->seenMask & (1UL << behind)) ? DEDUPE_DUPLICATE : DEDUPE_NEW;
+}
+
+void dedupeAccept(DedupeTable *table, uint8_t sender, uint32_t epoch, uint32_t seq)
+{
+  if (sender > SOUND_MESSAGE_MAX_BOARD)
+    return;
+  DedupePeer *peer = &table->peers[sender];
+  if (!peer->known || epoch != peer->epoch)
+  {
+    // First frame, or a fresh window after a reboot
+    peer->known = true;
+    peer->epoch = epoch;
+    peer->newestSeq = seq;
+    peer->seenMask = 1;
+  }
+  else if (seq > peer->newestSeq)
+  {
+    uint32_t shift = seq - peer->newestSeq;
+    peer->seenMask = shift >= DEDUPE_WINDOW ? 1 : (peer->seenMask << shift) | 1;
+    peer->newestSeq = seq;
+  }
+  else
+  {
+    peer->seenMask |= 1UL << (peer->newestSeq - seq);
+  }
+}
+
+void dedupeForget(DedupeTable *table, uint8_t sender)
+{
+  if (sender <= SOUND_MESSAGE_MAX_BOARD)
+    memset(&table->peers[sender], 0, sizeof(table->peers[sender]));
+}
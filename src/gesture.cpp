@@ -0,0 +1,247 @@
+#include "gesture.h"
+
+#include <string.h>
+
+void gestureInit(GestureEngine *engine, uint8_t buttonCount, uint32_t tapMask,
+                 uint16_t multiPressMs, uint16_t longHoldMs, uint16_t dualPressMs)
+{
+  memset(engine, 0, sizeof(*engine));
+  engine->buttonCount = buttonCount;
+  engine->tapMask = tapMask;
+  engine->multiPressMs = multiPressMs;
+  engine->longHoldMs = longHoldMs;
+  engine->dualPressMs = dualPressMs;
+}
+
+void gestureSetMultiPressWindow(GestureEngine *engine, uint16_t multiPressMs)
+{
+  engine->multiPressMs = multiPressMs;
+}
+
+void gestureSetPressStart(GestureEngine *engine, uint32_t pressStartMask)
+{
+  engine->pressStartMask = pressStartMask & engine->tapMask;
+}
+
+// Wrap-safe "now is at least duration after since". Edges from different
+// buttons can arrive slightly out of order, so now may be before since.
+static bool elapsed(uint32_t nowMs, uint32_t sinceMs, uint32_t durationMs)
+{
+  return (int32_t)(nowMs - sinceMs) >= (int32_t)durationMs;
+}
+
+static void emit(GestureEngine *engine, uint8_t type, uint8_t button, uint8_t count,
+                 uint32_t mask, uint32_t timeMs, uint32_t pressMs)
+{
+  // Drop the oldest event rather than the newest if nobody is polling
+  if ((uint8_t)(engine->head - engine->tail) >= GESTURE_QUEUE_SIZE)
+    engine->tail++;
+
+  GestureEvent &event = engine->queue[engine->head & (GESTURE_QUEUE_SIZE - 1)];
+  event.type = type;
+  event.button = button;
+  event.count = count;
+  event.mask = mask;
+  event.timeMs = timeMs;
+  event.pressMs = pressMs;
+  engine->head++;
+}
+
+// Buttons whose gestures are held back by the open chord window
+static uint32_t chordPending(const GestureEngine *engine)
+{
+  return engine->chordOpen ? engine->chordMask : 0;
+}
+
+// Chord arbiter: close the window once dualPressMs has passed since its
+// first edge. Two or more members make a chord that consumes them.
+static void closeChordWindow(GestureEngine *engine, uint32_t nowMs)
+{
+  if (!engine->chordOpen || !elapsed(nowMs, engine->chordStartMs, engine->dualPressMs))
+    return;
+
+  engine->chordOpen = false;
+  uint32_t members = engine->chordMask;
+  if (__builtin_popcount(members) < 2)
+    return; // Lone press, resolves as usual
+
+  for (uint32_t m = members; m; m &= m - 1)
+  {
+    GestureButton &member = engine->buttons[__builtin_ctz(m)];
+    member.state = member.state == GESTURE_DOWN ? GESTURE_HELD_CHORD : GESTURE_IDLE;
+    member.count = 0;
+  }
+  emit(engine, GESTURE_CHORD, 31 - __builtin_clz(members), 0, members,
+       engine->chordStartMs + engine->dualPressMs, engine->chordStartMs);
+}
+
+static void onTapPress(GestureEngine *engine, uint8_t button, uint32_t nowMs)
+{
+  GestureButton &b = engine->buttons[button];
+  bool joinsChord = false;
+
+  // Group press edges that fall inside the window of the first one
+  if (engine->chordOpen)
+  {
+    joinsChord = !(engine->chordMask & (1UL << button));
+    engine->chordMask |= 1UL << button;
+    // Edges from different buttons can arrive slightly out of order
+    if ((int32_t)(nowMs - engine->chordStartMs) < 0)
+      engine->chordStartMs = nowMs;
+  }
+  else
+  {
+    engine->chordOpen = true;
+    engine->chordStartMs = nowMs;
+    engine->chordMask = 1UL << button;
+  }
+
+  if (b.state == GESTURE_UP_WAIT && !elapsed(nowMs, b.lastPressMs, engine->multiPressMs))
+  {
+    b.count++;
+  }
+  else
+  {
+    b.count = 1;
+    b.firstPressMs = nowMs;
+  }
+  b.state = GESTURE_DOWN;
+  b.pressMs = nowMs;
+  b.lastPressMs = nowMs;
+
+  // A press that joins a chord window is most likely not a tap
+  if ((engine->pressStartMask & (1UL << button)) && !joinsChord)
+    emit(engine, GESTURE_PRESS_START, button, b.count, 0, nowMs, b.firstPressMs);
+}
+
+static void onTapRelease(GestureEngine *engine, uint8_t button, uint32_t nowMs)
+{
+  GestureButton &b = engine->buttons[button];
+
+  switch (b.state)
+  {
+  case GESTURE_DOWN:
+    // Window already over while held: resolve at release (unless a chord
+    // window still holds it back, then gestureTick() resolves it)
+    if (elapsed(nowMs, b.lastPressMs, engine->multiPressMs) &&
+        !(chordPending(engine) & (1UL << button)))
+    {
+      emit(engine, GESTURE_PRESS, button, b.count, 0, nowMs, b.firstPressMs);
+      b.state = GESTURE_IDLE;
+      b.count = 0;
+    }
+    else
+    {
+      b.state = GESTURE_UP_WAIT;
+    }
+    break;
+
+  case GESTURE_HELD_LONG:
+  case GESTURE_HELD_CHORD:
+    b.state = GESTURE_IDLE;
+    b.count = 0;
+    break;
+
+  default:
+    break;
+  }
+}
+
+void gestureOnEdge(GestureEngine *engine, uint8_t button, bool pressed, uint32_t nowMs)
+{
+  if (button >= engine->buttonCount)
+    return;
+
+  // Anything due before this edge is resolved first
+  gestureTick(engine, nowMs);
+
+  if (!(engine->tapMask & (1UL << button)))
+  {
+    if (pressed)
+      emit(engine, GESTURE_TRIGGER, button, 1, 0, nowMs, nowMs);
+    return;
+  }
+
+  if (pressed)
+    onTapPress(engine, button, nowMs);
+  else
+    onTapRelease(engine, button, nowMs);
+}
+
+void gestureTick(GestureEngine *engine, uint32_t nowMs)
+{
+  closeChordWindow(engine, nowMs);
+
+  for (uint32_t m = engine->tapMask & ~chordPending(engine); m; m &= m - 1)
+  {
+    int i = __builtin_ctz(m);
+    GestureButton &b = engine->buttons[i];
+
+    if (b.state == GESTURE_DOWN && elapsed(nowMs, b.pressMs, engine->longHoldMs))
+    {
+      emit(engine, GESTURE_LONG_HOLD, i, 0, 0, b.pressMs + engine->longHoldMs, b.pressMs);
+      b.state = GESTURE_HELD_LONG;
+      b.count = 0;
+    }
+    else if (b.state == GESTURE_UP_WAIT && elapsed(nowMs, b.lastPressMs, engine->multiPressMs))
+    {
+      emit(engine, GESTURE_PRESS, i, b.count, 0, b.lastPressMs + engine->multiPressMs, b.firstPressMs);
+      b.state = GESTURE_IDLE;
+      b.count = 0;
+    }
+  }
+}
+
+static void earliest(uint32_t candidate, uint32_t *deadlineMs, bool *found)
+{
+  if (!*found || (int32_t)(candidate - *deadlineMs) < 0)
+    *deadlineMs = candidate;
+  *found = true;
+}
+
+bool gestureNextDeadline(const GestureEngine *engine, uint32_t *deadlineMs)
+{
+  bool found = false;
+
+  // Members of an open chord window resolve after it closes
+  if (engine->chordOpen)
+    earliest(engine->chordStartMs + engine->dualPressMs, deadlineMs, &found);
+
+  for (uint32_t m = engine->tapMask & ~chordPending(engine); m; m &= m - 1)
+  {
+    const GestureButton &b = engine->buttons[__builtin_ctz(m)];
+    if (b.state == GESTURE_DOWN)
+      earliest(b.pressMs + engine->longHoldMs, deadlineMs, &found);
+    else if (b.state == GESTURE_UP_WAIT)
+      earliest(b.lastPressMs + engine->multiPressMs, deadlineMs, &found);
+  }
+  return found;
+}
+
+bool gesturePoll(GestureEngine *engine, GestureEvent *event)
+{
+  if (engine->tail == engine->head)
+    return false;
+  *event = engine->queue[engine->tail & (GESTURE_QUEUE_SIZE - 1)];
+  engine->tail++;
+  return true;
+}
+
+const char *gestureTypeName(uint8_t type)
+{
+  switch (type)
+  {
+  case GESTURE_PRESS:
+    return "press";
+  case GESTURE_LONG_HOLD:
+    return "long-hold";
+  case GESTURE_CHORD:
+    return "chord";
+  case GESTURE_TRIGGER:
+    return "trigger";
+  case GESTURE_PRESS_START:
+    return "press-start";
+  default:
+    return "?";
+  }
+}
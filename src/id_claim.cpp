@@ -0,0 +1,153 @@
+#include "id_claim.h"
+
+#include <string.h>
+
+static bool validId(uint8_t id)
+{
+  return id >= SOUND_MESSAGE_MIN_BOARD && id <= SOUND_MESSAGE_MAX_BOARD;
+}
+
+// Lowest ID nobody else was heard with, preferring ones no other claimer
+// beat us to; 0 when every ID is taken
+static uint8_t lowestFree(const IdClaim *claim)
+{
+  for (int pass = 0; pass < 2; pass++)
+  {
+    BoardMask avoid = pass == 0 ? claim->taken | claim->contested : claim->taken;
+    for (int id = SOUND_MESSAGE_MIN_BOARD; id <= SOUND_MESSAGE_MAX_BOARD; id++)
+    {
+      if (!(avoid & BOARD_BIT(id)))
+        return id;
+    }
+  }
+  return 0;
+}
+
+static void startClaim(IdClaim *claim, uint32_t nowMs)
+{
+  claim->id = lowestFree(claim);
+  claim->claiming = true;
+  claim->claimStartMs = nowMs;
+  claim->nextAnnounceMs = nowMs;
+}
+
+static void move(IdClaim *claim, uint32_t nowMs)
+{
+  claim->moves++;
+  startClaim(claim, nowMs);
+}
+
+void claimInit(IdClaim *claim, const uint8_t *mac, uint8_t fixedId, uint8_t storedId, uint32_t nowMs)
+{
+  memset(claim, 0, sizeof(*claim));
+  memcpy(claim->mac, mac, CLAIM_MAC_LEN);
+  if (validId(fixedId))
+  {
+    claim->id = fixedId;
+    claim->fixed = true;
+  }
+  else if (validId(storedId))
+    claim->id = storedId;
+  else
+    startClaim(claim, nowMs);
+}
+
+uint8_t claimBoardId(const IdClaim *claim)
+{
+  return claim->claiming ? 0 : claim->id;
+}
+
+uint8_t claimPresenceFlags(const IdClaim *claim)
+{
+  return claim->fixed ? SOUND_PRESENCE_FIXED_ID : 0;
+}
+
+uint8_t claimPresenceId(const IdClaim *claim)
+{
+  return claim->claiming ? claim->id : 0;
+}
+
+uint8_t claimOnBoard(IdClaim *claim, uint8_t board, const uint8_t *mac, bool fixed, uint32_t nowMs)
+{
+  if (!validId(board) || memcmp(mac, claim->mac, CLAIM_MAC_LEN) == 0)
+    return CLAIM_NOTHING;
+
+  claim->taken |= BOARD_BIT(board);
+  if (board != claim->id)
+    return CLAIM_NOTHING;
+
+  // It holds the ID we are claiming
+  if (claim->claiming)
+  {
+    move(claim, nowMs);
+    return CLAIM_MOVED;
+  }
+
+  if (claim->fixed && fixed)
+    return CLAIM_DUPLICATE;
+  bool lowerMac = memcmp(claim->mac, mac, CLAIM_MAC_LEN) < 0;
+  if ((claim->fixed && !fixed) || (!fixed && lowerMac))
+    return CLAIM_ANSWER;
+  move(claim, nowMs);
+  return CLAIM_MOVED;
+}
+
+uint8_t claimOnClaim(IdClaim *claim, uint8_t id, const uint8_t *mac, uint32_t nowMs)
+{
+  if (!validId(id) || memcmp(mac, claim->mac, CLAIM_MAC_LEN) == 0)
+    return CLAIM_NOTHING;
+
+  // Holders answer every claim, defending theirs or just saying it's taken
+  if (!claim->claiming)
+    return CLAIM_ANSWER;
+  // Claimers spread out over the free IDs instead of all trying the lowest
+  if (id != claim->id)
+  {
+    claim->contested |= BOARD_BIT(id);
+    return CLAIM_NOTHING;
+  }
+
+  if (memcmp(claim->mac, mac, CLAIM_MAC_LEN) < 0)
+    return CLAIM_ANSWER;
+  claim->contested |= BOARD_BIT(id);
+  move(claim, nowMs);
+  return CLAIM_MOVED;
+}
+
+uint8_t claimPoll(IdClaim *claim, uint32_t nowMs)
+{
+  if (!claim->claiming)
+    return CLAIM_NOTHING;
+
+  if (claim->id == 0)
+  {
+    // Every ID was taken, try again in case one was contested
+    startClaim(claim, nowMs);
+    if (claim->id == 0)
+    {
+      claim->nextAnnounceMs = nowMs + CLAIM_SETTLE_MS;
+      return CLAIM_NOTHING;
+    }
+  }
+
+  if (nowMs - claim->claimStartMs >= CLAIM_SETTLE_MS)
+  {
+    claim->claiming = false;
+    return CLAIM_SETTLED;
+  }
+  if ((int32_t)(nowMs - claim->nextAnnounceMs) >= 0)
+  {
+    claim->nextAnnounceMs = nowMs + CLAIM_ANNOUNCE_MS;
+    return CLAIM_ANNOUNCE;
+  }
+  return CLAIM_NOTHING;
+}
+
+bool claimNextDeadline(const IdClaim *claim, uint32_t *dueMs)
+{
+  if (!claim->claiming)
+    return false;
+  uint32_t settleMs = claim->claimStartMs + CLAIM_SETTLE_MS;
+  *dueMs = (int32_t)(claim->nextAnnounceMs - settleMs) < 0 ? claim->nextAnnounceMs : settleMs;
+  return true;
+}
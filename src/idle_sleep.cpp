@@ -0,0 +1,158 @@
+#include "idle_sleep.h"
+
+#include <esp_sleep.h>
+#include "audio_player.h"
+#include "button_input.h"
+#include "event_loop.h"
+
+static bool sleepEnabled = false;
+static uint16_t sleepBudget = 0;
+static uint16_t sliceMs = 0;
+
+static volatile uint32_t lastActivityMs = 0; // Also written from the WiFi task
+static uint32_t lastWakeMs = 0;
+static int64_t enabledAtUs = 0;
+
+static uint32_t sleepCount = 0;
+static uint32_t buttonWakes = 0;
+static uint32_t timerWakes = 0;
+static uint64_t sleptUs = 0;
+
+// Written from the WiFi task, only read elsewhere
+static volatile uint32_t framesArrived = 0;
+static volatile uint32_t framesLate = 0; // Not the first copy
+static volatile uint32_t lateTotalMs = 0;
+static volatile uint32_t lateMaxMs = 0;
+
+static void sleepFor(uint32_t ms)
+{
+  armButtonWakeup();
+  esp_sleep_enable_gpio_wakeup();
+  esp_sleep_enable_timer_wakeup((uint64_t)ms * 1000);
+
+  uint32_t startUs = micros();
+  esp_light_sleep_start();
+  // esp_timer (and with it millis()/micros()) is corrected for the time asleep
+  uint32_t wakeUs = micros();
+
+  disarmButtonWakeup();
+  lastWakeMs = millis();
+  sleepCount++;
+  sleptUs += wakeUs - startUs;
+
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO)
+  {
+    buttonWakes++;
+    queueWakeEdges(wakeUs);
+  }
+  else
+  {
+    timerWakes++;
+  }
+}
+
+static uint32_t onLoopIdle(uint32_t idleMs)
+{
+  uint32_t now = millis();
+
+  // Recent input, or the listen window after the last wakeup
+  int32_t holdMs = lastActivityMs + SLEEP_ACTIVITY_HOLD_MS - now;
+  int32_t listenMs = lastWakeMs + SLEEP_LISTEN_MS - now;
+  if (holdMs > 0 || listenMs > 0)
+    return max(holdMs, listenMs);
+
+  if (audioIsPlaying() || !buttonsIdle())
+    return SLEEP_BUSY_POLL_MS;
+
+  if (idleMs < SLEEP_MIN_MS)
+    return idleMs;
+
+  sleepFor(min(idleMs, (uint32_t)sliceMs));
+  return 0;
+}
+
+bool idleSleepInit(uint16_t budgetMs)
+{
+  sleepBudget = budgetMs;
+  if (budgetMs == 0)
+    return false;
+
+  if (budgetMs < SLEEP_LISTEN_MS + SLEEP_MIN_MS)
+  {
+    Serial.printf("sleep_budget_ms %u leaves no time to sleep (min %d), staying awake\n",
+                  budgetMs, SLEEP_LISTEN_MS + SLEEP_MIN_MS);
+    return false;
+  }
+
+  sliceMs = budgetMs - SLEEP_LISTEN_MS;
+  sleepEnabled = true;
+  lastActivityMs = millis();
+  enabledAtUs = esp_timer_get_time();
+  eventLoopSetIdleHook(onLoopIdle);
+  Serial.printf("Light sleep when idle: %u ms slices, %d ms listen windows\n",
+                sliceMs, SLEEP_LISTEN_MS);
+  return true;
+}
+
+void idleSleepActivity()
+{
+  lastActivityMs = millis();
+}
+
+void idleSleepFrameArrived(uint8_t copy)
+{
+  framesArrived++;
+  if (copy == 0)
+    return;
+  uint32_t lateMs = (uint32_t)copy * (SLEEP_LISTEN_MS / 2);
+  framesLate++;
+  lateTotalMs += lateMs;
+  if (lateMs > lateMaxMs)
+    lateMaxMs = lateMs;
+}
+
+uint16_t idleSleepBudget()
+{
+  return sleepEnabled ? sleepBudget : 0;
+}
+
+uint8_t idleSleepRepeats(uint16_t budgetMs, uint16_t *intervalMs)
+{
+  *intervalMs = SLEEP_LISTEN_MS / 2;
+  if (budgetMs < SLEEP_LISTEN_MS + SLEEP_MIN_MS)
+    return 1;
+  // Cover one whole slice plus listen window
+  uint32_t repeats = (budgetMs + *intervalMs - 1) / *intervalMs;
+  return repeats > 0xFF ? 0xFF : repeats;
+}
+
+void printSleepStats()
+{
+  if (!sleepEnabled)
+  {
+    Serial.println("Light sleep off (sleep_budget_ms in config.txt)");
+    return;
+  }
+
+  uint64_t totalUs = esp_timer_get_time() - enabledAtUs;
+  uint64_t asleepUs = sleptUs < totalUs ? sleptUs : totalUs;
+  uint32_t asleepPct = totalUs ? asleepUs * 100 / totalUs : 0;
+  uint32_t averageUa = totalUs ? (asleepUs * SLEEP_CURRENT_UA +
+                                  (totalUs - asleepUs) * AWAKE_CURRENT_UA) / totalUs
+                               : AWAKE_CURRENT_UA;
+
+  Serial.printf("Light sleep: budget %u ms (%u ms slices, %d ms listen)\n",
+                sleepBudget, sliceMs, SLEEP_LISTEN_MS);
+  Serial.printf("  %lu sleeps: %lu woken by a button, %lu by the timer\n",
+                (unsigned long)sleepCount, (unsigned long)buttonWakes, (unsigned long)timerWakes);
+  Serial.printf("  Asleep %lu%% of %lu s, average current %lu.%lu mA (datasheet estimate, not measured)\n",
+                (unsigned long)asleepPct, (unsigned long)(totalUs / 1000000),
+                (unsigned long)(averageUa / 1000), (unsigned long)(averageUa % 1000 / 100));
+  uint32_t late = framesLate;
+  Serial.printf("  %lu frames received, %lu heard only from a later copy",
+                (unsigned long)framesArrived, (unsigned long)late);
+  if (late)
+    Serial.printf(": %lu ms late on average, %lu ms at most", (unsigned long)(lateTotalMs / late),
+                  (unsigned long)lateMaxMs);
+  Serial.println();
+}
@@ -0,0 +1,109 @@
+#include "init_scheduler.h"
+
+#include "freertos/event_groups.h"
+
+static EventGroupHandle_t initDone = NULL;
+static volatile uint32_t failedMask = 0;
+static portMUX_TYPE failedMux = portMUX_INITIALIZER_UNLOCKED;
+
+static void runInitStep(const InitStep *step)
+{
+  if (step->dependsOn)
+  {
+    xEventGroupWaitBits(initDone, step->dependsOn, pdFALSE, pdTRUE, portMAX_DELAY);
+  }
+
+  bool ok = false;
+  if (failedMask & step->dependsOn)
+  {
+    Serial.printf("Init step %s skipped (dependency failed)\n", bootPhaseName(step->phase));
+  }
+  else
+  {
+    bootPhaseStart(step->phase);
+    ok = step->run();
+    bootPhaseEnd(step->phase);
+  }
+
+  if (!ok)
+  {
+    portENTER_CRITICAL(&failedMux);
+    failedMask |= INIT_DEP(step->phase);
+    portEXIT_CRITICAL(&failedMux);
+  }
+  xEventGroupSetBits(initDone, INIT_DEP(step->phase));
+}
+
+static void initStepTask(void *param)
+{
+  runInitStep((const InitStep *)param);
+  vTaskDelete(NULL);
+}
+
+void runInitSteps(const InitStep *steps, int count)
+{
+  initDone = xEventGroupCreate();
+  failedMask = 0;
+
+  uint32_t allSteps = 0;
+  for (int i = 0; i < count; i++)
+  {
+    allSteps |= INIT_DEP(steps[i].phase);
+    if (xTaskCreate(initStepTask, "init", INIT_TASK_STACK, (void *)&steps[i], 2, NULL) != pdPASS)
+    {
+      // Out of memory for a task, run inline (dependencies were listed earlier)
+      runInitStep(&steps[i]);
+    }
+  }
+
+  xEventGroupWaitBits(initDone, allSteps, pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
+bool initStepSucceeded(BootPhase phase)
+{
+  return !(failedMask & INIT_DEP(phase));
+}
+
+void printInitCriticalPath(const InitStep *steps, int count)
+{
+  // Start from the step that finished last and walk back through the
+  // dependency that finished last at each hop
+  const InitStep *chain[BOOT_PHASE_COUNT];
+  int length = 0;
+
+  const InitStep *current = NULL;
+  for (int i = 0; i < count; i++)
+  {
+    if (!current || bootPhaseEndMicros(steps[i].phase) > bootPhaseEndMicros(current->phase))
+      current = &steps[i];
+  }
+
+  while (current && length < BOOT_PHASE_COUNT)
+  {
+    chain[length++] = current;
+    const InitStep *next = NULL;
+    for (int i = 0; i < count; i++)
+    {
+      if ((current->dependsOn & INIT_DEP(steps[i].phase)) &&
+          (!next || bootPhaseEndMicros(steps[i].phase) > bootPhaseEndMicros(next->phase)))
+        next = &steps[i];
+    }
+    current = next;
+  }
+
+  uint32_t pathUs = 0;
+  uint32_t serialUs = 0;
+  for (int i = 0; i < count; i++)
+    serialUs += bootPhaseMicros(steps[i].phase);
+
+  Serial.print("Critical path:");
+  for (int i = length - 1; i >= 0; i--)
+  {
+    uint32_t us = bootPhaseMicros(chain[i]->phase);
+    pathUs += us;
+    Serial.printf(" %s %lums%s", bootPhaseName(chain[i]->phase), (unsigned long)(us / 1000),
+                  i > 0 ? " ->" : "");
+  }
+  Serial.printf(" = %lums (sequential would be %lums)\n",
+                (unsigned long)(pathUs / 1000), (unsigned long)(serialUs / 1000));
+}
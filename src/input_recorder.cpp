@@ -0,0 +1,136 @@
+#include "input_recorder.h"
+
+#include <Arduino.h>
+
+static uint8_t ring[RECORDER_RING_SIZE];
+static size_t ringHead = 0;  // Next byte to write
+static size_t ringUsed = 0;  // Bytes from the oldest record to head
+static RecordingHeader header;
+static uint16_t oldestWindowMs;  // Window in effect at the oldest retained record
+static uint16_t currentWindowMs; // Window in effect now
+static portMUX_TYPE recorderMux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t ringAt(size_t offset)
+{
+  return ring[(ringHead + RECORDER_RING_SIZE - ringUsed + offset) % RECORDER_RING_SIZE];
+}
+
+// Drop the oldest record, keeping track of the window it may have changed
+static void dropOldest()
+{
+  uint8_t type = ringAt(0);
+  uint8_t len = ringAt(1);
+  if (type == REC_WINDOW && len == sizeof(RecWindow))
+  {
+    oldestWindowMs = ringAt(2 + offsetof(RecWindow, newMs)) |
+                     (ringAt(3 + offsetof(RecWindow, newMs)) << 8);
+  }
+  ringUsed -= 2 + len;
+  header.dropped++;
+}
+
+static void putByte(uint8_t b)
+{
+  ring[ringHead] = b;
+  ringHead = (ringHead + 1) % RECORDER_RING_SIZE;
+  ringUsed++;
+}
+
+// Frames arrive on the WiFi task, everything else on the loop task
+static void append(uint8_t type, const void *a, size_t aLen, const void *b = NULL, size_t bLen = 0)
+{
+  size_t len = aLen + bLen;
+  if (len > 255)
+    return;
+
+  portENTER_CRITICAL(&recorderMux);
+  while (ringUsed + 2 + len > RECORDER_RING_SIZE)
+    dropOldest();
+  if (ringUsed == 0)
+    oldestWindowMs = currentWindowMs;
+
+  putByte(type);
+  putByte(len);
+  for (size_t i = 0; i < aLen; i++)
+    putByte(((const uint8_t *)a)[i]);
+  for (size_t i = 0; i < bLen; i++)
+    putByte(((const uint8_t *)b)[i]);
+  portEXIT_CRITICAL(&recorderMux);
+}
+
+void recorderBegin(const RecordingHeader *config)
+{
+  header = *config;
+  header.magic = RECORDER_MAGIC;
+  header.version = RECORDER_VERSION;
+  currentWindowMs = config->multiPressMs;
+  recorderClear();
+}
+
+void recordPass(uint32_t nowMs, uint32_t nowUs)
+{
+  RecPass pass = {nowMs, nowUs};
+  append(REC_PASS, &pass, sizeof(pass));
+}
+
+void recordEdge(uint32_t timestampUs, uint8_t button, bool pressed)
+{
+  RecEdge edge = {timestampUs, button, pressed};
+  append(REC_EDGE, &edge, sizeof(edge));
+}
+
+void recordFrame(uint32_t nowMs, const uint8_t *data, int len)
+{
+  RecFrame frame = {nowMs};
+  append(REC_FRAME, &frame, sizeof(frame), data, len > 0 ? len : 0);
+}
+
+void recordWindow(uint16_t oldMs, uint16_t newMs)
+{
+  RecWindow window = {oldMs, newMs};
+  append(REC_WINDOW, &window, sizeof(window));
+  currentWindowMs = newMs;
+}
+
+void recorderClear()
+{
+  portENTER_CRITICAL(&recorderMux);
+  ringHead = 0;
+  ringUsed = 0;
+  header.dropped = 0;
+  portEXIT_CRITICAL(&recorderMux);
+}
+
+static void printHex(char tag, const uint8_t *bytes, size_t len)
+{
+  char line[2 + 64 + 1];
+  for (size_t pos = 0; pos < len; pos += 32)
+  {
+    size_t n = min((size_t)32, len - pos);
+    line[0] = tag;
+    line[1] = ' ';
+    for (size_t i = 0; i < n; i++)
+      sprintf(line + 2 + i * 2, "%02x", bytes[pos + i]);
+    Serial.println(line);
+  }
+}
+
+void recorderDump()
+{
+  // Snapshot so recording can go on while the (slow) dump is printed
+  static uint8_t snapshot[RECORDER_RING_SIZE];
+  RecordingHeader out;
+
+  portENTER_CRITICAL(&recorderMux);
+  out = header;
+  out.multiPressMs = ringUsed ? oldestWindowMs : currentWindowMs;
+  out.length = ringUsed;
+  for (size_t i = 0; i < ringUsed; i++)
+    snapshot[i] = ringAt(i);
+  portEXIT_CRITICAL(&recorderMux);
+
+  Serial.printf("=== input recording v%d ===\n", RECORDER_VERSION);
+  printHex('H', (const uint8_t *)&out, sizeof(out));
+  printHex('R', snapshot, out.length);
+  Serial.println("=== end ===");
+}
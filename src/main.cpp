@@ -1,9 +1,28 @@
 #include <Arduino.h>
+#include <Preferences.h>
 #include <SD.h>
 #include <SPI.h>
-#include <driver/i2s.h>
 #include <esp_now.h>
+#include <esp_wifi.h>
 #include <WiFi.h>
+#include "board_config.h"
+#include "audio_player.h"
+#include "boot_trace.h"
+#include "button_input.h"
+#include "catalog_cache.h"
+#include "clock_sync.h"
+#include "dispatch.h"
+#include "event_loop.h"
+#include "gesture.h"
+#include "id_claim.h"
+#include "idle_sleep.h"
+#include "init_scheduler.h"
+#include "input_recorder.h"
+#include "peer_table.h"
+#include "press_cadence.h"
+#include "reliable_link.h"
+#include "serial_console.h"
+#include "sound_message.h"
 
 // SD card pin definitions for ESP32-C3
 #define SD_CS_PIN 5   // D3 -> CS
@@ -11,190 +30,182 @@
 #define SD_MISO_PIN 3 // D1 -> DO
 #define SD_SCK_PIN 2  // D0 -> CLK
 
-// I2S pins for MAX98357A (correct GPIO mapping for XIAO ESP32-C3)
-#define I2S_DOUT 21 // D6 -> DIN (GPIO21, not GPIO6)
-#define I2S_BCLK 20 // D7 -> BCLK (GPIO20, not GPIO7)
-#define I2S_LRC 8   // D8 -> LRC (GPIO8)
-
-// Button pin definitions
-#define BUTTON_RED 6     // GPIO6 (D4)
-#define BUTTON_GREEN 9   // GPIO9 (D9)
-#define BUTTON_BLUE 7    // GPIO7 (D5)
-#define BUTTON_YELLOW 10 // GPIO10 (D10)
-
-// Button timing constants
-#define DEBOUNCE_DELAY 50
-#define DUAL_PRESS_WINDOW 100
-#define BUTTON_TIMEOUT 5000
-#define LONG_HOLD_DURATION 1000 // 1 second for long hold
-#define MULTI_PRESS_WINDOW 500  // 500ms window for counting multiple presses
-
-// I2S configuration
-#define I2S_NUM I2S_NUM_0
-#define SAMPLE_RATE 44100
-#define BITS_PER_SAMPLE I2S_BITS_PER_SAMPLE_16BIT
-#define CHANNEL_FORMAT I2S_CHANNEL_FMT_RIGHT_LEFT
-#define BUFFER_SIZE 1024
-
-// Software gain control for MAX98357A with 3W @ 4Ω speakers
-// At 3.3V supply: Theoretical max ~2.7W (limited by supply voltage)
-// Software gain set to 1.0 (100%) to maximize loudness
-// Safe: 3.3V supply limits output well below 3W speaker rating
-#define SOFTWARE_GAIN 1.0
+// Buttons in config.txt are kept off these (board_config.h)
+#define PERIPHERAL_GPIOS (1UL << SD_CS_PIN | 1UL << SD_MOSI_PIN | 1UL << SD_MISO_PIN | 1UL << SD_SCK_PIN | \
+                          1UL << I2S_DOUT | 1UL << I2S_BCLK | 1UL << I2S_LRC)
+static_assert((CONFIG_RESERVED_GPIOS & PERIPHERAL_GPIOS) == PERIPHERAL_GPIOS,
+              "a peripheral pin is missing from CONFIG_RESERVED_GPIOS");
 
-// ESP-NOW broadcast address
-uint8_t broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+// Boot readiness timeouts
+#define SERIAL_ATTACH_TIMEOUT 500 // Don't hold up boot when no USB host is attached
+#define SD_IDLE_TIMEOUT 250       // Max time to wait for the card to answer CMD0
 
-// ESP-NOW message structure
-struct ESPNowMessage
-{
-  uint8_t senderBoardId;
-  uint8_t targetBoardId;
-  char soundFile[64];
-  uint32_t timestamp;
-  uint8_t checksum;
-};
 
-// Button state structure
-struct ButtonState
-{
-  uint8_t pin;
-  bool currentState;
-  bool lastState;
-  unsigned long lastDebounceTime;
-  bool pressed;
-  unsigned long pressStartTime; // When button was first pressed
-  bool longHoldTriggered;       // Has long hold been triggered
-  unsigned long lastPressTime;  // For multi-press detection
-  uint8_t pressCount;           // Number of presses in window
-};
+#define FIRMWARE_VERSION 2 // Sent in heartbeats, bump when the firmware changes
+#define CLOCK_FIRMWARE 2   // First firmware that keeps the fleet clock
+#define SYNC_MAX_AHEAD_US 2000000 // Start times further off than this are bogus, play now
 
-// Global variables
-ButtonState redButton = {BUTTON_RED, false, false, 0, false, 0, false, 0, 0};
-ButtonState greenButton = {BUTTON_GREEN, false, false, 0, false, 0, false, 0, 0};
-ButtonState blueButton = {BUTTON_BLUE, false, false, 0, false, 0, false, 0, 0};
-ButtonState yellowButton = {BUTTON_YELLOW, false, false, 0, false, 0, false, 0, 0};
+#define SEND_REPEAT_SLOTS 4 // Frames being repeated for sleeping boards at once
+#define ESPNOW_ACTION_CATEGORY 127 // Vendor-specific action frame, then Espressif's OUI
+#define ESPNOW_ACTION_MIN_LEN 28    // MAC header, category and OUI
+#define FRAME_EPOCH_NAMESPACE "frames"
+#define BOARD_ID_NAMESPACE "board"
+
+// ESP-NOW broadcast address
+uint8_t broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
+// Global variables
 String soundFiles[30]; // Array to store sound file names
 int soundFileCount = 0;
-uint8_t boardId = 0; // Board ID loaded from SD card
+volatile bool catalogReady = false; // Set once the background discovery has published soundFiles
+uint32_t catalogFingerprint = 0;
+uint8_t boardId = 0; // Set by hand (SD card) or negotiated, 0 while claiming one
+uint8_t storedBoardId = 0; // Negotiated at an earlier boot (NVS)
+BoardConfig boardConfig; // Tuning loaded from /config.txt (defaults otherwise)
 
-// Sound file assignments (loaded from SD card by index)
-String greenSound = "";
-String blueSound = "";
-String yellowSound = "";
+// Sound file assignments per button (by catalog index unless configured)
+String buttonSounds[MAX_BUTTONS];
 
 // Current sounds (can be changed by long-hold)
-String currentGreenSound = "";
-String currentBlueSound = "";
-String currentYellowSound = "";
-
-bool isPlaying = false;
+String currentSounds[MAX_BUTTONS];
+
+GestureEngine gestures;
+
+LoopTimer inputTimer;   // Next debounce settle or gesture deadline
+LoopTimer repeatTimer;  // Repeats sent frames for boards in light sleep
+LoopTimer flushTimer;   // Sends the commands batched during one loop pass
+LoopTimer linkTimer;    // Next retransmission (reliable_delivery)
+LoopTimer heartbeatTimer;
+LoopTimer claimTimer;    // Claim frames and settling while the board has no ID
+LoopTimer clockTimer;    // Master election and time requests (clock_sync.h)
+
+// Outgoing v2 frame, commands queued in the same pass share it
+uint8_t outFrame[SOUND_FRAME_MAX_LEN];
+SoundFrameWriter outWriter;
+bool outPending = false;
+uint32_t outSeq = 0;
+BoardMask outTargets = 0;      // Boards asked to ack outFrame
+BoardMask outDestinations = 0; // Boards outFrame is addressed to, 0 = everyone
+uint32_t lastFrameTimestamp = 0;
+uint32_t frameEpoch = 0; // Boot counter, see frame_dedupe.h
+uint32_t nextFrameSeq = 1;
+uint32_t lastBroadcastMs = 0; // Any broadcast frame doubles as a heartbeat
+uint32_t heartbeatIntervalMs = HEARTBEAT_MIN_MS;
+bool presenceChanged = false; // Playback started or ended since our last broadcast
+
+ReliableLink link; // Frames waiting for acks, loop task only
+
+// Learned MACs: written by the WiFi task (frames, send results), read when
+// sending from the loop task
+PeerTable peers;
+portMUX_TYPE peerMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Automatic board ID: frames update it on the WiFi task, the claim timer
+// on the loop task
+IdClaim idClaim;
+portMUX_TYPE claimMux = portMUX_INITIALIZER_UNLOCKED;
+bool duplicateIdReported = false;
+
+// Fleet clock: time frames update it on the WiFi task, elections and
+// requests run on the loop task
+ClockSync clockSync;
+portMUX_TYPE clockMux = portMUX_INITIALIZER_UNLOCKED;
+
+// MAC and RSSI of the last ESP-NOW frame, seen by the promiscuous callback
+// just before onDataReceive() (both run on the WiFi task)
+uint8_t lastRxMac[PEER_MAC_LEN];
+int8_t lastRxRssi = 0;
+volatile uint32_t sniffedFrames = 0; // Management frames the promiscuous callback got
+volatile uint32_t sniffedEspNow = 0; // Of those, ESP-NOW frames
+const uint8_t espressifOui[3] = {0x18, 0xFE, 0x34};
+
+// esp_timer time the frame being handled arrived (WiFi task)
+int64_t frameArrivedUs = 0;
+
+// Receive side load, WiFi task only
+uint32_t framesReceived = 0;
+uint32_t framesIgnored = 0; // Nothing in them for this board
+uint64_t receiveUs = 0;     // Spent in onDataReceive
+
+// Frames still to be repeated (idle_sleep.h), remaining = 0 marks a free slot
+struct PendingRepeat
+{
+  uint8_t data[SOUND_FRAME_MAX_LEN];
+  uint8_t len;
+  uint8_t remaining;
+  uint8_t copy;    // Of the last one sent
+  int copyOffset;  // Where the frame numbers its copies, -1 if it doesn't
+  uint8_t mac[PEER_MAC_LEN];
+};
+PendingRepeat pendingRepeats[SEND_REPEAT_SLOTS];
+volatile uint32_t quietSends = 0; // Repeats whose send status isn't logged
 
-uint8_t audioBuffer[BUFFER_SIZE];
-int16_t processedBuffer[BUFFER_SIZE / 2]; // For 16-bit audio processing
+// What gestures do (speculative playback, prefetch, sends), see dispatch.h.
+// Gestures run on the loop task, received frames on the WiFi task.
+Dispatcher gestureDispatch;
+Dispatcher frameDispatch;
 
 // Function declarations
-void setupI2S();
-void setupESPNow();
-void initButtons();
+bool setupRadio();
+bool setupESPNow();
+bool loadBoardConfig();
 bool loadBoardId();
 void discoverSoundFiles();
-void assignSoundsByIndex();
+bool scanSoundFiles();
+void startCatalogDiscovery();
+bool assignSoundsByIndex(const String *firstSounds);
 String getRandomSound();
 uint8_t getRandomBoardId();
-void updateButton(ButtonState *btn);
-void updateAllButtons();
-bool isButtonPressed(ButtonState *btn);
-int countPressedButtons();
 void handleButtons();
-void handleSingleButtonPress();
-void handleDualButtonPress();
-void handleRedButtonPress();
-void sendSoundCommand(uint8_t targetBoard, const char *soundFile);
-uint8_t calculateChecksum(const ESPNowMessage *msg);
-bool validateMessage(const ESPNowMessage *msg);
+void handleGesture(const GestureEvent &gesture);
+void runActions(const Action *actions, int count);
+void sendSoundCommand(uint8_t targetBoard, const char *soundFile, bool scheduled = false,
+                      uint32_t start = 0);
+void sendSoundToBoards(BoardMask targets, const char *soundFile, bool scheduled = false,
+                       uint32_t start = 0);
 void onDataReceive(const uint8_t *mac, const uint8_t *data, int len);
 void onDataSent(const uint8_t *mac_addr, esp_now_send_status_t status);
-void playWAVFile(const char *filename);
+void registerPeers();
 bool initializeSDCard();
 
-// Audio processing functions
-int16_t applyVolumeControl(int16_t sample, float volume)
-{
-  // Apply volume scaling with soft limiting to prevent crackling
-  int32_t scaled = (int32_t)(sample * volume);
-
-  // Soft limiting to prevent harsh clipping that causes crackling
-  if (scaled > 28000)
-    scaled = 28000 + (scaled - 28000) / 4;
-  if (scaled < -28000)
-    scaled = -28000 + (scaled + 28000) / 4;
-
-  // Final hard clamp
-  if (scaled > 32767)
-    scaled = 32767;
-  if (scaled < -32768)
-    scaled = -32768;
-
-  return (int16_t)scaled;
-}
-
-void processAudioBuffer(uint8_t *rawBuffer, int16_t *processedBuffer, size_t bytesRead)
-{
-  // Convert bytes to 16-bit samples and apply volume control
-  size_t sampleCount = bytesRead / 2; // 16-bit = 2 bytes per sample
-
-  for (size_t i = 0; i < sampleCount; i++)
-  {
-    // Convert little-endian bytes to 16-bit sample
-    int16_t sample = (int16_t)(rawBuffer[i * 2] | (rawBuffer[i * 2 + 1] << 8));
-
-    // Apply software gain and limiting
-    processedBuffer[i] = applyVolumeControl(sample, SOFTWARE_GAIN);
-  }
-}
-
-void setupI2S()
+// Poll the card with CMD0 (GO_IDLE_STATE) until it reports R1 idle
+bool waitForCardIdle(unsigned long timeoutMs)
 {
-  // Uninstall any existing I2S driver
-  i2s_driver_uninstall(I2S_NUM);
-
-  i2s_config_t i2s_config = {
-      .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),
-      .sample_rate = SAMPLE_RATE,
-      .bits_per_sample = BITS_PER_SAMPLE,
-      .channel_format = CHANNEL_FORMAT,
-      .communication_format = I2S_COMM_FORMAT_STAND_I2S,
-      .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-      .dma_buf_count = 16,
-      .dma_buf_len = 128,
-      .use_apll = true,
-      .tx_desc_auto_clear = true,
-      .fixed_mclk = 0};
-
-  i2s_pin_config_t pin_config = {
-      .bck_io_num = I2S_BCLK,
-      .ws_io_num = I2S_LRC,
-      .data_out_num = I2S_DOUT,
-      .data_in_num = I2S_PIN_NO_CHANGE};
+  unsigned long start = millis();
+  SPI.beginTransaction(SPISettings(400000, MSBFIRST, SPI_MODE0));
 
-  esp_err_t err = i2s_driver_install(I2S_NUM, &i2s_config, 0, NULL);
-  if (err != ESP_OK)
+  // At least 74 clocks with CS high put the card into native mode
+  digitalWrite(SD_CS_PIN, HIGH);
+  for (int i = 0; i < 10; i++)
   {
-    Serial.printf("I2S driver install failed: %s\n", esp_err_to_name(err));
-    return;
+    SPI.transfer(0xFF);
   }
 
-  err = i2s_set_pin(I2S_NUM, &pin_config);
-  if (err != ESP_OK)
+  bool idle = false;
+  while (!idle && millis() - start < timeoutMs)
   {
-    Serial.printf("I2S pin config failed: %s\n", esp_err_to_name(err));
-    return;
+    digitalWrite(SD_CS_PIN, LOW);
+    const uint8_t cmd0[] = {0x40, 0x00, 0x00, 0x00, 0x00, 0x95};
+    for (uint8_t b : cmd0)
+    {
+      SPI.transfer(b);
+    }
+    // R1 arrives within 8 bytes (NCR)
+    for (int i = 0; i < 8; i++)
+    {
+      uint8_t r1 = SPI.transfer(0xFF);
+      if (r1 != 0xFF)
+      {
+        idle = (r1 == 0x01);
+        break;
+      }
+    }
+    digitalWrite(SD_CS_PIN, HIGH);
+    SPI.transfer(0xFF);
   }
 
-  i2s_zero_dma_buffer(I2S_NUM);
-  Serial.println("I2S initialized successfully");
+  SPI.endTransaction();
+  return idle;
 }
 
 bool initializeSDCard()
@@ -204,25 +215,20 @@ bool initializeSDCard()
   // End any previous SD card session and SPI
   SD.end();
   SPI.end();
-  delay(200);
 
   // Configure CS pin as output and set HIGH (deselect) BEFORE SPI.begin
   pinMode(SD_CS_PIN, OUTPUT);
   digitalWrite(SD_CS_PIN, HIGH);
-  delay(100);
 
   // Initialize SPI with custom pins
   // Note: SPI.begin() parameter order is (SCK, MISO, MOSI, SS)
   SPI.begin(SD_SCK_PIN, SD_MISO_PIN, SD_MOSI_PIN, SD_CS_PIN);
-  delay(300);
 
-  // Send some clock pulses to wake up the SD card
-  digitalWrite(SD_CS_PIN, HIGH);
-  for (int i = 0; i < 10; i++)
+  // Wake the card and wait until it is actually idle instead of sleeping
+  if (!waitForCardIdle(SD_IDLE_TIMEOUT))
   {
-    SPI.transfer(0xFF);
+    Serial.println("SD card did not report idle - trying SD.begin() anyway");
   }
-  delay(100);
 
   // Try initialization with explicit SPI bus and lower speed for reliability
   Serial.println("Attempting SD.begin() with 4MHz clock...");
@@ -231,14 +237,14 @@ bool initializeSDCard()
     Serial.println("SD card initialization failed at 4MHz");
 
     // Try with 1MHz
-    delay(500);
+    waitForCardIdle(SD_IDLE_TIMEOUT);
     Serial.println("Retrying with 1MHz clock...");
     if (!SD.begin(SD_CS_PIN, SPI, 1000000))
     {
       Serial.println("SD card initialization failed at 1MHz");
 
       // Try one more time with even slower speed
-      delay(500);
+      waitForCardIdle(SD_IDLE_TIMEOUT);
       Serial.println("Retrying with 400kHz clock...");
       if (!SD.begin(SD_CS_PIN, SPI, 400000))
       {
@@ -280,38 +286,144 @@ bool initializeSDCard()
   return true;
 }
 
-// Load board ID from SD card
+void onConfigError(int line, const char *message)
+{
+  Serial.printf("%s:%d: %s\n", CONFIG_FILE_PATH + 1, line, message);
+}
+
+// Load /config.txt with a single read. The board ID comes from its
+// board_id, the legacy N.txt files, or else is negotiated over ESP-NOW
+// (id_claim.h) starting from the one stored last time.
+bool loadBoardConfig()
+{
+  setConfigDefaults(&boardConfig);
+
+  File configFile = SD.open(CONFIG_FILE_PATH);
+  if (configFile)
+  {
+    size_t size = configFile.size();
+    if (size > CONFIG_MAX_FILE_SIZE)
+    {
+      Serial.printf("%s too large (%u bytes), ignoring\n", CONFIG_FILE_PATH, size);
+    }
+    else
+    {
+      char *text = (char *)malloc(size + 1);
+      if (text)
+      {
+        size_t bytesRead = configFile.read((uint8_t *)text, size);
+        int errors = parseConfig(text, bytesRead, &boardConfig, onConfigError);
+        free(text);
+        Serial.printf("Loaded %s (%d error%s)\n", CONFIG_FILE_PATH, errors, errors == 1 ? "" : "s");
+      }
+    }
+    configFile.close();
+  }
+
+  if (boardConfig.boardId != 0)
+  {
+    boardId = boardConfig.boardId;
+    Serial.printf("Board ID set to %d from %s\n", boardId, CONFIG_FILE_PATH);
+    return true;
+  }
+  if (loadBoardId())
+    return true;
+
+  Preferences prefs;
+  if (prefs.begin(BOARD_ID_NAMESPACE, true))
+  {
+    storedBoardId = prefs.getUChar("id", 0);
+    prefs.end();
+  }
+  if (storedBoardId < SOUND_MESSAGE_MIN_BOARD || storedBoardId > SOUND_MESSAGE_MAX_BOARD)
+    storedBoardId = 0;
+
+  // Claims need v2 frames
+  if (storedBoardId == 0 && boardConfig.wireVersion == 1)
+  {
+    Serial.println("ERROR: wire_version = 1 needs a board ID set by hand");
+    return false;
+  }
+  Serial.println("No board ID set by hand, negotiating one");
+  return true;
+}
+
+// Legacy board ID from SD card (1.txt, 2.txt, ...), one walk of the root
+// directory instead of probing every possible name
 bool loadBoardId()
 {
-  Serial.println("Loading board ID from SD card...");
+  Serial.println("Looking for a board ID file on SD card...");
+
+  File root = SD.open("/");
+  if (!root)
+    return false;
 
-  // Check for id files 1.txt through 5.txt
-  for (uint8_t id = 1; id <= 5; id++)
+  while (true)
   {
-    String filename = "/" + String(id) + ".txt";
-    if (SD.exists(filename))
+    File entry = root.openNextFile();
+    if (!entry)
+      break;
+
+    String filename = entry.name();
+    bool directory = entry.isDirectory();
+    entry.close();
+    if (filename.startsWith("/"))
+      filename = filename.substring(1);
+    if (directory || !filename.endsWith(".txt"))
+      continue;
+
+    char *end;
+    long id = strtol(filename.c_str(), &end, 10);
+    if (filename[0] >= '1' && filename[0] <= '9' && strcmp(end, ".txt") == 0 &&
+        id >= SOUND_MESSAGE_MIN_BOARD && id <= SOUND_MESSAGE_MAX_BOARD)
     {
       boardId = id;
       Serial.printf("Found %s - Board ID set to %d\n", filename.c_str(), boardId);
+      root.close();
       return true;
     }
   }
-
-  Serial.println("ERROR: No board ID file found (1.txt, 2.txt, 3.txt, 4.txt, or 5.txt)");
+  root.close();
   return false;
 }
 
-// Sound file discovery
+// Sound file discovery (reuses the NVS catalog when the card is unchanged)
 void discoverSoundFiles()
 {
   Serial.println("Discovering sound files...");
+  unsigned long start = millis();
+
+  uint32_t fingerprint = catalogFingerprint;
+  uint32_t scanMs = 0;
+  if (loadCatalogCache(fingerprint, soundFiles, 30, &soundFileCount, &scanMs))
+  {
+    unsigned long elapsed = millis() - start;
+    Serial.printf("Catalog cache hit (%08lx): %d files in %lu ms, full scan took %lu ms (saved %ld ms)\n",
+                  (unsigned long)fingerprint, soundFileCount, elapsed,
+                  (unsigned long)scanMs, (long)scanMs - (long)elapsed);
+    return;
+  }
+
+  Serial.printf("Catalog cache miss (%08lx) - scanning card\n", (unsigned long)fingerprint);
+  if (!scanSoundFiles())
+    return; // An unreadable card must not be cached as an empty one
+
+  scanMs = millis() - start;
+  saveCatalogCache(fingerprint, soundFiles, soundFileCount, scanMs);
+  Serial.printf("Catalog built in %lu ms\n", (unsigned long)scanMs);
+}
+
+// Returns false if the root directory could not be read
+bool scanSoundFiles()
+{
   soundFileCount = 0;
+  int skipped = 0;
 
   File root = SD.open("/");
   if (!root)
   {
     Serial.println("Failed to open root directory");
-    return;
+    return false;
   }
 
   while (true)
@@ -325,272 +437,323 @@ void discoverSoundFiles()
       String filename = entry.name();
       if (filename.endsWith(".wav") || filename.endsWith(".WAV"))
       {
-        if (soundFileCount < 30)
+        // Insert in order and keep the 30 alphabetically first names, the
+        // same rule computeCatalogFingerprint() uses for the button sounds
+        int pos = soundFileCount;
+        while (pos > 0 && filename.compareTo(soundFiles[pos - 1]) < 0)
+          pos--;
+        if (pos < 30)
         {
-          soundFiles[soundFileCount] = filename;
-          soundFileCount++;
-          Serial.printf("  Found: %s\n", filename.c_str());
+          int last = soundFileCount < 30 ? soundFileCount : 29;
+          for (int i = last; i > pos; i--)
+            soundFiles[i] = soundFiles[i - 1];
+          soundFiles[pos] = filename;
+          if (soundFileCount < 30)
+            soundFileCount++;
         }
+        else
+        {
+          skipped++;
+        }
+        Serial.printf("  Found: %s\n", filename.c_str());
       }
     }
     entry.close();
   }
   root.close();
 
-  Serial.printf("Total sound files found: %d\n", soundFileCount);
+  Serial.printf("Total sound files found: %d\n", soundFileCount + skipped);
+  if (skipped > 0)
+    Serial.println("Keeping the first 30 alphabetically");
 
-  // Sort sound files alphabetically
-  if (soundFileCount > 1)
+  Serial.println("Sorted sound files:");
+  for (int i = 0; i < soundFileCount; i++)
   {
-    Serial.println("Sorting sound files alphabetically...");
-    for (int i = 0; i < soundFileCount - 1; i++)
-    {
-      for (int j = i + 1; j < soundFileCount; j++)
-      {
-        if (soundFiles[i].compareTo(soundFiles[j]) > 0)
-        {
-          String temp = soundFiles[i];
-          soundFiles[i] = soundFiles[j];
-          soundFiles[j] = temp;
-        }
-      }
-    }
-    Serial.println("Sorted sound files:");
-    for (int i = 0; i < soundFileCount; i++)
-    {
-      Serial.printf("  %d: %s\n", i + 1, soundFiles[i].c_str());
-    }
+    Serial.printf("  %d: %s\n", i + 1, soundFiles[i].c_str());
   }
+  return true;
 }
 
-// Assign sounds by index (first 3 WAV files)
-void assignSoundsByIndex()
+// Full catalog discovery runs off the setup() path so buttons go live first
+void catalogDiscoveryTask(void *param)
 {
-  Serial.println("Assigning sounds by index...");
-
-  if (soundFileCount < 3)
-  {
-    Serial.printf("ERROR: Need at least 3 WAV files, found %d\n", soundFileCount);
-    return;
-  }
-
-  greenSound = soundFiles[0];
-  blueSound = soundFiles[1];
-  yellowSound = soundFiles[2];
-
-  Serial.printf("  Green button: %s\n", greenSound.c_str());
-  Serial.printf("  Blue button: %s\n", blueSound.c_str());
-  Serial.printf("  Yellow button: %s\n", yellowSound.c_str());
+  discoverSoundFiles();
+  catalogReady = true;
+  Serial.printf("Full catalog ready at %lu ms after boot (%d files)\n", millis(), soundFileCount);
+  vTaskDelete(NULL);
 }
 
-String getRandomSound()
+void startCatalogDiscovery()
 {
-  if (soundFileCount == 0)
+  if (xTaskCreate(catalogDiscoveryTask, "catalog", 4096, NULL, 1, NULL) != pdPASS)
   {
-    Serial.println("No sound files available");
-    return "";
+    Serial.println("Failed to start catalog task - discovering in foreground");
+    discoverSoundFiles();
+    catalogReady = true;
   }
-  uint32_t randomIndex = esp_random() % soundFileCount;
-  return soundFiles[randomIndex];
-}
-
-uint8_t getRandomBoardId()
-{
-  uint8_t targetId;
-  do
-  {
-    targetId = (esp_random() % 5) + 1;
-  } while (targetId == boardId);
-  return targetId;
-}
-
-// Button management
-void initButtons()
-{
-  pinMode(BUTTON_RED, INPUT_PULLUP);
-  pinMode(BUTTON_GREEN, INPUT_PULLUP);
-  pinMode(BUTTON_BLUE, INPUT_PULLUP);
-  pinMode(BUTTON_YELLOW, INPUT_PULLUP);
-
-  Serial.println("Buttons initialized (active LOW with pullup)");
 }
 
-void updateButton(ButtonState *btn)
+// Assign sounds by index: the n-th sound button gets catalog entry n
+bool assignSoundsByIndex(const String *firstSounds)
 {
-  bool reading = digitalRead(btn->pin) == LOW; // Active LOW
+  Serial.println("Assigning sounds by index...");
 
-  if (reading != btn->lastState)
+  int slot = 0;
+  for (int i = 0; i < boardConfig.buttonCount; i++)
   {
-    btn->lastDebounceTime = millis();
-  }
+    const ButtonConfig &button = boardConfig.buttons[i];
+    if (button.role != BUTTON_ROLE_SOUND)
+      continue;
 
-  if ((millis() - btn->lastDebounceTime) > DEBOUNCE_DELAY)
-  {
-    if (reading != btn->currentState)
-    {
-      btn->currentState = reading;
-      if (reading)
-      {
-        // Button just pressed
-        btn->pressed = true;
-        btn->pressStartTime = millis();
-        btn->longHoldTriggered = false;
+    buttonSounds[i] = firstSounds[slot++];
 
-        // Multi-press detection
-        if (millis() - btn->lastPressTime < MULTI_PRESS_WINDOW)
-        {
-          btn->pressCount++;
-        }
-        else
-        {
-          btn->pressCount = 1;
-        }
-        btn->lastPressTime = millis();
-      }
+    // Sounds named in the config take precedence over the index mapping
+    if (button.sound[0] != '\0')
+    {
+      if (SD.exists("/" + String(button.sound)))
+        buttonSounds[i] = button.sound;
       else
-      {
-        // Button released
-        btn->pressStartTime = 0;
-      }
+        Serial.printf("Configured sound %s not found, keeping %s\n", button.sound, buttonSounds[i].c_str());
     }
-  }
 
-  btn->lastState = reading;
+    if (buttonSounds[i].length() == 0)
+    {
+      Serial.printf("ERROR: Need at least %d WAV files\n", slot);
+      return false;
+    }
+    Serial.printf("  %s button: %s\n", button.name, buttonSounds[i].c_str());
+  }
+  return true;
 }
 
-void updateAllButtons()
+String getRandomSound()
 {
-  updateButton(&redButton);
-  updateButton(&greenButton);
-  updateButton(&blueButton);
-  updateButton(&yellowButton);
-}
+  // Until the catalog is published, degrade to the button sounds
+  if (!catalogReady)
+  {
+    uint32_t soundMask = buttonRoleMask(BUTTON_ROLE_SOUND);
+    if (soundMask == 0)
+    {
+      Serial.println("Catalog still loading and no sound buttons to pick from");
+      return "";
+    }
+    int pick = esp_random() % __builtin_popcount(soundMask);
+    while (pick--)
+      soundMask &= soundMask - 1;
+    Serial.println("Catalog still loading - picking from button sounds");
+    return buttonSounds[__builtin_ctz(soundMask)];
+  }
 
-bool isButtonPressed(ButtonState *btn)
-{
-  if (btn->pressed)
+  if (soundFileCount == 0)
   {
-    btn->pressed = false;
-    return true;
+    Serial.println("No sound files available");
+    return "";
   }
-  return false;
+  uint32_t randomIndex = esp_random() % soundFileCount;
+  return soundFiles[randomIndex];
 }
 
-int countPressedButtons()
+// A random other board among those heard from recently, preferring idle
+// ones with a good link. When none is, any other board heard since boot
+// (its heartbeats may just be late); 0 if there is none.
+uint8_t getRandomBoardId()
 {
-  int count = 0;
-  if (greenButton.currentState)
-    count++;
-  if (blueButton.currentState)
-    count++;
-  if (yellowButton.currentState)
-    count++;
-  return count;
+  uint32_t now = millis();
+  portENTER_CRITICAL(&peerMux);
+  uint8_t targetId = peerPickTarget(&peers, boardId, now, esp_random());
+  BoardMask heard = 0;
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    if (board != boardId && peers.peers[board].heard)
+      heard |= BOARD_BIT(board);
+  }
+  portEXIT_CRITICAL(&peerMux);
+  if (targetId || !heard)
+    return targetId;
+
+  Serial.println("No other board heard from recently, picking any");
+  int pick = esp_random() % __builtin_popcountll(heard);
+  while (pick-- > 0)
+    heard &= heard - 1;
+  return __builtin_ctzll(heard);
 }
 
-// ESP-NOW communication
-uint8_t calculateChecksum(const ESPNowMessage *msg)
+// ESP-NOW frames are vendor-specific action frames; the receive callback
+// doesn't get their RSSI, so note it here. This runs on the WiFi task for
+// every management frame on the channel (beacons, probes, other networks),
+// so anything but an ESP-NOW frame is dropped after a few byte compares.
+void onPromiscuousRx(void *buf, wifi_promiscuous_pkt_type_t type)
 {
-  uint8_t sum = 0;
-  sum += msg->senderBoardId;
-  sum += msg->targetBoardId;
-  for (int i = 0; i < sizeof(msg->soundFile) && msg->soundFile[i]; i++)
-  {
-    sum += msg->soundFile[i];
-  }
-  return sum;
+  const wifi_promiscuous_pkt_t *packet = (const wifi_promiscuous_pkt_t *)buf;
+  const uint8_t *header = packet->payload;
+  sniffedFrames++;
+  if (type != WIFI_PKT_MGMT || packet->rx_ctrl.sig_len < ESPNOW_ACTION_MIN_LEN ||
+      header[0] != 0xD0 || // Action frame
+      header[24] != ESPNOW_ACTION_CATEGORY || memcmp(header + 25, espressifOui, 3) != 0)
+    return;
+  sniffedEspNow++;
+  memcpy(lastRxMac, header + 10, PEER_MAC_LEN); // Transmitter address
+  lastRxRssi = packet->rx_ctrl.rssi;
 }
 
-bool validateMessage(const ESPNowMessage *msg)
+void onDataReceive(const uint8_t *mac, const uint8_t *data, int len)
 {
-  // Check board ID range
-  if (msg->senderBoardId < 1 || msg->senderBoardId > 5)
+  int64_t startUs = esp_timer_get_time();
+  uint32_t now = millis();
+  frameArrivedUs = startUs;
+  recordFrame(now, data, len);
+  idleSleepActivity();
+
+  // Only the WiFi task receives, keep the decoded frame off its stack
+  static SoundFrame frame;
+  Action actions[DISPATCH_MAX_ACTIONS];
+  int count = dispatchFrame(&frameDispatch, data, len, now, &frame, actions);
+
+  // Stale by the sequence numbers of a board at another MAC: the ID went
+  // to a new board, whose epoch has nothing to do with the old one's
+  uint8_t stale = frameDispatch.staleFrom;
+  if (stale)
   {
-    Serial.println("Invalid sender board ID");
-    return false;
+    portENTER_CRITICAL(&peerMux);
+    bool moved = peers.peers[stale].known && memcmp(peers.peers[stale].mac, mac, PEER_MAC_LEN) != 0;
+    portEXIT_CRITICAL(&peerMux);
+    if (moved)
+    {
+      dedupeForget(&frameDispatch.dedupe, stale);
+      count = dispatchFrame(&frameDispatch, data, len, now, &frame, actions);
+    }
   }
-  if (msg->targetBoardId < 1 || msg->targetBoardId > 5)
+  if (frameDispatch.accepted)
+    idleSleepFrameArrived(frame.copy);
+  runActions(actions, count);
+
+  // Claims of boards without an ID, and the IDs of the others
+  uint8_t sender = frameDispatch.heardFrom;
+  uint8_t claimResults[2] = {CLAIM_NOTHING, CLAIM_NOTHING};
+  bool fixed = true; // Older firmware sends no presence and is numbered by hand
+  portENTER_CRITICAL(&claimMux);
+  for (int i = 0; i < count; i++)
   {
-    Serial.println("Invalid target board ID");
-    return false;
+    if (actions[i].type != ACTION_PRESENCE)
+      continue;
+    if (actions[i].board == SOUND_BOARD_UNASSIGNED)
+      claimResults[0] = claimOnClaim(&idClaim, actions[i].claim, mac, now);
+    else
+      fixed = actions[i].presence & SOUND_PRESENCE_FIXED_ID;
   }
-
-  // Verify checksum
-  uint8_t calculatedChecksum = calculateChecksum(msg);
-  if (msg->checksum != calculatedChecksum)
+  if (sender)
+    claimResults[1] = claimOnBoard(&idClaim, sender, mac, fixed, now);
+  frameDispatch.boardId = claimBoardId(&idClaim);
+  portEXIT_CRITICAL(&claimMux);
+  for (uint8_t result : claimResults)
   {
-    Serial.println("Checksum mismatch");
-    return false;
+    if (result != CLAIM_NOTHING)
+      eventLoopPost(LOOP_EVENT_CLAIM, result);
   }
 
-  // Check if file exists
-  String filePath = "/" + String(msg->soundFile);
-  if (!SD.exists(filePath))
+  if (sender && sender != frameDispatch.boardId)
   {
-    Serial.printf("File not found: %s\n", msg->soundFile);
-    return false;
+    int8_t rssi = memcmp(lastRxMac, mac, PEER_MAC_LEN) == 0 ? lastRxRssi : 0;
+    portENTER_CRITICAL(&peerMux);
+    bool changed = peerHeard(&peers, sender, mac, rssi, now);
+    portEXIT_CRITICAL(&peerMux);
+    // Registering with ESP-NOW and answering happen on the loop task
+    if (changed)
+      eventLoopPost(LOOP_EVENT_PEER, 0, sender);
   }
 
-  return true;
+  // Heartbeats are for everyone, anything else has to name this board
+  bool forUs = false;
+  for (int i = 0; i < count; i++)
+    forUs |= actions[i].type != ACTION_PRESENCE;
+  framesReceived++;
+  if (!forUs)
+    framesIgnored++;
+  receiveUs += esp_timer_get_time() - startUs;
 }
 
-void onDataReceive(const uint8_t *mac, const uint8_t *data, int len)
+void onDataSent(const uint8_t *mac_addr, esp_now_send_status_t status)
 {
-  if (len != sizeof(ESPNowMessage))
-  {
-    Serial.printf("Invalid message size: %d (expected %d)\n", len, sizeof(ESPNowMessage));
-    return;
-  }
-
-  ESPNowMessage msg;
-  memcpy(&msg, data, sizeof(msg));
-
-  // Filter by target board ID
-  if (msg.targetBoardId != boardId)
+  bool ok = status == ESP_NOW_SEND_SUCCESS;
+  bool quiet = false;
+  if (quietSends > 0)
   {
-    return; // Not for us, ignore silently
+    quietSends--;
+    quiet = true;
   }
 
-  Serial.printf("Received from Board %d: %s\n", msg.senderBoardId, msg.soundFile);
-
-  // Validate and play
-  if (validateMessage(&msg))
+  // Repeats for a board in light sleep are expected to fail until it
+  // listens, only count their successes
+  if (memcmp(mac_addr, broadcastAddress, PEER_MAC_LEN) != 0 && (ok || !quiet))
   {
-    String filePath = "/" + String(msg.soundFile);
-    playWAVFile(filePath.c_str());
-  }
-  else
-  {
-    Serial.println("Message validation failed");
+    portENTER_CRITICAL(&peerMux);
+    uint8_t forgotten = peerSendResult(&peers, mac_addr, ok);
+    portEXIT_CRITICAL(&peerMux);
+    if (forgotten)
+    {
+      Serial.printf("Board %d not answering on its MAC, broadcasting to it again\n", forgotten);
+      eventLoopPost(LOOP_EVENT_PEER, 0, forgotten); // Unregister it
+    }
   }
-}
 
-void onDataSent(const uint8_t *mac_addr, esp_now_send_status_t status)
-{
-  Serial.printf("Send status: %s\n", status == ESP_NOW_SEND_SUCCESS ? "Success" : "Fail");
+  if (quiet && ok)
+    return;
+  Serial.printf("Send status: %s\n", ok ? "Success" : "Fail");
 }
 
-void setupESPNow()
+// WiFi/ESP-NOW bring-up, independent of the SD card and board ID
+bool setupRadio()
 {
   Serial.println("Initializing ESP-NOW...");
 
   // Set device as WiFi Station
   WiFi.mode(WIFI_STA);
 
-  // Print MAC address for reference
-  Serial.printf("Board %d MAC Address: %s\n", boardId, WiFi.macAddress().c_str());
-
   // Initialize ESP-NOW
   if (esp_now_init() != ESP_OK)
   {
     Serial.println("Error initializing ESP-NOW");
-    return;
+    return false;
   }
   Serial.println("ESP-NOW initialized");
+  return true;
+}
+
+// Boot counter sent with every frame, so receivers can tell the restarted
+// sequence numbers of a rebooted board from old copies
+uint32_t loadFrameEpoch()
+{
+  Preferences prefs;
+  if (!prefs.begin(FRAME_EPOCH_NAMESPACE, false))
+  {
+    Serial.println("Frame epoch not stored, receivers may drop frames until they forget this board");
+    return 1;
+  }
+  uint32_t epoch = prefs.getUInt("epoch", 0) + 1;
+  prefs.putUInt("epoch", epoch);
+  prefs.end();
+  return epoch;
+}
+
+// Start sending/receiving, needs the board ID to filter messages
+bool setupESPNow()
+{
+  // A board ID set by hand is kept, otherwise the stored one until another
+  // board wins it, otherwise one is claimed (the lowest MAC wins)
+  uint8_t mac[PEER_MAC_LEN];
+  WiFi.macAddress(mac);
+  claimInit(&idClaim, mac, boardId, storedBoardId, millis());
+  boardId = claimBoardId(&idClaim);
+
+  // Print MAC address for reference
+  Serial.printf("Board %d MAC Address: %s\n", boardId, WiFi.macAddress().c_str());
 
   // Register callbacks
+  dispatchInit(&frameDispatch, boardId, 0);
+  peerTableInit(&peers, millis());
+  clockInit(&clockSync, esp_timer_get_time());
+  frameEpoch = loadFrameEpoch();
   esp_now_register_send_cb(onDataSent);
-  esp_now_register_recv_cb(onDataReceive);
 
   // Register broadcast peer
   esp_now_peer_info_t peerInfo = {};
@@ -601,283 +764,1221 @@ void setupESPNow()
   if (esp_now_add_peer(&peerInfo) != ESP_OK)
   {
     Serial.println("Failed to add broadcast peer");
-    return;
+    return false;
   }
 
   Serial.println("Broadcast peer registered");
+  return true;
+}
+
+// Frames are only handled once setup() got past its halt checks and the
+// event loop, the link and the sounds they play are set up
+void startReceiving()
+{
+  if (boardConfig.peerRssi)
+  {
+    wifi_promiscuous_filter_t filter = {WIFI_PROMIS_FILTER_MASK_MGMT};
+    esp_wifi_set_promiscuous_filter(&filter);
+    esp_wifi_set_promiscuous_rx_cb(onPromiscuousRx);
+    if (esp_wifi_set_promiscuous(true) != ESP_OK)
+      Serial.println("Peer RSSI not available");
+  }
+  esp_now_register_recv_cb(onDataReceive);
   Serial.printf("Board %d ready to send/receive messages\n", boardId);
 }
 
-void sendSoundCommand(uint8_t targetBoard, const char *soundFile)
+// v1 frames have no sequence number, receivers treat a repeated (sender,
+// timestamp) as a copy of the same frame, so no two frames may share one
+uint32_t nextFrameTimestamp()
 {
-  ESPNowMessage msg;
-  msg.senderBoardId = boardId;
-  msg.targetBoardId = targetBoard;
-  strncpy(msg.soundFile, soundFile, sizeof(msg.soundFile) - 1);
-  msg.soundFile[sizeof(msg.soundFile) - 1] = '\0';
-  msg.timestamp = millis();
-  msg.checksum = calculateChecksum(&msg);
+  uint32_t now = millis();
+  if ((int32_t)(now - lastFrameTimestamp) <= 0)
+    now = lastFrameTimestamp + 1;
+  lastFrameTimestamp = now;
+  return now;
+}
 
-  Serial.printf("Sending to Board %d: %s\n", targetBoard, soundFile);
+// Boards in light sleep only listen now and then, keep sending copies
+// (receivers drop the extras) until the deepest sleeper among the targets
+// must have heard
+uint8_t sendRepeats(BoardMask targetMask, uint16_t *intervalMs)
+{
+  portENTER_CRITICAL(&peerMux);
+  uint16_t budgetMs = peerSleepBudget(&peers, targetMask, boardId, boardConfig.sleepBudgetMs,
+                                      millis());
+  portEXIT_CRITICAL(&peerMux);
+  return idleSleepRepeats(budgetMs, intervalMs);
+}
+
+// Send to the one board in targetMask if its MAC is known, otherwise (and
+// for several targets or 0 = everyone) broadcast
+void sendFrame(const uint8_t *data, int len, BoardMask targetMask)
+{
+  uint8_t mac[PEER_MAC_LEN];
+  bool unicast = false;
+  if (boardConfig.unicast)
+  {
+    portENTER_CRITICAL(&peerMux);
+    unicast = peerRoute(&peers, targetMask, mac);
+    portEXIT_CRITICAL(&peerMux);
+  }
+  if (!unicast)
+  {
+    memcpy(mac, broadcastAddress, PEER_MAC_LEN);
+    lastBroadcastMs = millis();
+  }
 
-  esp_err_t result = esp_now_send(broadcastAddress, (uint8_t *)&msg, sizeof(msg));
+  esp_err_t result = esp_now_send(mac, data, len);
 
   if (result != ESP_OK)
   {
     Serial.printf("Send error: %s\n", esp_err_to_name(result));
   }
-}
 
-// Check for long hold and switch to random sound
-void checkLongHold(ButtonState *btn, String &currentSound, const String &defaultSound, const char *buttonName)
-{
-  if (btn->currentState && btn->pressStartTime > 0 && !btn->longHoldTriggered)
+  uint16_t intervalMs;
+  uint8_t repeats = sendRepeats(targetMask, &intervalMs);
+  if (repeats <= 1)
+    return;
+
+  PendingRepeat *slot = &pendingRepeats[0];
+  for (int i = 1; i < SEND_REPEAT_SLOTS; i++)
   {
-    unsigned long holdDuration = millis() - btn->pressStartTime;
-    if (holdDuration >= LONG_HOLD_DURATION)
-    {
-      btn->longHoldTriggered = true;
-      btn->pressed = false; // Clear the pressed flag so release doesn't trigger
-      btn->pressCount = 0;  // Clear press count so multi-press doesn't trigger
-      String randomSound = getRandomSound();
-      if (randomSound.length() > 0)
-      {
-        currentSound = randomSound;
-        Serial.printf("%s button long-hold - switching to random sound: %s\n", buttonName, randomSound.c_str());
-        String filePath = "/" + randomSound;
-        playWAVFile(filePath.c_str());
-      }
-    }
+    if (pendingRepeats[i].remaining < slot->remaining)
+      slot = &pendingRepeats[i];
   }
+  memcpy(slot->data, data, len);
+  slot->len = len;
+  slot->copy = 0;
+  slot->copyOffset = frameCopyOffset(data, len);
+  memcpy(slot->mac, mac, PEER_MAC_LEN);
+  slot->remaining = repeats - 1;
+  if (!repeatTimer.armed)
+    loopTimerStartPeriodic(&repeatTimer, intervalMs);
 }
 
-// Check if button was released (for single press detection)
-bool wasButtonReleased(ButtonState *btn)
+void scheduleLinkTimer()
 {
-  // Button was released if it was pressed but is no longer in currentState
-  if (btn->pressed && !btn->currentState)
-  {
-    btn->pressed = false;
-    return true;
-  }
-  return false;
+  uint32_t dueMs;
+  if (linkNextDeadline(&link, &dueMs))
+    loopTimerStartAt(&linkTimer, dueMs);
+  else
+    loopTimerStop(&linkTimer);
 }
 
-// Button handlers - removed, now handled by handleMultiPressSend
-void handleSingleButtonPress()
+void onLinkTimer(void *arg)
 {
-  // Single button presses are now handled by handleMultiPressSend
-  // This function is kept for compatibility but does nothing
+  linkPoll(&link, millis(), sendFrame);
+  scheduleLinkTimer();
 }
 
-void handleDualButtonPress()
+void flushCommands()
 {
-  // Check if exactly 2 of the 3 buttons are pressed
-  if (countPressedButtons() == 2)
+  if (!outPending)
+    return;
+  outPending = false;
+  // Numbered copies, so sleeping receivers can tell how late they heard it
+  uint16_t intervalMs;
+  if (sendRepeats(outDestinations, &intervalMs) > 1)
+    frameAddRepeat(&outWriter);
+  int len = frameFinish(&outWriter);
+  sendFrame(outFrame, len, outDestinations);
+
+  if (outTargets)
   {
-    Serial.println("Dual button press detected - playing random sound");
-    String randomSound = getRandomSound();
-    if (randomSound.length() > 0)
-    {
-      String filePath = "/" + randomSound;
-      playWAVFile(filePath.c_str());
-    }
-
-    // Clear button states to prevent repeated triggers
-    greenButton.pressed = false;
-    blueButton.pressed = false;
-    yellowButton.pressed = false;
+    linkTrack(&link, outSeq, outTargets, outFrame, len, millis());
+    scheduleLinkTimer();
   }
 }
 
-void handleRedButtonPress()
+void onFlushTimer(void *arg)
 {
-  if (isButtonPressed(&redButton))
-  {
-    Serial.println("Red button pressed - sending remote command");
-
-    uint8_t targetBoard = getRandomBoardId();
-    String randomSound = getRandomSound();
+  flushCommands();
+}
 
-    if (randomSound.length() > 0)
+// The v2 frame being batched, started if there is none. Commands queued in
+// the same loop pass share it, flushTimer sends it when the pass is over.
+SoundFrameWriter *outgoingFrame()
+{
+  if (!outPending)
+  {
+    outSeq = nextFrameSeq++;
+    outTargets = 0;
+    outDestinations = 0;
+    frameBegin(&outWriter, outFrame, sizeof(outFrame), boardId, frameEpoch, outSeq, millis());
+    // Every frame carries our state, so receivers needn't wait for a
+    // heartbeat. While we have no ID (boardId 0) it is our claim.
+    portENTER_CRITICAL(&claimMux);
+    uint8_t flags = claimPresenceFlags(&idClaim);
+    uint8_t claim = claimPresenceId(&idClaim);
+    portEXIT_CRITICAL(&claimMux);
+    if (audioIsPlaying())
+      flags |= SOUND_PRESENCE_PLAYING;
+    portENTER_CRITICAL(&clockMux);
+    if (clockIsMaster(&clockSync, boardId))
+      flags |= SOUND_PRESENCE_TIME_MASTER;
+    if (clockSync.synced)
+      flags |= SOUND_PRESENCE_TIME_SYNCED;
+    portEXIT_CRITICAL(&clockMux);
+    frameAddPresence(&outWriter, flags, FIRMWARE_VERSION, audioQueueDepth(), claim,
+                     idleSleepBudget());
+    outPending = true;
+    loopTimerStartAt(&flushTimer, millis());
+  }
+  return &outWriter;
+}
+
+void queueAck(uint8_t targetBoard, uint32_t seq)
+{
+  if (!frameAddAck(outgoingFrame(), targetBoard, seq))
+  {
+    flushCommands();
+    frameAddAck(outgoingFrame(), targetBoard, seq);
+  }
+  outDestinations |= BOARD_BIT(targetBoard);
+}
+
+// Tell targetMask (0 = everyone) this board exists, so they learn its MAC
+void sendPresence(BoardMask targetMask)
+{
+  if (boardConfig.wireVersion == 1)
+    return; // Older firmware would reject the frame
+
+  flushCommands();
+  outgoingFrame(); // Starts with a presence command
+  outDestinations = targetMask;
+  flushCommands();
+}
+
+// Heartbeat unless something else was broadcast within the interval, which
+// grows after boot (peer_table.h). A playback change goes out as soon as
+// PRESENCE_UPDATE_MIN_MS have passed since the last broadcast.
+void onHeartbeatTimer(void *arg)
+{
+  registerPeers();
+  uint32_t intervalMs = presenceChanged ? PRESENCE_UPDATE_MIN_MS : heartbeatIntervalMs;
+  if (millis() - lastBroadcastMs >= intervalMs)
+  {
+    if (!presenceChanged)
+      heartbeatIntervalMs = min(heartbeatIntervalMs * 2, (uint32_t)HEARTBEAT_MAX_MS);
+    presenceChanged = false;
+    sendPresence(0);
+    intervalMs = heartbeatIntervalMs;
+  }
+  loopTimerStartAt(&heartbeatTimer, lastBroadcastMs + intervalMs);
+}
+
+void onAudioState(bool playing)
+{
+  eventLoopPost(LOOP_EVENT_AUDIO, playing);
+}
+
+void setBoardId(uint8_t id)
+{
+  boardId = id;
+  gestureDispatch.boardId = id;
+  portENTER_CRITICAL(&claimMux);
+  frameDispatch.boardId = id;
+  portEXIT_CRITICAL(&claimMux);
+}
+
+// A negotiated ID is kept for the next boot
+void storeBoardId(uint8_t id)
+{
+  Preferences prefs;
+  if (!prefs.begin(BOARD_ID_NAMESPACE, false))
+  {
+    Serial.println("Board ID not stored, it will be negotiated again at the next boot");
+    return;
+  }
+  prefs.putUChar("id", id);
+  prefs.end();
+}
+
+void scheduleClaimTimer()
+{
+  uint32_t dueMs;
+  portENTER_CRITICAL(&claimMux);
+  bool pending = claimNextDeadline(&idClaim, &dueMs);
+  portEXIT_CRITICAL(&claimMux);
+  if (pending)
+    loopTimerStartAt(&claimTimer, dueMs);
+  else
+    loopTimerStop(&claimTimer);
+}
+
+// Claim frames while the board has no ID, then take the one claimed
+void onClaimTimer(void *arg)
+{
+  portENTER_CRITICAL(&claimMux);
+  uint8_t result = claimPoll(&idClaim, millis());
+  uint8_t id = claimBoardId(&idClaim);
+  portEXIT_CRITICAL(&claimMux);
+
+  if (result == CLAIM_ANNOUNCE)
+  {
+    sendPresence(0);
+  }
+  else if (result == CLAIM_SETTLED)
+  {
+    setBoardId(id);
+    storeBoardId(id);
+    Serial.printf("Board ID set to %d (negotiated)\n", id);
+    // Heartbeats start over as after boot, the first one now
+    heartbeatIntervalMs = HEARTBEAT_MIN_MS;
+    sendPresence(0);
+    loopTimerStartAt(&heartbeatTimer, millis());
+  }
+  scheduleClaimTimer();
+}
+
+// What a received frame did to our ID (onDataReceive)
+void onClaimEvent(uint8_t result)
+{
+  switch (result)
+  {
+  case CLAIM_ANSWER:
+    // Like a playback update: soon, but at most every PRESENCE_UPDATE_MIN_MS
+    presenceChanged = true;
+    loopTimerStartAt(&heartbeatTimer, millis());
+    break;
+
+  case CLAIM_MOVED:
+    if (boardId)
+      Serial.printf("Board ID %d belongs to another board, claiming a new one\n", boardId);
+    setBoardId(0);
+    scheduleClaimTimer();
+    break;
+
+  case CLAIM_DUPLICATE:
+    if (!duplicateIdReported)
+      Serial.printf("WARNING: another board has board ID %d set by hand too\n", boardId);
+    duplicateIdReported = true;
+    break;
+  }
+}
+
+void scheduleClockTimer(int64_t nowUs)
+{
+  portENTER_CRITICAL(&clockMux);
+  int64_t dueUs = clockNextDeadlineUs(&clockSync, nowUs);
+  portEXIT_CRITICAL(&clockMux);
+  int64_t inMs = dueUs > nowUs ? (dueUs - nowUs + 999) / 1000 : 0;
+  loopTimerStartAt(&clockTimer, millis() + (uint32_t)inMs);
+}
+
+// Pick the time master among the boards that are on, and ask it for the
+// time when a sample is due. The request goes in a frame of its own, so
+// the time it carries is read just before it is sent.
+void onClockTimer(void *arg)
+{
+  if (boardId == 0)
+  {
+    // Answers need an ID to go to
+    scheduleClockTimer(esp_timer_get_time());
+    return;
+  }
+
+  portENTER_CRITICAL(&peerMux);
+  BoardMask alive = peerAliveMask(&peers, boardId, millis());
+  BoardMask candidates = 0;
+  for (BoardMask rest = alive; rest; rest &= rest - 1)
+  {
+    int board = __builtin_ctzll(rest);
+    if (peers.peers[board].firmware >= CLOCK_FIRMWARE)
+      candidates |= BOARD_BIT(board);
+  }
+  portEXIT_CRITICAL(&peerMux);
+
+  int64_t nowUs = esp_timer_get_time();
+  portENTER_CRITICAL(&clockMux);
+  uint8_t previous = clockSync.master;
+  uint8_t master = clockElect(&clockSync, boardId, alive, candidates, nowUs);
+  bool due = clockPollDue(&clockSync, nowUs);
+  int32_t skewPpb = clockSync.synced ? clockSync.skewPpb : 0;
+  portEXIT_CRITICAL(&clockMux);
+  audioSetReferenceSkew(skewPpb);
+
+  if (master != previous)
+  {
+    if (master == boardId)
+    {
+      Serial.println("Keeping the fleet clock");
+      // Announce it soon, like a playback update
+      presenceChanged = true;
+      loopTimerStartAt(&heartbeatTimer, millis());
+    }
+    else if (master)
     {
-      sendSoundCommand(targetBoard, randomSound.c_str());
+      Serial.printf("Taking the time from Board %d\n", master);
     }
     else
     {
-      Serial.println("No sounds available to send");
+      Serial.println("No time master, keeping the fleet time as estimated");
     }
   }
+
+  if (due)
+  {
+    flushCommands();
+    SoundFrameWriter *writer = outgoingFrame();
+    // Tell the time keeper how our output drifts against fleet time
+    int32_t outputPpb;
+    int32_t drift = playbackOutputPpb(&outputPpb) ? outputPpb - skewPpb : SOUND_DRIFT_UNKNOWN;
+    frameAddTimeRequest(writer, master, esp_timer_get_time(), drift);
+    outDestinations = BOARD_BIT(master);
+    flushCommands();
+  }
+  scheduleClockTimer(esp_timer_get_time());
+}
+
+// Answer the time requests queued by onDataReceive(), each in a frame of
+// its own
+void answerTimeRequests()
+{
+  ClockRequest request;
+  for (;;)
+  {
+    portENTER_CRITICAL(&clockMux);
+    bool pending = clockNextRequest(&clockSync, &request);
+    portEXIT_CRITICAL(&clockMux);
+    if (!pending)
+      return;
+
+    flushCommands();
+    SoundFrameWriter *writer = outgoingFrame();
+    portENTER_CRITICAL(&clockMux);
+    int64_t receivedUs = clockFleetUs(&clockSync, request.receivedUs);
+    int64_t sentUs = clockFleetUs(&clockSync, esp_timer_get_time());
+    portEXIT_CRITICAL(&clockMux);
+    frameAddTimeResponse(writer, request.board, request.originUs, receivedUs, sentUs);
+    outDestinations = BOARD_BIT(request.board);
+    flushCommands();
+  }
+}
+
+// Fleet start time for a sound several boards play, syncLeadMs from now
+// (start: its low 32 bits, localUs: on our clock). False when this board
+// doesn't follow the fleet's time; they then start as soon as they can.
+bool planStart(uint32_t *start, int64_t *localUs)
+{
+  if (boardConfig.syncLeadMs == 0 || boardConfig.wireVersion == 1)
+    return false;
+  int64_t nowUs = esp_timer_get_time();
+  portENTER_CRITICAL(&clockMux);
+  bool synced = clockSync.synced;
+  int64_t fleetUs = clockFleetUs(&clockSync, nowUs) + boardConfig.syncLeadMs * 1000LL;
+  *localUs = clockLocalUs(&clockSync, fleetUs);
+  portEXIT_CRITICAL(&clockMux);
+  *start = (uint32_t)fleetUs;
+  return synced;
 }
 
-// Handle multi-press: 1 press = play locally, 2+ presses = send to board (pressCount-1)
-void handleMultiPressSend()
+// Our clock's time for a start another board sent, 0 (now) when we don't
+// follow the fleet's time or it is too far off to be meant
+int64_t remoteStartUs(uint32_t start)
 {
-  // Check if any button's press count indicates a command
-  ButtonState *buttons[] = {&greenButton, &blueButton, &yellowButton};
-  String *currentSounds[] = {&currentGreenSound, &currentBlueSound, &currentYellowSound};
-  const char *buttonNames[] = {"Green", "Blue", "Yellow"};
+  int64_t nowUs = esp_timer_get_time();
+  portENTER_CRITICAL(&clockMux);
+  bool synced = clockSync.synced;
+  int64_t localUs = clockLocalUs(&clockSync, clockExpandUs(&clockSync, start, nowUs));
+  portEXIT_CRITICAL(&clockMux);
+  if (!synced || llabs(localUs - nowUs) > SYNC_MAX_AHEAD_US)
+    return 0;
+  return localUs;
+}
 
-  for (int i = 0; i < 3; i++)
+// Delete the ESP-NOW registrations of MACs no peer uses any more
+// (forgotten, evicted or replaced), so they don't fill it up
+void dropStalePeers()
+{
+  uint8_t mac[PEER_MAC_LEN];
+  while (true)
   {
-    ButtonState *btn = buttons[i];
+    portENTER_CRITICAL(&peerMux);
+    uint8_t board = peerTakeStale(&peers, mac);
+    portEXIT_CRITICAL(&peerMux);
+    if (!board)
+      break;
+    esp_now_del_peer(mac);
+  }
+}
+
+// A board was heard from a new MAC: register it for unicast and answer
+// with our own presence, so it learns ours without waiting for traffic
+void onPeerLearned(uint8_t board)
+{
+  esp_now_peer_info_t peerInfo = {};
+  portENTER_CRITICAL(&peerMux);
+  bool known = peers.peers[board].known;
+  memcpy(peerInfo.peer_addr, peers.peers[board].mac, PEER_MAC_LEN);
+  portEXIT_CRITICAL(&peerMux);
+  if (!known)
+    return;
 
-    // Check if press window has expired and we have presses to process
-    if (btn->pressCount > 0 && millis() - btn->lastPressTime > MULTI_PRESS_WINDOW)
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+  esp_err_t result = ESP_OK;
+  if (!esp_now_is_peer_exist(peerInfo.peer_addr))
+  {
+    // ESP-NOW holds only so many peers, the quietest one makes room
+    portENTER_CRITICAL(&peerMux);
+    uint8_t evicted = peerEvict(&peers);
+    portEXIT_CRITICAL(&peerMux);
+    if (evicted)
+      dropStalePeers();
+    result = esp_now_add_peer(&peerInfo);
+  }
+  if (result != ESP_OK)
+  {
+    Serial.printf("Failed to add board %d as peer: %s\n", board, esp_err_to_name(result));
+    return;
+  }
+
+  // Heard from yet another MAC meanwhile: the one just added is stale
+  portENTER_CRITICAL(&peerMux);
+  peerSetRoutable(&peers, board, peerInfo.peer_addr);
+  bool routable = peers.peers[board].routable;
+  portEXIT_CRITICAL(&peerMux);
+  if (!routable)
+  {
+    dropStalePeers();
+    return;
+  }
+
+  const uint8_t *m = peerInfo.peer_addr;
+  Serial.printf("Board %d is at %02X:%02X:%02X:%02X:%02X:%02X\n", board,
+                m[0], m[1], m[2], m[3], m[4], m[5]);
+  sendPresence(BOARD_BIT(board));
+}
+
+// Drop stale registrations, then register every peer whose MAC is known
+// but not registered yet. Peers are learned and forgotten on the WiFi
+// task; a LOOP_EVENT_PEER lost to a full queue would otherwise leave the
+// board broadcast-only until its MAC changes.
+void registerPeers()
+{
+  dropStalePeers();
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    portENTER_CRITICAL(&peerMux);
+    bool missing = peers.peers[board].known && !peers.peers[board].routable;
+    portEXIT_CRITICAL(&peerMux);
+    if (missing)
+      onPeerLearned(board);
+  }
+}
+
+void sendSoundCommand(uint8_t targetBoard, const char *soundFile, bool scheduled, uint32_t start)
+{
+  if (boardId == 0)
+  {
+    Serial.println("No board ID yet, not sending");
+    return;
+  }
+  Serial.printf("Sending to Board %d: %s\n", targetBoard, soundFile);
+  // Until its next presence update, so the next random pick goes elsewhere
+  portENTER_CRITICAL(&peerMux);
+  peerMarkBusy(&peers, targetBoard);
+  portEXIT_CRITICAL(&peerMux);
+
+  if (boardConfig.wireVersion == 1)
+  {
+    ESPNowMessage msg;
+    msg.senderBoardId = boardId;
+    msg.targetBoardId = targetBoard;
+    strncpy(msg.soundFile, soundFile, sizeof(msg.soundFile) - 1);
+    msg.soundFile[sizeof(msg.soundFile) - 1] = '\0';
+    msg.timestamp = nextFrameTimestamp();
+    msg.checksum = calculateChecksum(&msg);
+    sendFrame((uint8_t *)&msg, sizeof(msg), BOARD_BIT(targetBoard));
+    return;
+  }
+
+  uint8_t flags = boardConfig.reliableDelivery ? SOUND_FLAG_ACK : 0;
+  if (scheduled)
+    flags |= SOUND_FLAG_START;
+  if (!frameAddPlay(outgoingFrame(), targetBoard, soundFile, flags, start))
+  {
+    flushCommands();
+    frameAddPlay(outgoingFrame(), targetBoard, soundFile, flags, start);
+  }
+  outDestinations |= BOARD_BIT(targetBoard);
+  if (flags & SOUND_FLAG_ACK)
+    outTargets |= BOARD_BIT(targetBoard);
+}
+
+// "every board", "Board 12" or "Boards 27+31"
+String boardSetName(BoardMask set)
+{
+  if ((set | BOARD_BIT(boardId)) == BOARD_MASK_ALL)
+    return "every board";
+  String name = (set & (set - 1)) ? "Boards " : "Board ";
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    if (!(set & BOARD_BIT(board)))
+      continue;
+    if (!name.endsWith(" "))
+      name += "+";
+    name += board;
+  }
+  return name;
+}
+
+// One PLAY_GROUP command for any set of boards other than this one, instead
+// of a frame per board. With reliable_delivery every board in the set acks;
+// for every board, that is the ones heard from recently. When scheduled,
+// they all start it at the fleet time start (planStart()).
+void sendSoundToBoards(BoardMask targets, const char *soundFile, bool scheduled, uint32_t start)
+{
+  targets &= ~BOARD_BIT(boardId);
+  if (targets == 0)
+    return;
+  if ((targets & (targets - 1)) == 0)
+  {
+    sendSoundCommand(__builtin_ctzll(targets), soundFile, scheduled, start);
+    return;
+  }
+  if (boardId == 0)
+  {
+    Serial.println("No board ID yet, not sending");
+    return;
+  }
+
+  bool everyone = (targets | BOARD_BIT(boardId)) == BOARD_MASK_ALL;
+  portENTER_CRITICAL(&peerMux);
+  BoardMask alive = peerAliveMask(&peers, boardId, millis());
+  BoardMask expected = everyone ? alive : targets;
+  for (BoardMask rest = expected; rest; rest &= rest - 1)
+    peerMarkBusy(&peers, __builtin_ctzll(rest));
+  portEXIT_CRITICAL(&peerMux);
+
+  // Legacy frames have one target each
+  if (boardConfig.wireVersion == 1)
+  {
+    for (BoardMask rest = expected; rest; rest &= rest - 1)
+      sendSoundCommand(__builtin_ctzll(rest), soundFile);
+    return;
+  }
+
+  Serial.printf("Sending to %s: %s\n", boardSetName(targets).c_str(), soundFile);
+  BoardMask wireTargets = everyone ? BOARD_MASK_ALL : targets;
+  uint8_t flags = boardConfig.reliableDelivery ? SOUND_FLAG_ACK : 0;
+  if (scheduled)
+    flags |= SOUND_FLAG_START;
+  if (!frameAddPlayGroup(outgoingFrame(), wireTargets, soundFile, flags, start))
+  {
+    flushCommands();
+    frameAddPlayGroup(outgoingFrame(), wireTargets, soundFile, flags, start);
+  }
+  outDestinations |= targets;
+  if (flags & SOUND_FLAG_ACK)
+    outTargets |= expected;
+}
+
+void onRepeatTimer(void *arg)
+{
+  bool pending = false;
+  for (int i = 0; i < SEND_REPEAT_SLOTS; i++)
+  {
+    PendingRepeat &repeat = pendingRepeats[i];
+    if (repeat.remaining == 0)
+      continue;
+    if (repeat.copyOffset >= 0)
+      frameSetCopy(repeat.data, repeat.len, repeat.copyOffset, ++repeat.copy);
+    quietSends++;
+    if (esp_now_send(repeat.mac, repeat.data, repeat.len) != ESP_OK)
+      quietSends--;
+    pending |= --repeat.remaining > 0;
+  }
+  if (!pending)
+    loopTimerStop(&repeatTimer);
+}
+
+// Execute what the dispatcher decided for a gesture or frame
+void runActions(const Action *actions, int count)
+{
+  // One start for everything a gesture plays on several boards
+  bool startPlanned = false;
+  bool scheduled = false;
+  uint32_t start = 0;
+  int64_t startUs = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    const Action &action = actions[i];
+    // Frame actions run on the WiFi task: only the gesture cases (loop
+    // task) may touch button state and currentSounds
+    switch (action.type)
     {
-      // Skip if this was a long hold - long hold takes priority
-      if (btn->longHoldTriggered)
+    case ACTION_PLAY:
+    {
+      if (currentSounds[action.button].length() == 0)
+        break;
+      Serial.printf("%s button %s - playing %s locally\n", buttons[action.button].name,
+                    action.speculative ? "press" : "single press", currentSounds[action.button].c_str());
+      if (action.together && !startPlanned)
       {
-        btn->pressCount = 0;
-        continue;
+        scheduled = planStart(&start, &startUs);
+        startPlanned = true;
       }
+      String filePath = "/" + currentSounds[action.button];
+      playWAVFile(filePath.c_str(), action.triggerMs,
+                  action.speculative ? PLAYBACK_SPECULATIVE : PLAYBACK_RESOLVED,
+                  action.together && scheduled ? startUs : 0);
+      break;
+    }
+
+    case ACTION_PREFETCH:
+      if (currentSounds[action.button].length() > 0)
+        prefetchWAVFile(("/" + currentSounds[action.button]).c_str());
+      break;
+
+    case ACTION_DISCARD_PREFETCH:
+      discardPrefetch();
+      break;
+
+    case ACTION_CANCEL:
+      Serial.printf("%s button - cancelling speculative sound\n", buttons[action.button].name);
+      stopPlayback(AUDIO_CANCEL_FADE_MS);
+      break;
 
-      // If button is still pressed, wait to see if it becomes a long hold
-      // Only process if button has been released
-      if (btn->currentState)
+    case ACTION_PLAY_RANDOM_HOLD:
+    {
+      // Long hold: switch to a random sound and play it
+      String randomSound = getRandomSound();
+      if (randomSound.length() > 0)
       {
-        continue; // Button still held, don't process yet
+        currentSounds[action.button] = randomSound;
+        Serial.printf("%s button long-hold - switching to random sound: %s\n",
+                      buttons[action.button].name, randomSound.c_str());
+        String randomPath = "/" + randomSound;
+        playWAVFile(randomPath.c_str(), action.triggerMs, PLAYBACK_RESOLVED);
       }
+      break;
+    }
 
-      // Single press = play locally
-      if (btn->pressCount == 1)
+    case ACTION_PLAY_RANDOM:
+    {
+      Serial.println("Dual button press detected - playing random sound");
+      String randomSound = getRandomSound();
+      if (randomSound.length() > 0)
       {
-        String soundToPlay = *currentSounds[i];
-        if (soundToPlay.length() > 0)
-        {
-          Serial.printf("%s button single press - playing %s locally\n",
-                        buttonNames[i], soundToPlay.c_str());
-          String filePath = "/" + soundToPlay;
-          playWAVFile(filePath.c_str());
-        }
+        String randomPath = "/" + randomSound;
+        playWAVFile(randomPath.c_str(), action.triggerMs, PLAYBACK_RESOLVED);
       }
-      // 2+ presses = send to board (pressCount-1)
-      else if (btn->pressCount >= 2)
-      {
-        uint8_t targetBoard = btn->pressCount - 1;
+      break;
+    }
 
-        // Validate target board (1-5) and ensure not sending to self
-        if (targetBoard >= 1 && targetBoard <= 5 && targetBoard != boardId)
-        {
-          String soundToSend = *currentSounds[i];
-          if (soundToSend.length() > 0)
-          {
-            Serial.printf("%s button pressed %d times - sending %s to Board %d\n",
-                          buttonNames[i], btn->pressCount, soundToSend.c_str(), targetBoard);
-            sendSoundCommand(targetBoard, soundToSend.c_str());
-          }
-        }
-        else if (targetBoard == boardId)
-        {
-          Serial.printf("%s button: Cannot send to own board (Board %d)\n", buttonNames[i], boardId);
-        }
-        else
-        {
-          Serial.printf("%s button: Invalid target board %d (must be 1-5, not %d)\n",
-                        buttonNames[i], targetBoard, boardId);
-        }
+    case ACTION_SEND:
+      // The send path logs the target and sound, once per send
+      if (currentSounds[action.button].length() == 0)
+        break;
+      if (action.board)
+      {
+        portENTER_CRITICAL(&peerMux);
+        bool alive = peerAlive(&peers, action.board, millis());
+        portEXIT_CRITICAL(&peerMux);
+        if (!alive)
+          Serial.printf("Board %d hasn't been heard from for a while, it may be off\n", action.board);
+      }
+      if ((action.targets & (action.targets - 1)) && !startPlanned)
+      {
+        scheduled = planStart(&start, &startUs);
+        startPlanned = true;
       }
+      sendSoundToBoards(action.targets, currentSounds[action.button].c_str(), scheduled, start);
+      break;
+
+    case ACTION_REJECT_TARGET:
+    {
+      const char *name = buttons[action.button].name;
+      if (action.board == 0)
+        Serial.printf("%s button: More presses than listed targets\n", name);
+      else if (action.board == boardId)
+        Serial.printf("%s button: Cannot send to own board (Board %d)\n", name, boardId);
+      else
+        Serial.printf("%s button: Invalid target board %d (must be %d-%d, not %d)\n", name,
+                      action.board, SOUND_MESSAGE_MIN_BOARD, SOUND_MESSAGE_MAX_BOARD, boardId);
+      break;
+    }
+
+    case ACTION_SEND_RANDOM:
+    {
+      Serial.printf("%s button pressed - sending remote command\n", buttons[action.button].name);
+      uint8_t targetBoard = getRandomBoardId();
+      String randomSound = getRandomSound();
+      if (targetBoard == 0)
+        Serial.println("No other board heard from yet");
+      else if (randomSound.length() > 0)
+        sendSoundCommand(targetBoard, randomSound.c_str());
+      else
+        Serial.println("No sounds available to send");
+      break;
+    }
+
+    case ACTION_PLAY_REMOTE:
+    {
+      // Queued for the audio task, which owns the SD card and reports a
+      // missing file when it tries to open it
+      Serial.printf("Received from Board %d: %s\n", action.board, action.sound);
+      String remotePath = "/" + String(action.sound);
+      playWAVFile(remotePath.c_str(), action.triggerMs, PLAYBACK_REMOTE,
+                  action.scheduled ? remoteStartUs(action.startUs) : 0);
+      break;
+    }
+
+    case ACTION_STOP_REMOTE:
+      Serial.printf("Received from Board %d: stop (%u ms fade)\n", action.board, action.fadeMs);
+      stopPlayback(action.fadeMs);
+      break;
+
+    case ACTION_REJECT_FRAME:
+      Serial.printf("Message validation failed: %s\n", action.reason);
+      break;
+
+    // Frames are only built and tracked on the loop task
+    case ACTION_SEND_ACK:
+      eventLoopPost(LOOP_EVENT_SEND_ACK, action.seq, action.board);
+      break;
+
+    case ACTION_ACK:
+      eventLoopPost(LOOP_EVENT_ACK, action.seq, action.board);
+      break;
 
-      // Reset press count
-      btn->pressCount = 0;
+    case ACTION_PRESENCE:
+      portENTER_CRITICAL(&peerMux);
+      peerPresence(&peers, action.board, action.presence, action.firmware, action.queueDepth,
+                   action.sleepMs);
+      portEXIT_CRITICAL(&peerMux);
+      portENTER_CRITICAL(&clockMux);
+      clockOnPresence(&clockSync, action.board, action.presence);
+      portEXIT_CRITICAL(&clockMux);
+      break;
+
+    // Time frames are stamped with when they arrived (onDataReceive)
+    case ACTION_TIME_REQUEST:
+      portENTER_CRITICAL(&clockMux);
+      clockOnRequest(&clockSync, action.board, action.time[0], frameArrivedUs);
+      portEXIT_CRITICAL(&clockMux);
+      portENTER_CRITICAL(&peerMux);
+      peerDrift(&peers, action.board, action.drift);
+      portEXIT_CRITICAL(&peerMux);
+      eventLoopPost(LOOP_EVENT_TIME, 0, action.board);
+      break;
+
+    case ACTION_TIME_RESPONSE:
+      portENTER_CRITICAL(&clockMux);
+      clockOnResponse(&clockSync, action.board, action.time[0], action.time[1], action.time[2],
+                      frameArrivedUs);
+      portEXIT_CRITICAL(&clockMux);
+      break;
     }
   }
 }
 
-void handleButtons()
+void handleGesture(const GestureEvent &gesture)
 {
-  updateAllButtons();
+  if (gesture.type == GESTURE_PRESS_START)
+  {
+    uint16_t window = cadenceWindow();
+    if (cadenceOnPressEdge(gesture.button, gesture.count, gesture.timeMs))
+    {
+      gestureSetMultiPressWindow(&gestures, cadenceWindow());
+      recordWindow(window, cadenceWindow());
+    }
+  }
 
-  // Check for long holds on green/blue/yellow buttons
-  checkLongHold(&greenButton, currentGreenSound, greenSound, "Green");
-  checkLongHold(&blueButton, currentBlueSound, blueSound, "Blue");
-  checkLongHold(&yellowButton, currentYellowSound, yellowSound, "Yellow");
+  Action actions[DISPATCH_MAX_ACTIONS];
+  runActions(actions, dispatchGesture(&gestureDispatch, gesture, actions));
+}
 
-  // Handle multi-press send commands
-  handleMultiPressSend();
+void onButtonChange(uint8_t index, bool pressed, uint32_t timestampMs)
+{
+  idleSleepActivity();
+  gestureOnEdge(&gestures, index, pressed, timestampMs);
+}
 
-  // Check for dual button press first (higher priority)
-  if (countPressedButtons() >= 2)
+// Arm inputTimer for whichever comes first: a bounce settling or a gesture
+// deadline. With neither pending the loop sleeps until the next edge.
+void scheduleInputTimer()
+{
+  uint32_t due = 0;
+  uint32_t candidate;
+  bool pending = gestureNextDeadline(&gestures, &due);
+  if (buttonSettleDeadline(&candidate) && (!pending || (int32_t)(candidate - due) < 0))
   {
-    handleDualButtonPress();
+    due = candidate;
+    pending = true;
   }
-  // Then check for red button (remote trigger)
-  else if (redButton.currentState)
+
+  if (pending)
+    loopTimerStartAt(&inputTimer, due);
+  else
+    loopTimerStop(&inputTimer);
+}
+
+void handleButtons()
+{
+  // One clock reading for the whole pass, the recorder stores it
+  uint32_t nowMs = millis();
+  uint32_t nowUs = micros();
+  updateAllButtons(onButtonChange, nowMs, nowUs);
+  gestureTick(&gestures, nowMs);
+
+  GestureEvent gesture;
+  while (gesturePoll(&gestures, &gesture))
   {
-    handleRedButtonPress();
+    handleGesture(gesture);
   }
-  // Finally check for single button presses
-  else
+
+  scheduleInputTimer();
+}
+
+void onInputTimer(void *arg)
+{
+  handleButtons();
+}
+
+// Serial driver task: wake the loop to read the console, once per batch
+volatile bool consolePending = false;
+
+void onConsoleInput()
+{
+  if (consolePending)
+    return;
+  consolePending = true;
+  if (!eventLoopPost(LOOP_EVENT_CONSOLE, 0))
+    consolePending = false;
+}
+
+void onLoopEvent(const LoopEvent &event)
+{
+  switch (event.type)
   {
-    handleSingleButtonPress();
+  case LOOP_EVENT_BUTTON:
+    handleButtons();
+    break;
+
+  case LOOP_EVENT_SEND_ACK:
+    queueAck(event.source, event.arg);
+    break;
+
+  case LOOP_EVENT_ACK:
+    linkOnAck(&link, event.source, event.arg, millis());
+    scheduleLinkTimer();
+    break;
+
+  case LOOP_EVENT_PEER:
+    registerPeers(); // event.source, and any whose event was lost
+    break;
+
+  case LOOP_EVENT_CLAIM:
+    onClaimEvent(event.arg);
+    break;
+
+  case LOOP_EVENT_TIME:
+    answerTimeRequests();
+    break;
+
+  case LOOP_EVENT_CONSOLE:
+    consolePending = false;
+    consolePoll();
+    break;
+
+  case LOOP_EVENT_AUDIO:
+    // Tell the others soon, so their random picks avoid us while we play
+    if (boardConfig.wireVersion != 1)
+    {
+      presenceChanged = true;
+      loopTimerStartAt(&heartbeatTimer, millis());
+    }
+    break;
   }
 }
 
-void playWAVFile(const char *filename)
+// Boot steps, each runs as soon as its dependencies are done
+bool initStorageStep()
+{
+  if (!initializeSDCard())
+    return false;
+
+  // Show SD card info
+  uint64_t cardSize = SD.cardSize() / (1024 * 1024);
+  Serial.printf("SD Card: %lluMB\n", cardSize);
+  return true;
+}
+
+bool initAudioStep()
 {
-  isPlaying = true;
+  return setupAudio(&boardConfig);
+}
 
-  File audioFile = SD.open(filename);
-  if (!audioFile)
+bool initDiscoveryStep()
+{
+  // Resolve the button sounds with a single directory walk, the full
+  // catalog is then built in the background
+  int soundButtons = 0;
+  for (int i = 0; i < boardConfig.buttonCount; i++)
   {
-    Serial.printf("Failed to open: %s\n", filename);
-    isPlaying = false;
-    return;
+    if (boardConfig.buttons[i].role == BUTTON_ROLE_SOUND)
+      soundButtons++;
   }
 
-  Serial.printf("Playing: %s (%d bytes)\n", filename, audioFile.size());
+  String firstSounds[MAX_BUTTONS];
+  catalogFingerprint = computeCatalogFingerprint(firstSounds, soundButtons);
+  if (catalogFingerprint == 0)
+  {
+    // Raw directory walk unavailable, fall back to a blocking discovery
+    discoverSoundFiles();
+    catalogReady = true;
+    for (int i = 0; i < soundButtons && i < soundFileCount; i++)
+      firstSounds[i] = soundFiles[i];
+  }
 
-  // Skip WAV header (44 bytes for standard WAV)
-  if (String(filename).endsWith(".wav") || String(filename).endsWith(".WAV"))
+  // Assign sounds by index
+  return assignSoundsByIndex(firstSounds);
+}
+
+// I2S and SPI use disjoint pins and peripherals; I2S only waits for the
+// config (one small read), not for the directory walk.
+const InitStep initSteps[] = {
+    {BOOT_SD, initStorageStep, 0},
+    {BOOT_CONFIG, loadBoardConfig, INIT_DEP(BOOT_SD)},
+    {BOOT_DISCOVERY, initDiscoveryStep, INIT_DEP(BOOT_CONFIG)},
+    {BOOT_I2S, initAudioStep, INIT_DEP(BOOT_CONFIG)}, // DMA buffer profile
+    {BOOT_RADIO, setupRadio, 0},
+    // Sending only, setup() starts receiving once everything is up
+    {BOOT_ESPNOW, setupESPNow, INIT_DEP(BOOT_RADIO) | INIT_DEP(BOOT_CONFIG)},
+};
+
+// Serial console commands
+void onCadenceCommand(const char *args)
+{
+  if (strcmp(args, "reset") == 0)
   {
-    audioFile.seek(44);
+    uint16_t window = cadenceWindow();
+    cadenceReset();
+    gestureSetMultiPressWindow(&gestures, cadenceWindow());
+    recordWindow(window, cadenceWindow());
   }
+  printCadence();
+}
 
-  size_t bytesRead, bytesWritten;
+void onRecordCommand(const char *args)
+{
+  if (strcmp(args, "clear") == 0)
+  {
+    recorderClear();
+    Serial.println("Recording cleared");
+    return;
+  }
+  recorderDump();
+}
 
-  while (audioFile.available())
+void onSleepCommand(const char *args)
+{
+  printSleepStats();
+}
+
+void onNetCommand(const char *args)
+{
+  Serial.printf("Board %d, frame epoch %lu, %lu frames sent\n", boardId,
+                (unsigned long)frameEpoch, (unsigned long)(nextFrameSeq - 1));
+  Serial.printf("Dropped: %lu duplicate frames, %lu stale frames\n",
+                (unsigned long)frameDispatch.dedupe.duplicates,
+                (unsigned long)frameDispatch.dedupe.stale);
+  Serial.printf("Received %lu frames, %lu with nothing for this board, %lu us each on average\n",
+                (unsigned long)framesReceived, (unsigned long)framesIgnored,
+                (unsigned long)(framesReceived ? receiveUs / framesReceived : 0));
+
+  portENTER_CRITICAL(&peerMux);
+  PeerTable table = peers;
+  portEXIT_CRITICAL(&peerMux);
+  const PeerStats &sent = table.stats;
+  uint32_t unicastDone = sent.unicastOk + sent.unicastFailed;
+  Serial.printf("Sent %lu unicast (%lu%% acked by the radio), %lu broadcast%s\n",
+                (unsigned long)sent.unicast,
+                (unsigned long)(unicastDone ? sent.unicastOk * 100 / unicastDone : 100),
+                (unsigned long)sent.broadcast, boardConfig.unicast ? "" : " (unicast = off)");
+  if (boardConfig.peerRssi)
+    Serial.printf("Peer RSSI: %lu management frames sniffed, %lu of them ESP-NOW\n",
+                  (unsigned long)sniffedFrames, (unsigned long)sniffedEspNow);
+  Serial.printf("Peer MACs: %lu learned, %lu forgotten, %lu evicted, %lu unregistered\n",
+                (unsigned long)sent.learned, (unsigned long)sent.forgotten,
+                (unsigned long)sent.evicted, (unsigned long)sent.unregistered);
+
+  if (!boardConfig.reliableDelivery)
+    return;
+  const LinkStats &stats = link.stats;
+  uint32_t finished = stats.delivered + stats.failed;
+  Serial.printf("Reliable delivery: %lu%% of %lu delivered (%lu first try), %lu failed, %lu retransmits\n",
+                (unsigned long)(finished ? stats.delivered * 100 / finished : 100),
+                (unsigned long)finished, (unsigned long)stats.firstTry,
+                (unsigned long)stats.failed, (unsigned long)stats.retransmits);
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
   {
-    bytesRead = audioFile.read(audioBuffer, BUFFER_SIZE);
+    const LinkPeer &peer = link.peers[board];
+    if (peer.measured)
+      Serial.printf("  Board %d: last RTT %lu ms, smoothed %ld ms, timeout %lu ms\n", board,
+                    (unsigned long)peer.lastRttMs, (long)(peer.srtt8 >> 3), (unsigned long)peer.rtoMs);
+  }
+}
 
-    if (bytesRead > 0)
-    {
-      processAudioBuffer(audioBuffer, processedBuffer, bytesRead);
+void onPeersCommand(const char *args)
+{
+  uint32_t now = millis();
+  portENTER_CRITICAL(&peerMux);
+  PeerTable table = peers;
+  portEXIT_CRITICAL(&peerMux);
+
+  portENTER_CRITICAL(&claimMux);
+  IdClaim claim = idClaim;
+  portEXIT_CRITICAL(&claimMux);
+  if (claim.claiming)
+    Serial.printf("Board ID: claiming %d", claim.id);
+  else
+    Serial.printf("Board ID: %d (%s)", claim.id, claim.fixed ? "set by hand" : "negotiated");
+  Serial.printf(", %d other IDs taken, gave up an ID %u times\n",
+                __builtin_popcountll(claim.taken), claim.moves);
 
-      esp_err_t result = i2s_write(I2S_NUM, processedBuffer, bytesRead,
-                                   &bytesWritten, pdMS_TO_TICKS(100));
-      if (result != ESP_OK)
-      {
-        Serial.printf("I2S write error: %s\n", esp_err_to_name(result));
-        break;
-      }
+  Serial.printf("Heartbeat every %lu ms unless something else was broadcast\n",
+                (unsigned long)heartbeatIntervalMs);
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    const PeerEntry &peer = table.peers[board];
+    if (board == boardId || !peer.heard)
+      continue;
+    Serial.printf("  Board %d: %s, heard %lu s ago", board,
+                  peerAlive(&table, board, now) ? "alive" : "off?",
+                  (unsigned long)((now - peer.lastHeardMs) / 1000));
+    if (peer.rssi)
+      Serial.printf(", RSSI %d dBm", peer.rssi);
+    if (peer.firmware)
+      Serial.printf(", firmware %u", peer.firmware);
+    if (peer.busy)
+      Serial.print(", playing");
+    if (peer.queueDepth)
+      Serial.printf(", %u queued", peer.queueDepth);
+    if (peer.driftKnown)
+      Serial.printf(", output %+.2f ppm", peer.driftPpb / 1000.0);
+    if (peer.sleepMs)
+      Serial.printf(", sleeps up to %u ms", peer.sleepMs);
+    if (peer.known)
+      Serial.printf(", %02X:%02X:%02X:%02X:%02X:%02X%s",
+                    peer.mac[0], peer.mac[1], peer.mac[2], peer.mac[3], peer.mac[4], peer.mac[5],
+                    peer.routable ? "" : " (not registered)");
+    Serial.println();
+  }
+}
 
-      if (bytesWritten < bytesRead)
-      {
-        taskYIELD();
-      }
-    }
+void onSendCommand(const char *args)
+{
+  char target[32];
+  int len = strcspn(args, " ");
+  BoardMask targets = 0;
+  if (len < (int)sizeof(target))
+  {
+    memcpy(target, args, len);
+    target[len] = '\0';
+    if (!parseBoardSet(target, &targets))
+      targets = 0;
+  }
+  if ((targets & ~BOARD_BIT(boardId)) == 0)
+  {
+    Serial.printf("Usage: send <board %d-%d, not this one | a+b+c | all> [sound]\n",
+                  SOUND_MESSAGE_MIN_BOARD, SOUND_MESSAGE_MAX_BOARD);
+    return;
   }
+  const char *end = args + len;
+  while (*end == ' ')
+    end++;
+  String sound = *end ? String(end) : getRandomSound();
+  if (sound.length() == 0)
+  {
+    Serial.println("No sounds available to send");
+    return;
+  }
+  BoardMask others = targets & ~BOARD_BIT(boardId);
+  uint32_t start = 0;
+  int64_t startUs;
+  bool scheduled = (others & (others - 1)) && planStart(&start, &startUs);
+  sendSoundToBoards(targets, sound.c_str(), scheduled, start);
+}
 
-  audioFile.close();
-  isPlaying = false;
-  Serial.println("Playback completed");
+void onSyncCommand(const char *args)
+{
+  int64_t nowUs = esp_timer_get_time();
+  portENTER_CRITICAL(&clockMux);
+  ClockSync sync = clockSync;
+  portEXIT_CRITICAL(&clockMux);
+
+  if (sync.master == 0)
+    Serial.print("No time master");
+  else if (sync.master == boardId)
+    Serial.print("Keeping the fleet clock");
+  else
+    Serial.printf("Taking the time from Board %d", sync.master);
+  if (sync.synced)
+    Serial.printf(", fleet time %lld us, offset %lld us, rate %+.2f ppm, within %ld us\n",
+                  clockFleetUs(&sync, nowUs), clockFleetUs(&sync, nowUs) - nowUs,
+                  sync.skewPpb / 1000.0, (long)clockErrorUs(&sync, nowUs));
+  else
+    Serial.println(", not synced yet");
+  Serial.printf("Requests: %lu sent, %lu samples, %lu rejected, %lu answered; master changed %lu times\n",
+                (unsigned long)sync.stats.requests, (unsigned long)sync.stats.samples,
+                (unsigned long)sync.stats.rejected, (unsigned long)sync.stats.answered,
+                (unsigned long)sync.stats.masterChanges);
+
+  const ScheduleStats *schedule = playbackScheduleStats();
+  Serial.printf("Scheduled starts: %lu, %lu late (worst %lld us), last released %lld us ahead%s\n",
+                (unsigned long)schedule->scheduled, (unsigned long)schedule->late,
+                schedule->maxLateUs, schedule->lastSlackUs,
+                boardConfig.syncLeadMs ? "" : " (sync_lead_ms = 0)");
+
+  // Output clock (sample_clock.h)
+  int32_t outputPpb;
+  const RateStats *rate = playbackRateStats();
+  if (playbackOutputPpb(&outputPpb))
+    Serial.printf("Output clock: %+.2f ppm against ours, %+.2f ppm against fleet time",
+                  outputPpb / 1000.0, (outputPpb - (sync.synced ? sync.skewPpb : 0)) / 1000.0);
+  else
+    Serial.printf("Output clock: not measured yet (%d s of playback in one go)",
+                  RATE_MIN_SPAN_US / 1000000);
+  Serial.printf(", %lu stretches, %lu ended by silence; ", (unsigned long)rate->stretches,
+                (unsigned long)rate->glitches);
+  if (boardConfig.driftCorrection)
+    Serial.printf("resampling by %+.2f ppm\n", playbackCorrectionPpb() / 1000.0);
+  else
+    Serial.println("not corrected (drift_correction = off)");
 }
 
+const ConsoleCommand consoleCommands[] = {
+    {"cadence", "Multi-press window and press interval histogram ([reset])", onCadenceCommand},
+    {"record", "Dump recorded inputs for tools/replay ([clear])", onRecordCommand},
+    {"sleep", "Light sleep duty cycle and estimated idle current", onSleepCommand},
+    {"net", "ESP-NOW frame counters", onNetCommand},
+    {"peers", "Board ID, other boards: last heard, RSSI, firmware, load, drift, MAC", onPeersCommand},
+    {"send", "Send a sound to any boards (<board|a+b|all> [sound], random sound if none)", onSendCommand},
+    {"sync", "Fleet clock: time master, offset, rate, error bound, scheduled starts, output drift", onSyncCommand},
+};
+
 void setup()
 {
+  bootPhaseStart(BOOT_SERIAL);
   Serial.begin(115200);
-  delay(2000);
+  // Wait for a host to attach, but never block boot on it
+  while (!Serial && millis() < SERIAL_ATTACH_TIMEOUT)
+  {
+    delay(1);
+  }
+  bootPhaseEnd(BOOT_SERIAL);
 
   Serial.println("=== ESP32-C3 Sound Board ===");
 
-  // Initialize buttons first (they don't conflict with SPI)
-  initButtons();
-
-  // Give the system time to stabilize before initializing SPI peripherals
-  delay(500);
+  // SD, I2S and the radio come up concurrently, see initSteps
+  runInitSteps(initSteps, sizeof(initSteps) / sizeof(initSteps[0]));
 
-  // Initialize SD card (must be before I2S to avoid SPI conflicts)
-  if (!initializeSDCard())
+  if (!initStepSucceeded(BOOT_SD))
   {
     Serial.println("Cannot continue without SD card");
     Serial.println("Halting. Please fix SD card and reset board.");
@@ -885,59 +1986,120 @@ void setup()
       delay(1000);
   }
 
-  // Show SD card info
-  uint64_t cardSize = SD.cardSize() / (1024 * 1024);
-  Serial.printf("SD Card: %lluMB\n", cardSize);
-
-  // Load board ID from SD card
-  if (!loadBoardId())
+  if (!initStepSucceeded(BOOT_CONFIG))
   {
-    Serial.println("Cannot continue without board ID file");
-    Serial.println("Please create 1.txt, 2.txt, 3.txt, 4.txt, or 5.txt on SD card");
+    Serial.println("Cannot continue without board ID");
+    Serial.println("Please set board_id in config.txt (or create 1.txt, 2.txt, ...) on SD card,");
+    Serial.println("or remove wire_version = 1 to have the ID negotiated");
     Serial.println("Halting. Please fix and reset board.");
     while (1)
       delay(1000);
   }
 
-  Serial.printf("Board ID: %d\n", boardId);
-
-  // Discover sound files
-  discoverSoundFiles();
-
-  // Assign sounds by index
-  assignSoundsByIndex();
+  if (boardId)
+    Serial.printf("Board ID: %d\n", boardId);
+  else
+    Serial.printf("Board ID: claiming %d\n", idClaim.id);
 
-  if (greenSound.length() == 0 || blueSound.length() == 0 || yellowSound.length() == 0)
+  if (!initStepSucceeded(BOOT_DISCOVERY))
   {
-    Serial.println("Cannot continue without at least 3 WAV files");
+    Serial.println("Cannot continue without a WAV file for every sound button");
     Serial.println("Halting. Please add WAV files to SD card and reset board.");
     while (1)
       delay(1000);
   }
 
   // Initialize current sounds to default sounds
-  currentGreenSound = greenSound;
-  currentBlueSound = blueSound;
-  currentYellowSound = yellowSound;
-
-  // Initialize I2S audio
-  Serial.println("\nInitializing audio...");
-  setupI2S();
+  for (int i = 0; i < MAX_BUTTONS; i++)
+  {
+    currentSounds[i] = buttonSounds[i];
+  }
 
-  // Initialize ESP-NOW
-  setupESPNow();
+  // The button ISR wakes the event loop, so it must exist first
+  eventLoopInit(onLoopEvent);
+  loopTimerInit(&inputTimer, onInputTimer, NULL);
+  loopTimerInit(&repeatTimer, onRepeatTimer, NULL);
+  loopTimerInit(&flushTimer, onFlushTimer, NULL);
+  loopTimerInit(&linkTimer, onLinkTimer, NULL);
+  loopTimerInit(&heartbeatTimer, onHeartbeatTimer, NULL);
+  loopTimerInit(&claimTimer, onClaimTimer, NULL);
+  loopTimerInit(&clockTimer, onClockTimer, NULL);
+  scheduleClaimTimer();
+  linkInit(&link, esp_random());
+  // The first heartbeat goes out at once: boards already up learn our MAC
+  // and answer with theirs. Older firmware can't decode them.
+  if (boardConfig.wireVersion != 1)
+  {
+    loopTimerStartAt(&heartbeatTimer, millis());
+    scheduleClockTimer(esp_timer_get_time());
+  }
+  audioSetStateHook(onAudioState);
+
+  // Buttons come from the config table
+  initButtons(&boardConfig);
+  cadenceInit(boardConfig.multiPressMs, boardConfig.adaptiveMultiPress);
+  gestureInit(&gestures, buttonCount, buttonRoleMask(BUTTON_ROLE_SOUND),
+              cadenceWindow(), boardConfig.longHoldMs, boardConfig.dualPressMs);
+  // Press edges of every sound button either start or prefetch its sound
+  gestureSetPressStart(&gestures, buttonRoleMask(BUTTON_ROLE_SOUND));
+
+  uint32_t speculativeButtons = 0;
+  for (int i = 0; i < buttonCount; i++)
+  {
+    if (boardConfig.buttons[i].speculative)
+      speculativeButtons |= 1UL << i;
+  }
+  dispatchInit(&gestureDispatch, boardId, speculativeButtons);
+  BoardMask targets[CONFIG_MAX_TARGETS]; // BoardConfig is packed, these may be unaligned
+  memcpy(targets, boardConfig.targets, sizeof(targets));
+  dispatchSetTargets(&gestureDispatch, targets, boardConfig.targetCount);
+
+  RecordingHeader recording = {};
+  recording.boardId = boardId;
+  recording.buttonCount = buttonCount;
+  recording.tapMask = buttonRoleMask(BUTTON_ROLE_SOUND);
+  recording.speculativeMask = speculativeButtons;
+  recording.debounceMs = boardConfig.debounceMs;
+  recording.multiPressMs = cadenceWindow();
+  recording.longHoldMs = boardConfig.longHoldMs;
+  recording.dualPressMs = boardConfig.dualPressMs;
+  recorderBegin(&recording);
+
+  printBootTrace();
+  printInitCriticalPath(initSteps, sizeof(initSteps) / sizeof(initSteps[0]));
+  Serial.printf("First playable button at %lu ms after boot\n", millis());
+
+  if (!catalogReady)
+    startCatalogDiscovery();
 
   Serial.println("\n=== Setup Complete ===");
   Serial.println("Button Functions:");
-  Serial.println("  Green/Blue/Yellow: Play assigned sound (hold 1s for random)");
-  Serial.println("  Press 2x: Send to Board 1, 3x: Board 2, etc. (not to self)");
-  Serial.println("  Any 2 together: Play random sound");
-  Serial.println("  Red: Send random sound to random board");
+  for (int i = 0; i < buttonCount; i++)
+  {
+    if (buttons[i].role == BUTTON_ROLE_SOUND)
+      Serial.printf("  %s: Play %s (hold for random)%s\n", buttons[i].name, buttonSounds[i].c_str(),
+                    boardConfig.buttons[i].speculative ? " - plays on press" : "");
+    else
+      Serial.printf("  %s: Send random sound to random board\n", buttons[i].name);
+  }
+  if (boardConfig.targetCount == 0)
+    Serial.println("  Press 2x: Send to Board 1, 3x: Board 2, etc. (not to self)");
+  for (int i = 0; i < boardConfig.targetCount; i++)
+    Serial.printf("  Press %dx: Send to %s\n", i + 2, boardSetName(boardConfig.targets[i]).c_str());
+  Serial.printf("  Any 2 sound buttons pressed within %d ms: Play random sound\n", boardConfig.dualPressMs);
+  if (__builtin_popcount(buttonRoleMask(BUTTON_ROLE_SOUND)) >= 3)
+    Serial.println("  3 or more sound buttons together: Play everywhere");
+  consoleBegin(consoleCommands, sizeof(consoleCommands) / sizeof(consoleCommands[0]));
+  consoleSetInputHook(onConsoleInput);
+  consolePoll(); // Whatever was typed during boot
+  Serial.println("Type help on the serial monitor for commands");
+  idleSleepInit(boardConfig.sleepBudgetMs);
+  startReceiving();
   Serial.println("Ready!");
 }
 
+// Sleeps on the event queue until a button edge or a timer is due
 void loop()
 {
-  handleButtons();
-  delay(10); // Small delay to prevent excessive CPU usage
+  eventLoopRunOnce();
 }
\ No newline at end of file
@@ -0,0 +1,254 @@
+#include "peer_table.h"
+
+#include <string.h>
+
+void peerTableInit(PeerTable *table, uint32_t nowMs)
+{
+  memset(table, 0, sizeof(*table));
+  table->startMs = nowMs;
+}
+
+bool peerHeard(PeerTable *table, uint8_t board, const uint8_t *mac, int8_t rssi, uint32_t nowMs)
+{
+  if (board < SOUND_MESSAGE_MIN_BOARD || board > SOUND_MESSAGE_MAX_BOARD)
+    return false;
+
+  PeerEntry &peer = table->peers[board];
+  peer.heard = true;
+  peer.lastHeardMs = nowMs;
+  if (rssi)
+    peer.rssi = rssi;
+  if (peer.known && memcmp(peer.mac, mac, PEER_MAC_LEN) == 0)
+    return false;
+
+  memcpy(peer.mac, mac, PEER_MAC_LEN);
+  peer.known = true;
+  peer.routable = false;
+  peer.failures = 0;
+  table->stats.learned++;
+  return true;
+}
+
+void peerPresence(PeerTable *table, uint8_t board, uint8_t flags, uint16_t firmware,
+                  uint8_t queueDepth, uint16_t sleepMs)
+{
+  if (board < SOUND_MESSAGE_MIN_BOARD || board > SOUND_MESSAGE_MAX_BOARD)
+    return;
+  PeerEntry &peer = table->peers[board];
+  peer.busy = flags & SOUND_PRESENCE_PLAYING;
+  peer.queueDepth = queueDepth;
+  peer.sleepKnown = true;
+  peer.sleepMs = sleepMs;
+  if (firmware)
+    peer.firmware = firmware;
+}
+
+void peerDrift(PeerTable *table, uint8_t board, int32_t driftPpb)
+{
+  if (board < SOUND_MESSAGE_MIN_BOARD || board > SOUND_MESSAGE_MAX_BOARD ||
+      driftPpb == SOUND_DRIFT_UNKNOWN)
+    return;
+  table->peers[board].driftKnown = true;
+  table->peers[board].driftPpb = driftPpb;
+}
+
+void peerMarkBusy(PeerTable *table, uint8_t board)
+{
+  if (board >= SOUND_MESSAGE_MIN_BOARD && board <= SOUND_MESSAGE_MAX_BOARD)
+    table->peers[board].busy = true;
+}
+
+bool peerAlive(const PeerTable *table, uint8_t board, uint32_t nowMs)
+{
+  if (board < SOUND_MESSAGE_MIN_BOARD || board > SOUND_MESSAGE_MAX_BOARD)
+    return false;
+  const PeerEntry &peer = table->peers[board];
+  uint32_t sinceMs = peer.heard ? peer.lastHeardMs : table->startMs;
+  return nowMs - sinceMs < PEER_ALIVE_MS;
+}
+
+// Heard from and alive; with up to SOUND_MESSAGE_MAX_BOARD IDs, boards
+// never heard are mostly ones that don't exist
+static bool pickable(const PeerTable *table, uint8_t board, uint8_t self, uint32_t nowMs)
+{
+  return board != self && table->peers[board].heard && peerAlive(table, board, nowMs);
+}
+
+// Idle boards 4x as likely as playing ones, 8x as ones with commands
+// queued; then up to 4x for a strong link
+static uint32_t targetWeight(const PeerEntry &peer)
+{
+  uint32_t load = !peer.busy && peer.queueDepth == 0 ? 8 : peer.queueDepth == 0 ? 2 : 1;
+
+  uint32_t link;
+  if (peer.failures > 0)
+    link = 1;
+  else if (peer.rssi == 0)
+    link = 2; // Unknown
+  else if (peer.rssi >= -65)
+    link = 4;
+  else if (peer.rssi >= -75)
+    link = 3;
+  else if (peer.rssi >= -85)
+    link = 2;
+  else
+    link = 1;
+  return load * link;
+}
+
+uint8_t peerPickTarget(const PeerTable *table, uint8_t self, uint32_t nowMs, uint32_t random)
+{
+  uint32_t total = 0;
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    if (pickable(table, board, self, nowMs))
+      total += targetWeight(table->peers[board]);
+  }
+  if (total == 0)
+    return 0;
+
+  uint32_t pick = random % total;
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    if (!pickable(table, board, self, nowMs))
+      continue;
+    uint32_t weight = targetWeight(table->peers[board]);
+    if (pick < weight)
+      return board;
+    pick -= weight;
+  }
+  return 0;
+}
+
+BoardMask peerAliveMask(const PeerTable *table, uint8_t self, uint32_t nowMs)
+{
+  BoardMask alive = 0;
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    if (pickable(table, board, self, nowMs))
+      alive |= BOARD_BIT(board);
+  }
+  return alive;
+}
+
+uint16_t peerSleepBudget(const PeerTable *table, BoardMask targetMask, uint8_t self,
+                         uint16_t fallbackMs, uint32_t nowMs)
+{
+  // Nobody heard yet: whoever is out there may sleep like us
+  uint16_t longest = targetMask ? 0 : fallbackMs;
+  bool any = false;
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    if (targetMask ? !(targetMask & BOARD_BIT(board)) || board == self
+                   : !pickable(table, board, self, nowMs))
+      continue;
+    const PeerEntry &peer = table->peers[board];
+    uint16_t budgetMs = peer.sleepKnown ? peer.sleepMs : fallbackMs;
+    if (!any || budgetMs > longest)
+      longest = budgetMs;
+    any = true;
+  }
+  return longest;
+}
+
+void peerSetRoutable(PeerTable *table, uint8_t board, const uint8_t *mac)
+{
+  if (board < SOUND_MESSAGE_MIN_BOARD || board > SOUND_MESSAGE_MAX_BOARD)
+    return;
+  PeerEntry &peer = table->peers[board];
+  peer.registered = true;
+  memcpy(peer.registeredMac, mac, PEER_MAC_LEN);
+  peer.routable = peer.known && memcmp(peer.mac, mac, PEER_MAC_LEN) == 0;
+}
+
+uint8_t peerEvict(PeerTable *table)
+{
+  int routable = 0;
+  uint8_t oldest = 0;
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    const PeerEntry &peer = table->peers[board];
+    if (!peer.routable)
+      continue;
+    routable++;
+    if (!oldest || (int32_t)(peer.lastHeardMs - table->peers[oldest].lastHeardMs) < 0)
+      oldest = board;
+  }
+  if (routable < PEER_MAX_ROUTABLE)
+    return 0;
+  // Forgotten, so it is registered again when it is next heard
+  table->peers[oldest].known = false;
+  table->peers[oldest].routable = false;
+  table->stats.evicted++;
+  return oldest;
+}
+
+uint8_t peerTakeStale(PeerTable *table, uint8_t *mac)
+{
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    PeerEntry &peer = table->peers[board];
+    if (!peer.registered || peer.routable)
+      continue;
+    peer.registered = false;
+
+    bool shared = false;
+    for (int other = SOUND_MESSAGE_MIN_BOARD; other <= SOUND_MESSAGE_MAX_BOARD; other++)
+    {
+      const PeerEntry &entry = table->peers[other];
+      shared |= entry.routable && memcmp(entry.mac, peer.registeredMac, PEER_MAC_LEN) == 0;
+    }
+    if (shared)
+      continue;
+    memcpy(mac, peer.registeredMac, PEER_MAC_LEN);
+    table->stats.unregistered++;
+    return board;
+  }
+  return 0;
+}
+
+bool peerRoute(PeerTable *table, BoardMask targetMask, uint8_t *mac)
+{
+  // Exactly one target
+  if (targetMask != 0 && (targetMask & (targetMask - 1)) == 0)
+  {
+    for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+    {
+      const PeerEntry &peer = table->peers[board];
+      if (targetMask == BOARD_BIT(board) && peer.routable)
+      {
+        memcpy(mac, peer.mac, PEER_MAC_LEN);
+        table->stats.unicast++;
+        return true;
+      }
+    }
+  }
+  table->stats.broadcast++;
+  return false;
+}
+
+uint8_t peerSendResult(PeerTable *table, const uint8_t *mac, bool ok)
+{
+  for (int board = SOUND_MESSAGE_MIN_BOARD; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    PeerEntry &peer = table->peers[board];
+    if (!peer.known || memcmp(peer.mac, mac, PEER_MAC_LEN) != 0)
+      continue;
+
+    if (ok)
+    {
+      table->stats.unicastOk++;
+      peer.failures = 0;
+      return 0;
+    }
+    table->stats.unicastFailed++;
+    if (++peer.failures < PEER_MAX_FAILURES)
+      return 0;
+    peer.known = false;
+    peer.routable = false;
+    peer.failures = 0;
+    table->stats.forgotten++;
+    return board;
+  }
+  return 0;
+}
@@ -0,0 +1,181 @@
+#include "press_cadence.h"
+
+#include <Preferences.h>
+#include "board_config.h"
+#include "gesture.h"
+
+static uint16_t histogram[CADENCE_BUCKETS];
+static uint32_t sampleCount = 0;
+static uint32_t nearMisses = 0;
+static uint16_t sinceUpdate = 0;
+static uint16_t maxWindow = MULTI_PRESS_WINDOW;
+static uint16_t window = MULTI_PRESS_WINDOW;
+static bool adaptiveWindow = true;
+
+// Previous press edge per button, 0 = none yet
+static uint32_t lastEdgeMs[GESTURE_MAX_BUTTONS];
+
+static uint16_t computeWindow()
+{
+  if (!adaptiveWindow || sampleCount < CADENCE_MIN_SAMPLES)
+    return maxWindow;
+
+  uint32_t target = (sampleCount * CADENCE_PERCENTILE + 99) / 100;
+  uint32_t seen = 0;
+  int bucket = 0;
+  for (; bucket < CADENCE_BUCKETS - 1; bucket++)
+  {
+    seen += histogram[bucket];
+    if (seen >= target)
+      break;
+  }
+
+  // Upper edge of the percentile bucket plus headroom
+  uint32_t ms = (bucket + 1) * CADENCE_BUCKET_MS;
+  ms += ms * CADENCE_HEADROOM_PCT / 100;
+  if (ms < CADENCE_MIN_WINDOW)
+    ms = CADENCE_MIN_WINDOW;
+  if (ms > maxWindow)
+    ms = maxWindow;
+  return ms;
+}
+
+static void saveCadence()
+{
+  Preferences prefs;
+  if (prefs.begin(CADENCE_NAMESPACE, false))
+  {
+    prefs.putBytes("hist", histogram, sizeof(histogram));
+    prefs.putUInt("misses", nearMisses);
+    prefs.putUChar("ver", CADENCE_VERSION);
+    prefs.end();
+  }
+}
+
+static void addSample(uint32_t intervalMs)
+{
+  int bucket = intervalMs / CADENCE_BUCKET_MS;
+  if (bucket >= CADENCE_BUCKETS)
+    bucket = CADENCE_BUCKETS - 1;
+  histogram[bucket]++;
+  sampleCount++;
+
+  // Age out old behaviour so a new operator is picked up
+  if (sampleCount >= CADENCE_DECAY_TOTAL)
+  {
+    sampleCount = 0;
+    for (int i = 0; i < CADENCE_BUCKETS; i++)
+    {
+      histogram[i] /= 2;
+      sampleCount += histogram[i];
+    }
+  }
+}
+
+void cadenceInit(uint16_t maxWindowMs, bool adaptive)
+{
+  maxWindow = maxWindowMs;
+  adaptiveWindow = adaptive;
+  memset(histogram, 0, sizeof(histogram));
+  memset(lastEdgeMs, 0, sizeof(lastEdgeMs));
+  sampleCount = 0;
+  nearMisses = 0;
+
+  Preferences prefs;
+  if (prefs.begin(CADENCE_NAMESPACE, true))
+  {
+    if (prefs.getUChar("ver", 0) == CADENCE_VERSION &&
+        prefs.getBytesLength("hist") == sizeof(histogram))
+    {
+      prefs.getBytes("hist", histogram, sizeof(histogram));
+      nearMisses = prefs.getUInt("misses", 0);
+      for (int i = 0; i < CADENCE_BUCKETS; i++)
+        sampleCount += histogram[i];
+    }
+    prefs.end();
+  }
+
+  window = computeWindow();
+}
+
+uint16_t cadenceWindow()
+{
+  return window;
+}
+
+bool cadenceOnPressEdge(uint8_t button, uint8_t count, uint32_t nowMs)
+{
+  if (button >= GESTURE_MAX_BUTTONS)
+    return false;
+
+  uint32_t previous = lastEdgeMs[button];
+  lastEdgeMs[button] = nowMs;
+  if (previous == 0)
+    return false;
+
+  uint32_t interval = nowMs - previous;
+  if (count >= 2)
+  {
+    addSample(interval); // Confirmed multi-press
+  }
+  else if (interval >= window && interval < maxWindow)
+  {
+    // Would have been a multi-press with the configured window
+    addSample(interval);
+    nearMisses++;
+  }
+  else
+  {
+    return false;
+  }
+
+  if (++sinceUpdate < CADENCE_UPDATE_EVERY)
+    return false;
+  sinceUpdate = 0;
+  saveCadence();
+
+  uint16_t updated = computeWindow();
+  if (updated == window)
+    return false;
+  Serial.printf("Multi-press window %u -> %u ms (%lu samples)\n", window, updated,
+                (unsigned long)sampleCount);
+  window = updated;
+  return true;
+}
+
+void cadenceReset()
+{
+  memset(histogram, 0, sizeof(histogram));
+  sampleCount = 0;
+  nearMisses = 0;
+  sinceUpdate = 0;
+  saveCadence();
+  window = computeWindow();
+}
+
+void printCadence()
+{
+  Serial.printf("Multi-press window: %u ms (%s, max %u ms, min %u ms)\n", window,
+                adaptiveWindow ? "adaptive" : "fixed", maxWindow, CADENCE_MIN_WINDOW);
+  Serial.printf("Samples: %lu, near misses: %lu, p%d after %d samples\n",
+                (unsigned long)sampleCount, (unsigned long)nearMisses,
+                CADENCE_PERCENTILE, CADENCE_MIN_SAMPLES);
+
+  uint16_t peak = 1;
+  for (int i = 0; i < CADENCE_BUCKETS; i++)
+  {
+    if (histogram[i] > peak)
+      peak = histogram[i];
+  }
+  for (int i = 0; i < CADENCE_BUCKETS; i++)
+  {
+    if (histogram[i] == 0)
+      continue;
+    char bar[41];
+    int len = histogram[i] * 40 / peak;
+    memset(bar, '#', len);
+    bar[len] = '\0';
+    Serial.printf("  %4d-%4d%s ms %5u %s\n", i * CADENCE_BUCKET_MS, (i + 1) * CADENCE_BUCKET_MS,
+                  i == CADENCE_BUCKETS - 1 ? "+" : " ", histogram[i], bar);
+  }
+}
@@ -0,0 +1,162 @@
+#include "reliable_link.h"
+
+#include <string.h>
+
+void linkInit(ReliableLink *link, uint32_t seed)
+{
+  memset(link, 0, sizeof(*link));
+  for (int i = 0; i <= SOUND_MESSAGE_MAX_BOARD; i++)
+    link->peers[i].rtoMs = LINK_INITIAL_RTO_MS;
+  link->jitterState = seed ? seed : 1;
+}
+
+// xorshift32, only needs to decorrelate senders
+static uint32_t nextJitter(ReliableLink *link, uint32_t range)
+{
+  uint32_t x = link->jitterState;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  link->jitterState = x;
+  return range ? x % range : 0;
+}
+
+static void updateRto(LinkPeer *peer, uint32_t rttMs)
+{
+  int32_t rtt = rttMs;
+  peer->lastRttMs = rttMs;
+  if (!peer->measured)
+  {
+    peer->srtt8 = rtt << 3;
+    peer->rttvar4 = rtt << 1; // rtt / 2
+    peer->measured = true;
+  }
+  else
+  {
+    int32_t delta = rtt - (peer->srtt8 >> 3);
+    peer->srtt8 += delta; // srtt += delta / 8
+    if (delta < 0)
+      delta = -delta;
+    peer->rttvar4 += delta - (peer->rttvar4 >> 2); // rttvar += (|delta| - rttvar) / 4
+  }
+
+  uint32_t rto = (peer->srtt8 >> 3) + peer->rttvar4; // srtt + 4 * rttvar
+  if (rto < LINK_MIN_RTO_MS)
+    rto = LINK_MIN_RTO_MS;
+  if (rto > LINK_MAX_RTO_MS)
+    rto = LINK_MAX_RTO_MS;
+  peer->rtoMs = rto;
+}
+
+// Timeout for the next attempt: slowest waiting target, doubled per attempt
+static uint32_t deliveryTimeout(ReliableLink *link, const LinkDelivery *delivery)
+{
+  uint32_t rto = LINK_MIN_RTO_MS;
+  for (int board = 1; board <= SOUND_MESSAGE_MAX_BOARD; board++)
+  {
+    if ((delivery->waitingMask & BOARD_BIT(board)) && link->peers[board].rtoMs > rto)
+      rto = link->peers[board].rtoMs;
+  }
+  uint32_t backoff = rto << (delivery->attempts - 1);
+  if (backoff > LINK_MAX_RTO_MS)
+    backoff = LINK_MAX_RTO_MS;
+  return backoff + nextJitter(link, backoff / LINK_JITTER_DIV + 1);
+}
+
+void linkTrack(ReliableLink *link, uint32_t seq, BoardMask targetMask,
+               const uint8_t *data, int len, uint32_t nowMs)
+{
+  if (targetMask == 0 || len > SOUND_FRAME_MAX_LEN)
+    return;
+
+  LinkDelivery *slot = NULL;
+  for (int i = 0; i < LINK_MAX_PENDING && !slot; i++)
+  {
+    if (!link->pending[i].active)
+      slot = &link->pending[i];
+  }
+  if (!slot)
+  {
+    slot = &link->pending[0];
+    for (int i = 1; i < LINK_MAX_PENDING; i++)
+    {
+      if ((int32_t)(link->pending[i].firstSentMs - slot->firstSentMs) < 0)
+        slot = &link->pending[i];
+    }
+    link->stats.failed++;
+  }
+
+  slot->active = true;
+  slot->seq = seq;
+  slot->waitingMask = targetMask;
+  slot->attempts = 1;
+  slot->firstSentMs = nowMs;
+  slot->len = len;
+  memcpy(slot->data, data, len);
+  slot->dueMs = nowMs + deliveryTimeout(link, slot);
+  link->stats.tracked++;
+}
+
+void linkOnAck(ReliableLink *link, uint8_t board, uint32_t seq, uint32_t nowMs)
+{
+  if (board > SOUND_MESSAGE_MAX_BOARD)
+    return;
+
+  for (int i = 0; i < LINK_MAX_PENDING; i++)
+  {
+    LinkDelivery &delivery = link->pending[i];
+    if (!delivery.active || delivery.seq != seq || !(delivery.waitingMask & BOARD_BIT(board)))
+      continue;
+
+    // Karn: after a retransmission it's unknown which copy was acked
+    if (delivery.attempts == 1)
+      updateRto(&link->peers[board], nowMs - delivery.firstSentMs);
+
+    delivery.waitingMask &= ~BOARD_BIT(board);
+    if (delivery.waitingMask == 0)
+    {
+      delivery.active = false;
+      link->stats.delivered++;
+      if (delivery.attempts == 1)
+        link->stats.firstTry++;
+    }
+    return;
+  }
+}
+
+void linkPoll(ReliableLink *link, uint32_t nowMs, LinkSendFn send)
+{
+  for (int i = 0; i < LINK_MAX_PENDING; i++)
+  {
+    LinkDelivery &delivery = link->pending[i];
+    if (!delivery.active || (int32_t)(nowMs - delivery.dueMs) < 0)
+      continue;
+
+    if (delivery.attempts >= LINK_MAX_ATTEMPTS)
+    {
+      delivery.active = false;
+      link->stats.failed++;
+      continue;
+    }
+
+    send(delivery.data, delivery.len, delivery.waitingMask);
+    delivery.attempts++;
+    link->stats.retransmits++;
+    delivery.dueMs = nowMs + deliveryTimeout(link, &delivery);
+  }
+}
+
+bool linkNextDeadline(const ReliableLink *link, uint32_t *dueMs)
+{
+  bool found = false;
+  for (int i = 0; i < LINK_MAX_PENDING; i++)
+  {
+    const LinkDelivery &delivery = link->pending[i];
+    if (delivery.active && (!found || (int32_t)(delivery.dueMs - *dueMs) < 0))
+    {
+      *dueMs = delivery.dueMs;
+      found = true;
+    }
+  }
+  return found;
+}
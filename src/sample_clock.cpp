@@ -0,0 +1,146 @@
+#include "sample_clock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void rateMeterInit(RateMeter *meter, uint32_t sampleRate)
+{
+  memset(meter, 0, sizeof(*meter));
+  meter->sampleRate = sampleRate;
+}
+
+// Rate known so far, to tell a glitch from drift
+static int32_t expectedPpb(const RateMeter *meter)
+{
+  int32_t ppb = 0;
+  rateMeterPpb(meter, &ppb);
+  return ppb;
+}
+
+static void endStretch(RateMeter *meter)
+{
+  if (meter->stretchSpanUs)
+  {
+    int64_t weight = meter->weightUs + meter->stretchSpanUs;
+    meter->ppb = (meter->ppb * meter->weightUs + (int64_t)meter->stretchPpb * meter->stretchSpanUs) /
+                 weight;
+    meter->weightUs = weight < RATE_MAX_WEIGHT_US ? weight : RATE_MAX_WEIGHT_US;
+    meter->stats.stretches++;
+  }
+  meter->running = false;
+  meter->stretchSpanUs = 0;
+}
+
+static void startStretch(RateMeter *meter)
+{
+  meter->running = true;
+  meter->firstUs = meter->lastUs = meter->windowUs;
+  meter->firstResidualUs = meter->lastResidualUs = meter->windowResidualUs;
+}
+
+static void closeWindow(RateMeter *meter)
+{
+  meter->windowed = false;
+  if (!meter->running)
+  {
+    startStretch(meter);
+    return;
+  }
+
+  int64_t predictedUs = meter->lastResidualUs -
+                        (int64_t)expectedPpb(meter) * (meter->windowUs - meter->lastUs) / 1000000000LL;
+  int64_t spanUs = meter->windowUs - meter->firstUs;
+  int64_t ppb = spanUs > 0 ? -(meter->windowResidualUs - meter->firstResidualUs) * 1000000000LL / spanUs
+                           : 0;
+  if (llabs(meter->windowResidualUs - predictedUs) > RATE_GLITCH_US ||
+      (spanUs >= RATE_MIN_SPAN_US && llabs(ppb) > RATE_MAX_PPB))
+  {
+    meter->stats.glitches++;
+    endStretch(meter);
+    startStretch(meter);
+    return;
+  }
+
+  meter->lastUs = meter->windowUs;
+  meter->lastResidualUs = meter->windowResidualUs;
+  if (spanUs >= RATE_MIN_SPAN_US)
+  {
+    meter->stretchPpb = ppb;
+    meter->stretchSpanUs = spanUs;
+  }
+}
+
+void rateMeterAdd(RateMeter *meter, uint64_t frames, int64_t nowUs)
+{
+  int64_t residualUs = nowUs - (int64_t)(frames * 1000000 / meter->sampleRate);
+  if (meter->windowed && nowUs - meter->windowStartUs >= RATE_WINDOW_US)
+    closeWindow(meter);
+  if (!meter->windowed)
+  {
+    meter->windowed = true;
+    meter->windowStartUs = meter->windowUs = nowUs;
+    meter->windowResidualUs = residualUs;
+  }
+  else if (residualUs < meter->windowResidualUs)
+  {
+    meter->windowUs = nowUs;
+    meter->windowResidualUs = residualUs;
+  }
+}
+
+void rateMeterBreak(RateMeter *meter)
+{
+  if (meter->windowed)
+    closeWindow(meter);
+  endStretch(meter);
+}
+
+bool rateMeterPpb(const RateMeter *meter, int32_t *ppb)
+{
+  int64_t weight = meter->weightUs + meter->stretchSpanUs;
+  if (weight == 0)
+    return false;
+  *ppb = (meter->ppb * meter->weightUs + (int64_t)meter->stretchPpb * meter->stretchSpanUs) / weight;
+  return true;
+}
+
+void resamplerReset(Resampler *resampler)
+{
+  resampler->prev[0] = resampler->prev[1] = 0;
+  resampler->position = (uint64_t)1 << 32; // First output is the first input frame
+}
+
+int resample(Resampler *resampler, const int16_t *in, int frames, int16_t *out)
+{
+  int64_t stepPpb = resampler->stepPpb;
+  if (stepPpb > RESAMPLE_MAX_PPB)
+    stepPpb = RESAMPLE_MAX_PPB;
+  if (stepPpb < -RESAMPLE_MAX_PPB)
+    stepPpb = -RESAMPLE_MAX_PPB;
+  uint64_t step = ((uint64_t)1 << 32) + stepPpb * ((int64_t)1 << 32) / 1000000000LL;
+
+  // Input frame i is in[i - 1], frame 0 the previous call's last
+  int count = 0;
+  uint64_t position = resampler->position;
+  for (;;)
+  {
+    int i = (int)(position >> 32);
+    if (i >= frames)
+      break;
+    const int16_t *a = i == 0 ? resampler->prev : in + (i - 1) * 2;
+    const int16_t *b = in + i * 2;
+    int64_t fraction = position & 0xFFFFFFFF;
+    out[count * 2] = a[0] + (((int64_t)b[0] - a[0]) * fraction >> 32);
+    out[count * 2 + 1] = a[1] + (((int64_t)b[1] - a[1]) * fraction >> 32);
+    count++;
+    position += step;
+  }
+  if (frames > 0)
+  {
+    resampler->prev[0] = in[(frames - 1) * 2];
+    resampler->prev[1] = in[(frames - 1) * 2 + 1];
+    position -= (uint64_t)frames << 32;
+  }
+  resampler->position = position;
+  return count;
+}
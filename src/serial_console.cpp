@@ -0,0 +1,90 @@
+#include "serial_console.h"
+
+static const ConsoleCommand *commandTable = NULL;
+static int commandCount = 0;
+static char line[CONSOLE_LINE_LEN];
+static size_t lineLen = 0;
+static ConsoleInputFn inputHook = NULL;
+
+void consoleBegin(const ConsoleCommand *commands, int count)
+{
+  commandTable = commands;
+  commandCount = count;
+  lineLen = 0;
+}
+
+static void runLine(char *text)
+{
+  while (*text == ' ')
+    text++;
+  if (*text == '\0')
+    return;
+
+  char *args = text;
+  while (*args && *args != ' ')
+    args++;
+  if (*args)
+    *args++ = '\0';
+  while (*args == ' ')
+    args++;
+
+  if (strcmp(text, "help") == 0)
+  {
+    for (int i = 0; i < commandCount; i++)
+      Serial.printf("  %-10s %s\n", commandTable[i].name, commandTable[i].help);
+    return;
+  }
+
+  for (int i = 0; i < commandCount; i++)
+  {
+    if (strcmp(text, commandTable[i].name) == 0)
+    {
+      commandTable[i].handler(args);
+      return;
+    }
+  }
+  Serial.printf("Unknown command: %s (try help)\n", text);
+}
+
+#if ARDUINO_USB_CDC_ON_BOOT
+static void onUsbEvent(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+  if (inputHook)
+    inputHook();
+}
+#else
+static void onUartReceive()
+{
+  if (inputHook)
+    inputHook();
+}
+#endif
+
+void consoleSetInputHook(ConsoleInputFn hook)
+{
+  inputHook = hook;
+  // Serial is the C3's USB CDC when the board boots with it, else UART0
+#if ARDUINO_USB_CDC_ON_BOOT
+  Serial.onEvent(ARDUINO_HW_CDC_RX_EVENT, onUsbEvent);
+#else
+  Serial.onReceive(onUartReceive);
+#endif
+}
+
+void consolePoll()
+{
+  while (Serial.available() > 0)
+  {
+    int c = Serial.read();
+    if (c == '\r' || c == '\n')
+    {
+      line[lineLen] = '\0';
+      runLine(line);
+      lineLen = 0;
+    }
+    else if (lineLen < sizeof(line) - 1)
+    {
+      line[lineLen++] = c;
+    }
+  }
+}
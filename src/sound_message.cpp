@@ -0,0 +1,492 @@
+#include "sound_message.h"
+
+#include <string.h>
+
+uint8_t calculateChecksum(const ESPNowMessage *msg)
+{
+  uint8_t sum = 0;
+  sum += msg->senderBoardId;
+  sum += msg->targetBoardId;
+  for (size_t i = 0; i < sizeof(msg->soundFile) && msg->soundFile[i]; i++)
+  {
+    sum += msg->soundFile[i];
+  }
+  return sum;
+}
+
+const char *decodeMessage(const uint8_t *data, int len, ESPNowMessage *msg)
+{
+  if (len != sizeof(ESPNowMessage))
+    return "invalid message size";
+
+  memcpy(msg, data, sizeof(*msg));
+  return NULL;
+}
+
+static bool validBoard(uint32_t id)
+{
+  return id >= SOUND_MESSAGE_MIN_BOARD && id <= SOUND_MESSAGE_MAX_BOARD;
+}
+
+const char *checkMessage(const ESPNowMessage *msg)
+{
+  // Check board ID range
+  if (!validBoard(msg->senderBoardId))
+    return "invalid sender board ID";
+  if (!validBoard(msg->targetBoardId))
+    return "invalid target board ID";
+
+  // Verify checksum
+  if (msg->checksum != calculateChecksum(msg))
+    return "checksum mismatch";
+
+  // The checksum stops at the first NUL, make sure there is one
+  if (memchr(msg->soundFile, '\0', sizeof(msg->soundFile)) == NULL)
+    return "unterminated sound name";
+  return NULL;
+}
+
+static uint8_t sumBytes(const uint8_t *data, int len)
+{
+  uint8_t sum = 0;
+  for (int i = 0; i < len; i++)
+    sum += data[i];
+  return sum;
+}
+
+static int putVarint(uint8_t *out, uint64_t value)
+{
+  int n = 0;
+  while (value >= 0x80)
+  {
+    out[n++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = value;
+  return n;
+}
+
+// Read a varint from data[*pos] up to end, false if truncated or over 64 bits
+static bool getVarint64(const uint8_t *data, int end, int *pos, uint64_t *value)
+{
+  uint64_t result = 0;
+  for (int shift = 0; shift < 70; shift += 7)
+  {
+    if (*pos >= end)
+      return false;
+    uint8_t byte = data[(*pos)++];
+    if (shift == 63 && (byte & 0x7E))
+      return false;
+    result |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+    {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Same, false if over 32 bits
+static bool getVarint(const uint8_t *data, int end, int *pos, uint32_t *value)
+{
+  uint64_t result;
+  if (!getVarint64(data, end, pos, &result) || result > 0xFFFFFFFF)
+    return false;
+  *value = result;
+  return true;
+}
+
+static const char *decodeLegacy(const uint8_t *data, int len, SoundFrame *frame)
+{
+  ESPNowMessage msg;
+  const char *reason = decodeMessage(data, len, &msg);
+  if (!reason)
+    reason = checkMessage(&msg);
+  if (reason)
+    return reason;
+
+  frame->version = 1;
+  frame->sender = msg.senderBoardId;
+  frame->epoch = frame->seq = 0;
+  frame->timestamp = msg.timestamp;
+  frame->copy = 0;
+  frame->commandCount = 1;
+  SoundCommand &cmd = frame->commands[0];
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = SOUND_CMD_PLAY;
+  cmd.target = msg.targetBoardId;
+  cmd.targets = BOARD_BIT(cmd.target);
+  memcpy(cmd.sound, msg.soundFile, sizeof(cmd.sound));
+  return NULL;
+}
+
+// Fields of one known command, payload is data[pos..end)
+static const char *decodeCommand(const uint8_t *data, int pos, int end, SoundCommand *cmd)
+{
+  uint32_t target = 0, value = 0, nameLen, flags = 0, firmware = 0, depth = 0, claim = 0,
+           sleep = 0;
+  uint64_t targets = 0;
+
+  switch (cmd->type)
+  {
+  case SOUND_CMD_PLAY:
+  case SOUND_CMD_PLAY_GROUP:
+    if (cmd->type == SOUND_CMD_PLAY_GROUP &&
+        (!getVarint64(data, end, &pos, &targets) || (targets & ~BOARD_MASK_ALL)))
+      return "malformed play command";
+    if ((cmd->type == SOUND_CMD_PLAY && !getVarint(data, end, &pos, &target)) ||
+        !getVarint(data, end, &pos, &nameLen) ||
+        nameLen == 0 || nameLen >= SOUND_NAME_LEN || pos + (int)nameLen > end)
+      return "malformed play command";
+    if (memchr(data + pos, '\0', nameLen))
+      return "malformed play command";
+    memcpy(cmd->sound, data + pos, nameLen);
+    cmd->sound[nameLen] = '\0';
+    pos += nameLen;
+    if (pos < end && !getVarint(data, end, &pos, &flags))
+      return "malformed play command";
+    if ((flags & SOUND_FLAG_START) && !getVarint(data, end, &pos, &cmd->start))
+      return "malformed play command";
+    if (cmd->type == SOUND_CMD_PLAY_GROUP)
+    {
+      cmd->targets = targets ? targets : BOARD_MASK_ALL;
+      cmd->flags = flags;
+      return NULL; // No single target
+    }
+    break;
+
+  case SOUND_CMD_STOP:
+    if (!getVarint(data, end, &pos, &target) || !getVarint(data, end, &pos, &value) ||
+        value > 0xFFFF)
+      return "malformed stop command";
+    cmd->fadeMs = value;
+    if (pos < end && !getVarint(data, end, &pos, &flags))
+      return "malformed stop command";
+    break;
+
+  case SOUND_CMD_PRESENCE:
+    if (!getVarint(data, end, &pos, &value))
+      return "malformed presence command";
+    cmd->value = value;
+    if (pos < end && (!getVarint(data, end, &pos, &firmware) || firmware > 0xFFFF))
+      return "malformed presence command";
+    if (pos < end && !getVarint(data, end, &pos, &depth))
+      return "malformed presence command";
+    if (pos < end && (!getVarint(data, end, &pos, &claim) || !validBoard(claim)))
+      return "malformed presence command";
+    if (pos < end && !getVarint(data, end, &pos, &sleep))
+      return "malformed presence command";
+    cmd->firmware = firmware;
+    cmd->queueDepth = depth > 0xFF ? 0xFF : depth;
+    cmd->sleepMs = sleep > 0xFFFF ? 0xFFFF : sleep;
+    cmd->target = claim;
+    return NULL; // No target
+
+  case SOUND_CMD_ACK:
+    if (!getVarint(data, end, &pos, &target) || !getVarint(data, end, &pos, &value))
+      return "malformed ack command";
+    cmd->value = value;
+    break;
+
+  case SOUND_CMD_TIME_REQUEST:
+  case SOUND_CMD_TIME_RESPONSE:
+  {
+    int count = cmd->type == SOUND_CMD_TIME_REQUEST ? 1 : 3;
+    if (!getVarint(data, end, &pos, &target))
+      return "malformed time command";
+    for (int i = 0; i < count; i++)
+    {
+      if (!getVarint64(data, end, &pos, &cmd->time[i]))
+        return "malformed time command";
+    }
+    cmd->drift = SOUND_DRIFT_UNKNOWN;
+    if (cmd->type == SOUND_CMD_TIME_REQUEST && pos < end)
+    {
+      if (!getVarint(data, end, &pos, &value))
+        return "malformed time command";
+      cmd->drift = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+    }
+    break;
+  }
+  }
+
+  if (!validBoard(target))
+    return "invalid target board ID";
+  cmd->target = target;
+  cmd->targets = BOARD_BIT(target);
+  cmd->flags = flags;
+  return NULL;
+}
+
+// v2 header fields, *pos is left at the first command
+static const char *decodeHeader(const uint8_t *data, int end, int *pos, SoundFrame *frame)
+{
+  if (end < 6)
+    return "truncated frame";
+  if (data[1] != SOUND_FRAME_VERSION)
+    return "unsupported frame version";
+
+  *pos = 2;
+  uint32_t sender;
+  if (!getVarint(data, end, pos, &sender) || !getVarint(data, end, pos, &frame->epoch) ||
+      !getVarint(data, end, pos, &frame->seq) || !getVarint(data, end, pos, &frame->timestamp))
+    return "truncated frame";
+  if (sender != SOUND_BOARD_UNASSIGNED && !validBoard(sender))
+    return "invalid sender board ID";
+
+  frame->version = SOUND_FRAME_VERSION;
+  frame->sender = sender;
+  frame->copy = 0;
+  frame->commandCount = 0;
+  return NULL;
+}
+
+const char *decodeFrameHeader(const uint8_t *data, int len, SoundFrame *frame)
+{
+  if (len <= 0)
+    return "empty frame";
+  if (data[0] == SOUND_FRAME_MAGIC)
+  {
+    int pos;
+    return decodeHeader(data, len - 1, &pos, frame);
+  }
+
+  ESPNowMessage msg;
+  const char *reason = decodeMessage(data, len, &msg);
+  if (reason)
+    return reason;
+  frame->version = 1;
+  frame->sender = msg.senderBoardId;
+  frame->epoch = frame->seq = 0;
+  frame->timestamp = msg.timestamp;
+  frame->copy = 0;
+  frame->commandCount = 0;
+  return NULL;
+}
+
+const char *decodeFrame(const uint8_t *data, int len, SoundFrame *frame)
+{
+  if (len <= 0)
+    return "empty frame";
+  if (data[0] != SOUND_FRAME_MAGIC)
+    return decodeLegacy(data, len, frame);
+
+  int end = len - 1;
+  if (end < 6)
+    return "truncated frame";
+  if (sumBytes(data, end) != data[end])
+    return "checksum mismatch";
+
+  int pos;
+  const char *reason = decodeHeader(data, end, &pos, frame);
+  if (reason)
+    return reason;
+
+  while (pos < end)
+  {
+    uint8_t type = data[pos++];
+    uint32_t payloadLen;
+    if (!getVarint(data, end, &pos, &payloadLen) || payloadLen > (uint32_t)(end - pos))
+      return "truncated command";
+    int payloadEnd = pos + payloadLen;
+
+    if (type == SOUND_CMD_REPEAT)
+    {
+      if (payloadLen < 1)
+        return "malformed repeat command";
+      frame->copy = data[pos];
+    }
+    else if (type >= SOUND_CMD_PLAY && type <= SOUND_CMD_TIME_RESPONSE)
+    {
+      if (frame->commandCount >= SOUND_FRAME_MAX_COMMANDS)
+        return "too many commands";
+      SoundCommand *cmd = &frame->commands[frame->commandCount];
+      memset(cmd, 0, sizeof(*cmd));
+      cmd->type = type;
+      const char *reason = decodeCommand(data, pos, payloadEnd, cmd);
+      if (reason)
+        return reason;
+      if (frame->sender == SOUND_BOARD_UNASSIGNED && type != SOUND_CMD_PRESENCE)
+        return "command from a board without an ID";
+      frame->commandCount++;
+    }
+    pos = payloadEnd;
+  }
+  return NULL;
+}
+
+void frameBegin(SoundFrameWriter *writer, uint8_t *buf, int capacity,
+                uint8_t sender, uint32_t epoch, uint32_t seq, uint32_t timestamp)
+{
+  writer->buf = buf;
+  writer->capacity = capacity;
+  writer->commandCount = 0;
+  writer->sender = sender;
+  buf[0] = SOUND_FRAME_MAGIC;
+  buf[1] = SOUND_FRAME_VERSION;
+  writer->len = 2;
+  writer->len += putVarint(buf + writer->len, sender);
+  writer->len += putVarint(buf + writer->len, epoch);
+  writer->len += putVarint(buf + writer->len, seq);
+  writer->len += putVarint(buf + writer->len, timestamp);
+}
+
+// Append type, length and payload if they fit with room left for the checksum
+static bool addCommand(SoundFrameWriter *writer, uint8_t type, const uint8_t *payload, int payloadLen)
+{
+  uint8_t header[6];
+  header[0] = type;
+  int headerLen = 1 + putVarint(header + 1, payloadLen);
+
+  if (writer->commandCount >= SOUND_FRAME_MAX_COMMANDS ||
+      writer->len + headerLen + payloadLen + 1 > writer->capacity)
+    return false;
+
+  memcpy(writer->buf + writer->len, header, headerLen);
+  memcpy(writer->buf + writer->len + headerLen, payload, payloadLen);
+  writer->len += headerLen + payloadLen;
+  writer->commandCount++;
+  return true;
+}
+
+bool frameAddPlay(SoundFrameWriter *writer, uint8_t target, const char *sound, uint8_t flags,
+                  uint32_t start)
+{
+  uint8_t payload[5 + 1 + SOUND_NAME_LEN + 2 + 5];
+  size_t nameLen = strnlen(sound, SOUND_NAME_LEN - 1);
+  int len = putVarint(payload, target);
+  len += putVarint(payload + len, nameLen);
+  memcpy(payload + len, sound, nameLen);
+  len += nameLen;
+  if (flags)
+    len += putVarint(payload + len, flags);
+  if (flags & SOUND_FLAG_START)
+    len += putVarint(payload + len, start);
+  return addCommand(writer, SOUND_CMD_PLAY, payload, len);
+}
+
+bool frameAddPlayGroup(SoundFrameWriter *writer, BoardMask targets, const char *sound, uint8_t flags,
+                       uint32_t start)
+{
+  uint8_t payload[10 + 1 + SOUND_NAME_LEN + 2 + 5];
+  size_t nameLen = strnlen(sound, SOUND_NAME_LEN - 1);
+  int len = putVarint(payload, targets == BOARD_MASK_ALL ? 0 : targets);
+  len += putVarint(payload + len, nameLen);
+  memcpy(payload + len, sound, nameLen);
+  len += nameLen;
+  if (flags)
+    len += putVarint(payload + len, flags);
+  if (flags & SOUND_FLAG_START)
+    len += putVarint(payload + len, start);
+  return addCommand(writer, SOUND_CMD_PLAY_GROUP, payload, len);
+}
+
+bool frameAddStop(SoundFrameWriter *writer, uint8_t target, uint16_t fadeMs, uint8_t flags)
+{
+  uint8_t payload[12];
+  int len = putVarint(payload, target);
+  len += putVarint(payload + len, fadeMs);
+  if (flags)
+    len += putVarint(payload + len, flags);
+  return addCommand(writer, SOUND_CMD_STOP, payload, len);
+}
+
+bool frameAddPresence(SoundFrameWriter *writer, uint32_t flags, uint16_t firmware,
+                      uint8_t queueDepth, uint8_t claim, uint16_t sleepMs)
+{
+  // The claimed ID slot ahead of the budget: our own once we have one
+  if (!claim)
+    claim = sleepMs ? writer->sender : 0;
+  if (!claim)
+    sleepMs = 0;
+
+  uint8_t payload[16];
+  int len = putVarint(payload, flags);
+  if (firmware || queueDepth || claim)
+    len += putVarint(payload + len, firmware);
+  if (queueDepth || claim)
+    len += putVarint(payload + len, queueDepth);
+  if (claim)
+    len += putVarint(payload + len, claim);
+  if (sleepMs)
+    len += putVarint(payload + len, sleepMs);
+  return addCommand(writer, SOUND_CMD_PRESENCE, payload, len);
+}
+
+bool frameAddAck(SoundFrameWriter *writer, uint8_t target, uint32_t seq)
+{
+  uint8_t payload[10];
+  int len = putVarint(payload, target);
+  len += putVarint(payload + len, seq);
+  return addCommand(writer, SOUND_CMD_ACK, payload, len);
+}
+
+bool frameAddTimeRequest(SoundFrameWriter *writer, uint8_t target, uint64_t origin,
+                         int32_t drift)
+{
+  uint8_t payload[5 + 10 + 5];
+  int len = putVarint(payload, target);
+  len += putVarint(payload + len, origin);
+  if (drift != SOUND_DRIFT_UNKNOWN)
+    len += putVarint(payload + len, ((uint32_t)drift << 1) ^ (uint32_t)(drift >> 31));
+  return addCommand(writer, SOUND_CMD_TIME_REQUEST, payload, len);
+}
+
+bool frameAddTimeResponse(SoundFrameWriter *writer, uint8_t target, uint64_t origin,
+                          uint64_t received, uint64_t sent)
+{
+  uint8_t payload[5 + 3 * 10];
+  int len = putVarint(payload, target);
+  len += putVarint(payload + len, origin);
+  len += putVarint(payload + len, received);
+  len += putVarint(payload + len, sent);
+  return addCommand(writer, SOUND_CMD_TIME_RESPONSE, payload, len);
+}
+
+bool frameAddRepeat(SoundFrameWriter *writer)
+{
+  uint8_t copy = 0;
+  return addCommand(writer, SOUND_CMD_REPEAT, &copy, 1);
+}
+
+int frameFinish(SoundFrameWriter *writer)
+{
+  writer->buf[writer->len] = sumBytes(writer->buf, writer->len);
+  return writer->len + 1;
+}
+
+int frameCopyOffset(const uint8_t *data, int len)
+{
+  SoundFrame header;
+  int pos;
+  if (len <= 0 || data[0] != SOUND_FRAME_MAGIC || decodeHeader(data, len - 1, &pos, &header))
+    return -1;
+
+  // REPEAT is the last command: type, length 1, copy, then the checksum
+  int end = len - 1;
+  while (pos < end)
+  {
+    uint8_t type = data[pos++];
+    uint32_t payloadLen;
+    if (!getVarint(data, end, &pos, &payloadLen) || payloadLen > (uint32_t)(end - pos))
+      return -1;
+    if (type == SOUND_CMD_REPEAT && payloadLen == 1 && pos + 1 == end)
+      return pos;
+    pos += payloadLen;
+  }
+  return -1;
+}
+
+void frameSetCopy(uint8_t *data, int len, int offset, uint8_t copy)
+{
+  data[len - 1] += copy - data[offset];
+  data[offset] = copy;
+}
+
+const char *soundCommandName(uint8_t type)
+{
+  static const char *names[] = {"?", "play", "stop", "presence", "ack", "play-group", "time-request", "time-response",
+                                "repeat"};
+  return type < sizeof(names) / sizeof(names[0]) ? names[type] : "?";
+}
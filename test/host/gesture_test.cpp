@@ -0,0 +1,211 @@
+// Host test of the gesture engine's transitions (include/gesture.h)
+//
+// Each case feeds timed edges and ticks into a fresh engine and compares
+// every gesture it emits, with its time, against the expected list:
+//
+//   transitions  every state and deadline, at and 1 ms either side of it
+//   adversarial  chord window edges, edges from different buttons
+//                arriving out of order, millis() wrapping around, and
+//                chords overlapping other gestures
+//
+// The engine has 3 tap buttons (b0-b2) and one trigger button (b3), a 350 ms
+// multi-press window, a 1000 ms long hold and a 100 ms chord window.
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Iinclude -o gesture_test test/host/gesture_test.cpp
+//       src/gesture.cpp
+//
+// Prints every failing case and "ok" or "FAILED"; exits non-zero on failure.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "gesture.h"
+
+#define TAP_MASK 0x7
+#define MULTI_PRESS_MS 350
+#define LONG_HOLD_MS 1000
+#define DUAL_PRESS_MS 100
+#define SETTLE_MS 10000 // Ticked after the last step, resolves anything pending
+
+struct GestureCase
+{
+  const char *name;
+  // "p<button>@<ms>" press, "r<button>@<ms>" release, "t@<ms>" tick,
+  // times relative to base (may be negative)
+  const char *steps;
+  const char *expect; // "<type> b<button> [count=<n>|mask=<m>] @<ms>; ..."
+  uint32_t base = 0;
+};
+
+static const GestureCase transitions[] = {
+    // Single and multi-press around the window (350 ms from the last press)
+    {"single press", "p0@0 r0@100", "press b0 count=1 @350"},
+    {"single press released after the window", "p0@0 r0@500", "press b0 count=1 @500"},
+    {"double press, second at window - 1", "p0@0 r0@50 p0@349 r0@400", "press b0 count=2 @699"},
+    {"double press, second at the window", "p0@0 r0@50 p0@350 r0@400",
+     "press b0 count=1 @350; press b0 count=1 @700"},
+    {"double press, second at window + 1", "p0@0 r0@50 p0@351 r0@400",
+     "press b0 count=1 @350; press b0 count=1 @701"},
+    {"triple press", "p1@0 r1@60 p1@200 r1@260 p1@400 r1@460", "press b1 count=3 @750"},
+    {"release at window - 1 waits for the window", "p0@0 r0@349", "press b0 count=1 @350"},
+    {"release at the window resolves at release", "p0@0 r0@350", "press b0 count=1 @350"},
+    {"press count 1 tick before its deadline", "p0@0 r0@50 t@349", "press b0 count=1 @350"},
+
+    // Long hold
+    {"long hold", "p0@0 t@999 t@1000 r0@1500", "long-hold b0 @1000"},
+    {"long hold resolved late by a tick", "p0@0 t@1700 r0@1800", "long-hold b0 @1000"},
+    {"release at hold - 1 is a press", "p0@0 r0@999", "press b0 count=1 @999"},
+    {"long hold ends a multi-press", "p0@0 r0@50 p0@200 t@1200 r0@1300", "long-hold b0 @1200"},
+
+    // Chord
+    {"chord of two", "p0@0 p1@50 r0@300 r1@320", "chord b1 mask=0x3 @100"},
+    {"chord of three", "p0@0 p2@30 p1@60 r0@300 r1@300 r2@300", "chord b2 mask=0x7 @100"},
+    {"chord members never long-hold", "p0@0 p1@20 t@5000 r0@5100 r1@5200", "chord b1 mask=0x3 @100"},
+    {"chord by a press during a multi-press", "p0@0 r0@40 p1@200 p0@250 r0@300 r1@300",
+     "chord b1 mask=0x3 @300"},
+
+    // Trigger buttons emit at the press edge only, and never chord
+    {"trigger", "p3@10 r3@5000", "trigger b3 @10"},
+    {"trigger during a chord window", "p0@0 p3@20 r0@50", "trigger b3 @20; press b0 count=1 @350"},
+
+    // Edges while a gesture is already decided
+    {"release from HELD_LONG", "p0@0 t@1000 r0@1200 p0@1300 r0@1350",
+     "long-hold b0 @1000; press b0 count=1 @1650"},
+    {"other button during HELD_LONG", "p0@0 t@1000 p1@1100 r1@1150 r0@1200",
+     "long-hold b0 @1000; press b1 count=1 @1450"},
+    {"second chord attempt during HELD_LONG", "p0@0 t@1000 p1@1100 p2@1150 r1@1200 r2@1200 r0@1300",
+     "long-hold b0 @1000; chord b2 mask=0x6 @1200"},
+    {"release from HELD_CHORD", "p0@0 p1@50 r0@150 p0@400 r0@450 r1@2000",
+     "chord b1 mask=0x3 @100; press b0 count=1 @750"},
+    {"other button during HELD_CHORD", "p0@0 p1@50 p2@300 r2@320 r0@400 r1@400",
+     "chord b1 mask=0x3 @100; press b2 count=1 @650"},
+    {"held chord member not counted as a press", "p0@0 p1@50 r1@200 p1@300 r1@350 r0@400",
+     "chord b1 mask=0x3 @100; press b1 count=1 @650"},
+};
+
+#define WRAP_BASE 0xFFFFFF00 // millis() wraps 256 ms into the case
+
+static const GestureCase adversarial[] = {
+    // Chord window (100 ms from the first press edge)
+    {"chord, second press at window - 1", "p0@0 p1@99 r0@300 r1@300", "chord b1 mask=0x3 @100"},
+    {"chord, second press at the window", "p0@0 p1@100 r0@200 r1@200",
+     "press b0 count=1 @350; press b1 count=1 @450"},
+    {"chord window closed by a tick at window - 1", "p0@0 t@99 p1@99 r0@300 r1@300",
+     "chord b1 mask=0x3 @100"},
+    {"chords don't chain", "p0@0 p1@90 p2@180 r2@200 r0@300 r1@300",
+     "chord b1 mask=0x3 @100; press b2 count=1 @530"},
+
+    // Edges of different buttons handed over out of order
+    {"reordered presses", "p1@50 p0@40 r0@200 r1@200", "chord b1 mask=0x3 @140"},
+    {"reordered, later edge seen after the window of the earlier", "p1@120 p0@30 r0@300 r1@300",
+     "chord b1 mask=0x3 @130"},
+    {"reordered press and release", "p0@0 r0@60 p1@50 r1@300", "chord b1 mask=0x3 @100"},
+    {"reordered press joining a multi-press", "p0@0 r0@50 p1@300 p0@290 r0@400 r1@400",
+     "chord b1 mask=0x3 @390"},
+
+    // millis() wraps around during the gesture
+    {"single press across the wrap", "p0@200 r0@250", "press b0 count=1 @550", WRAP_BASE},
+    {"double press across the wrap", "p0@200 r0@240 p0@400 r0@450", "press b0 count=2 @750",
+     WRAP_BASE},
+    {"multi-press window ending on the wrap", "p0@-94 r0@-50 p0@256 r0@300",
+     "press b0 count=1 @256; press b0 count=1 @606", WRAP_BASE},
+    {"long hold across the wrap", "p0@0 t@999 t@1000 r0@1100", "long-hold b0 @1000", WRAP_BASE},
+    {"chord across the wrap", "p0@230 p1@280 r0@400 r1@400", "chord b1 mask=0x3 @330", WRAP_BASE},
+
+    // Chords overlapping other gestures
+    {"chord of three at window - 1", "p0@0 p1@50 p2@99 r0@300 r1@300 r2@300",
+     "chord b2 mask=0x7 @100"},
+    {"second chord while a member of the first is held",
+     "p0@0 p1@50 p2@150 r0@160 p0@200 r1@300 r0@400 r2@400",
+     "chord b1 mask=0x3 @100; chord b2 mask=0x5 @250"},
+    {"chord during a long hold", "p0@0 t@1000 p1@1100 p2@1150 r1@1300 r2@1300 r0@1400",
+     "long-hold b0 @1000; chord b2 mask=0x6 @1200"},
+    {"chord with the second press of a multi-press", "p0@0 r0@50 p0@150 r0@200 p1@230 r1@300",
+     "chord b1 mask=0x3 @250"},
+};
+
+static std::string describe(const GestureEvent &event, uint32_t base)
+{
+  char text[64];
+  int len = snprintf(text, sizeof(text), "%s b%d", gestureTypeName(event.type), event.button);
+  if (event.type == GESTURE_PRESS || event.type == GESTURE_PRESS_START)
+    len += snprintf(text + len, sizeof(text) - len, " count=%d", event.count);
+  if (event.type == GESTURE_CHORD)
+    len += snprintf(text + len, sizeof(text) - len, " mask=0x%x", (unsigned)event.mask);
+  snprintf(text + len, sizeof(text) - len, " @%u", (unsigned)(event.timeMs - base));
+  return text;
+}
+
+static void drain(GestureEngine *engine, uint32_t base, std::string *out)
+{
+  GestureEvent event;
+  while (gesturePoll(engine, &event))
+  {
+    if (!out->empty())
+      *out += "; ";
+    *out += describe(event, base);
+  }
+}
+
+static bool runCase(const GestureCase &c)
+{
+  GestureEngine engine;
+  gestureInit(&engine, 4, TAP_MASK, MULTI_PRESS_MS, LONG_HOLD_MS, DUAL_PRESS_MS);
+
+  std::string got;
+  uint32_t lastMs = 0;
+  const char *p = c.steps;
+  while (*p)
+  {
+    char kind = *p++;
+    int button = kind == 't' ? 0 : *p++ - '0';
+    if (*p++ != '@')
+    {
+      printf("FAIL %s: bad step near \"%s\"\n", c.name, p);
+      return false;
+    }
+    char *end;
+    uint32_t ms = (uint32_t)strtol(p, &end, 10);
+    p = end;
+    while (*p == ' ')
+      p++;
+    lastMs = ms;
+
+    uint32_t nowMs = c.base + ms;
+    if (kind == 't')
+      gestureTick(&engine, nowMs);
+    else
+      gestureOnEdge(&engine, button, kind == 'p', nowMs);
+    drain(&engine, c.base, &got);
+  }
+  gestureTick(&engine, c.base + lastMs + SETTLE_MS);
+  drain(&engine, c.base, &got);
+
+  if (got == c.expect)
+    return true;
+  printf("FAIL %s\n  steps:  %s\n  expect: %s\n  got:    %s\n", c.name, c.steps, c.expect,
+         got.c_str());
+  return false;
+}
+
+static int runTable(const char *title, const GestureCase *cases, int count)
+{
+  int failures = 0;
+  for (int i = 0; i < count; i++)
+  {
+    if (!runCase(cases[i]))
+      failures++;
+  }
+  printf("%s: %d cases, %d failed\n", title, count, failures);
+  return failures;
+}
+
+int main()
+{
+  int failures = runTable("transitions", transitions, sizeof(transitions) / sizeof(transitions[0]));
+  failures += runTable("adversarial", adversarial, sizeof(adversarial) / sizeof(adversarial[0]));
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,260 @@
+// Host check and benchmark for the ESP-NOW frame codec (include/sound_message.h)
+//
+// Round-trips a set of v2 frames and a legacy v1 frame through the firmware
+// codec, rejects a few corrupted ones, then times encoding and decoding.
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Iinclude -o codec_bench tools/codec_bench/codec_bench.cpp
+//       src/sound_message.cpp
+//
+// Usage:
+//   codec_bench [iterations]
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sound_message.h"
+
+static int failures = 0;
+
+static void expect(bool ok, const char *what)
+{
+  if (!ok)
+  {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+static const char *names[] = {"airhorn.wav", "laugh.wav", "boo.wav", "rimshot_long_name_for_testing.wav"};
+
+// One frame with a play per name, a stop, a presence and an ack
+static int buildFrame(uint8_t *buf, uint32_t timestamp)
+{
+  SoundFrameWriter writer;
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, 2, 300, timestamp / 16, timestamp);
+  for (int i = 0; i < 4; i++)
+    frameAddPlay(&writer, 1 + i, names[i]);
+  frameAddStop(&writer, 5, 8);
+  frameAddPresence(&writer, SOUND_PRESENCE_PLAYING, 300, 2);
+  frameAddAck(&writer, 3, timestamp - 1);
+  return frameFinish(&writer);
+}
+
+static void checkRoundTrip()
+{
+  uint8_t buf[SOUND_FRAME_MAX_LEN];
+  uint32_t timestamp = 0x12345678;
+  int len = buildFrame(buf, timestamp);
+
+  SoundFrame frame;
+  const char *reason = decodeFrame(buf, len, &frame);
+  expect(reason == NULL, reason ? reason : "v2 decode");
+  expect(frame.version == SOUND_FRAME_VERSION && frame.sender == 2 && frame.epoch == 300 &&
+             frame.seq == timestamp / 16 && frame.timestamp == timestamp,
+         "v2 header fields");
+  expect(frame.commandCount == 7, "v2 command count");
+  for (int i = 0; i < 4; i++)
+  {
+    expect(frame.commands[i].type == SOUND_CMD_PLAY && frame.commands[i].target == 1 + i &&
+               strcmp(frame.commands[i].sound, names[i]) == 0,
+           "v2 play command");
+  }
+  expect(frame.commands[4].type == SOUND_CMD_STOP && frame.commands[4].fadeMs == 8, "v2 stop");
+  expect(frame.commands[5].type == SOUND_CMD_PRESENCE && frame.commands[5].value == SOUND_PRESENCE_PLAYING &&
+             frame.commands[5].firmware == 300 && frame.commands[5].queueDepth == 2,
+         "v2 presence");
+  expect(frame.commands[6].type == SOUND_CMD_ACK && frame.commands[6].value == timestamp - 1, "v2 ack");
+
+  // Byte order is fixed by the format: epoch 300 is always AC 02
+  expect(buf[2] == 2 && buf[3] == 0xAC && buf[4] == 0x02, "little endian varint");
+
+  SoundFrame header;
+  expect(decodeFrameHeader(buf, len, &header) == NULL && header.seq == frame.seq, "header only");
+
+  // Every corruption of a single byte must be caught
+  int caught = 0;
+  for (int i = 0; i < len; i++)
+  {
+    uint8_t copy[SOUND_FRAME_MAX_LEN];
+    memcpy(copy, buf, len);
+    copy[i] ^= 0x01;
+    if (decodeFrame(copy, len, &frame) != NULL)
+      caught++;
+  }
+  expect(caught == len, "single-bit corruption");
+  expect(decodeFrame(buf, len - 1, &frame) != NULL, "truncated frame");
+
+  // Unknown command types are skipped
+  uint8_t unknown[] = {SOUND_FRAME_MAGIC, SOUND_FRAME_VERSION, 1, 1, 1, 10, 0x7F, 2, 0xAA, 0xBB,
+                       SOUND_CMD_PRESENCE, 1, 0, 0};
+  unknown[sizeof(unknown) - 1] = 0;
+  for (size_t i = 0; i < sizeof(unknown) - 1; i++)
+    unknown[sizeof(unknown) - 1] += unknown[i];
+  expect(decodeFrame(unknown, sizeof(unknown), &frame) == NULL && frame.commandCount == 1 &&
+             frame.commands[0].type == SOUND_CMD_PRESENCE,
+         "unknown command skipped");
+
+  // A frame full of plays stops accepting commands instead of overflowing
+  SoundFrameWriter writer;
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, 1, 1, 1, 0);
+  int added = 0;
+  while (frameAddPlay(&writer, 2, names[3]))
+    added++;
+  len = frameFinish(&writer);
+  expect(len <= SOUND_FRAME_MAX_LEN && added > 0 && decodeFrame(buf, len, &frame) == NULL &&
+             frame.commandCount == added,
+         "full frame");
+
+  // A board claiming an ID sends only its presence, as board 0
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, SOUND_BOARD_UNASSIGNED, 1, 1, 0);
+  frameAddPresence(&writer, 0, 1, 0, 42);
+  len = frameFinish(&writer);
+  expect(decodeFrame(buf, len, &frame) == NULL && frame.sender == SOUND_BOARD_UNASSIGNED &&
+             frame.commandCount == 1 && frame.commands[0].target == 42,
+         "claim frame");
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, SOUND_BOARD_UNASSIGNED, 1, 1, 0);
+  frameAddPresence(&writer, 0, 1, 0, 42, 500);
+  len = frameFinish(&writer);
+  expect(decodeFrame(buf, len, &frame) == NULL && frame.commands[0].target == 42 &&
+             frame.commands[0].sleepMs == 500,
+         "claim frame with a sleep budget");
+
+  // A board with an ID fills the claim slot with its own ahead of the budget
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, 7, 1, 1, 0);
+  frameAddPresence(&writer, 0, 1, 0, 0, 500);
+  len = frameFinish(&writer);
+  expect(decodeFrame(buf, len, &frame) == NULL && frame.commands[0].target == 7 &&
+             frame.commands[0].sleepMs == 500,
+         "sleep budget");
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, 7, 1, 1, 0);
+  frameAddPresence(&writer, 0, 1);
+  len = frameFinish(&writer);
+  expect(decodeFrame(buf, len, &frame) == NULL && frame.commands[0].sleepMs == 0,
+         "no sleep budget");
+
+  // Copies of a repeated frame are numbered in place
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, 7, 1, 1, 0);
+  frameAddPlay(&writer, 2, names[0]);
+  frameAddRepeat(&writer);
+  len = frameFinish(&writer);
+  int offset = frameCopyOffset(buf, len);
+  expect(offset > 0 && decodeFrame(buf, len, &frame) == NULL && frame.copy == 0 &&
+             frame.commandCount == 1,
+         "first copy");
+  frameSetCopy(buf, len, offset, 200);
+  expect(decodeFrame(buf, len, &frame) == NULL && frame.copy == 200, "later copy");
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, 7, 1, 1, 0);
+  frameAddPlay(&writer, 2, names[0]);
+  len = frameFinish(&writer);
+  expect(frameCopyOffset(buf, len) < 0 && decodeFrame(buf, len, &frame) == NULL && frame.copy == 0,
+         "frame that isn't repeated");
+
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, SOUND_BOARD_UNASSIGNED, 1, 1, 0);
+  frameAddPlay(&writer, 2, names[0]);
+  len = frameFinish(&writer);
+  expect(decodeFrame(buf, len, &frame) != NULL, "play from a board without an ID");
+
+  // One group command reaches any set of boards; every board takes one byte
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, 1, 1, 1, 0);
+  frameAddPlayGroup(&writer, BOARD_BIT(2) | BOARD_BIT(40) | BOARD_BIT(63), names[0], SOUND_FLAG_ACK);
+  frameAddPlayGroup(&writer, BOARD_MASK_ALL, names[1]);
+  len = frameFinish(&writer);
+  expect(decodeFrame(buf, len, &frame) == NULL && frame.commandCount == 2 &&
+             frame.commands[0].type == SOUND_CMD_PLAY_GROUP &&
+             frame.commands[0].targets == (BOARD_BIT(2) | BOARD_BIT(40) | BOARD_BIT(63)) &&
+             frame.commands[0].flags == SOUND_FLAG_ACK && strcmp(frame.commands[0].sound, names[0]) == 0 &&
+             frame.commands[1].targets == BOARD_MASK_ALL,
+         "group play");
+  expect(buf[len - 1 - (int)strlen(names[1]) - 2] == 0, "every board encoded as 0");
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, 1, 1, 1, 0);
+  frameAddPlayGroup(&writer, BOARD_BIT(0) | BOARD_BIT(3), names[0]);
+  len = frameFinish(&writer);
+  expect(decodeFrame(buf, len, &frame) != NULL, "group naming board 0");
+
+  // Start times and the clock exchange keep all their bits
+  uint64_t t1 = 0x123456789AULL, t2 = 0xFFFFFFFFFFFFULL, t3 = 1;
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, 1, 1, 1, 0);
+  frameAddPlayGroup(&writer, BOARD_MASK_ALL, names[0], SOUND_FLAG_START, 0xFEDCBA98);
+  frameAddPlay(&writer, 3, names[1], SOUND_FLAG_ACK);
+  frameAddTimeRequest(&writer, 2, t1);
+  frameAddTimeResponse(&writer, 3, t1, t2, t3);
+  len = frameFinish(&writer);
+  expect(decodeFrame(buf, len, &frame) == NULL && frame.commandCount == 4 &&
+             frame.commands[0].flags == SOUND_FLAG_START && frame.commands[0].start == 0xFEDCBA98 &&
+             frame.commands[1].flags == SOUND_FLAG_ACK && frame.commands[1].start == 0 &&
+             strcmp(frame.commands[1].sound, names[1]) == 0,
+         "play start");
+  expect(frame.commands[2].type == SOUND_CMD_TIME_REQUEST && frame.commands[2].target == 2 &&
+             frame.commands[2].time[0] == t1 && frame.commands[3].type == SOUND_CMD_TIME_RESPONSE &&
+             frame.commands[3].target == 3 && frame.commands[3].time[0] == t1 &&
+             frame.commands[3].time[1] == t2 && frame.commands[3].time[2] == t3,
+         "time exchange");
+
+  // Output drift rides on time requests, either sign, or not at all
+  frameBegin(&writer, buf, SOUND_FRAME_MAX_LEN, 1, 1, 2, 0);
+  frameAddTimeRequest(&writer, 2, t1, -23456);
+  frameAddTimeRequest(&writer, 2, t1, 1000000);
+  frameAddTimeRequest(&writer, 2, t1, SOUND_DRIFT_UNKNOWN);
+  len = frameFinish(&writer);
+  expect(decodeFrame(buf, len, &frame) == NULL && frame.commandCount == 3 &&
+             frame.commands[0].drift == -23456 && frame.commands[1].drift == 1000000 &&
+             frame.commands[2].drift == SOUND_DRIFT_UNKNOWN && frame.commands[2].time[0] == t1,
+         "time request drift");
+
+  // Legacy v1 frames still decode
+  ESPNowMessage legacy = {};
+  legacy.senderBoardId = 4;
+  legacy.targetBoardId = 1;
+  strcpy(legacy.soundFile, "boo.wav");
+  legacy.timestamp = 777;
+  legacy.checksum = calculateChecksum(&legacy);
+  reason = decodeFrame((const uint8_t *)&legacy, sizeof(legacy), &frame);
+  expect(reason == NULL && frame.version == 1 && frame.sender == 4 && frame.timestamp == 777 &&
+             frame.commandCount == 1 && frame.commands[0].target == 1 &&
+             strcmp(frame.commands[0].sound, "boo.wav") == 0,
+         "legacy v1 frame");
+}
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+  long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+
+  checkRoundTrip();
+  printf("codec checks: %s\n", failures ? "FAILED" : "ok");
+
+  uint8_t buf[SOUND_FRAME_MAX_LEN];
+  int len = 0;
+  uint32_t sink = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++)
+  {
+    len = buildFrame(buf, i);
+    sink += buf[len - 1];
+  }
+  double encodeSec = seconds(start);
+
+  SoundFrame frame;
+  start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++)
+  {
+    asm volatile("" ::: "memory"); // Keep the decode inside the loop
+    if (decodeFrame(buf, len, &frame) == NULL)
+      sink += frame.commandCount;
+  }
+  double decodeSec = seconds(start);
+
+  printf("frame: %d bytes, 7 commands\n", len);
+  printf("encode: %.0f frames/s, %.1f MB/s\n", iterations / encodeSec, iterations * len / encodeSec / 1e6);
+  printf("decode: %.0f frames/s, %.1f MB/s\n", iterations / decodeSec, iterations * len / decodeSec / 1e6);
+  printf("(%u)\n", sink);
+  return failures ? 1 : 0;
+}
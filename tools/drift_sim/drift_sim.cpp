@@ -0,0 +1,274 @@
+// Simulation of output clock drift and its compensation (include/sample_clock.h)
+//
+// 8 boards, each with a crystal off by up to +-30 ppm (esp_timer and I2S
+// both run from it) and an I2S divider that rounds by up to +-20 ppm. The
+// audio task is modelled the way audio_player.cpp drives the legacy
+// driver: 256-frame chunks into a ring of 16 DMA buffers of 128 frames,
+// a write that finds the ring full waits for the next buffer boundary and
+// wakes up 5-100 us late (now and then 2 ms, preempted). Every write that
+// waited goes to the board's RateMeter, like writeOutput() does.
+//
+//   measure   clips of 20-120 s; every 20 s the SD card stalls for 80 ms,
+//             longer than the ring, so silence is played in between. The
+//             measured rate has to come within 1 ppm of the true one.
+//   together  then every board plays a 10 minute clip from the same
+//             instant, resampled by fleet skew (0.5 ppm off, like
+//             tools/sync_sim gets it) minus the measured rate. Where each
+//             board is in the clip is compared every second, with and
+//             without the correction.
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Iinclude -o drift_sim tools/drift_sim/drift_sim.cpp
+//       src/sample_clock.cpp
+//
+// Usage:
+//   drift_sim [seed]
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "sample_clock.h"
+
+#define BOARDS 8
+#define SAMPLE_RATE 44100
+#define CHUNK_FRAMES 256 // BUFFER_SIZE bytes
+#define DMA_BUF_LEN 128
+#define DMA_BUF_COUNT 16
+#define STALL_EVERY_S 20.0
+#define STALL_S 0.080
+#define MEASURE_CLIPS 12
+#define TOGETHER_S 600.0
+#define MAX_RATE_ERROR_PPB 1000
+#define MAX_SPREAD_US 1000 // Still together after 10 minutes
+
+static std::mt19937 rng;
+
+struct SimBoard
+{
+  double crystalPpm;
+  double dividerPpm;
+  double fleetSkewError; // ppb, of ClockSync skewPpb
+  RateMeter meter;
+};
+
+static SimBoard boards[BOARDS];
+static SimBoard *master = &boards[0]; // Keeps the fleet time
+
+static double uniform(double low, double high)
+{
+  return std::uniform_real_distribution<double>(low, high)(rng);
+}
+
+// The board's esp_timer at true time t (s)
+static int64_t localUs(const SimBoard &board, double t)
+{
+  return (int64_t)llround(t * 1e6 * (1 + board.crystalPpm * 1e-6));
+}
+
+// ClockSync skewPpb: how much faster fleet time runs than the board's clock
+static int32_t fleetSkewPpb(const SimBoard &board)
+{
+  double skew = (1 + master->crystalPpm * 1e-6) / (1 + board.crystalPpm * 1e-6) - 1;
+  return (int32_t)llround(skew * 1e9 + board.fleetSkewError);
+}
+
+static double wakeLatency()
+{
+  if (std::uniform_int_distribution<int>(0, 199)(rng) == 0)
+    return 0.002;
+  return uniform(5e-6, 100e-6);
+}
+
+// Resampler step the firmware uses: fleet skew minus the measured rate
+static int32_t correctionPpb(const SimBoard &board)
+{
+  int32_t ppb = 0;
+  rateMeterPpb(&board.meter, &ppb);
+  return fleetSkewPpb(board) - ppb;
+}
+
+// One clip from true time start: the DMA starts the first buffer then.
+// Returns where in the clip (frames) the board is at each whole second
+// after start.
+static std::vector<double> play(SimBoard &board, double start, double seconds, bool stalls,
+                                bool resampled)
+{
+  double bufferS = DMA_BUF_LEN / (SAMPLE_RATE * (1 + board.crystalPpm * 1e-6) *
+                                  (1 + board.dividerPpm * 1e-6));
+  Resampler resampler;
+  resamplerReset(&resampler);
+  int16_t in[CHUNK_FRAMES * 2] = {};
+  int16_t out[(CHUNK_FRAMES + 2) * 2];
+
+  std::vector<double> bufferContent; // Clip frame each queued buffer starts with
+  double content = 0;                // Clip frame of the next output frame
+  int bufferFill = 0;                // Frames in the buffer being filled
+  double writerS = start;
+  double nextStall = start + STALL_EVERY_S;
+  uint64_t frames = 0;
+  std::vector<double> positions;
+
+  // DMA: buffer k of the ring starts at start + k * bufferS, playing the
+  // next queued one or silence
+  int64_t boundary = 0; // Next buffer to start
+  size_t played = 0;    // Queued buffers started
+  std::vector<double> playing; // Clip frame at each buffer start, -1 = silence
+  auto advance = [&](double t) {
+    while (start + boundary * bufferS <= t)
+    {
+      playing.push_back(played < bufferContent.size() ? bufferContent[played++] : -1);
+      boundary++;
+    }
+  };
+
+  rateMeterBreak(&board.meter);
+  while (writerS < start + seconds)
+  {
+    writerS += uniform(50e-6, 300e-6); // SD read and processing
+    if (stalls && writerS >= nextStall)
+    {
+      writerS += STALL_S;
+      nextStall += STALL_EVERY_S;
+    }
+    resampler.stepPpb = resampled ? correctionPpb(board) : 0;
+    int count = resample(&resampler, in, CHUNK_FRAMES, out);
+    double step = 1 + resampler.stepPpb * 1e-9;
+
+    for (int i = 0; i < count; i++)
+    {
+      if (bufferFill == 0)
+      {
+        // Take a buffer: wait for a boundary while the ring is full
+        advance(writerS);
+        if (bufferContent.size() - played >= DMA_BUF_COUNT - 1)
+        {
+          writerS = start + boundary * bufferS;
+          advance(writerS);
+          writerS += wakeLatency();
+          advance(writerS);
+          rateMeterAdd(&board.meter, frames, localUs(board, writerS));
+        }
+        bufferContent.push_back(content);
+      }
+      content += step;
+      frames++;
+      bufferFill = (bufferFill + 1) % DMA_BUF_LEN;
+    }
+  }
+  advance(start + seconds);
+  rateMeterBreak(&board.meter);
+
+  for (int s = 1; s <= (int)seconds; s++)
+  {
+    double t = start + s;
+    int64_t k = (int64_t)floor((t - start) / bufferS);
+    if (k >= (int64_t)playing.size() || playing[k] < 0)
+    {
+      positions.push_back(-1);
+      continue;
+    }
+    double into = (t - start - k * bufferS) / bufferS * DMA_BUF_LEN;
+    positions.push_back(playing[k] + into);
+  }
+  return positions;
+}
+
+int main(int argc, char **argv)
+{
+  rng.seed(argc > 1 ? atoi(argv[1]) : 1);
+  int failures = 0;
+  for (int i = 0; i < BOARDS; i++)
+  {
+    boards[i].crystalPpm = uniform(-30, 30);
+    boards[i].dividerPpm = uniform(-20, 20);
+    boards[i].fleetSkewError = i == 0 ? 0 : uniform(-500, 500);
+    rateMeterInit(&boards[i].meter, SAMPLE_RATE);
+  }
+
+  // measure: the rate against the board's own clock is the divider's
+  double t = 0;
+  double worstPpb = 0;
+  for (int clip = 0; clip < MEASURE_CLIPS; clip++)
+  {
+    double seconds = uniform(20, 120);
+    for (int i = 0; i < BOARDS; i++)
+      play(boards[i], t, seconds, true, false);
+    t += seconds + 5;
+  }
+  uint32_t stretches = 0, glitches = 0;
+  for (int i = 0; i < BOARDS; i++)
+  {
+    int32_t ppb = 0;
+    if (!rateMeterPpb(&boards[i].meter, &ppb))
+    {
+      printf("FAIL: board %d measured nothing\n", i + 1);
+      failures++;
+      continue;
+    }
+    double truePpb = boards[i].dividerPpm * 1000;
+    worstPpb = std::max(worstPpb, fabs(ppb - truePpb));
+    stretches += boards[i].meter.stats.stretches;
+    glitches += boards[i].meter.stats.glitches;
+  }
+  printf("measure : %d clips with SD stalls, %u stretches, %u ended by silence, "
+         "worst rate error %.0f ppb\n",
+         MEASURE_CLIPS, stretches, glitches, worstPpb);
+  if (worstPpb > MAX_RATE_ERROR_PPB)
+  {
+    printf("FAIL: rate more than %d ppb off\n", MAX_RATE_ERROR_PPB);
+    failures++;
+  }
+
+  // together: where every board is in one long clip
+  for (int resampled = 0; resampled <= 1; resampled++)
+  {
+    std::vector<std::vector<double>> positions;
+    for (int i = 0; i < BOARDS; i++)
+      positions.push_back(play(boards[i], t, TOGETHER_S, false, resampled));
+    t += TOGETHER_S + 5;
+
+    // Against fleet time: the master's clock
+    double worstUs = 0, endUs = 0;
+    for (size_t s = 0; s < positions[0].size(); s++)
+    {
+      double low = 1e18, high = -1e18;
+      for (int i = 0; i < BOARDS; i++)
+      {
+        low = std::min(low, positions[i][s]);
+        high = std::max(high, positions[i][s]);
+      }
+      double spreadUs = (high - low) * 1e6 / SAMPLE_RATE;
+      worstUs = std::max(worstUs, spreadUs);
+      endUs = spreadUs;
+    }
+    printf("together: %s, spread after %.0f s %.0f us, worst %.0f us\n",
+           resampled ? "resampled  " : "uncorrected", TOGETHER_S, endUs, worstUs);
+    if (resampled && worstUs > MAX_SPREAD_US)
+    {
+      printf("FAIL: boards more than %d us apart\n", MAX_SPREAD_US);
+      failures++;
+    }
+  }
+
+  // What the resampler costs per frame (on the host)
+  Resampler resampler;
+  resamplerReset(&resampler);
+  resampler.stepPpb = 23456;
+  int16_t in[CHUNK_FRAMES * 2], out[(CHUNK_FRAMES + 2) * 2];
+  for (int i = 0; i < CHUNK_FRAMES * 2; i++)
+    in[i] = (int16_t)(i * 97);
+  long produced = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < 20000; i++)
+    produced += resample(&resampler, in, CHUNK_FRAMES, out) + out[0] % 2;
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  printf("resample: %.1f ns per stereo frame\n", elapsed * 1e9 / produced);
+
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
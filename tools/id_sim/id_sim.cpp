@@ -0,0 +1,430 @@
+// Fleet simulation of automatic board IDs (include/id_claim.h)
+//
+// 32 boards with random MACs boot onto a shared broadcast medium that
+// drops frames and delays them by a random latency. Each board runs the
+// firmware's IdClaim, dispatcher and frame codec, and sends its claims,
+// answers and heartbeats the way the firmware does. Checks that every
+// board ends up with an ID of its own, in several scenarios:
+//
+//   staggered    fresh boards powered on over 5 s
+//   simultaneous fresh boards powered on in the same millisecond
+//   reboot       the settled fleet restarted with the IDs it stored
+//   override     one board given the ID of another by hand (N.txt)
+//   late return  a board off while its ID is free, another board comes
+//                up meanwhile, then it returns with its stored ID
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Iinclude -o id_sim tools/id_sim/id_sim.cpp
+//       src/id_claim.cpp src/peer_table.cpp src/dispatch.cpp
+//       src/frame_dedupe.cpp src/sound_message.cpp src/gesture.cpp
+//
+// Usage:
+//   id_sim [runs per scenario and loss rate]
+
+#include <queue>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "dispatch.h"
+#include "id_claim.h"
+#include "peer_table.h"
+
+#define BOARDS 32
+#define RUN_MS 30000
+
+struct InFlight
+{
+  uint32_t arriveMs;
+  int from;
+  std::vector<uint8_t> data;
+  bool operator>(const InFlight &other) const { return arriveMs > other.arriveMs; }
+};
+
+struct SimBoard
+{
+  bool on;
+  uint32_t bootMs;
+  uint8_t mac[CLAIM_MAC_LEN];
+  uint8_t fixedId;  // N.txt
+  uint8_t storedId; // NVS
+  IdClaim claim;
+  Dispatcher dispatcher;
+  PeerTable peers;
+  uint32_t epoch;
+  uint32_t nextSeq;
+  uint32_t lastBroadcastMs;
+  uint32_t heartbeatMs;
+  bool answer; // Presence owed, sent PRESENCE_UPDATE_MIN_MS after the last broadcast
+  bool duplicate;
+  uint8_t lastId;
+};
+
+static std::mt19937 rng;
+static double lossRate;
+static uint32_t nowMs;
+static std::priority_queue<InFlight, std::vector<InFlight>, std::greater<InFlight>> medium;
+static SimBoard boards[BOARDS];
+static uint32_t framesOnAir;
+static uint32_t lastChangeMs; // Some board's ID last changed (or settled)
+
+static uint32_t latencyMs()
+{
+  uint32_t ms = std::uniform_int_distribution<uint32_t>(3, 12)(rng);
+  if (std::uniform_int_distribution<int>(0, 19)(rng) == 0)
+    ms += 40;
+  return ms;
+}
+
+// What the firmware's sendPresence(0) puts on the air
+static void sendPresence(int index)
+{
+  SimBoard &board = boards[index];
+  uint8_t buf[SOUND_FRAME_MAX_LEN];
+  SoundFrameWriter writer;
+  frameBegin(&writer, buf, sizeof(buf), claimBoardId(&board.claim), board.epoch, board.nextSeq++, nowMs);
+  frameAddPresence(&writer, claimPresenceFlags(&board.claim), 1, 0, claimPresenceId(&board.claim));
+  int len = frameFinish(&writer);
+  board.lastBroadcastMs = nowMs;
+  board.answer = false;
+
+  // Every other board that is on hears it, or doesn't, independently
+  for (int i = 0; i < BOARDS; i++)
+  {
+    if (i == index || !boards[i].on)
+      continue;
+    if (std::uniform_real_distribution<double>(0, 1)(rng) >= lossRate)
+      medium.push({nowMs + latencyMs(), index, std::vector<uint8_t>(buf, buf + len)});
+  }
+  framesOnAir++;
+}
+
+static void boot(int index)
+{
+  SimBoard &board = boards[index];
+  board.on = true;
+  claimInit(&board.claim, board.mac, board.fixedId, board.storedId, nowMs);
+  dispatchInit(&board.dispatcher, claimBoardId(&board.claim), 0);
+  peerTableInit(&board.peers, nowMs);
+  board.epoch++;
+  board.nextSeq = 1;
+  board.heartbeatMs = HEARTBEAT_MIN_MS;
+  board.answer = false;
+  board.duplicate = false;
+  if (!board.claim.claiming)
+    sendPresence(index); // The firmware's first heartbeat
+}
+
+static void onClaimResult(int index, uint8_t result)
+{
+  SimBoard &board = boards[index];
+  if (result == CLAIM_ANSWER)
+    board.answer = true;
+  else if (result == CLAIM_DUPLICATE)
+    board.duplicate = true;
+  board.dispatcher.boardId = claimBoardId(&board.claim);
+}
+
+// What the firmware's onDataReceive() does with the frame
+static void receive(int index, const InFlight &arrival)
+{
+  SimBoard &board = boards[index];
+  static SoundFrame frame;
+  Action actions[DISPATCH_MAX_ACTIONS];
+  int count = dispatchFrame(&board.dispatcher, arrival.data.data(), arrival.data.size(), nowMs,
+                            &frame, actions);
+  const uint8_t *mac = boards[arrival.from].mac;
+
+  // An ID that went to another board: its epoch has nothing to do with
+  // the previous holder's
+  uint8_t stale = board.dispatcher.staleFrom;
+  if (stale && board.peers.peers[stale].known &&
+      memcmp(board.peers.peers[stale].mac, mac, PEER_MAC_LEN) != 0)
+  {
+    dedupeForget(&board.dispatcher.dedupe, stale);
+    count = dispatchFrame(&board.dispatcher, arrival.data.data(), arrival.data.size(), nowMs,
+                          &frame, actions);
+  }
+
+  bool fixed = true; // Older firmware sends no presence and is numbered by hand
+  for (int i = 0; i < count; i++)
+  {
+    if (actions[i].type != ACTION_PRESENCE)
+      continue;
+    if (actions[i].board == SOUND_BOARD_UNASSIGNED)
+      onClaimResult(index, claimOnClaim(&board.claim, actions[i].claim, mac, nowMs));
+    else
+      fixed = actions[i].presence & SOUND_PRESENCE_FIXED_ID;
+  }
+  uint8_t sender = board.dispatcher.heardFrom;
+  if (sender)
+  {
+    peerHeard(&board.peers, sender, mac, 0, nowMs);
+    onClaimResult(index, claimOnBoard(&board.claim, sender, mac, fixed, nowMs));
+  }
+}
+
+// Claim timer and heartbeat timer of one board
+static void tick(int index)
+{
+  SimBoard &board = boards[index];
+  uint8_t result = claimPoll(&board.claim, nowMs);
+  if (result == CLAIM_ANNOUNCE)
+  {
+    sendPresence(index);
+    return;
+  }
+  if (result == CLAIM_SETTLED)
+  {
+    board.storedId = board.claim.id;
+    board.dispatcher.boardId = board.claim.id;
+    board.heartbeatMs = HEARTBEAT_MIN_MS;
+    sendPresence(index);
+    return;
+  }
+  if (board.claim.claiming)
+    return; // Claims are its only frames
+
+  uint32_t sinceMs = nowMs - board.lastBroadcastMs;
+  if (board.answer && sinceMs >= PRESENCE_UPDATE_MIN_MS)
+    sendPresence(index);
+  else if (sinceMs >= board.heartbeatMs)
+  {
+    board.heartbeatMs = board.heartbeatMs * 2 > HEARTBEAT_MAX_MS ? HEARTBEAT_MAX_MS : board.heartbeatMs * 2;
+    sendPresence(index);
+  }
+}
+
+// Runs until runEndMs; returns how many times two settled boards held the
+// same ID at once (sampled every 100 ms)
+static int run(uint32_t runEndMs)
+{
+  int overlaps = 0;
+  for (; nowMs < runEndMs; nowMs++)
+  {
+    for (int i = 0; i < BOARDS; i++)
+    {
+      if (!boards[i].on && boards[i].bootMs == nowMs)
+        boot(i);
+    }
+    while (!medium.empty() && medium.top().arriveMs <= nowMs)
+    {
+      InFlight arrival = medium.top();
+      medium.pop();
+      for (int i = 0; i < BOARDS; i++)
+      {
+        if (i != arrival.from && boards[i].on)
+          receive(i, arrival);
+      }
+    }
+    for (int i = 0; i < BOARDS; i++)
+    {
+      if (!boards[i].on)
+        continue;
+      tick(i);
+      uint8_t id = claimBoardId(&boards[i].claim);
+      if (id != boards[i].lastId)
+        lastChangeMs = nowMs;
+      boards[i].lastId = id;
+    }
+
+    if (nowMs % 100 == 0)
+    {
+      BoardMask seen = 0;
+      for (int i = 0; i < BOARDS; i++)
+      {
+        uint8_t id = boards[i].on ? claimBoardId(&boards[i].claim) : 0;
+        if (id && (seen & BOARD_BIT(id)))
+          overlaps++;
+        if (id)
+          seen |= BOARD_BIT(id);
+      }
+    }
+  }
+  return overlaps;
+}
+
+struct Outcome
+{
+  int collisions; // Boards sharing an ID at the end
+  int unsettled;  // Boards still without an ID at the end
+  int moves;
+  uint8_t highestId;
+};
+
+static Outcome outcome()
+{
+  Outcome out = {};
+  BoardMask seen = 0;
+  for (int i = 0; i < BOARDS; i++)
+  {
+    if (!boards[i].on)
+      continue;
+    uint8_t id = claimBoardId(&boards[i].claim);
+    out.moves += boards[i].claim.moves;
+    if (id == 0)
+    {
+      out.unsettled++;
+      continue;
+    }
+    if (seen & BOARD_BIT(id))
+      out.collisions++;
+    seen |= BOARD_BIT(id);
+    if (id > out.highestId)
+      out.highestId = id;
+  }
+  return out;
+}
+
+static void powerOff()
+{
+  for (int i = 0; i < BOARDS; i++)
+    boards[i].on = false;
+  while (!medium.empty())
+    medium.pop();
+}
+
+static void freshFleet(bool simultaneous)
+{
+  powerOff();
+  nowMs = 0;
+  lastChangeMs = 0;
+  for (int i = 0; i < BOARDS; i++)
+  {
+    SimBoard &board = boards[i];
+    memset(&board, 0, sizeof(board));
+    board.mac[0] = 0x02; // Locally administered
+    for (int b = 1; b < CLAIM_MAC_LEN; b++)
+      board.mac[b] = std::uniform_int_distribution<int>(0, 255)(rng);
+    board.bootMs = simultaneous ? 1 : std::uniform_int_distribution<uint32_t>(1, 5000)(rng);
+  }
+}
+
+static void rebootAll(uint32_t spreadMs)
+{
+  powerOff();
+  lastChangeMs = nowMs;
+  uint32_t start = nowMs + 1;
+  for (int i = 0; i < BOARDS; i++)
+    boards[i].bootMs = start + std::uniform_int_distribution<uint32_t>(0, spreadMs)(rng);
+}
+
+struct Totals
+{
+  int runs;
+  int collisions;
+  int unsettled;
+  int overlaps;
+  int moves;
+  int highestId;
+  uint32_t slowestMs; // From the first boot until no ID changed any more
+  int failures;
+};
+
+static void check(Totals *totals, const char *scenario, uint32_t startMs, int overlaps, int maxMoves)
+{
+  Outcome out = outcome();
+  totals->runs++;
+  if (lastChangeMs > startMs && lastChangeMs - startMs > totals->slowestMs)
+    totals->slowestMs = lastChangeMs - startMs;
+  totals->collisions += out.collisions;
+  totals->unsettled += out.unsettled;
+  totals->overlaps += overlaps;
+  totals->moves += out.moves;
+  if (out.highestId > totals->highestId)
+    totals->highestId = out.highestId;
+  if (out.collisions || out.unsettled || (maxMoves >= 0 && out.moves > maxMoves))
+  {
+    printf("FAIL: %s at %.0f%% loss: %d sharing an ID, %d without one, %d moves\n",
+           scenario, lossRate * 100, out.collisions, out.unsettled, out.moves);
+    totals->failures++;
+  }
+}
+
+static void report(const char *scenario, const Totals &totals)
+{
+  printf("loss %3.0f%% %-12s: %d runs, %d collisions, %d unsettled, %.1f moves per run, "
+         "highest ID %d, settled within %.1f s, %d transient overlaps\n",
+         lossRate * 100, scenario, totals.runs, totals.collisions, totals.unsettled,
+         (double)totals.moves / totals.runs, totals.highestId, totals.slowestMs / 1000.0,
+         totals.overlaps);
+}
+
+int main(int argc, char **argv)
+{
+  int runs = argc > 1 ? atoi(argv[1]) : 20;
+  int failures = 0;
+  const double rates[] = {0.0, 0.1, 0.3};
+
+  for (double rate : rates)
+  {
+    lossRate = rate;
+    Totals staggered = {}, simultaneous = {}, reboot = {}, override = {}, late = {};
+    for (int r = 0; r < runs; r++)
+    {
+      rng.seed(1000 + r);
+
+      freshFleet(false);
+      check(&staggered, "staggered", 0, run(RUN_MS), -1);
+
+      // Stored IDs are kept: nothing moves
+      rebootAll(2000);
+      uint32_t startMs = nowMs;
+      check(&reboot, "reboot", startMs, run(nowMs + RUN_MS), 0);
+
+      // Hand-set ID of another board: that one moves, the override stays
+      int victim = std::uniform_int_distribution<int>(1, BOARDS - 1)(rng);
+      uint8_t wanted = boards[victim].storedId;
+      boards[0].fixedId = wanted;
+      rebootAll(2000);
+      startMs = nowMs;
+      int overlaps = run(nowMs + RUN_MS);
+      check(&override, "override", startMs, overlaps, -1);
+      if (claimBoardId(&boards[0].claim) != wanted)
+      {
+        printf("FAIL: override lost ID %d\n", wanted);
+        failures++;
+      }
+      boards[0].fixedId = 0;
+
+      // Board 1 off, a fresh board takes the free ID, board 1 returns
+      boards[1].on = false;
+      SimBoard &newcomer = boards[2];
+      newcomer.on = false;
+      newcomer.storedId = 0;
+      newcomer.bootMs = nowMs + 100;
+      run(nowMs + 10000);
+      boards[1].bootMs = nowMs + 1;
+      startMs = nowMs;
+      overlaps = run(nowMs + RUN_MS);
+      check(&late, "late return", startMs, overlaps, -1);
+
+      freshFleet(true);
+      check(&simultaneous, "simultaneous", 0, run(RUN_MS), -1);
+    }
+    report("staggered", staggered);
+    report("simultaneous", simultaneous);
+    report("reboot", reboot);
+    report("override", override);
+    report("late return", late);
+    failures += staggered.failures + simultaneous.failures + reboot.failures + override.failures +
+                late.failures;
+  }
+
+  // Two boards numbered the same by hand can't be resolved, only reported
+  lossRate = 0;
+  rng.seed(7);
+  freshFleet(false);
+  boards[0].fixedId = boards[1].fixedId = 3;
+  run(RUN_MS);
+  if (!boards[0].duplicate || !boards[1].duplicate)
+  {
+    printf("FAIL: duplicate hand-set IDs not reported\n");
+    failures++;
+  }
+
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,317 @@
+// Lossy-medium simulation of reliable delivery (include/reliable_link.h)
+//
+// Board 1 sends play commands with SOUND_FLAG_ACK to boards 2-5 over a
+// simulated medium that drops frames and delays them by a random latency.
+// Receivers run the firmware dispatcher (dedupe, acks) and the sender runs
+// the firmware ReliableLink, so this exercises the same code as the boards.
+// Checks that nothing plays twice, that delivery holds up under loss and
+// that the timeout follows the medium's round-trip time.
+//
+// Every loss rate runs twice: broadcast only, and with peers learned from
+// traffic (include/peer_table.h) so commands and acks go unicast. Unicast
+// frames only reach their target and are retried by the radio until it
+// sees a MAC-layer ack, broadcast frames reach every board once.
+//
+// A third run per loss rate sends every command to all four receivers as
+// one PLAY_GROUP frame, and checks that it takes fewer frames on air than
+// a command per board.
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Iinclude -o link_sim tools/link_sim/link_sim.cpp
+//       src/reliable_link.cpp src/peer_table.cpp src/dispatch.cpp
+//       src/frame_dedupe.cpp src/sound_message.cpp src/gesture.cpp
+//
+// Usage:
+//   link_sim [frames per loss rate]
+
+#include <map>
+#include <queue>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "dispatch.h"
+#include "peer_table.h"
+#include "reliable_link.h"
+
+#define SENDER 1
+#define FIRST_RECEIVER 2
+#define LAST_RECEIVER 5
+#define SEND_INTERVAL_MS 300
+#define MAC_ATTEMPTS 4 // Unicast tries before the radio reports a failure
+
+struct InFlight
+{
+  uint32_t arriveMs;
+  uint8_t from;
+  uint8_t to; // 0 = broadcast
+  std::vector<uint8_t> data;
+  bool operator>(const InFlight &other) const { return arriveMs > other.arriveMs; }
+};
+
+struct Board
+{
+  Dispatcher dispatcher;
+  PeerTable peers;
+  uint32_t epoch;
+  uint32_t nextSeq;
+};
+
+static std::mt19937 rng(12345);
+static double lossRate;
+static bool unicastMode;
+static bool groupMode; // Every command is for all receivers
+static uint32_t nowMs;
+static std::priority_queue<InFlight, std::vector<InFlight>, std::greater<InFlight>> medium;
+static Board boards[LAST_RECEIVER + 1];
+static uint32_t framesOnAir;
+static uint32_t framesIgnored; // Received by a board with nothing in it for that board
+
+// One-way latency: mostly a few ms, sometimes a lot more (busy channel)
+static uint32_t latencyMs()
+{
+  uint32_t ms = std::uniform_int_distribution<uint32_t>(3, 12)(rng);
+  if (std::uniform_int_distribution<int>(0, 19)(rng) == 0)
+    ms += 40;
+  return ms;
+}
+
+static bool lost()
+{
+  return std::uniform_real_distribution<double>(0, 1)(rng) < lossRate;
+}
+
+static void boardMac(uint8_t board, uint8_t *mac)
+{
+  const uint8_t base[PEER_MAC_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+  for (int i = 0; i < PEER_MAC_LEN; i++)
+    mac[i] = base[i];
+  mac[PEER_MAC_LEN - 1] = board;
+}
+
+// What the firmware's sendFrame() does, on the simulated radio
+static void transmit(uint8_t from, const uint8_t *data, int len, BoardMask targetMask)
+{
+  std::vector<uint8_t> frame(data, data + len);
+  uint8_t mac[PEER_MAC_LEN];
+  if (!unicastMode || !peerRoute(&boards[from].peers, targetMask, mac))
+  {
+    framesOnAir++;
+    if (!lost())
+      medium.push({nowMs + latencyMs(), from, 0, frame});
+    return;
+  }
+
+  // The frame or its MAC ack may be lost; in the latter case the target
+  // gets the retry as a duplicate
+  bool acked = false;
+  for (int attempt = 0; attempt < MAC_ATTEMPTS && !acked; attempt++)
+  {
+    framesOnAir++;
+    if (lost())
+      continue;
+    medium.push({nowMs + latencyMs(), from, mac[PEER_MAC_LEN - 1], frame});
+    acked = !lost();
+  }
+  peerSendResult(&boards[from].peers, mac, acked);
+}
+
+static void senderTransmit(const uint8_t *data, int len, BoardMask targetMask)
+{
+  transmit(SENDER, data, len, targetMask);
+}
+
+static int runLossRate(double loss, bool unicast, bool group, int frames)
+{
+  lossRate = loss;
+  unicastMode = unicast;
+  groupMode = group;
+  nowMs = 0;
+  framesOnAir = 0;
+  framesIgnored = 0;
+  while (!medium.empty())
+    medium.pop();
+
+  for (int id = SENDER; id <= LAST_RECEIVER; id++)
+  {
+    dispatchInit(&boards[id].dispatcher, id, 0);
+    peerTableInit(&boards[id].peers, 0);
+    boards[id].epoch = 7;
+    boards[id].nextSeq = 1;
+  }
+
+  ReliableLink link;
+  linkInit(&link, 99);
+  std::map<std::pair<int, uint32_t>, int> plays; // (board, seq) -> times played
+
+  static SoundFrame frame;
+  Action actions[DISPATCH_MAX_ACTIONS];
+  uint8_t buf[SOUND_FRAME_MAX_LEN];
+  int sent = 0;
+  uint32_t nextSendMs = 0;
+
+  uint32_t dueMs;
+  while (sent < frames || !medium.empty() || linkNextDeadline(&link, &dueMs))
+  {
+    // Next event: a send, an arrival or a retransmission timeout
+    uint32_t next = UINT32_MAX;
+    if (sent < frames)
+      next = nextSendMs;
+    if (!medium.empty() && medium.top().arriveMs < next)
+      next = medium.top().arriveMs;
+    if (linkNextDeadline(&link, &dueMs) && dueMs < next)
+      next = dueMs;
+    nowMs = next;
+
+    if (sent < frames && nowMs == nextSendMs)
+    {
+      Board &sender = boards[SENDER];
+      uint8_t target = FIRST_RECEIVER + sent % (LAST_RECEIVER - FIRST_RECEIVER + 1);
+      BoardMask targets = BOARD_BIT(target);
+      uint32_t seq = sender.nextSeq++;
+      SoundFrameWriter writer;
+      frameBegin(&writer, buf, sizeof(buf), SENDER, sender.epoch, seq, nowMs);
+      if (groupMode)
+      {
+        targets = 0;
+        for (int id = FIRST_RECEIVER; id <= LAST_RECEIVER; id++)
+          targets |= BOARD_BIT(id);
+        frameAddPlayGroup(&writer, targets, "airhorn.wav", SOUND_FLAG_ACK);
+      }
+      else
+        frameAddPlay(&writer, target, "airhorn.wav", SOUND_FLAG_ACK);
+      int len = frameFinish(&writer);
+      senderTransmit(buf, len, targets);
+      linkTrack(&link, seq, targets, buf, len, nowMs);
+      sent++;
+      nextSendMs += SEND_INTERVAL_MS;
+    }
+
+    linkPoll(&link, nowMs, senderTransmit);
+
+    while (!medium.empty() && medium.top().arriveMs <= nowMs)
+    {
+      InFlight arrival = medium.top();
+      medium.pop();
+      uint8_t fromMac[PEER_MAC_LEN];
+      boardMac(arrival.from, fromMac);
+
+      for (int id = SENDER; id <= LAST_RECEIVER; id++)
+      {
+        if (id == arrival.from || (arrival.to != 0 && arrival.to != id))
+          continue;
+        Board &board = boards[id];
+        int count = dispatchFrame(&board.dispatcher, arrival.data.data(), arrival.data.size(),
+                                  nowMs, &frame, actions);
+        if (count == 0)
+          framesIgnored++;
+        // The firmware registers new peers with ESP-NOW before using them
+        uint8_t heard = board.dispatcher.heardFrom;
+        if (heard && peerHeard(&board.peers, heard, fromMac, 0, nowMs))
+          peerSetRoutable(&board.peers, heard, fromMac);
+
+        for (int i = 0; i < count; i++)
+        {
+          if (actions[i].type == ACTION_PLAY_REMOTE)
+            plays[{id, frame.seq}]++;
+          else if (actions[i].type == ACTION_SEND_ACK)
+          {
+            SoundFrameWriter writer;
+            frameBegin(&writer, buf, sizeof(buf), id, board.epoch, board.nextSeq++, nowMs);
+            frameAddAck(&writer, actions[i].board, actions[i].seq);
+            transmit(id, buf, frameFinish(&writer), BOARD_BIT(actions[i].board));
+          }
+          else if (actions[i].type == ACTION_ACK && id == SENDER)
+            linkOnAck(&link, actions[i].board, actions[i].seq, nowMs);
+        }
+      }
+    }
+  }
+
+  int failures = 0;
+  int doubles = 0;
+  for (auto &entry : plays)
+  {
+    if (entry.second > 1)
+      doubles++;
+  }
+
+  // A group command counts as delivered once every receiver acked it; per
+  // board, what matters is how many of them played it
+  const LinkStats &stats = link.stats;
+  int receivers = group ? LAST_RECEIVER - FIRST_RECEIVER + 1 : 1;
+  double delivered = group ? 100.0 * plays.size() / (frames * receivers)
+                           : 100.0 * stats.delivered / frames;
+  printf("loss %3.0f%% %-9s: %5.1f%% delivered (%u first try, %u failed), %u retransmits, "
+         "%.2f frames on air and %.2f ignored receptions per command, %d played twice\n",
+         loss * 100, group ? "group" : unicast ? "unicast" : "broadcast", delivered,
+         stats.firstTry, stats.failed,
+         stats.retransmits, (double)framesOnAir / frames, (double)framesIgnored / frames, doubles);
+  for (int id = FIRST_RECEIVER; id <= LAST_RECEIVER; id++)
+  {
+    const LinkPeer &peer = link.peers[id];
+    // Two-way latency is 6-24 ms, plus 40 ms now and then
+    if (peer.measured && (peer.rtoMs < LINK_MIN_RTO_MS || peer.rtoMs > 150))
+    {
+      printf("FAIL: board %d timeout %u ms did not follow the round-trip time\n", id, peer.rtoMs);
+      failures++;
+    }
+  }
+
+  if (doubles)
+  {
+    printf("FAIL: commands played more than once\n");
+    failures++;
+  }
+  if (stats.delivered + stats.failed != (uint32_t)frames)
+  {
+    printf("FAIL: %u deliveries unaccounted for\n", frames - stats.delivered - stats.failed);
+    failures++;
+  }
+  // A command is lost only if all LINK_MAX_ATTEMPTS rounds lose the frame or
+  // its ack (radio retries only make it better)
+  double roundLoss = 1 - (1 - loss) * (1 - loss);
+  double expected = 100.0 * (1 - roundLoss * roundLoss * roundLoss * roundLoss * roundLoss);
+  if (delivered < expected - 3)
+  {
+    printf("FAIL: expected about %.1f%% delivered\n", expected);
+    failures++;
+  }
+  // Latency spikes still cause the odd spurious retransmission, but nothing
+  // may fail
+  if (loss == 0 && (stats.delivered != (uint32_t)frames ||
+                    stats.retransmits > (uint32_t)frames * receivers / 5))
+  {
+    printf("FAIL: losses or too many retransmissions on a lossless medium\n");
+    failures++;
+  }
+  return failures;
+}
+
+int main(int argc, char **argv)
+{
+  int frames = argc > 1 ? atoi(argv[1]) : 2000;
+  int failures = 0;
+  const double rates[] = {0.0, 0.05, 0.1, 0.2, 0.3, 0.5};
+  for (double rate : rates)
+  {
+    failures += runLossRate(rate, false, false, frames);
+    uint32_t broadcastIgnored = framesIgnored;
+    failures += runLossRate(rate, true, false, frames);
+    if (framesIgnored * 2 > broadcastIgnored)
+    {
+      printf("FAIL: unicast did not spare the other boards\n");
+      failures++;
+    }
+    uint32_t perBoardOnAir = framesOnAir * (LAST_RECEIVER - FIRST_RECEIVER + 1);
+    failures += runLossRate(rate, true, true, frames);
+    if (framesOnAir >= perBoardOnAir)
+    {
+      printf("FAIL: a group command took as many frames as one per board\n");
+      failures++;
+    }
+  }
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
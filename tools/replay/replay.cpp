@@ -0,0 +1,284 @@
+// Host replayer for input recordings (see include/input_recorder.h)
+//
+// Feeds a recording through the firmware's own debouncer, gesture engine
+// and dispatcher and prints every gesture and the actions it produced.
+// Output depends only on the recording, so it can be diffed against a
+// stored expectation.
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Iinclude -o replay tools/replay/replay.cpp
+//       src/debounce.cpp src/gesture.cpp src/dispatch.cpp src/sound_message.cpp
+//       src/frame_dedupe.cpp
+//
+// Usage:
+//   replay capture.log [more.log ...]
+//
+// Each file is a serial log containing a "record" dump; other lines are
+// ignored, the last dump in the file is used.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "debounce.h"
+#include "dispatch.h"
+#include "gesture.h"
+#include "input_recorder.h"
+
+struct Replay
+{
+  RecordingHeader header;
+  Debouncer debouncer;
+  GestureEngine gestures;
+  Dispatcher dispatcher;
+  uint32_t passMs;
+  uint32_t passUs;
+  FILE *out;
+};
+
+static Replay *current = NULL;
+
+static bool appendHex(const char *text, std::vector<uint8_t> *bytes)
+{
+  while (text[0] && text[1] && text[0] != '\n' && text[0] != '\r')
+  {
+    unsigned value;
+    if (sscanf(text, "%2x", &value) != 1)
+      return false;
+    bytes->push_back(value);
+    text += 2;
+  }
+  return true;
+}
+
+// Pull the last dump out of a serial log
+static bool loadDump(const char *path, std::vector<uint8_t> *head, std::vector<uint8_t> *ring)
+{
+  FILE *file = fopen(path, "r");
+  if (!file)
+  {
+    fprintf(stderr, "%s: cannot open\n", path);
+    return false;
+  }
+
+  char line[256];
+  bool inDump = false;
+  bool found = false;
+  while (fgets(line, sizeof(line), file))
+  {
+    if (strncmp(line, "=== input recording", 19) == 0)
+    {
+      head->clear();
+      ring->clear();
+      inDump = true;
+    }
+    else if (strncmp(line, "=== end ===", 11) == 0 && inDump)
+    {
+      inDump = false;
+      found = true;
+    }
+    else if (inDump && line[0] == 'H' && line[1] == ' ')
+    {
+      appendHex(line + 2, head);
+    }
+    else if (inDump && line[0] == 'R' && line[1] == ' ')
+    {
+      appendHex(line + 2, ring);
+    }
+  }
+  fclose(file);
+
+  if (!found)
+    fprintf(stderr, "%s: no complete recording\n", path);
+  return found;
+}
+
+static void printActions(const Action *actions, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    const Action &a = actions[i];
+    fprintf(current->out, "    -> %s b%d", actionTypeName(a.type), a.button);
+    if (a.type == ACTION_PLAY && a.speculative)
+      fprintf(current->out, " speculative");
+    if (a.type == ACTION_SEND || a.type == ACTION_REJECT_TARGET || a.type == ACTION_PLAY_REMOTE ||
+        a.type == ACTION_STOP_REMOTE || a.type == ACTION_SEND_ACK || a.type == ACTION_ACK ||
+        a.type == ACTION_PRESENCE)
+      fprintf(current->out, " board=%d", a.board);
+    if (a.type == ACTION_SEND && a.board == 0)
+      fprintf(current->out, " targets=0x%016llx", (unsigned long long)a.targets);
+    if (a.type == ACTION_SEND_ACK || a.type == ACTION_ACK)
+      fprintf(current->out, " seq=%u", a.seq);
+    if (a.type == ACTION_PLAY_REMOTE && a.scheduled)
+      fprintf(current->out, " start=%u", a.startUs);
+    if (a.type == ACTION_STOP_REMOTE)
+      fprintf(current->out, " fade=%u", a.fadeMs);
+    if (a.type == ACTION_PRESENCE)
+    {
+      fprintf(current->out, " flags=%u firmware=%u queue=%u", a.presence, a.firmware, a.queueDepth);
+      if (a.claim)
+        fprintf(current->out, " claim=%u", a.claim);
+      if (a.sleepMs)
+        fprintf(current->out, " sleep=%u", a.sleepMs);
+    }
+    if (a.sound)
+      fprintf(current->out, " sound=%s", a.sound);
+    if (a.reason)
+      fprintf(current->out, " (%s)", a.reason);
+    fprintf(current->out, "\n");
+  }
+}
+
+static void onChange(uint8_t index, bool pressed, uint32_t timestampUs)
+{
+  uint32_t edgeMs = debounceEdgeMillis(timestampUs, current->passMs, current->passUs);
+  gestureOnEdge(&current->gestures, index, pressed, edgeMs);
+}
+
+static void runPass(const std::vector<RecEdge> &edges)
+{
+  for (const RecEdge &edge : edges)
+    debounceEdge(&current->debouncer, edge.button, edge.pressed, edge.timestampUs, onChange);
+  debounceSettle(&current->debouncer, current->passUs, onChange);
+  gestureTick(&current->gestures, current->passMs);
+
+  GestureEvent gesture;
+  while (gesturePoll(&current->gestures, &gesture))
+  {
+    fprintf(current->out, "%10u %s b%d", gesture.timeMs, gestureTypeName(gesture.type), gesture.button);
+    if (gesture.type == GESTURE_PRESS || gesture.type == GESTURE_PRESS_START)
+      fprintf(current->out, " count=%d", gesture.count);
+    if (gesture.type == GESTURE_CHORD)
+      fprintf(current->out, " mask=0x%02x", gesture.mask);
+    fprintf(current->out, "\n");
+
+    Action actions[DISPATCH_MAX_ACTIONS];
+    printActions(actions, dispatchGesture(&current->dispatcher, gesture, actions));
+  }
+}
+
+static bool replayFile(const char *path, FILE *out)
+{
+  std::vector<uint8_t> head;
+  std::vector<uint8_t> ring;
+  if (!loadDump(path, &head, &ring))
+    return false;
+
+  Replay replay;
+  memset(&replay, 0, sizeof(replay));
+  replay.out = out;
+  current = &replay;
+
+  if (head.size() != sizeof(RecordingHeader))
+  {
+    fprintf(stderr, "%s: bad header size %zu\n", path, head.size());
+    return false;
+  }
+  memcpy(&replay.header, head.data(), sizeof(RecordingHeader));
+  const RecordingHeader &h = replay.header;
+  if (h.magic != RECORDER_MAGIC || h.version != RECORDER_VERSION || h.length != ring.size())
+  {
+    fprintf(stderr, "%s: not a v%d recording (or truncated)\n", path, RECORDER_VERSION);
+    return false;
+  }
+
+  // Same setup as the firmware; button levels before the oldest record are
+  // unknown and taken as released
+  debounceInit(&replay.debouncer, h.buttonCount, h.debounceMs * 1000UL);
+  gestureInit(&replay.gestures, h.buttonCount, h.tapMask, h.multiPressMs, h.longHoldMs, h.dualPressMs);
+  gestureSetPressStart(&replay.gestures, h.tapMask);
+  dispatchInit(&replay.dispatcher, h.boardId, h.speculativeMask);
+
+  fprintf(out, "# %s: board %d, %d buttons, %u bytes, %u records dropped\n", path, h.boardId,
+          h.buttonCount, h.length, h.dropped);
+
+  std::vector<RecEdge> edges;
+  bool inPass = false;
+  size_t pos = 0;
+  while (pos + 2 <= ring.size())
+  {
+    uint8_t type = ring[pos];
+    uint8_t len = ring[pos + 1];
+    const uint8_t *payload = ring.data() + pos + 2;
+    if (pos + 2 + len > ring.size())
+    {
+      fprintf(stderr, "%s: truncated record at %zu\n", path, pos);
+      return false;
+    }
+    pos += 2 + len;
+
+    // Edges belong to the pass before them, anything else ends it
+    if (type != REC_EDGE && inPass)
+    {
+      runPass(edges);
+      edges.clear();
+      inPass = false;
+    }
+
+    if (type == REC_PASS && len == sizeof(RecPass))
+    {
+      RecPass pass;
+      memcpy(&pass, payload, sizeof(pass));
+      replay.passMs = pass.nowMs;
+      replay.passUs = pass.nowUs;
+      inPass = true;
+    }
+    else if (type == REC_EDGE && len == sizeof(RecEdge))
+    {
+      // Edges before the first pass record lost their pass, skip them
+      if (inPass)
+      {
+        RecEdge edge;
+        memcpy(&edge, payload, sizeof(edge));
+        edges.push_back(edge);
+      }
+    }
+    else if (type == REC_FRAME && len >= sizeof(RecFrame))
+    {
+      RecFrame frame;
+      memcpy(&frame, payload, sizeof(frame));
+      fprintf(out, "%10u frame %d bytes\n", frame.nowMs, len - (int)sizeof(RecFrame));
+
+      static SoundFrame decoded;
+      Action actions[DISPATCH_MAX_ACTIONS];
+      printActions(actions, dispatchFrame(&replay.dispatcher, payload + sizeof(RecFrame),
+                                          len - sizeof(RecFrame), frame.nowMs, &decoded, actions));
+    }
+    else if (type == REC_WINDOW && len == sizeof(RecWindow))
+    {
+      RecWindow window;
+      memcpy(&window, payload, sizeof(window));
+      gestureSetMultiPressWindow(&replay.gestures, window.newMs);
+      fprintf(out, "%10s window %u -> %u ms\n", "", window.oldMs, window.newMs);
+    }
+    else
+    {
+      fprintf(stderr, "%s: unknown record type %d (len %d)\n", path, type, len);
+      return false;
+    }
+  }
+  if (inPass)
+    runPass(edges);
+
+  fprintf(out, "# end\n");
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s recording.log [...]\n", argv[0]);
+    return 2;
+  }
+
+  int failed = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!replayFile(argv[i], stdout))
+      failed++;
+  }
+  return failed ? 1 : 0;
+}
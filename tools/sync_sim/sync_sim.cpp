@@ -0,0 +1,477 @@
+// Fleet simulation of the fleet clock (include/clock_sync.h)
+//
+// 16 boards boot within 2 s, each with a crystal off by up to +-30 ppm and
+// its own esp_timer starting at zero. Frames take 0.4 ms and more to
+// arrive, a few take up to 20 ms (retries, a busy channel), independently
+// in each direction, and some are lost. Every board runs the firmware's
+// ClockSync, dispatcher and frame codec, and sends heartbeats, time
+// requests and answers the way the firmware does.
+//
+// From a minute in (boards have learned their rates), every 100 ms of true
+// time the fleet time of each synced board is read at the same instant; the spread (latest minus earliest) is the skew
+// two boards would start a sound with. Every 5 s a board sends a sound to
+// every board with a start time (PLAY_GROUP), and the true times the
+// boards would release it are compared too. At 120 s the master reboots,
+// at 210 s the board that took over is switched off for good: each time
+// another board has to take over and the fleet time has to carry on
+// without a jump.
+//
+// Audio itself isn't simulated; on the boards a start is further rounded
+// to a sample (23 us) and the DMA boundary estimate (audio_player.cpp).
+//
+// Build from the repository root:
+//   g++ -std=gnu++17 -O2 -Iinclude -o sync_sim tools/sync_sim/sync_sim.cpp
+//       src/clock_sync.cpp src/peer_table.cpp src/dispatch.cpp
+//       src/frame_dedupe.cpp src/sound_message.cpp src/gesture.cpp
+//
+// Usage:
+//   sync_sim [seed]
+
+#include <algorithm>
+#include <math.h>
+#include <queue>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "clock_sync.h"
+#include "dispatch.h"
+#include "peer_table.h"
+
+#define BOARDS 16
+#define FIRMWARE 2
+#define RUN_US 330000000LL
+#define REBOOT_US 120000000LL   // The master reboots (off for 1 s)
+#define SWITCH_OFF_US 210000000LL // The next master is switched off
+#define WARMUP_US 60000000LL    // Rates are learned, before skew is measured
+#define SETTLE_US 40000000LL    // After a master is lost, before it is measured again
+#define SEND_EVERY_US 5000000LL
+#define LEAD_US 100000          // sync_lead_ms
+#define MAX_SKEW_US 1000        // Boards within a millisecond
+#define MAX_JUMP_US 1000        // Fleet time steps between two readings
+
+struct InFlight
+{
+  int64_t arriveUs; // True time
+  int from;
+  int to; // -1 = broadcast
+  std::vector<uint8_t> data;
+  bool operator>(const InFlight &other) const { return arriveUs > other.arriveUs; }
+};
+
+struct SimBoard
+{
+  bool on;
+  int64_t bootUs; // True time
+  double ppm;     // Crystal error
+  uint8_t id;
+  ClockSync clock;
+  Dispatcher dispatcher;
+  PeerTable peers;
+  uint32_t epoch; // Boot counter (frame_dedupe.h)
+  uint32_t nextSeq;
+  int64_t nextHeartbeatUs;
+  uint32_t heartbeatMs;
+  int64_t nextClockUs; // clockTimer, true time
+  int64_t lastFleetUs; // Last reading, for the continuity check
+  int64_t lastReadUs;
+};
+
+static std::mt19937 rng;
+static double lossRate = 0.05;
+static int64_t nowUs; // True time
+static std::priority_queue<InFlight, std::vector<InFlight>, std::greater<InFlight>> medium;
+static SimBoard boards[BOARDS];
+
+// Its esp_timer_get_time() at true time trueUs
+static int64_t localUs(const SimBoard &board, int64_t trueUs)
+{
+  return (int64_t)llround((trueUs - board.bootUs) * (1 + board.ppm * 1e-6));
+}
+
+static int64_t trueUs(const SimBoard &board, int64_t local)
+{
+  return board.bootUs + (int64_t)llround(local / (1 + board.ppm * 1e-6));
+}
+
+static int64_t latencyUs()
+{
+  int64_t us = 400 + (int64_t)std::exponential_distribution<double>(1 / 300.0)(rng);
+  if (std::uniform_int_distribution<int>(0, 19)(rng) == 0)
+    us += std::uniform_int_distribution<int64_t>(2000, 20000)(rng);
+  return us;
+}
+
+static uint32_t msOf(int64_t us)
+{
+  return (uint32_t)(us / 1000);
+}
+
+static void transmit(int from, int to, const uint8_t *buf, int len, int64_t departUs)
+{
+  for (int i = 0; i < BOARDS; i++)
+  {
+    if (i == from || !boards[i].on || (to >= 0 && i != to))
+      continue;
+    if (std::uniform_real_distribution<double>(0, 1)(rng) >= lossRate)
+      medium.push({departUs + latencyUs(), from, to, std::vector<uint8_t>(buf, buf + len)});
+  }
+}
+
+// What the firmware's outgoingFrame() starts every frame with
+static void beginFrame(SimBoard &board, SoundFrameWriter *writer, uint8_t *buf, int64_t atUs)
+{
+  frameBegin(writer, buf, SOUND_FRAME_MAX_LEN, board.id, board.epoch, board.nextSeq++, msOf(atUs));
+  uint8_t flags = SOUND_PRESENCE_FIXED_ID;
+  if (clockIsMaster(&board.clock, board.id))
+    flags |= SOUND_PRESENCE_TIME_MASTER;
+  if (board.clock.synced)
+    flags |= SOUND_PRESENCE_TIME_SYNCED;
+  frameAddPresence(writer, flags, FIRMWARE, 0, 0);
+}
+
+static void sendPresence(int index)
+{
+  SimBoard &board = boards[index];
+  uint8_t buf[SOUND_FRAME_MAX_LEN];
+  SoundFrameWriter writer;
+  beginFrame(board, &writer, buf, nowUs);
+  transmit(index, -1, buf, frameFinish(&writer), nowUs);
+}
+
+static void boot(int index)
+{
+  SimBoard &board = boards[index];
+  board.on = true;
+  clockInit(&board.clock, localUs(board, nowUs));
+  dispatchInit(&board.dispatcher, board.id, 0);
+  peerTableInit(&board.peers, msOf(nowUs));
+  board.epoch++;
+  board.nextSeq = 1;
+  board.heartbeatMs = HEARTBEAT_MIN_MS;
+  board.nextHeartbeatUs = nowUs;
+  board.nextClockUs = nowUs;
+  board.lastReadUs = 0;
+}
+
+struct StartEvent
+{
+  int64_t trueUs[BOARDS]; // When each board would release it, 0 = not received or not synced
+};
+static std::vector<StartEvent> starts;
+
+// What the firmware's onDataReceive() and runActions() do with the frame
+static void receive(int index, const InFlight &arrival)
+{
+  SimBoard &board = boards[index];
+  int64_t arrivedUs = localUs(board, arrival.arriveUs);
+  static SoundFrame frame;
+  Action actions[DISPATCH_MAX_ACTIONS];
+  int count = dispatchFrame(&board.dispatcher, arrival.data.data(), arrival.data.size(),
+                            msOf(arrival.arriveUs), &frame, actions);
+  uint8_t mac[PEER_MAC_LEN] = {0x02, 0, 0, 0, 0, (uint8_t)arrival.from};
+  if (board.dispatcher.heardFrom)
+    peerHeard(&board.peers, board.dispatcher.heardFrom, mac, 0, msOf(arrival.arriveUs));
+
+  for (int i = 0; i < count; i++)
+  {
+    const Action &action = actions[i];
+    switch (action.type)
+    {
+    case ACTION_PRESENCE:
+      peerPresence(&board.peers, action.board, action.presence, action.firmware, 0,
+                   action.sleepMs);
+      clockOnPresence(&board.clock, action.board, action.presence);
+      break;
+
+    case ACTION_TIME_REQUEST:
+    {
+      clockOnRequest(&board.clock, action.board, action.time[0], arrivedUs);
+      // answerTimeRequests() on the loop task, a little later
+      int64_t departUs = arrival.arriveUs + std::uniform_int_distribution<int64_t>(100, 3000)(rng);
+      ClockRequest request;
+      while (clockNextRequest(&board.clock, &request))
+      {
+        uint8_t buf[SOUND_FRAME_MAX_LEN];
+        SoundFrameWriter writer;
+        beginFrame(board, &writer, buf, departUs);
+        frameAddTimeResponse(&writer, request.board, request.originUs,
+                             clockFleetUs(&board.clock, request.receivedUs),
+                             clockFleetUs(&board.clock, localUs(board, departUs)));
+        transmit(index, request.board - 1, buf, frameFinish(&writer), departUs);
+      }
+      break;
+    }
+
+    case ACTION_TIME_RESPONSE:
+      clockOnResponse(&board.clock, action.board, action.time[0], action.time[1], action.time[2],
+                      arrivedUs);
+      break;
+
+    case ACTION_PLAY_REMOTE:
+      // remoteStartUs(); the sound is named after the start it belongs to
+      if (action.scheduled && board.clock.synced)
+      {
+        int64_t fleetUs = clockExpandUs(&board.clock, action.startUs, arrivedUs);
+        starts[atoi(action.sound + 1)].trueUs[index] =
+            trueUs(board, clockLocalUs(&board.clock, fleetUs));
+      }
+      break;
+    }
+  }
+}
+
+// Heartbeat and clock timers of one board (onHeartbeatTimer, onClockTimer)
+static void tick(int index)
+{
+  SimBoard &board = boards[index];
+  if (nowUs >= board.nextHeartbeatUs)
+  {
+    sendPresence(index);
+    board.nextHeartbeatUs = nowUs + board.heartbeatMs * 1000LL;
+    board.heartbeatMs = std::min(board.heartbeatMs * 2, (uint32_t)HEARTBEAT_MAX_MS);
+  }
+  if (nowUs < board.nextClockUs)
+    return;
+
+  uint32_t nowMs = msOf(nowUs);
+  BoardMask alive = peerAliveMask(&board.peers, board.id, nowMs);
+  BoardMask candidates = 0;
+  for (BoardMask rest = alive; rest; rest &= rest - 1)
+  {
+    int id = __builtin_ctzll(rest);
+    if (board.peers.peers[id].firmware >= FIRMWARE)
+      candidates |= BOARD_BIT(id);
+  }
+  int64_t local = localUs(board, nowUs);
+  uint8_t previous = board.clock.master;
+  uint8_t master = clockElect(&board.clock, board.id, alive, candidates, local);
+  if (master != previous && master == board.id)
+  {
+    // Announced soon, like a playback update
+    board.nextHeartbeatUs = nowUs + PRESENCE_UPDATE_MIN_MS * 1000LL;
+  }
+  if (clockPollDue(&board.clock, local))
+  {
+    int64_t departUs = nowUs + std::uniform_int_distribution<int64_t>(0, 300)(rng);
+    uint8_t buf[SOUND_FRAME_MAX_LEN];
+    SoundFrameWriter writer;
+    beginFrame(board, &writer, buf, departUs);
+    frameAddTimeRequest(&writer, master, localUs(board, departUs));
+    transmit(index, master - 1, buf, frameFinish(&writer), departUs);
+  }
+  int64_t dueLocal = clockNextDeadlineUs(&board.clock, local);
+  board.nextClockUs = trueUs(board, dueLocal) / 1000 * 1000 + 1000; // Millisecond timer
+}
+
+// A board plays a sound together with every other board (planStart())
+static void sendTogether(int index)
+{
+  SimBoard &board = boards[index];
+  if (!board.clock.synced)
+    return;
+  int64_t local = localUs(board, nowUs);
+  int64_t fleetUs = clockFleetUs(&board.clock, local) + LEAD_US;
+
+  StartEvent event = {};
+  event.trueUs[index] = trueUs(board, clockLocalUs(&board.clock, fleetUs));
+  starts.push_back(event);
+
+  char sound[16];
+  snprintf(sound, sizeof(sound), "s%zu.wav", starts.size() - 1);
+  uint8_t buf[SOUND_FRAME_MAX_LEN];
+  SoundFrameWriter writer;
+  beginFrame(board, &writer, buf, nowUs);
+  frameAddPlayGroup(&writer, BOARD_MASK_ALL, sound, SOUND_FLAG_START, (uint32_t)fleetUs);
+  transmit(index, -1, buf, frameFinish(&writer), nowUs);
+}
+
+struct Spread
+{
+  std::vector<int64_t> samples;
+  int jumps;
+  int64_t worstJumpUs;
+
+  void add(int64_t us) { samples.push_back(us); }
+  int64_t percentile(double p)
+  {
+    if (samples.empty())
+      return 0;
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))];
+  }
+};
+
+// Fleet time of every synced board at this true instant
+static void measure(Spread *spread)
+{
+  int64_t low = INT64_MAX, high = INT64_MIN;
+  int synced = 0;
+  for (int i = 0; i < BOARDS; i++)
+  {
+    SimBoard &board = boards[i];
+    if (!board.on || !board.clock.synced)
+      continue;
+    int64_t fleetUs = clockFleetUs(&board.clock, localUs(board, nowUs));
+    low = std::min(low, fleetUs);
+    high = std::max(high, fleetUs);
+    synced++;
+
+    // Fleet time runs on with true time, give or take the crystals
+    if (board.lastReadUs)
+    {
+      int64_t stepUs = (fleetUs - board.lastFleetUs) - (nowUs - board.lastReadUs);
+      if (llabs(stepUs) > MAX_JUMP_US)
+        spread->jumps++;
+      spread->worstJumpUs = std::max(spread->worstJumpUs, (int64_t)llabs(stepUs));
+    }
+    board.lastFleetUs = fleetUs;
+    board.lastReadUs = nowUs;
+  }
+  if (synced >= 2)
+    spread->add(high - low);
+}
+
+int main(int argc, char **argv)
+{
+  rng.seed(argc > 1 ? atoi(argv[1]) : 1);
+  for (int i = 0; i < BOARDS; i++)
+  {
+    SimBoard &board = boards[i];
+    memset(&board, 0, sizeof(board));
+    board.id = i + 1;
+    board.bootUs = std::uniform_int_distribution<int64_t>(0, 2000000)(rng);
+    board.ppm = std::uniform_real_distribution<double>(-30, 30)(rng);
+  }
+
+  Spread steady = {}, takeover = {};
+  int64_t nextSendUs = WARMUP_US;
+  int64_t lostUs = 0; // A master was lost
+  uint8_t lost[2] = {0, 0};
+
+  for (nowUs = 0; nowUs < RUN_US; nowUs += 1000)
+  {
+    for (int i = 0; i < BOARDS; i++)
+    {
+      if (!boards[i].on && nowUs >= boards[i].bootUs)
+        boot(i);
+    }
+    while (!medium.empty() && medium.top().arriveUs <= nowUs)
+    {
+      InFlight arrival = medium.top();
+      medium.pop();
+      for (int i = 0; i < BOARDS; i++)
+      {
+        if (i != arrival.from && boards[i].on && (arrival.to < 0 || arrival.to == i))
+          receive(i, arrival);
+      }
+    }
+    for (int i = 0; i < BOARDS; i++)
+    {
+      if (boards[i].on)
+        tick(i);
+    }
+
+    if (nowUs == REBOOT_US || nowUs == SWITCH_OFF_US)
+    {
+      for (int i = 0; i < BOARDS; i++)
+      {
+        if (!boards[i].on || !clockIsMaster(&boards[i].clock, boards[i].id))
+          continue;
+        boards[i].on = false;
+        boards[i].bootUs = nowUs == REBOOT_US ? nowUs + 1000000 : INT64_MAX;
+        lost[nowUs == REBOOT_US ? 0 : 1] = boards[i].id;
+      }
+      lostUs = nowUs;
+    }
+
+    if (nowUs % 100000 == 0 && nowUs >= WARMUP_US)
+      measure(lostUs && nowUs < lostUs + SETTLE_US ? &takeover : &steady);
+    if (nowUs >= nextSendUs)
+    {
+      int sender;
+      do
+        sender = std::uniform_int_distribution<int>(0, BOARDS - 1)(rng);
+      while (!boards[sender].on);
+      sendTogether(sender);
+      nextSendUs += SEND_EVERY_US;
+    }
+  }
+
+  int master = 0;
+  int failures = 0;
+  for (int i = 0; i < BOARDS; i++)
+  {
+    if (boards[i].on && clockIsMaster(&boards[i].clock, boards[i].id))
+      master = boards[i].id;
+    if (boards[i].on && !boards[i].clock.synced)
+    {
+      printf("FAIL: board %d never synced\n", boards[i].id);
+      failures++;
+    }
+  }
+
+  struct Phase
+  {
+    const char *name;
+    Spread *spread;
+  } phases[] = {{"steady", &steady}, {"takeover", &takeover}};
+  for (const Phase &phase : phases)
+  {
+    Spread &spread = *phase.spread;
+    printf("%-8s: fleet time spread p50 %lld us, p99 %lld us, max %lld us over %zu readings; "
+           "%d steps over %d us (worst %lld us)\n",
+           phase.name, (long long)spread.percentile(0.5), (long long)spread.percentile(0.99),
+           (long long)spread.percentile(1.0), spread.samples.size(), spread.jumps, MAX_JUMP_US,
+           (long long)spread.worstJumpUs);
+  }
+  if (steady.percentile(0.99) > MAX_SKEW_US)
+  {
+    printf("FAIL: boards more than %d us apart\n", MAX_SKEW_US);
+    failures++;
+  }
+  if (steady.jumps || takeover.jumps)
+  {
+    printf("FAIL: fleet time jumped\n");
+    failures++;
+  }
+
+  Spread startSkew = {};
+  for (const StartEvent &event : starts)
+  {
+    int64_t low = INT64_MAX, high = INT64_MIN;
+    int boardsStarting = 0;
+    for (int64_t us : event.trueUs)
+    {
+      if (!us)
+        continue;
+      low = std::min(low, us);
+      high = std::max(high, us);
+      boardsStarting++;
+    }
+    if (boardsStarting >= 2)
+      startSkew.add(high - low);
+  }
+  printf("starts  : %zu sounds sent to every board, skew p50 %lld us, p99 %lld us, max %lld us\n",
+         startSkew.samples.size(), (long long)startSkew.percentile(0.5),
+         (long long)startSkew.percentile(0.99), (long long)startSkew.percentile(1.0));
+  printf("master  : board %d rebooted at %lld s, board %d switched off at %lld s, "
+         "board %d keeps the time\n",
+         lost[0], (long long)(REBOOT_US / 1000000), lost[1], (long long)(SWITCH_OFF_US / 1000000),
+         master);
+  if (!lost[0] || !lost[1] || !master || master == lost[1])
+  {
+    printf("FAIL: no master to take over\n");
+    failures++;
+  }
+  if (startSkew.percentile(0.99) > MAX_SKEW_US)
+  {
+    printf("FAIL: scheduled starts more than %d us apart\n", MAX_SKEW_US);
+    failures++;
+  }
+
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}